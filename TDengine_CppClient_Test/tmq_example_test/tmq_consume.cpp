@@ -0,0 +1,137 @@
+// 测试：数据订阅-按消费组读取主题中的新数据并手动确认
+// 与 tdengine_fdw 订阅表（topic 选项）使用相同的消费方式：关闭自动提交，
+// 读完一批消息后调用 ws_tmq_commit_sync 确认；不确认就关闭消费者时，
+// 同一消费组的下一个消费者会重新读到这些消息。
+//
+// 对应的外部表：
+// CREATE FOREIGN TABLE meters_feed (time timestamp, current float8, voltage int, phase float8)
+//     SERVER tdengine_server OPTIONS (topic 'topic_meters', group_id 'group1', max_messages '10');
+
+// TAOS standard API example. The same syntax as MySQL, but only a subset
+// to compile: gcc -o tmq_consume_demo tmq_consume.cpp -ltaosws
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "taosws.h"
+
+static int ExecSql(WS_TAOS *taos, const char *sql) {
+  WS_RES *result = ws_query(taos, sql);  // 执行SQL
+  int     code = ws_errno(result);       // 获取错误码
+  if (code != 0) {
+    fprintf(stderr, "Failed to execute sql: %s, ErrCode: 0x%x, ErrMessage: %s.\n", sql, code, ws_errstr(result));
+  }
+  ws_free_result(result);
+  return code;
+}
+
+// 读取一条消息中的所有数据块，返回行数
+static int ReadMessage(WS_RES *msg) {
+  int             rows = 0;
+  int             num_fields = ws_field_count(msg);  // 获取字段数量
+  const WS_FIELD *fields = ws_fetch_fields(msg);     // 获取字段信息
+
+  fprintf(stdout, "message from topic: %s, db: %s, table: %s, %d fields.\n", ws_tmq_get_topic_name(msg),
+          ws_tmq_get_db_name(msg), ws_tmq_get_table_name(msg), num_fields);
+
+  while (1) {
+    const void *block = NULL;
+    int32_t     block_rows = 0;
+    int         code = ws_fetch_raw_block(msg, &block, &block_rows);  // 获取下一个数据块
+    if (code != 0) {
+      fprintf(stderr, "Failed to fetch block, ErrCode: 0x%x, ErrMessage: %s.\n", code, ws_errstr(msg));
+      break;
+    }
+    if (block_rows == 0) break;  // 消息读完
+
+    for (int32_t r = 0; r < block_rows; r++) {
+      uint8_t     type = 0;
+      uint32_t    len = 0;
+      const void *value = ws_get_value_in_block(msg, r, 0, &type, &len);  // 第一列为时间戳
+      if (value != NULL && r == 0) {
+        fprintf(stdout, "  first row: %s = %" PRId64 "\n", fields[0].name, *(const int64_t *)value);
+      }
+    }
+    rows += block_rows;
+  }
+
+  return rows;
+}
+
+static int DemoTmqConsume() {
+  // ANCHOR: tmq_consume
+  int   code = 0;
+  char *dsn = "ws://localhost:6041";  // TDengine WebSocket连接字符串
+
+  // 建立连接，创建主题，请确保 power.meters 已存在
+  WS_TAOS *taos = ws_connect(dsn);
+  if (taos == NULL) {
+    fprintf(stderr, "Failed to connect to %s, ErrCode: 0x%x, ErrMessage: %s.\n", dsn, ws_errno(NULL), ws_errstr(NULL));
+    return -1;
+  }
+  code = ExecSql(taos, "CREATE TOPIC IF NOT EXISTS topic_meters AS SELECT ts, current, voltage, phase FROM power.meters");
+  ws_close(taos);
+  if (code != 0) return -1;
+
+  // 配置消费者：消费组、客户端标识，关闭自动提交
+  WS_TMQ_CONF *conf = ws_tmq_conf_new();
+  if (ws_tmq_conf_set(conf, "group.id", "group1") != WS_TMQ_CONF_OK ||
+      ws_tmq_conf_set(conf, "client.id", "client1") != WS_TMQ_CONF_OK ||
+      ws_tmq_conf_set(conf, "auto.offset.reset", "earliest") != WS_TMQ_CONF_OK ||
+      ws_tmq_conf_set(conf, "enable.auto.commit", "false") != WS_TMQ_CONF_OK) {
+    fprintf(stderr, "Failed to set consumer config.\n");
+    ws_tmq_conf_destroy(conf);
+    return -1;
+  }
+
+  char    errstr[256] = {0};
+  WS_TMQ *tmq = ws_tmq_consumer_new(conf, dsn, errstr, sizeof(errstr));  // 创建消费者
+  ws_tmq_conf_destroy(conf);
+  if (tmq == NULL) {
+    fprintf(stderr, "Failed to create consumer, ErrMessage: %s.\n", errstr);
+    return -1;
+  }
+
+  // 订阅主题
+  WS_TMQ_LIST *topics = ws_tmq_list_new();
+  ws_tmq_list_append(topics, "topic_meters");
+  code = ws_tmq_subscribe(tmq, topics);
+  ws_tmq_list_destroy(topics);
+  if (code != 0) {
+    fprintf(stderr, "Failed to subscribe topic_meters, ErrCode: 0x%x, ErrMessage: %s.\n", code, ws_tmq_errstr(tmq));
+    ws_tmq_consumer_close(tmq);
+    return -1;
+  }
+
+  // 最多读取 10 条消息，等待 100 毫秒没有新消息时结束
+  int messages = 0;
+  int rows = 0;
+  while (messages < 10) {
+    WS_RES *msg = ws_tmq_consumer_poll(tmq, 100);  // 拉取一条消息
+    if (msg == NULL) break;
+
+    rows += ReadMessage(msg);
+    messages++;
+    ws_free_result(msg);  // 释放消息
+  }
+  fprintf(stdout, "consumed %d messages, %d rows.\n", messages, rows);
+
+  // 确认读过的消息，之后同一消费组不会再读到这些消息
+  if (messages > 0) {
+    code = ws_tmq_commit_sync(tmq, NULL);
+    if (code != 0) {
+      fprintf(stderr, "Failed to commit offset, ErrCode: 0x%x, ErrMessage: %s.\n", code, ws_tmq_errstr(tmq));
+    } else {
+      fprintf(stdout, "commit offset successfully.\n");
+    }
+  }
+
+  // 取消订阅并关闭消费者
+  ws_tmq_unsubscribe(tmq);
+  ws_tmq_consumer_close(tmq);
+  return code == 0 ? 0 : -1;
+  // ANCHOR_END: tmq_consume
+}
+
+int main(int argc, char *argv[]) { return DemoTmqConsume(); }
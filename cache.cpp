@@ -0,0 +1,599 @@
+extern "C" {
+#include "postgres.h"
+#include "common/hashfn.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/dsa.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+}
+
+#include "cache.hpp"
+
+#include <vector>
+
+/*
+ * 共享结果缓存
+ *
+ * 启用 tdengine_fdw.result_cache_size 后，设置了 cache_ttl 的外部表的查询
+ * 结果在读完后存入共享内存，有效期内其他会话执行相同的查询（同一服务器和
+ * 用户、相同的远程查询文本和参数值）时直接从缓存返回结果，不再访问
+ * TDengine。仪表盘类负载会在短时间内从多个会话反复发送同一个查询。
+ *
+ * 条目头保存在固定大小的数组中，按哈希值链接在哈希桶中，查询文本和结果
+ * 保存在位于同一块共享内存中的 DSA 区域里。查找只持有共享锁，多个会话可以
+ * 同时命中；写入和淘汰持有排他锁。总字节数超过预算或 DSA 区域分配失败时
+ * 按最近使用淘汰。
+ *
+ * 失效以远程表为单位，键由服务器和远程数据库、表名确定，映射到同一远程表的
+ * 多个外部表共用一个键。通过本 FDW 向远程表写入数据时，第一次提交前、写入
+ * 结束后以及事务中止时，读取了该表的条目都被丢弃，同时增加该表的失效代数。
+ * 未命中时记录所读各表的代数，写入时代数已变化说明远程查询执行期间数据被
+ * 修改过，结果可能已经过时，不写入缓存。
+ *
+ * 结果的格式与连接池的消息相同:
+ *   int32 列数, int32 时间精度, 每列以 0 结尾的列名,
+ *   之后每个值为 uint8 空值标志, 非空时跟 uint8 类型、uint32 长度和原始字节
+ */
+
+/* 每个条目平均占用的字节数，用于确定条目数组的大小 */
+#define TDENGINE_CACHE_BYTES_PER_ENTRY 4096
+
+#define TDENGINE_CACHE_MIN_ENTRIES 64
+
+/* 失效代数按远程表的键散列到的槽数，不同的表落在同一槽中只会多跳过几次写入 */
+#define TDENGINE_CACHE_GENERATION_SLOTS 1024
+
+#define TDENGINE_CACHE_GENERATION_SLOT(table) ((table) % TDENGINE_CACHE_GENERATION_SLOTS)
+
+typedef struct TDengineCacheEntry
+{
+    bool valid;                 /* 条目是否在使用中 */
+    uint32 hash;                /* 服务器、用户和查询文本的哈希值 */
+    int next;                   /* 同一哈希桶中的下一个条目，或下一个空闲条目，-1 表示没有 */
+    Oid serverid;
+    Oid userid;
+    int nrels;                  /* 查询读取的远程表，用于写入后失效 */
+    uint32 tables[TDENGINE_CACHE_MAX_RELS];
+    TimestampTz expires;        /* 过期时间 */
+    pg_atomic_uint64 last_used; /* 最近一次命中或写入的序号，用于淘汰；命中时只持有共享锁 */
+    dsa_pointer data;           /* 以 0 结尾的查询文本之后紧跟结果 */
+    Size sql_len;
+    Size size;                  /* data 的总字节数 */
+} TDengineCacheEntry;
+
+typedef struct TDengineCacheShared
+{
+    LWLock *lock;               /* 保护所有条目、哈希桶和 DSA 区域 */
+    int tranche_id;             /* DSA 区域内部锁的 tranche */
+    pg_atomic_uint64 use_counter;
+    Size used_bytes;            /* 所有条目 data 的总字节数 */
+    int nentries;               /* 条目数，也是哈希桶数 */
+    int free_list;              /* 第一个空闲条目，-1 表示没有 */
+    uint64 generations[TDENGINE_CACHE_GENERATION_SLOTS]; /* 各远程表的失效代数 */
+    TDengineCacheEntry entries[FLEXIBLE_ARRAY_MEMBER];
+    /* 条目数组之后是 nentries 个哈希桶，每个桶为链中第一个条目的下标 */
+} TDengineCacheShared;
+
+/* 结果缓存的总字节数（kB），0 表示不启用 */
+static int tdengine_result_cache_size = 0;
+static TDengineCacheShared *TDengineCache = NULL;
+static dsa_area *cache_area = NULL;
+
+/* 当前事务中写入过的远程表，事务中止时再次失效 */
+static std::vector<uint32> written_tables;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size tdengine_cache_budget(void);
+static int tdengine_cache_nentries(void);
+static Size tdengine_cache_area_size(void);
+static Size tdengine_cache_shmem_size(void);
+static void tdengine_cache_shmem_request(void);
+static void tdengine_cache_shmem_startup(void);
+static int *tdengine_cache_buckets(void);
+static void *tdengine_cache_area_place(void);
+static dsa_area *tdengine_cache_attach(void);
+static uint32 tdengine_cache_hash(Oid serverid, Oid userid, const char *sql, Size sql_len);
+static TDengineCacheEntry *tdengine_cache_find(dsa_area *area, uint32 hash, Oid serverid, Oid userid, const char *sql, Size sql_len);
+static void tdengine_cache_remove(dsa_area *area, TDengineCacheEntry *entry);
+static TDengineCacheEntry *tdengine_cache_alloc_entry(dsa_area *area);
+static bool tdengine_cache_evict(dsa_area *area);
+
+/*
+ * tdengine_result_cache_init - 注册结果缓存的配置参数和共享内存
+ *
+ * 只有通过 shared_preload_libraries 加载且 result_cache_size 大于 0 时才启用
+ */
+void
+tdengine_result_cache_init(void)
+{
+    DefineCustomIntVariable("tdengine_fdw.result_cache_size",
+                            "Amount of shared memory used to cache remote query results.",
+                            "Only foreign tables with the cache_ttl option are cached. Zero disables the cache. "
+                            "Requires tdengine_fdw in shared_preload_libraries.",
+                            &tdengine_result_cache_size,
+                            0, 0, MAX_KILOBYTES,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_KB,
+                            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress || tdengine_result_cache_size == 0)
+        return;
+
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = tdengine_cache_shmem_request;
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = tdengine_cache_shmem_startup;
+}
+
+/*
+ * 缓存条目 data 的总字节数上限
+ */
+static Size
+tdengine_cache_budget(void)
+{
+    return (Size) tdengine_result_cache_size * 1024;
+}
+
+static int
+tdengine_cache_nentries(void)
+{
+    return (int) Max(tdengine_cache_budget() / TDENGINE_CACHE_BYTES_PER_ENTRY, TDENGINE_CACHE_MIN_ENTRIES);
+}
+
+/*
+ * DSA 区域的大小，在预算之外留出区域自身元数据的空间
+ */
+static Size
+tdengine_cache_area_size(void)
+{
+    return add_size(tdengine_cache_budget(), dsa_minimum_size());
+}
+
+/*
+ * 共享内存布局: 条目数组之后是哈希桶，然后是 DSA 区域
+ */
+static Size
+tdengine_cache_shmem_size(void)
+{
+    Size size = offsetof(TDengineCacheShared, entries);
+
+    size = add_size(size, mul_size(tdengine_cache_nentries(), sizeof(TDengineCacheEntry)));
+    size = add_size(size, mul_size(tdengine_cache_nentries(), sizeof(int)));
+    size = MAXALIGN(size);
+    size = add_size(size, tdengine_cache_area_size());
+
+    return size;
+}
+
+static void
+tdengine_cache_shmem_request(void)
+{
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+
+    RequestAddinShmemSpace(tdengine_cache_shmem_size());
+    RequestNamedLWLockTranche("tdengine_fdw result cache", 1);
+}
+
+static void
+tdengine_cache_shmem_startup(void)
+{
+    bool found;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    TDengineCache = (TDengineCacheShared *) ShmemInitStruct("tdengine_fdw result cache", tdengine_cache_shmem_size(), &found);
+    if (!found)
+    {
+        dsa_area *area;
+        int i;
+
+        TDengineCache->lock = &(GetNamedLWLockTranche("tdengine_fdw result cache"))->lock;
+        TDengineCache->tranche_id = LWLockNewTrancheId();
+        pg_atomic_init_u64(&TDengineCache->use_counter, 0);
+        TDengineCache->used_bytes = 0;
+        TDengineCache->nentries = tdengine_cache_nentries();
+        memset(TDengineCache->generations, 0, sizeof(TDengineCache->generations));
+
+        /* 开始时所有条目都在空闲链表中，哈希桶为空 */
+        for (i = 0; i < TDengineCache->nentries; i++)
+        {
+            TDengineCache->entries[i].valid = false;
+            TDengineCache->entries[i].next = (i + 1 < TDengineCache->nentries) ? i + 1 : -1;
+            pg_atomic_init_u64(&TDengineCache->entries[i].last_used, 0);
+            tdengine_cache_buckets()[i] = -1;
+        }
+        TDengineCache->free_list = 0;
+
+        /* 区域只使用这块共享内存，不再创建额外的 DSM 段 */
+        area = dsa_create_in_place(tdengine_cache_area_place(), tdengine_cache_area_size(),
+                                   TDengineCache->tranche_id, NULL);
+        dsa_set_size_limit(area, tdengine_cache_area_size());
+        dsa_detach(area);
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+static int *
+tdengine_cache_buckets(void)
+{
+    return (int *) ((char *) TDengineCache +
+                    offsetof(TDengineCacheShared, entries) + TDengineCache->nentries * sizeof(TDengineCacheEntry));
+}
+
+static void *
+tdengine_cache_area_place(void)
+{
+    return (char *) TDengineCache +
+        MAXALIGN(offsetof(TDengineCacheShared, entries) + TDengineCache->nentries * (sizeof(TDengineCacheEntry) + sizeof(int)));
+}
+
+/*
+ * 在当前后端中连接到 DSA 区域，第一次使用缓存时调用
+ */
+static dsa_area *
+tdengine_cache_attach(void)
+{
+    if (cache_area == NULL)
+    {
+        MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+        LWLockRegisterTranche(TDengineCache->tranche_id, "tdengine_fdw result cache area");
+        cache_area = dsa_attach_in_place(tdengine_cache_area_place(), NULL);
+        MemoryContextSwitchTo(oldcxt);
+    }
+
+    return cache_area;
+}
+
+/*
+ * tdengine_result_cache_enabled - 当前后端是否可以使用结果缓存
+ */
+bool
+tdengine_result_cache_enabled(void)
+{
+    return TDengineCache != NULL;
+}
+
+/*
+ * tdengine_result_cache_max_entry - 单个结果最多缓存的字节数
+ *
+ * 限制为预算的四分之一，避免一个大结果挤掉所有其他条目
+ */
+Size
+tdengine_result_cache_max_entry(void)
+{
+    return tdengine_cache_budget() / 4;
+}
+
+static uint32
+tdengine_cache_hash(Oid serverid, Oid userid, const char *sql, Size sql_len)
+{
+    uint32 hash = hash_bytes((const unsigned char *) sql, (int) sql_len);
+
+    hash = hash_combine(hash, murmurhash32((uint32) serverid));
+    return hash_combine(hash, murmurhash32((uint32) userid));
+}
+
+/*
+ * 在哈希值所在的桶中查找键对应的条目，调用者需持有锁（共享锁即可）
+ */
+static TDengineCacheEntry *
+tdengine_cache_find(dsa_area *area, uint32 hash, Oid serverid, Oid userid, const char *sql, Size sql_len)
+{
+    int i;
+
+    for (i = tdengine_cache_buckets()[hash % TDengineCache->nentries]; i >= 0; i = TDengineCache->entries[i].next)
+    {
+        TDengineCacheEntry *entry = &TDengineCache->entries[i];
+
+        if (entry->hash == hash &&
+            entry->serverid == serverid && entry->userid == userid &&
+            entry->sql_len == sql_len &&
+            memcmp(dsa_get_address(area, entry->data), sql, sql_len) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * 释放条目，从哈希桶中摘下后放回空闲链表。调用者需持有排他锁
+ */
+static void
+tdengine_cache_remove(dsa_area *area, TDengineCacheEntry *entry)
+{
+    int idx = (int) (entry - TDengineCache->entries);
+    int *link = &tdengine_cache_buckets()[entry->hash % TDengineCache->nentries];
+
+    while (*link != idx)
+    {
+        Assert(*link >= 0);
+        link = &TDengineCache->entries[*link].next;
+    }
+    *link = entry->next;
+
+    dsa_free(area, entry->data);
+    TDengineCache->used_bytes -= entry->size;
+    entry->valid = false;
+    entry->next = TDengineCache->free_list;
+    TDengineCache->free_list = idx;
+}
+
+/*
+ * 从空闲链表中取出一个条目，没有空闲条目时淘汰最久未使用的条目，
+ * 仍然没有时返回 NULL。调用者需持有排他锁
+ */
+static TDengineCacheEntry *
+tdengine_cache_alloc_entry(dsa_area *area)
+{
+    TDengineCacheEntry *entry;
+
+    if (TDengineCache->free_list < 0 && !tdengine_cache_evict(area))
+        return NULL;
+
+    entry = &TDengineCache->entries[TDengineCache->free_list];
+    TDengineCache->free_list = entry->next;
+
+    return entry;
+}
+
+/*
+ * 淘汰最久未使用的条目，没有可淘汰的条目时返回 false。调用者需持有排他锁
+ */
+static bool
+tdengine_cache_evict(dsa_area *area)
+{
+    TDengineCacheEntry *victim = NULL;
+    int i;
+
+    for (i = 0; i < TDengineCache->nentries; i++)
+    {
+        TDengineCacheEntry *entry = &TDengineCache->entries[i];
+
+        if (entry->valid &&
+            (victim == NULL || pg_atomic_read_u64(&entry->last_used) < pg_atomic_read_u64(&victim->last_used)))
+            victim = entry;
+    }
+
+    if (victim == NULL)
+        return false;
+
+    tdengine_cache_remove(area, victim);
+    return true;
+}
+
+/*
+ * tdengine_result_cache_lookup - 查找未过期的缓存结果，命中时复制到 result 中
+ *
+ * 未命中时通过 generations 返回 scan 中各外部表当前的失效代数，存入结果时
+ * 传给 tdengine_result_cache_store()。过期的条目留待写入或淘汰时释放
+ */
+bool
+tdengine_result_cache_lookup(Oid serverid, Oid userid, const char *sql, const TDengineCacheScan *scan, uint64 *generations, std::string *result)
+{
+    dsa_area *area = tdengine_cache_attach();
+    Size sql_len = strlen(sql);
+    uint32 hash = tdengine_cache_hash(serverid, userid, sql, sql_len);
+    TimestampTz now = GetCurrentTimestamp();
+    TDengineCacheEntry *entry;
+    bool found = false;
+    int i;
+
+    LWLockAcquire(TDengineCache->lock, LW_SHARED);
+
+    entry = tdengine_cache_find(area, hash, serverid, userid, sql, sql_len);
+    if (entry != NULL && entry->expires > now)
+    {
+        const char *data = (const char *) dsa_get_address(area, entry->data);
+
+        result->assign(data + sql_len + 1, entry->size - sql_len - 1);
+        pg_atomic_write_u64(&entry->last_used, pg_atomic_add_fetch_u64(&TDengineCache->use_counter, 1));
+        found = true;
+    }
+    else
+    {
+        for (i = 0; i < scan->nrels; i++)
+            generations[i] = TDengineCache->generations[TDENGINE_CACHE_GENERATION_SLOT(scan->tables[i])];
+    }
+
+    LWLockRelease(TDengineCache->lock);
+
+    return found;
+}
+
+/*
+ * tdengine_result_cache_store - 缓存一个已读完的查询结果
+ *
+ * generations 为 tdengine_result_cache_lookup() 未命中时返回的失效代数，
+ * 之后所读的外部表被修改过时不缓存。空间不足时按最近使用淘汰其他条目，
+ * 仍然放不下时不缓存
+ */
+void
+tdengine_result_cache_store(Oid serverid, Oid userid, const char *sql, const TDengineCacheScan *scan, const uint64 *generations, const std::string &result)
+{
+    dsa_area *area = tdengine_cache_attach();
+    Size sql_len = strlen(sql);
+    Size size = sql_len + 1 + result.size();
+    uint32 hash = tdengine_cache_hash(serverid, userid, sql, sql_len);
+    TDengineCacheEntry *entry;
+    dsa_pointer data = InvalidDsaPointer;
+    char *p;
+    int i;
+
+    if (size > tdengine_result_cache_max_entry())
+        return;
+
+    LWLockAcquire(TDengineCache->lock, LW_EXCLUSIVE);
+
+    /* 查询执行期间所读的外部表被修改过，结果可能不包含这些修改 */
+    for (i = 0; i < scan->nrels; i++)
+    {
+        if (TDengineCache->generations[TDENGINE_CACHE_GENERATION_SLOT(scan->tables[i])] != generations[i])
+        {
+            LWLockRelease(TDengineCache->lock);
+            elog(DEBUG1, "tdengine_fdw : not caching result of \"%s\": foreign table modified during the query", sql);
+            return;
+        }
+    }
+
+    /* 其他会话可能已经缓存了同一个查询，以新结果为准 */
+    entry = tdengine_cache_find(area, hash, serverid, userid, sql, sql_len);
+    if (entry != NULL)
+        tdengine_cache_remove(area, entry);
+
+    while (TDengineCache->used_bytes + size > tdengine_cache_budget())
+    {
+        if (!tdengine_cache_evict(area))
+            break;
+    }
+
+    for (;;)
+    {
+        data = dsa_allocate_extended(area, size, DSA_ALLOC_NO_OOM);
+        if (DsaPointerIsValid(data) || !tdengine_cache_evict(area))
+            break;
+    }
+
+    if (!DsaPointerIsValid(data))
+    {
+        LWLockRelease(TDengineCache->lock);
+        return;
+    }
+
+    entry = tdengine_cache_alloc_entry(area);
+    if (entry == NULL)
+    {
+        dsa_free(area, data);
+        LWLockRelease(TDengineCache->lock);
+        return;
+    }
+
+    p = (char *) dsa_get_address(area, data);
+    memcpy(p, sql, sql_len + 1);
+    memcpy(p + sql_len + 1, result.data(), result.size());
+
+    entry->valid = true;
+    entry->hash = hash;
+    entry->serverid = serverid;
+    entry->userid = userid;
+    entry->nrels = scan->nrels;
+    memcpy(entry->tables, scan->tables, sizeof(uint32) * scan->nrels);
+    entry->expires = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), (int64) scan->ttl * 1000);
+    pg_atomic_write_u64(&entry->last_used, pg_atomic_add_fetch_u64(&TDengineCache->use_counter, 1));
+    entry->data = data;
+    entry->sql_len = sql_len;
+    entry->size = size;
+    TDengineCache->used_bytes += size;
+
+    entry->next = tdengine_cache_buckets()[hash % TDengineCache->nentries];
+    tdengine_cache_buckets()[hash % TDengineCache->nentries] = (int) (entry - TDengineCache->entries);
+
+    LWLockRelease(TDengineCache->lock);
+}
+
+/*
+ * tdengine_result_cache_table_key - 外部表对应的远程表在缓存中的键
+ */
+uint32
+tdengine_result_cache_table_key(Oid serverid, tdengine_opt *options)
+{
+    const char *database = options->svr_database ? options->svr_database : "";
+    const char *table = options->svr_table ? options->svr_table : "";
+    uint32 key;
+
+    key = hash_bytes((const unsigned char *) database, (int) strlen(database));
+    key = hash_combine(key, hash_bytes((const unsigned char *) table, (int) strlen(table)));
+    return hash_combine(key, murmurhash32((uint32) serverid));
+}
+
+/*
+ * tdengine_result_cache_invalidate - 丢弃读取了远程表 table 的所有缓存结果，
+ * 并增加该表的失效代数，使正在执行的查询不再缓存其结果
+ *
+ * 通过本 FDW 写入远程表的数据后调用
+ */
+void
+tdengine_result_cache_invalidate(uint32 table)
+{
+    dsa_area *area;
+    int i;
+
+    if (!tdengine_result_cache_enabled())
+        return;
+
+    area = tdengine_cache_attach();
+
+    LWLockAcquire(TDengineCache->lock, LW_EXCLUSIVE);
+
+    TDengineCache->generations[TDENGINE_CACHE_GENERATION_SLOT(table)]++;
+
+    for (i = 0; i < TDengineCache->nentries; i++)
+    {
+        TDengineCacheEntry *entry = &TDengineCache->entries[i];
+        int j;
+
+        if (!entry->valid)
+            continue;
+
+        for (j = 0; j < entry->nrels; j++)
+        {
+            if (entry->tables[j] == table)
+            {
+                tdengine_cache_remove(area, entry);
+                break;
+            }
+        }
+    }
+
+    LWLockRelease(TDengineCache->lock);
+}
+
+/*
+ * tdengine_result_cache_begin_write - 开始向远程表写入数据，第一次提交前调用
+ *
+ * 立即使读取了该表的缓存结果失效，并记录下来：写入中途出错时部分数据可能
+ * 已经写入远程表，事务中止时再失效一次
+ */
+void
+tdengine_result_cache_begin_write(uint32 table)
+{
+    if (!tdengine_result_cache_enabled())
+        return;
+
+    tdengine_result_cache_invalidate(table);
+
+    for (uint32 t : written_tables)
+    {
+        if (t == table)
+            return;
+    }
+    written_tables.push_back(table);
+}
+
+/*
+ * tdengine_result_cache_xact_end - 事务结束时调用，中止时使本事务写入过的
+ * 远程表再失效一次
+ */
+void
+tdengine_result_cache_xact_end(bool commit)
+{
+    if (!commit)
+    {
+        for (uint32 t : written_tables)
+            tdengine_result_cache_invalidate(t);
+    }
+
+    written_tables.clear();
+}
@@ -0,0 +1,16 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "connection.hpp"
+
+#include <string>
+
+extern bool tdengine_result_cache_enabled(void);
+
+extern Size tdengine_result_cache_max_entry(void);
+
+extern bool tdengine_result_cache_lookup(Oid serverid, Oid userid, const char *sql, const TDengineCacheScan *scan, uint64 *generations, std::string *result);
+
+extern void tdengine_result_cache_store(Oid serverid, Oid userid, const char *sql, const TDengineCacheScan *scan, const uint64 *generations, const std::string &result);
+
+#endif /* CACHE_HPP */
@@ -11,10 +11,21 @@ extern "C" {
 #include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 }
 
 #include "connection.hpp"
 
+#include <atomic>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
 typedef Oid ConnCacheKey;
 
 /*
@@ -27,14 +38,35 @@ typedef struct ConnCacheEntry
     bool invalidated;          /* 连接失效标志，true表示需要重新连接 */
     uint32 server_hashvalue;   /* 外部服务器OID的哈希值，用于缓存失效检测 */
     uint32 mapping_hashvalue;  /* 用户映射OID的哈希值，用于缓存失效检测 */
+    TimestampTz last_used;     /* 最近一次取用连接的时间，用于空闲探测 */
 } ConnCacheEntry;
 
 static HTAB *ConnectionHash = NULL;
 
+/* 尚未结束的异步查询数，存在时其他线程可能正在使用连接，不能关闭连接 */
+static int pending_queries = 0;
+
+/*
+ * 异步查询：在后台线程中执行阻塞的 ws_query，完成后向管道写入一个字节。
+ * 后端将管道的读端加入 WaitEventSet 即可等待查询完成，后台线程不调用
+ * 任何 PostgreSQL 函数。
+ */
+struct TDengineAsyncQuery
+{
+    WS_TAOS *conn;            /* 执行查询所用的连接 */
+    std::string sql;          /* 查询语句 */
+    WS_RES *res;              /* 查询结果，线程结束后有效 */
+    std::atomic<bool> done;   /* 查询是否已完成 */
+    int pipefd[2];            /* 完成通知管道 */
+    std::thread worker;       /* 执行查询的线程 */
+};
+
 static void tdengine_make_new_connection(ConnCacheEntry *entry, UserMapping *user, tdengine_opt *options);
 static WS_TAOS* tdengine_connect_server(tdengine_opt *options);
 static void tdengine_disconnect_server(ConnCacheEntry *entry);
 static void tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static bool tdengine_connection_alive(WS_TAOS *conn);
+static bool tdengine_connection_busy(WS_TAOS *conn);
 
 /*
  * 获取或创建与TDengine服务器的连接
@@ -71,19 +103,117 @@ tdengine_get_connection(UserMapping *user, tdengine_opt *options)
         entry->conn = NULL;
     }
 
-    if (entry->conn != NULL && entry->invalidated)
+    /*
+     * 失效的连接在不再被使用时才关闭，仍有异步查询或游标结果时继续使用旧连接，
+     * 新的选项在之后取用连接时生效
+     */
+    if (entry->conn != NULL && entry->invalidated && !tdengine_connection_busy(entry->conn))
     {
         elog(DEBUG3, "tdengine_fdw: closing connection %p for option changes to take effect",
              entry->conn);
         tdengine_disconnect_server(entry);
     }
 
+    /*
+     * 连接空闲较久时可能已被服务器重启或负载均衡器断开，复用前先探测，
+     * 探测失败则重新建立连接
+     */
+    if (entry->conn != NULL && options->keepalive_idle > 0 && !tdengine_connection_busy(entry->conn) &&
+        GetCurrentTimestamp() >= TimestampTzPlusMilliseconds(entry->last_used,
+                                                             (int64) options->keepalive_idle * 1000) &&
+        !tdengine_connection_alive(entry->conn))
+    {
+        elog(DEBUG3, "tdengine_fdw: connection %p is broken, reconnecting", entry->conn);
+        tdengine_disconnect_server(entry);
+    }
+
     if (entry->conn == NULL)
         tdengine_make_new_connection(entry, user, options);
 
+    entry->last_used = GetCurrentTimestamp();
+
     return entry->conn;
 }
 
+/*
+ * tdengine_reset_connection - 丢弃用户映射对应的缓存连接并重新连接
+ *
+ * 在查询因连接级错误失败后调用。连接仍被异步查询或其他游标使用时不能关闭，返回 NULL
+ */
+WS_TAOS*
+tdengine_reset_connection(UserMapping *user, tdengine_opt *options)
+{
+    ConnCacheEntry *entry = NULL;
+    ConnCacheKey key = user->umid;
+
+    if (ConnectionHash != NULL)
+        entry = (ConnCacheEntry *)hash_search(ConnectionHash, &key, HASH_FIND, NULL);
+
+    if (entry != NULL && entry->conn != NULL)
+    {
+        if (tdengine_connection_busy(entry->conn))
+            return NULL;
+        tdengine_disconnect_server(entry);
+    }
+
+    return tdengine_get_connection(user, options);
+}
+
+/*
+ * 连接是否正在被使用：后台线程可能正在连接上执行查询，或游标、插入语句
+ * 持有连接上的结果或语句
+ */
+static bool
+tdengine_connection_busy(WS_TAOS *conn)
+{
+    return pending_queries > 0 || tdengine_connection_in_use(conn);
+}
+
+/*
+ * 通过一个代价很小的查询检查连接是否可用
+ */
+static bool
+tdengine_connection_alive(WS_TAOS *conn)
+{
+    WS_RES *res = ws_query(conn, "SELECT SERVER_STATUS()");
+    int code = ws_errno(res);
+
+    ws_free_result(res);
+
+    return code == 0;
+}
+
+/*
+ * tdengine_is_connection_error - 错误码是否表示连接已断开，而不是查询本身出错
+ *
+ * TDengine 中模块号为 0 的低 0x100 个错误码属于 RPC 层，WebSocket 客户端自身的
+ * 错误码位于 0xE000 段
+ */
+bool
+tdengine_is_connection_error(int code)
+{
+    int low = code & 0xFFFF;
+
+    if (code == 0)
+        return false;
+
+    return low < 0x0100 || (low & 0xFF00) == 0xE000;
+}
+
+/*
+ * tdengine_is_read_only_query - 语句是否只读，只读语句失败后可以安全地重试
+ */
+bool
+tdengine_is_read_only_query(const char *sql)
+{
+    while (*sql == ' ' || *sql == '\t' || *sql == '\n' || *sql == '(')
+        sql++;
+
+    return pg_strncasecmp(sql, "SELECT", 6) == 0 ||
+           pg_strncasecmp(sql, "DESCRIBE", 8) == 0 ||
+           pg_strncasecmp(sql, "SHOW", 4) == 0;
+}
+
 /*
  * 创建新的TDengine服务器连接并初始化连接缓存项
  */
@@ -127,16 +257,13 @@ create_tdengine_connection(char* dsn)
     return taos;
 }
 
-// TODO: 添加对超级表的处理
 /*
- * 根据连接选项创建TDengine服务器连接
+ * 根据连接选项生成连接TDengine服务器所用的DSN
  */
-static WS_TAOS*
-tdengine_connect_server(tdengine_opt *opts)
+void
+tdengine_build_dsn(tdengine_opt *opts, char *dsn, size_t size)
 {
-    char dsn[1024];
-    
-    snprintf(dsn, sizeof(dsn), 
+    snprintf(dsn, size, 
              "%s[+%s]://[%s:%s@]%s:%d/%s?%s",
              opts->driver ? opts->driver : "",          // 驱动类型
              opts->protocol ? opts->protocol : "",      // 协议类型
@@ -145,7 +272,18 @@ tdengine_connect_server(tdengine_opt *opts)
              opts->svr_address ? opts->svr_address : "localhost", // 服务器地址
              opts->svr_port ? opts->svr_port : 6030,    // 服务器端口
              opts->svr_database ? opts->svr_database : ""); // 数据库名称
-    
+}
+
+/*
+ * 根据连接选项创建TDengine服务器连接
+ */
+static WS_TAOS*
+tdengine_connect_server(tdengine_opt *opts)
+{
+    char dsn[TDENGINE_DSN_LEN];
+
+    tdengine_build_dsn(opts, dsn, sizeof(dsn));
+
     return create_tdengine_connection(dsn);
 }
 
@@ -157,6 +295,7 @@ tdengine_disconnect_server(ConnCacheEntry *entry)
 {
     if (entry && entry->conn != NULL)
     {
+        tdengine_stmt_cache_forget(entry->conn);
         ws_close(entry->conn);
         entry->conn = NULL;
     }
@@ -164,6 +303,9 @@ tdengine_disconnect_server(ConnCacheEntry *entry)
 
 /*
  * 连接失效回调函数，用于处理服务器或用户映射变更时的连接清理
+ *
+ * 失效消息可能在查询执行中途（例如获取锁时）处理，此时连接可能正被后台线程
+ * 或游标使用，因此这里只做标记，由 tdengine_get_connection() 在连接空闲时关闭
  */
 static void
 tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
@@ -186,8 +328,7 @@ tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
             (cacheid == USERMAPPINGOID && entry->mapping_hashvalue == hashvalue))   /* 特定用户映射失效 */
         {
             entry->invalidated = true;
-            elog(DEBUG3, "tdengine_fdw: discarding connection %p", entry->conn);
-            tdengine_disconnect_server(entry);
+            elog(DEBUG3, "tdengine_fdw: connection %p invalidated", entry->conn);
         }
     }
 }
@@ -214,3 +355,108 @@ tdengine_cleanup_connection(void)
         tdengine_disconnect_server(entry);
     }
 }
+
+/*
+ * tdengine_submit_query - 提交一个异步查询，立即返回
+ *
+ * conn 必须是调用者为本次查询单独建立的连接：后台线程执行期间后端
+ * 主线程可能在缓存的连接上执行其他查询，taosws 不保证同一连接可以被
+ * 两个线程同时使用。查询结果通过 tdengine_finish_query() 获取。
+ */
+TDengineAsyncQuery *
+tdengine_submit_query(WS_TAOS *conn, const char *sql)
+{
+    TDengineAsyncQuery *query = new TDengineAsyncQuery();
+    char errbuf[256] = {0};
+    sigset_t blocked;
+    sigset_t saved;
+
+    query->conn = conn;
+    query->sql = sql;
+    query->res = NULL;
+    query->done = false;
+
+    if (pipe(query->pipefd) != 0)
+    {
+        delete query;
+        elog(ERROR, "tdengine_fdw : could not create pipe for asynchronous query: %m");
+    }
+
+    pending_queries++;
+
+    /* 读端只用于等待可读事件，设为非阻塞 */
+    (void) fcntl(query->pipefd[0], F_SETFL, O_NONBLOCK);
+
+    /*
+     * 新线程继承创建时的信号屏蔽字。创建期间屏蔽所有信号，保证 SIGINT、
+     * SIGTERM 等信号只会递送到后端主线程，由 PostgreSQL 的处理函数处理
+     */
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_SETMASK, &blocked, &saved);
+
+    try
+    {
+        query->worker = std::thread([query]() {
+            char c = 1;
+
+            query->res = ws_query(query->conn, query->sql.c_str());
+            query->done = true;
+            (void) !write(query->pipefd[1], &c, 1);
+        });
+    }
+    catch (const std::system_error &e)
+    {
+        snprintf(errbuf, sizeof(errbuf), "%s", e.what());
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (errbuf[0] != '\0')
+    {
+        pending_queries--;
+        close(query->pipefd[0]);
+        close(query->pipefd[1]);
+        delete query;
+        elog(ERROR, "tdengine_fdw : could not start asynchronous query: %s", errbuf);
+    }
+
+    return query;
+}
+
+/*
+ * 返回可用于等待异步查询完成的文件描述符
+ */
+int
+tdengine_query_wait_fd(TDengineAsyncQuery *query)
+{
+    return query->pipefd[0];
+}
+
+/*
+ * 异步查询是否已经完成
+ */
+bool
+tdengine_query_is_done(TDengineAsyncQuery *query)
+{
+    return query->done;
+}
+
+/*
+ * tdengine_finish_query - 等待异步查询完成并返回其结果，同时释放异步查询
+ */
+WS_RES *
+tdengine_finish_query(TDengineAsyncQuery *query)
+{
+    WS_RES *res;
+
+    if (query->worker.joinable())
+        query->worker.join();
+
+    res = query->res;
+    pending_queries--;
+    close(query->pipefd[0]);
+    close(query->pipefd[1]);
+    delete query;
+
+    return res;
+}
@@ -8,8 +8,36 @@ extern "C" {
 
 extern WS_TAOS* tdengine_get_connection(UserMapping *user, tdengine_opt *options);
 
+extern WS_TAOS* tdengine_reset_connection(UserMapping *user, tdengine_opt *options);
+
+extern bool tdengine_is_connection_error(int code);
+
+extern bool tdengine_is_read_only_query(const char *sql);
+
 extern WS_TAOS* create_tdengine_connection(char* dsn);
 
+/* DSN 的最大长度 */
+#define TDENGINE_DSN_LEN 1024
+
+extern void tdengine_build_dsn(tdengine_opt *opts, char *dsn, size_t size);
+
 extern void tdengine_cleanup_connection(void);
 
+/* 释放在连接上准备的查询语句，定义在 query.cpp 中 */
+extern void tdengine_stmt_cache_forget(WS_TAOS *conn);
+
+/* 连接上是否还有未释放的游标结果或插入语句，定义在 query.cpp 中 */
+extern bool tdengine_connection_in_use(WS_TAOS *conn);
+
+/* 异步查询，定义在 connection.cpp 中 */
+struct TDengineAsyncQuery;
+
+extern TDengineAsyncQuery* tdengine_submit_query(WS_TAOS *conn, const char *sql);
+
+extern int tdengine_query_wait_fd(TDengineAsyncQuery *query);
+
+extern bool tdengine_query_is_done(TDengineAsyncQuery *query);
+
+extern WS_RES* tdengine_finish_query(TDengineAsyncQuery *query);
+
 #endif /* CONNECTION_HPP */
\ No newline at end of file
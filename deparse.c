@@ -12,12 +12,15 @@
 #include "nodes/nodeFuncs.h"
 #include "nodes/parsenodes.h"
 #include "optimizer/tlist.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
 
 #define QUOTE '"'
+/* 连接下推时各个表在远程查询中的别名前缀 */
+#define REL_ALIAS_PREFIX "r"
 
 // TODO: TDengine支持的函数列表
 
@@ -41,6 +44,10 @@ static const char *TDengineUniqueFunction[] = {
 	"log10", /* Use for PostgreSQL old version */
 
 	"tdengine_time",
+	"tdengine_interval",
+	"tdengine_session",
+	"tdengine_state_window",
+	"tdengine_event_window",
 	"tdengine_fill_numeric",
 	"tdengine_fill_option",
 	NULL};
@@ -159,6 +166,7 @@ static void tdengine_deparse_func_expr(FuncExpr *node, deparse_expr_cxt *context
 static void tdengine_deparse_fill_option(StringInfo buf, const char *val);
 static void tdengine_deparse_op_expr(OpExpr *node, deparse_expr_cxt *context);
 static void tdengine_deparse_operator_name(StringInfo buf, Form_pg_operator opform, PatternMatchingOperator *op_type);
+static bool tdengine_deparse_tag_in_list(Expr *arg1, Expr *arg2, deparse_expr_cxt *context);
 static void tdengine_deparse_scalar_array_op_expr(ScalarArrayOpExpr *node,
 												  deparse_expr_cxt *context);
 static void tdengine_deparse_relabel_type(RelabelType *node, deparse_expr_cxt *context);
@@ -174,7 +182,7 @@ static void tdengine_deparse_relation(StringInfo buf, Relation rel);
 static void tdengine_deparse_target_list(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, Bitmapset *attrs_used, List **retrieved_attrs);
 static void tdengine_deparse_target_list_schemaless(StringInfo buf, Relation rel, Oid reloid, Bitmapset *attrs_used, List **retrieved_attrs, bool all_fieldtag, List *slcols);
 static void tdengine_deparse_slvar(Node *node, Var *var, Const *cnst, deparse_expr_cxt *context);
-static void tdengine_deparse_column_ref(StringInfo buf, int varno, int varattno, Oid vartype, PlannerInfo *root, bool convert, bool *can_delete_directly);
+static void tdengine_deparse_column_ref(StringInfo buf, int varno, int varattno, Oid vartype, PlannerInfo *root, bool convert, bool *can_delete_directly, bool qualify_col);
 
 static void tdengine_deparse_select(List *tlist, List **retrieved_attrs, deparse_expr_cxt *context);
 static void tdengine_deparse_from_expr_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *foreignrel, bool use_alias, List **params_list);
@@ -186,7 +194,6 @@ static void tdengine_append_order_by_clause(List *pathkeys, deparse_expr_cxt *co
 static Node *tdengine_deparse_sort_group_clause(Index ref, List *tlist, deparse_expr_cxt *context);
 
 static void tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_attrs, deparse_expr_cxt *context);
-static Expr *tdengine_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel);
 
 static bool tdengine_contain_time_column(List *exprs, schemaless_info *pslinfo);
 static bool tdengine_contain_time_key_column(Oid relid, List *exprs);
@@ -208,6 +215,7 @@ char *tdengine_replace_function(char *in);
 bool tdengine_is_star_func(Oid funcid, char *in);
 static bool tdengine_is_unique_func(Oid funcid, char *in);
 static bool tdengine_is_supported_builtin_func(Oid funcid, char *in);
+static void tdengine_append_duration(StringInfo buf, Interval *interval);
 static bool exist_in_function_list(char *funcname, const char **funclist);
 
 static void add_backslash(StringInfo buf, const char *ptr, const char *regex_special);
@@ -590,13 +598,17 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 			return false;
 
 		// TODO: fill()函数相关
-		/* fill() must be inside tdengine_time() */
+		/* fill() must be inside tdengine_time() or tdengine_interval() */
 		if (strcmp(opername, "tdengine_fill_numeric") == 0 ||
 			strcmp(opername, "tdengine_fill_option") == 0)
 		{
 			if (outer_cxt->tdengine_fill_enable == false)
-				elog(ERROR, "tdengine_fdw: syntax error tdengine_fill_numeric() or tdengine_fill_option() must be embedded inside tdengine_time() function\n");
+				elog(ERROR, "tdengine_fdw: syntax error tdengine_fill_numeric() or tdengine_fill_option() must be embedded inside tdengine_time() or tdengine_interval() function\n");
 		}
+
+		/* 窗口函数只能作为分组项出现，反解析为时间窗口子句 */
+		if (tdengine_is_window_func((Expr *)fe) && !glob_cxt->for_tlist)
+			return false;
 		if (is_cast_func)
 		{
 			/* 类型转换函数必须在外层允许跳过转换检查时才可下推 */
@@ -611,7 +623,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 			glob_cxt->is_inner_func = true;
 		}
 
-		if (strcmp(opername, "tdengine_time") == 0)
+		if (tdengine_is_interval_func((Expr *)fe))
 		{
 			inner_cxt.tdengine_fill_enable = true;
 		}
@@ -975,6 +987,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 		// TODO:
 		/* these function can be passed to TDengine */
 		if ((strcmp(opername, "sum") == 0 ||
+			 strcmp(opername, "avg") == 0 ||
 			 strcmp(opername, "max") == 0 ||
 			 strcmp(opername, "min") == 0 ||
 			 strcmp(opername, "count") == 0 ||
@@ -1038,6 +1051,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 
 				if (IsA(n, Var) ||
 					((index == index_const) && IsA(n, Const)))
+					/* 参数检查通过 */ ;
 				else if (IsA(n, Const))
 				{
 					Const *arg = (Const *)n;
@@ -1047,6 +1061,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 					{
 						is_regex = tdengine_is_regex_argument(arg, &extval);
 						if (is_regex)
+							/* 正则表达式参数可以下推 */ ;
 						else
 							return false;
 					}
@@ -1074,6 +1089,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 						return false;
 				}
 				else if (is_star_func)
+					/* 星号函数的参数不作检查 */ ;
 				else
 					return false;
 			}
@@ -1129,6 +1145,7 @@ static bool tdengine_foreign_expr_walker(Node *node, foreign_glob_cxt *glob_cxt,
 		else
 		{
 			if (agg_inputcollid == InvalidOid)
+				/* 聚合没有输入排序规则 */ ;
 			else if (inner_cxt.state != FDW_COLLATE_SAFE ||
 					 agg_inputcollid != inner_cxt.collation)
 				return false;
@@ -1349,7 +1366,7 @@ void tdengine_deparse_delete(StringInfo buf, PlannerInfo *root,
 		appendStringInfo(buf, i == 0 ? " WHERE " : " AND ");
 
 		/* 反解析列引用(表名.列名形式) */
-		tdengine_deparse_column_ref(buf, rtindex, attnum, -1, root, false, false);
+		tdengine_deparse_column_ref(buf, rtindex, attnum, -1, root, false, false, false);
 
 		/* 添加参数占位符($1, $2等) */
 		appendStringInfo(buf, "=$%d", i + 1);
@@ -1406,6 +1423,10 @@ void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, Rel
 	/* 构建FROM和WHERE子句 */
 	tdengine_deparse_from_expr(quals, &context);
 
+	/* 记录WHERE子句的结束位置，执行时可以在此处追加时间条件 */
+	fpinfo->where_end = buf->len;
+	fpinfo->has_where = (quals != NIL);
+
 	/* 处理上层关系的特殊子句 */
 	if (rel->reloptkind == RELOPT_UPPER_REL)
 	{
@@ -1560,6 +1581,9 @@ static void tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_
 	bool is_need_comma = false;																	   
 	bool selected_all_fieldtag = false;															   
 	TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)context->foreignrel->fdw_private; 
+	/* 上层关系和连接的结果按位置与目标列表对应，每个目标项都必须输出 */
+	bool by_position = (context->foreignrel->reloptkind == RELOPT_UPPER_REL ||
+					 context->foreignrel->reloptkind == RELOPT_JOINREL);
 
 	*retrieved_attrs = NIL; // 初始化返回的属性索引列表
 
@@ -1575,13 +1599,13 @@ static void tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_
 			is_slvar = true;
 
 		/* 检查是否是分组目标列 */
-		if (!fpinfo->is_tlist_func_pushdown && IsA((Expr *)tle->expr, Var))
+		if (!by_position && !fpinfo->is_tlist_func_pushdown && IsA((Expr *)tle->expr, Var))
 		{
 			is_col_grouping_target = tdengine_is_grouping_target(tle, context->root->parse);
 		}
 
 		/* 处理无模式变量的分组目标检查 */
-		if (is_slvar)
+		if (!by_position && is_slvar)
 		{
 			is_col_grouping_target = tdengine_is_grouping_target(tle, context->root->parse);
 		}
@@ -1593,16 +1617,20 @@ static void tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_
 			((IsA((Expr *)tle->expr, Var) || is_slvar) && !is_col_grouping_target)) // 变量引用(非分组目标)
 		{
 			bool is_skip_expr = false; // 是否跳过当前表达式
+			bool is_window_start = false; // 是否输出时间窗口的起始时间
 
+			/* 按窗口分组时，窗口函数对应窗口的起始时间 */
+			if (by_position && tdengine_is_window_func((Expr *)tle->expr))
+				is_window_start = true;
 			/* 特殊处理某些函数调用 */
-			if (IsA((Expr *)tle->expr, FuncExpr))
+			else if (IsA((Expr *)tle->expr, FuncExpr))
 			{
 				FuncExpr *fe = (FuncExpr *)tle->expr;
 				StringInfo func_name = makeStringInfo();
 
 				get_proname(fe->funcid, func_name);
 				/* 跳过特定函数 */
-				if (strcmp(func_name->data, "tdengine_time") == 0 ||
+				if (tdengine_is_window_func((Expr *)fe) ||
 					strcmp(func_name->data, "tdengine_fill_numeric") == 0 ||
 					strcmp(func_name->data, "tdengine_fill_option") == 0)
 					is_skip_expr = true;
@@ -1616,6 +1644,12 @@ static void tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_
 			{
 				if (fpinfo->is_tlist_func_pushdown && fpinfo->all_fieldtag)
 					selected_all_fieldtag = true; // 标记选择了所有字段标签
+				else if (is_window_start)
+				{
+					first = false;
+					appendStringInfoString(buf, "_wstart");
+					is_need_comma = true;
+				}
 				else
 				{
 					first = false;
@@ -1668,10 +1702,16 @@ static void
 tdengine_deparse_from_expr_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *foreignrel,
 								   bool use_alias, List **params_list)
 {
-	Assert(!use_alias); // 确保不使用别名(当前实现限制)
 	if (foreignrel->reloptkind == RELOPT_JOINREL)
 	{
-		Assert(false); // 触发断言失败
+		TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)foreignrel->fdw_private;
+
+		/* 只下推内连接，连接条件与其他条件一起写在 WHERE 子句中 */
+		Assert(fpinfo->jointype == JOIN_INNER);
+
+		tdengine_deparse_from_expr_for_rel(buf, root, fpinfo->outerrel, true, params_list);
+		appendStringInfoString(buf, ", ");
+		tdengine_deparse_from_expr_for_rel(buf, root, fpinfo->innerrel, true, params_list);
 	}
 	else
 	{
@@ -1683,16 +1723,169 @@ tdengine_deparse_from_expr_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo
 		/* 反解析关系名称到输出缓冲区 */
 		tdengine_deparse_relation(buf, rel);
 
+		/* 连接查询中为每个表指定别名 */
+		if (use_alias)
+			appendStringInfo(buf, " %s%d", REL_ALIAS_PREFIX, foreignrel->relid);
+
 		table_close(rel, NoLock); // 关闭表
 	}
 }
 
-void tdengine_deparse_analyze(StringInfo sql, char *dbname, char *relname)
+/*
+ * 反解析 ANALYZE 采样使用的查询，按属性顺序取出所有列
+ *
+ * 调用方可以在语句末尾追加时间条件和 LIMIT 子句。
+ */
+void tdengine_deparse_analyze(StringInfo buf, Relation rel, List **retrieved_attrs)
+{
+	TupleDesc tupdesc = RelationGetDescr(rel);
+	bool first = true;
+	int i;
+
+	*retrieved_attrs = NIL;
+
+	appendStringInfoString(buf, "SELECT ");
+	for (i = 1; i <= tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+		char *colname;
+
+		if (attr->attisdropped)
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		colname = tdengine_get_column_name(RelationGetRelid(rel), i);
+		if (TDENGINE_IS_TIME_COLUMN(colname))
+			appendStringInfoString(buf, "time");
+		else if (pg_strcasecmp(colname, TDENGINE_TBNAME_COLUMN) == 0)
+			appendStringInfoString(buf, TDENGINE_TBNAME_COLUMN);
+		else
+			appendStringInfoString(buf, tdengine_quote_identifier(colname, QUOTE));
+
+		*retrieved_attrs = lappend_int(*retrieved_attrs, i);
+	}
+
+	/* 所有列都已删除时仍需要一个合法的目标列 */
+	if (first)
+		appendStringInfoString(buf, "time");
+
+	appendStringInfoString(buf, " FROM ");
+	tdengine_deparse_relation(buf, rel);
+}
+
+/*
+ * 反解析参数绑定插入语句，每个目标列对应一个 ? 占位符
+ *
+ * time 和 time_text 都对应远程的时间列，只输出一次，绑定时两者合并为一列
+ */
+void tdengine_deparse_insert(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *targetAttrs)
+{
+	ListCell   *lc;
+	bool		first = true;
+	bool		time_added = false;
+	int			nparams = 0;
+	int			i;
+
+	appendStringInfoString(buf, "INSERT INTO ");
+	tdengine_deparse_relation(buf, rel);
+	appendStringInfoString(buf, " (");
+
+	foreach(lc, targetAttrs)
+	{
+		int			attnum = lfirst_int(lc);
+		char	   *colname = tdengine_get_column_name(RelationGetRelid(rel), attnum);
+
+		if (TDENGINE_IS_TIME_COLUMN(colname))
+		{
+			if (time_added)
+				continue;
+			time_added = true;
+		}
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		if (TDENGINE_IS_TIME_COLUMN(colname))
+			appendStringInfoString(buf, "time");
+		else if (pg_strcasecmp(colname, TDENGINE_TBNAME_COLUMN) == 0)
+			appendStringInfoString(buf, TDENGINE_TBNAME_COLUMN);
+		else
+			appendStringInfoString(buf, tdengine_quote_identifier(colname, QUOTE));
+		nparams++;
+	}
+
+	appendStringInfoString(buf, ") VALUES (");
+	for (i = 0; i < nparams; i++)
+		appendStringInfoString(buf, i == 0 ? "?" : ", ?");
+	appendStringInfoChar(buf, ')');
+}
+
+/*
+ * 反解析 ANALYZE 前的探测查询，获取总行数和时间列的取值范围
+ */
+void tdengine_deparse_analyze_probe(StringInfo buf, Relation rel)
+{
+	appendStringInfoString(buf, "SELECT COUNT(*), MIN(time), MAX(time) FROM ");
+	tdengine_deparse_relation(buf, rel);
+}
+
+/*
+ * 反解析查询超级表结构的 DESCRIBE 语句，表名与其他语句一样加引号
+ */
+void tdengine_deparse_describe_stmt(StringInfo buf, const char *stable_name)
+{
+	appendStringInfo(buf, "DESCRIBE %s", tdengine_quote_identifier(stable_name, QUOTE));
+}
+
+/*
+ * 检查表达式中是否包含参数节点
+ */
+static bool
+tdengine_contain_param_walker(Node *node, void *context)
 {
-	appendStringInfo(sql, "SELECT");
-	appendStringInfo(sql, " round(((data_length + index_length)), 2)");
-	appendStringInfo(sql, " FROM information_schema.TABLES");
-	appendStringInfo(sql, " WHERE table_schema = '%s' AND table_name = '%s'", dbname, relname);
+	if (node == NULL)
+		return false;
+	if (IsA(node, Param))
+		return true;
+	return expression_tree_walker(node, tdengine_contain_param_walker, context);
+}
+
+/*
+ * 反解析用于远程行数估算的 COUNT(*) 语句
+ *
+ * 含参数的条件在规划阶段无法取值，直接忽略，估算结果因此偏大。
+ */
+void tdengine_deparse_count_stmt(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *remote_conds)
+{
+	deparse_expr_cxt context;
+	List *quals = NIL;
+	ListCell *lc;
+
+	foreach (lc, remote_conds)
+	{
+		RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+		if (!tdengine_contain_param_walker((Node *)ri->clause, NULL))
+			quals = lappend(quals, ri);
+	}
+
+	context.buf = buf;
+	context.root = root;
+	context.foreignrel = baserel;
+	context.scanrel = baserel;
+	context.params_list = NULL;
+	context.op_type = UNKNOWN_OPERATOR;
+	context.is_tlist = false;
+	context.can_skip_cast = false;
+	context.convert_to_timestamp = false;
+	context.has_bool_cmp = false;
+
+	appendStringInfoString(buf, "SELECT COUNT(*)");
+	tdengine_deparse_from_expr(quals, &context);
 }
 
 /*
@@ -1743,7 +1936,7 @@ tdengine_deparse_target_list(StringInfo buf,PlannerInfo *root,Index rtindex,Rela
 				first = false;
 
 				// 反解析列引用并添加到缓冲区
-				tdengine_deparse_column_ref(buf, rtindex, i, -1, root, false, false);
+				tdengine_deparse_column_ref(buf, rtindex, i, -1, root, false, false, false);
 			}
 
 			// 将属性编号添加到返回列表
@@ -1769,7 +1962,7 @@ tdengine_deparse_target_list(StringInfo buf,PlannerInfo *root,Index rtindex,Rela
  * tdengine_deparse_column_ref - 反解析列引用并输出到缓冲区
  */
 static void tdengine_deparse_column_ref(StringInfo buf, int varno, int varattno, Oid vartype,
-							PlannerInfo *root, bool convert, bool *can_delete_directly)
+							PlannerInfo *root, bool convert, bool *can_delete_directly, bool qualify_col)
 {
 	RangeTblEntry *rte;
 	char *colname = NULL;
@@ -1794,13 +1987,23 @@ static void tdengine_deparse_column_ref(StringInfo buf, int varno, int varattno,
 	/* 处理布尔类型转换 */
 	if (convert && vartype == BOOLOID)
 	{
-		appendStringInfo(buf, "(%s=true)", tdengine_quote_identifier(colname, QUOTE));
+		appendStringInfoChar(buf, '(');
+		if (qualify_col)
+			appendStringInfo(buf, "%s%d.", REL_ALIAS_PREFIX, varno);
+		appendStringInfo(buf, "%s=true)", tdengine_quote_identifier(colname, QUOTE));
 	}
 	else
 	{
+		/* 连接查询中用表的别名限定列名 */
+		if (qualify_col)
+			appendStringInfo(buf, "%s%d.", REL_ALIAS_PREFIX, varno);
+
 		/* 特殊处理时间列 */
 		if (TDENGINE_IS_TIME_COLUMN(colname))
 			appendStringInfoString(buf, "time");
+		/* 超级表的子表名伪列不能加引号 */
+		else if (pg_strcasecmp(colname, TDENGINE_TBNAME_COLUMN) == 0)
+			appendStringInfoString(buf, TDENGINE_TBNAME_COLUMN);
 		else
 			/* 普通列添加引号 */
 			appendStringInfoString(buf, tdengine_quote_identifier(colname, QUOTE));
@@ -2054,7 +2257,8 @@ tdengine_deparse_var(Var *node, deparse_expr_cxt *context)
 
 		tdengine_deparse_column_ref(buf, node->varno, node->varattno,
 									node->vartype, context->root,
-									convert, &context->can_delete_directly);
+									convert, &context->can_delete_directly,
+									bms_num_members(relids) > 1);
 	}
 	else
 	{
@@ -2174,12 +2378,7 @@ tdengine_deparse_const(Const *node, deparse_expr_cxt *context, int showtype)
 	case INTERVALOID:
 	{
 		// 处理时间间隔类型
-		Interval *interval = DatumGetIntervalP(node->constvalue);
-		struct pg_itm tm;
-
-		interval2itm(*interval, &tm);
-		appendStringInfo(buf, "%dd%ldh%dm%ds%du", tm.tm_mday, tm.tm_hour,tm.tm_min, tm.tm_sec, tm.tm_usec
-		);
+		tdengine_append_duration(buf, DatumGetIntervalP(node->constvalue));
 		break;
 	}
 	default:
@@ -2262,14 +2461,83 @@ static void tdengine_deparse_param(Param *node, deparse_expr_cxt *context)
 	}
 }
 
-// TODO:
 /*
  * 将PostgreSQL函数名转换为TDengine对应的等效函数名
  */
 char *
 tdengine_replace_function(char *in)
 {
-	
+	const char *prefix = "tdengine_";
+	const char *suffix = "_all";
+	size_t prefix_len = strlen(prefix);
+	size_t suffix_len = strlen(suffix);
+	size_t len;
+
+	/* TDengine 没有 mean，等价的聚合函数为 avg */
+	if (strcmp(in, "mean") == 0)
+		return "avg";
+
+	/* 其余函数名原样使用 */
+	if (strncmp(in, prefix, prefix_len) != 0)
+		return in;
+
+	/* 去掉为避免与 PostgreSQL 同名函数冲突而加的 tdengine_ 前缀和星号函数的 _all 后缀 */
+	in += prefix_len;
+	len = strlen(in);
+	if (len > suffix_len && strcmp(in + len - suffix_len, suffix) == 0)
+		return pnstrdup(in, len - suffix_len);
+
+	return pstrdup(in);
+}
+
+/*
+ * 将时间间隔输出为 TDengine 的时长常量，如 1m、90s
+ *
+ * TDengine 的时长常量只能带一个单位，因此选择能整除该时间间隔的最大单位。
+ * 以月为单位的时间间隔不能与天或更小的单位混用
+ */
+static void
+tdengine_append_duration(StringInfo buf, Interval *interval)
+{
+	static const struct
+	{
+		int64 usecs;
+		const char *unit;
+	} units[] = {
+		{USECS_PER_DAY * 7, "w"},
+		{USECS_PER_DAY, "d"},
+		{USECS_PER_HOUR, "h"},
+		{USECS_PER_MINUTE, "m"},
+		{USECS_PER_SEC, "s"},
+		{1000, "a"},
+		{1, "u"},
+	};
+	int64 usecs;
+	int i;
+
+	if (interval->month != 0)
+	{
+		if (interval->day != 0 || interval->time != 0)
+			elog(ERROR, "tdengine_fdw : interval mixing months with days or time is not supported");
+		appendStringInfo(buf, "%dn", interval->month);
+		return;
+	}
+
+	usecs = interval->time + (int64)interval->day * USECS_PER_DAY;
+	if (usecs == 0)
+	{
+		appendStringInfoString(buf, "0s");
+		return;
+	}
+
+	for (i = 0; i < lengthof(units); i++)
+	{
+		if (usecs % units[i].usecs == 0)
+		{
+			appendStringInfo(buf, INT64_FORMAT "%s", usecs / units[i].usecs, units[i].unit);
+			return;
+		}
+	}
 }
 
 /*
@@ -2313,7 +2581,7 @@ static void tdengine_deparse_func_expr(FuncExpr *node, deparse_expr_cxt *context
 		if (context->is_tlist)
 			return;
 
-		appendStringInfo(buf, "time("); // 输出函数名开始
+		appendStringInfo(buf, "INTERVAL("); // 输出时间窗口子句
 		first = true;
 		foreach (arg, args)
 		{
@@ -2332,6 +2600,68 @@ static void tdengine_deparse_func_expr(FuncExpr *node, deparse_expr_cxt *context
 		return;
 	}
 
+	/*
+	 * tdengine_interval(time, 窗口长度, 滑动步长[, fill]) 反解析为 INTERVAL(...) SLIDING(...)，
+	 * fill 参数与 tdengine_time() 相同，输出在 FILL 子句中
+	 */
+	if (strcmp(proname, "tdengine_interval") == 0)
+	{
+		if (context->is_tlist)
+			return;
+
+		Assert(list_length(args) >= 3);
+		appendStringInfoString(buf, "INTERVAL(");
+		tdengine_deparse_expr((Expr *)lsecond(args), context);
+		appendStringInfoString(buf, ") SLIDING(");
+		tdengine_deparse_expr((Expr *)lthird(args), context);
+		appendStringInfoChar(buf, ')');
+		if (list_length(args) > 3)
+			context->tdengine_fill_expr = (FuncExpr *)lfourth(args);
+		return;
+	}
+
+	/* tdengine_session(time, 间隔) 反解析为 SESSION(time, 间隔) */
+	if (strcmp(proname, "tdengine_session") == 0)
+	{
+		if (context->is_tlist)
+			return;
+
+		Assert(list_length(args) == 2);
+		appendStringInfoString(buf, "SESSION(");
+		tdengine_deparse_expr((Expr *)linitial(args), context);
+		appendStringInfoString(buf, ", ");
+		tdengine_deparse_expr((Expr *)lsecond(args), context);
+		appendStringInfoChar(buf, ')');
+		return;
+	}
+
+	/* tdengine_state_window(col) 反解析为 STATE_WINDOW(col) */
+	if (strcmp(proname, "tdengine_state_window") == 0)
+	{
+		if (context->is_tlist)
+			return;
+
+		Assert(list_length(args) == 1);
+		appendStringInfoString(buf, "STATE_WINDOW(");
+		tdengine_deparse_expr((Expr *)linitial(args), context);
+		appendStringInfoChar(buf, ')');
+		return;
+	}
+
+	/* tdengine_event_window(开始条件, 结束条件) 反解析为 EVENT_WINDOW START WITH ... END WITH ... */
+	if (strcmp(proname, "tdengine_event_window") == 0)
+	{
+		if (context->is_tlist)
+			return;
+
+		Assert(list_length(args) == 2);
+		appendStringInfoString(buf, "EVENT_WINDOW START WITH ");
+		tdengine_deparse_expr((Expr *)linitial(args), context);
+		appendStringInfoString(buf, " END WITH ");
+		tdengine_deparse_expr((Expr *)lsecond(args), context);
+		return;
+	}
+
 	if (context->can_skip_cast == true &&
 		(strcmp(proname, "float8") == 0 || strcmp(proname, "numeric") == 0))
 	{
@@ -2506,6 +2836,118 @@ tdengine_deparse_operator_name(StringInfo buf, Form_pg_operator opform, PatternM
 	}
 }
 
+/*
+ * tdengine_deparse_tag_in_list - 将标签列与常量数组的比较反解析为 IN 列表
+ *
+ * 左操作数不是标签列(包括 tbname 伪列)或右操作数不是常量时返回 false，
+ * 由调用者按普通数组操作处理
+ */
+static bool
+tdengine_deparse_tag_in_list(Expr *arg1, Expr *arg2, deparse_expr_cxt *context)
+{
+	StringInfo	buf = context->buf;
+	Var		   *var;
+	Const	   *c;
+	RangeTblEntry *rte;
+	char	   *colname;
+	Oid			elemtype;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	Oid			typoutput;
+	bool		typIsVarlena;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			i;
+	bool		first = true;
+
+	if (IsA(arg1, RelabelType))
+		arg1 = ((RelabelType *) arg1)->arg;
+
+	if (!IsA(arg1, Var) || !IsA(arg2, Const) || ((Const *) arg2)->constisnull)
+		return false;
+
+	var = (Var *) arg1;
+	c = (Const *) arg2;
+
+	rte = planner_rt_fetch(var->varno, context->root);
+	colname = tdengine_get_column_name(rte->relid, var->varattno);
+	if (!tdengine_is_tag_key(colname, rte->relid))
+		return false;
+
+	elemtype = get_element_type(c->consttype);
+	if (!OidIsValid(elemtype))
+		return false;
+
+	get_typlenbyvalalign(elemtype, &elmlen, &elmbyval, &elmalign);
+	getTypeOutputInfo(elemtype, &typoutput, &typIsVarlena);
+	deconstruct_array(DatumGetArrayTypeP(c->constvalue), elemtype,
+					  elmlen, elmbyval, elmalign, &elems, &nulls, &nelems);
+
+	/*
+	 * NaN、Infinity 等非数字取值不能按数字字面量输出，与标量常量的处理一致；
+	 * 在写入 buf 之前检查，含有此类元素时交给调用者按普通数组操作处理
+	 */
+	if (elemtype == FLOAT4OID || elemtype == FLOAT8OID || elemtype == NUMERICOID)
+	{
+		for (i = 0; i < nelems; i++)
+		{
+			char	   *extval;
+
+			if (nulls[i])
+				continue;
+
+			extval = OidOutputFunctionCall(typoutput, elems[i]);
+			if (strspn(extval, "0123456789+-eE.") != strlen(extval))
+				return false;
+		}
+	}
+
+	tdengine_deparse_column_ref(buf, var->varno, var->varattno, var->vartype, context->root, false, false, bms_num_members(context->scanrel->relids) > 1);
+	appendStringInfoString(buf, " IN (");
+
+	for (i = 0; i < nelems; i++)
+	{
+		char	   *extval;
+
+		/* NULL 元素永远不会相等，直接跳过 */
+		if (nulls[i])
+			continue;
+
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		extval = OidOutputFunctionCall(typoutput, elems[i]);
+		switch (elemtype)
+		{
+			case INT2OID:
+			case INT4OID:
+			case INT8OID:
+			case FLOAT4OID:
+			case FLOAT8OID:
+			case NUMERICOID:
+				appendStringInfoString(buf, extval);
+				break;
+			case BOOLOID:
+				appendStringInfoString(buf, strcmp(extval, "t") == 0 ? "true" : "false");
+				break;
+			default:
+				tdengine_deparse_string_literal(buf, extval);
+				break;
+		}
+	}
+
+	/* 所有元素都是 NULL 时条件恒为假 */
+	if (first)
+		appendStringInfoString(buf, "NULL");
+
+	appendStringInfoChar(buf, ')');
+
+	return true;
+}
+
 /*
  * 反解析ScalarArrayOpExpr表达式(数组操作表达式)
  */
@@ -2533,6 +2975,11 @@ tdengine_deparse_scalar_array_op_expr(ScalarArrayOpExpr *node, deparse_expr_cxt
 	arg1 = linitial(node->args); // 第一个参数(左操作数)
 	arg2 = lsecond(node->args);	 // 第二个参数(右操作数)
 
+	/* 标签列上的 = ANY(...) 以 IN 列表下推，TDengine 据此只访问相关的子表 */
+	if (node->useOr && strcmp(opname, "=") == 0 &&
+		tdengine_deparse_tag_in_list(arg1, arg2, context))
+		return;
+
 	/* 根据右操作数类型进行不同处理 */
 	switch (nodeTag((Node *)arg2))
 	{
@@ -2585,7 +3032,7 @@ tdengine_deparse_scalar_array_op_expr(ScalarArrayOpExpr *node, deparse_expr_cxt
 						{
 							Var *var = (Var *)arg1;
 							/* 反解析列引用，不进行类型转换 */
-							tdengine_deparse_column_ref(buf, var->varno,var->varattno, var->vartype,context->root, false, false);
+							tdengine_deparse_column_ref(buf, var->varno,var->varattno, var->vartype,context->root, false, false, bms_num_members(context->scanrel->relids) > 1);
 						}
 						else if (arg1 != NULL && IsA(arg1, CoerceViaIO)) // 类型转换
 						{
@@ -2879,6 +3326,66 @@ tdengine_is_unique_func(Oid funcid, char *in)
 
 	return false;
 }
+/*
+ * 检查表达式是否为按固定长度时间窗口分组的 tdengine_time() 或 tdengine_interval() 函数，
+ * 两者的第二个参数都是窗口长度
+ */
+bool
+tdengine_is_interval_func(Expr *expr)
+{
+	char *proname;
+
+	if (expr == NULL || !IsA(expr, FuncExpr))
+		return false;
+
+	proname = get_func_name(((FuncExpr *)expr)->funcid);
+	return strcmp(proname, "tdengine_time") == 0 ||
+		   strcmp(proname, "tdengine_interval") == 0;
+}
+
+/*
+ * 检查表达式是否为划分窗口的函数，包括时间窗口、会话窗口、状态窗口和事件窗口
+ */
+bool
+tdengine_is_window_func(Expr *expr)
+{
+	char *proname;
+
+	if (tdengine_is_interval_func(expr))
+		return true;
+
+	if (expr == NULL || !IsA(expr, FuncExpr))
+		return false;
+
+	proname = get_func_name(((FuncExpr *)expr)->funcid);
+	return strcmp(proname, "tdengine_session") == 0 ||
+		   strcmp(proname, "tdengine_state_window") == 0 ||
+		   strcmp(proname, "tdengine_event_window") == 0;
+}
+
+/*
+ * 检查表达式是否为关系 rel 中时间类型的时间列
+ */
+bool
+tdengine_is_time_key_expr(PlannerInfo *root, RelOptInfo *rel, Expr *expr)
+{
+	Var *var;
+	char *colname;
+
+	if (expr == NULL || !IsA(expr, Var))
+		return false;
+
+	var = (Var *)expr;
+	if (var->varlevelsup != 0 || var->varattno <= 0 ||
+		!bms_is_member(var->varno, rel->relids) ||
+		!TDENGINE_IS_TIME_TYPE(var->vartype))
+		return false;
+
+	colname = tdengine_get_column_name(planner_rt_fetch(var->varno, root)->relid, var->varattno);
+
+	return TDENGINE_IS_TIME_COLUMN(colname);
+}
+
 /*
  * 检查函数是否为支持的TDengine内置函数
  */
@@ -3002,31 +3509,56 @@ tdengine_append_group_by_clause(List *tlist, deparse_expr_cxt *context)
 	Query *query = context->root->parse; // 查询解析树
 	ListCell *lc;						 // 列表迭代器
 	bool first = true;					 // 标记是否是第一个分组项
+	Expr *interval_expr = NULL;			 // 窗口函数分组项
+	List *group_refs = NIL;				 // 其余分组项的引用编号
 
 	/* 检查查询是否有GROUP BY子句，没有则直接返回 */
 	if (!query->groupClause)
 		return;
 
-	appendStringInfo(buf, " GROUP BY ");
 	Assert(!query->groupingSets);
 
-	context->tdengine_fill_expr = NULL;
+	/* 窗口函数分组项转换为窗口子句，其余分组项单独输出 */
 	foreach (lc, query->groupClause)
 	{
 		SortGroupClause *grp = (SortGroupClause *)lfirst(lc); // 获取当前分组项
+		TargetEntry *tle = get_sortgroupref_tle(grp->tleSortGroupRef, tlist);
+
+		if (interval_expr == NULL && tdengine_is_window_func(tle->expr))
+			interval_expr = tle->expr;
+		else
+			group_refs = lappend_int(group_refs, grp->tleSortGroupRef);
+	}
 
+	/* TDengine 中时间窗口和其他分组列同时使用时，其他分组列需要写在 PARTITION BY 中 */
+	if (group_refs != NIL)
+		appendStringInfoString(buf, interval_expr ? " PARTITION BY " : " GROUP BY ");
+
+	foreach (lc, group_refs)
+	{
 		if (!first)
 			appendStringInfoString(buf, ", ");
 		first = false; // 标记已处理第一个分组项
 
-		tdengine_deparse_sort_group_clause(grp->tleSortGroupRef, tlist, context);
+		tdengine_deparse_sort_group_clause((Index)lfirst_int(lc), tlist, context);
+	}
+
+	context->tdengine_fill_expr = NULL;
+	if (interval_expr)
+	{
+		appendStringInfoChar(buf, ' ');
+		tdengine_deparse_expr(interval_expr, context);
 	}
 
 	if (context->tdengine_fill_expr)
 	{
 		ListCell *arg; // 参数列表迭代器
 
-		appendStringInfo(buf, " fill(");
+		appendStringInfo(buf, " FILL(");
+
+		/* 以数值填充时需要指明 VALUE 模式 */
+		if (strcmp(get_func_name(context->tdengine_fill_expr->funcid), "tdengine_fill_numeric") == 0)
+			appendStringInfoString(buf, "VALUE, ");
 
 		foreach (arg, context->tdengine_fill_expr->args)
 		{
@@ -3064,7 +3596,7 @@ tdengine_append_limit_clause(deparse_expr_cxt *context)
 /*
  * 查找等价类中完全来自指定关系的成员表达式
  */
-static Expr *tdengine_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel)
+Expr *tdengine_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel)
 {
 	ListCell *lc_em; // 等价成员列表迭代器
 
@@ -3105,15 +3637,21 @@ tdengine_append_order_by_clause(List *pathkeys, deparse_expr_cxt *context)
 		Assert(em_expr != NULL); // 必须找到有效表达式
 
 		appendStringInfoString(buf, delim);
-		tdengine_deparse_expr(em_expr, context);
+		/* 按窗口排序即按窗口的起始时间排序 */
+		if (tdengine_is_window_func(em_expr))
+			appendStringInfoString(buf, "_wstart");
+		else
+			tdengine_deparse_expr(em_expr, context);
 
 		if (pathkey->pk_strategy == BTLessStrategyNumber)
 			appendStringInfoString(buf, " ASC"); // 升序
 		else
 			appendStringInfoString(buf, " DESC"); // 降序
 
-		if (pathkey->pk_nulls_first)
-			elog(ERROR, "NULLS FIRST not supported");
+		/* 时间列和窗口不会为空，其他表达式显式指定空值的位置 */
+		if (!tdengine_is_window_func(em_expr) &&
+			!tdengine_is_time_key_expr(context->root, baserel, em_expr))
+			appendStringInfoString(buf, pathkey->pk_nulls_first ? " NULLS FIRST" : " NULLS LAST");
 
 		delim = ", ";
 	}
@@ -3385,7 +3923,7 @@ void tdengine_append_field_key(TupleDesc tupdesc, StringInfo buf, Index rtindex,
 		{
 			if (!first)
 				appendStringInfoString(buf, ", ");
-			tdengine_deparse_column_ref(buf, rtindex, i, -1, root, false, false);
+			tdengine_deparse_column_ref(buf, rtindex, i, -1, root, false, false, false);
 			return;
 		}
 	}
@@ -3407,7 +3945,8 @@ char *tdengine_get_table_name(Relation rel)
 	{
 		DefElem *def = (DefElem *)lfirst(lc);
 
-		if (strcmp(def->defname, "table") == 0)
+		if (strcmp(def->defname, "table") == 0 ||
+			strcmp(def->defname, "stable_name") == 0)
 			relname = defGetString(def);
 	}
 
@@ -3450,23 +3989,8 @@ tdengine_get_column_name(Oid relid, int attnum)
  */
 bool tdengine_is_tag_key(const char *colname, Oid reloid)
 {
-	tdengine_opt *options;
-	ListCell *lc;
-
-	options = tdengine_get_options(reloid, GetUserId());
-
-	if (!options->tags_list)
-		return false;
-
-	foreach (lc, options->tags_list)
-	{
-		char *name = (char *)lfirst(lc);
-
-		if (strcmp(colname, name) == 0)
-			return true;
-	}
-
-	return false;
+	/* 标签列集合按外部表缓存，无需每次重新解析选项 */
+	return tdengine_options_is_tag(reloid, GetUserId(), colname);
 }
 
 /*****************************************************************************
@@ -3918,3 +4442,123 @@ static void tdengine_deparse_slvar(Node *node, Var *var, Const *cnst, deparse_ex
 		}
 	}
 }
+
+/*
+ * tdengine_extract_time_range - 从下推的条件中提取时间列的取值范围
+ *
+ * 只识别 time 列与时间戳常量之间的 <、<=、>、>=、= 比较，多个条件取交集。
+ * 只有同时得到上界和下界时才返回 true。
+ */
+bool
+tdengine_extract_time_range(PlannerInfo *root, RelOptInfo *baserel, List *remote_conds, Timestamp *lower, Timestamp *upper)
+{
+	Oid			relid = planner_rt_fetch(baserel->relid, root)->relid;
+	ListCell   *lc;
+	bool		has_lower = false;
+	bool		has_upper = false;
+
+	foreach(lc, remote_conds)
+	{
+		Expr	   *clause = (Expr *) lfirst(lc);
+		OpExpr	   *op;
+		Node	   *left;
+		Node	   *right;
+		Var		   *var;
+		Const	   *con;
+		char	   *opname;
+		Timestamp	value;
+		bool		var_on_left;
+
+		if (IsA(clause, RestrictInfo))
+			clause = ((RestrictInfo *) clause)->clause;
+
+		if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+			continue;
+
+		op = (OpExpr *) clause;
+		left = (Node *) linitial(op->args);
+		right = (Node *) lsecond(op->args);
+
+		if (IsA(left, RelabelType))
+			left = (Node *) ((RelabelType *) left)->arg;
+		if (IsA(right, RelabelType))
+			right = (Node *) ((RelabelType *) right)->arg;
+
+		if (IsA(left, Var) && IsA(right, Const))
+		{
+			var = (Var *) left;
+			con = (Const *) right;
+			var_on_left = true;
+		}
+		else if (IsA(left, Const) && IsA(right, Var))
+		{
+			var = (Var *) right;
+			con = (Const *) left;
+			var_on_left = false;
+		}
+		else
+			continue;
+
+		if (var->varno != baserel->relid || var->varlevelsup != 0 ||
+			(var->vartype != TIMESTAMPOID && var->vartype != TIMESTAMPTZOID))
+			continue;
+		if (con->constisnull ||
+			(con->consttype != TIMESTAMPOID && con->consttype != TIMESTAMPTZOID))
+			continue;
+		if (strcmp(tdengine_get_column_name(relid, var->varattno), TDENGINE_TIME_COLUMN) != 0)
+			continue;
+
+		value = DatumGetTimestamp(con->constvalue);
+		opname = get_opname(op->opno);
+		if (opname == NULL)
+			continue;
+
+		/* 常量在左侧时交换比较方向 */
+		if (!var_on_left)
+		{
+			if (opname[0] == '<')
+				opname = psprintf(">%s", opname + 1);
+			else if (opname[0] == '>')
+				opname = psprintf("<%s", opname + 1);
+		}
+
+		if (strcmp(opname, ">") == 0 || strcmp(opname, ">=") == 0 || strcmp(opname, "=") == 0)
+		{
+			if (!has_lower || value > *lower)
+				*lower = value;
+			has_lower = true;
+		}
+		if (strcmp(opname, "<") == 0 || strcmp(opname, "<=") == 0 || strcmp(opname, "=") == 0)
+		{
+			if (!has_upper || value < *upper)
+				*upper = value;
+			has_upper = true;
+		}
+	}
+
+	return has_lower && has_upper &&
+		!TIMESTAMP_NOT_FINITE(*lower) && !TIMESTAMP_NOT_FINITE(*upper) &&
+		*lower < *upper;
+}
+
+/*
+ * tdengine_splice_time_condition - 在远程查询的 WHERE 子句末尾追加一个条件
+ *
+ * 参数:
+ *   @query: 反解析得到的远程查询
+ *   @where_end: WHERE 子句(或 FROM 子句)在查询中的结束位置
+ *   @has_where: 查询中是否已有 WHERE 子句
+ *   @cond: 追加的条件
+ */
+char *
+tdengine_splice_time_condition(const char *query, int where_end, bool has_where, const char *cond)
+{
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, query, where_end);
+	appendStringInfo(&buf, has_where ? " AND (%s)" : " WHERE (%s)", cond);
+	appendStringInfoString(&buf, query + where_end);
+
+	return buf.data;
+}
@@ -24,6 +24,10 @@
 #include "utils/guc.h"
 #include "utils/rel.h"
 #include "utils/lsyscache.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
 
 /*
  * 定义有效选项的结构
@@ -42,14 +46,38 @@ static struct TDengineFdwOption valid_options[] = {
     {"host", ForeignServerRelationId},
     {"dbname", ForeignServerRelationId},
     {"port", ForeignServerRelationId},
+    {"fetch_size", ForeignServerRelationId},
+    {"async_capable", ForeignServerRelationId},
+    {"use_remote_estimate", ForeignServerRelationId},
+    {"fdw_startup_cost", ForeignServerRelationId},
+    {"fdw_tuple_cost", ForeignServerRelationId},
+    {"keepalive_idle", ForeignServerRelationId},
+    {"precision", ForeignServerRelationId},
+    {"batch_size", ForeignServerRelationId},
+    {"max_payload_bytes", ForeignServerRelationId},
+    {"pipelined_insert", ForeignServerRelationId},
 
     {"username", UserMappingRelationId},
     {"password", UserMappingRelationId},
 
 	{"table", ForeignTableRelationId},
+	{"stable_name", ForeignTableRelationId},
 	{"column_name", AttributeRelationId},
 	{"tags", ForeignTableRelationId},
 	{"schemaless", ForeignTableRelationId},
+	{"fetch_size", ForeignTableRelationId},
+	{"async_capable", ForeignTableRelationId},
+	{"use_remote_estimate", ForeignTableRelationId},
+	{"precision", ForeignTableRelationId},
+	{"batch_size", ForeignTableRelationId},
+	{"pipelined_insert", ForeignTableRelationId},
+	{"cache_ttl", ForeignTableRelationId},
+	{"tail", ForeignTableRelationId},
+	{"topic", ForeignTableRelationId},
+	{"group_id", ForeignTableRelationId},
+	{"client_id", ForeignTableRelationId},
+	{"poll_timeout", ForeignTableRelationId},
+	{"max_messages", ForeignTableRelationId},
 
 	{"tags", AttributeRelationId},
 	{"fields", AttributeRelationId},
@@ -61,6 +89,45 @@ extern Datum tdengine_fdw_validator(PG_FUNCTION_ARGS);
 PG_FUNCTION_INFO_V1(tdengine_fdw_validator);
 
 bool tdengine_is_valid_option(const char *option, Oid context);
+static List *tdengineExtractTagsList(char *in_string);
+static int tdengine_parse_precision(const char *value);
+static List *tdengine_get_stable_tags(Oid foreigntableid, UserMapping *user, tdengine_opt *opt);
+static void tdengine_stable_tags_inval_callback(Datum arg, Oid relid);
+static tdengine_opt *tdengine_parse_options(Oid foreigntableid, Oid userid);
+static tdengine_opt *tdengine_copy_options(const tdengine_opt *src);
+static void tdengine_options_inval_relcache(Datum arg, Oid relid);
+static void tdengine_options_inval_syscache(Datum arg, int cacheid, uint32 hashvalue);
+
+/*
+ * 超级表标签列缓存条目，标签列通过 DESCRIBE 从超级表的模式中获取
+ */
+typedef struct StableTagsCacheEntry
+{
+    Oid relid;   /* 外部表 OID (哈希键) */
+    List *tags;  /* 标签列名列表，分配在 CacheMemoryContext 中 */
+} StableTagsCacheEntry;
+
+static HTAB *StableTagsHash = NULL;
+
+/*
+ * 解析后的选项缓存，键为外部表 OID 和用户 OID。每个条目有自己的内存上下文，
+ * 失效时整体删除
+ */
+typedef struct OptionsCacheKey
+{
+    Oid relid;
+    Oid userid;
+} OptionsCacheKey;
+
+typedef struct OptionsCacheEntry
+{
+    OptionsCacheKey key;  /* 哈希键 */
+    MemoryContext cxt;    /* 保存 opt 和 tags 的内存上下文 */
+    tdengine_opt *opt;    /* 解析后的选项 */
+    HTAB *tags;           /* 标签列名集合 */
+} OptionsCacheEntry;
+
+static HTAB *OptionsHash = NULL;
 
 Datum tdengine_fdw_validator(PG_FUNCTION_ARGS)
 {
@@ -103,32 +170,172 @@ Datum tdengine_fdw_validator(PG_FUNCTION_ARGS)
                          errmsg("port number must be between 1 and 65535")));
         }
 
-        // TODO: 超级表支持
-		// 校验：是否使用超级表
-        // if (strcmp(def->defname, "using_stable") == 0)
-        // {
-        //     bool using_stable = defGetBoolean(def);
-        //     if (using_stable && catalog == ForeignTableRelationId)
-        //     {
-        //         bool has_stable = false;
-        //         ListCell *lc;
-
-        //         foreach(lc, options_list)
-        //         {
-        //             DefElem *def2 = (DefElem *) lfirst(lc); 
-        //             if (strcmp(def2->defname, "stable_name") == 0)
-        //             {
-        //                 has_stable = true;
-        //                 break;
-        //             }
-        //         }
-                
-        //         if (!has_stable)
-        //             ereport(ERROR,
-        //                     (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
-        //                      errmsg("when using_stable is true, stable_name must be specified")));
-        //     }
-        // }
+        // 校验：流式扫描每批拉取的行数
+        if (strcmp(def->defname, "fetch_size") == 0)
+        {
+            int fetch_size;
+
+            if (!parse_int(defGetString(def), &fetch_size, 0, NULL) || fetch_size <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than zero",
+                                def->defname)));
+        }
+
+        // 校验：连接空闲多久后需要探测，0 表示不探测
+        if (strcmp(def->defname, "keepalive_idle") == 0)
+        {
+            int keepalive_idle;
+
+            if (!parse_int(defGetString(def), &keepalive_idle, GUC_UNIT_S, NULL) || keepalive_idle < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a non-negative number of seconds",
+                                def->defname)));
+            /* 使用时换算为毫秒，不能超出 int 范围 */
+            if (keepalive_idle > PG_INT32_MAX / 1000)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must not exceed %d seconds",
+                                def->defname, PG_INT32_MAX / 1000)));
+        }
+
+        // 校验：批量插入的行数，'auto' 表示按提交的字节数和耗时自动调整
+        if (strcmp(def->defname, "batch_size") == 0)
+        {
+            int batch_size;
+
+            if (pg_strcasecmp(defGetString(def), "auto") != 0 &&
+                (!parse_int(defGetString(def), &batch_size, 0, NULL) || batch_size <= 0))
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than zero or \"auto\"",
+                                def->defname)));
+        }
+
+        // 校验：结果缓存的有效期，0 表示不缓存
+        if (strcmp(def->defname, "cache_ttl") == 0)
+        {
+            int cache_ttl;
+
+            if (!parse_int(defGetString(def), &cache_ttl, GUC_UNIT_S, NULL) || cache_ttl < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a non-negative number of seconds",
+                                def->defname)));
+        }
+
+        // 校验：订阅表拉取消息的等待时间
+        if (strcmp(def->defname, "poll_timeout") == 0)
+        {
+            int poll_timeout;
+
+            if (!parse_int(defGetString(def), &poll_timeout, GUC_UNIT_MS, NULL) || poll_timeout <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a positive number of milliseconds",
+                                def->defname)));
+        }
+
+        // 校验：订阅表每次扫描读取的消息数
+        if (strcmp(def->defname, "max_messages") == 0)
+        {
+            int max_messages;
+
+            if (!parse_int(defGetString(def), &max_messages, 0, NULL) || max_messages <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than zero",
+                                def->defname)));
+        }
+
+        // 校验：单次插入提交的最大字节数
+        if (strcmp(def->defname, "max_payload_bytes") == 0)
+        {
+            int max_payload_bytes;
+
+            if (!parse_int(defGetString(def), &max_payload_bytes, GUC_UNIT_BYTE, NULL) || max_payload_bytes <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a positive number of bytes",
+                                def->defname)));
+        }
+
+        // 校验：时间精度
+        if (strcmp(def->defname, "precision") == 0)
+        {
+            if (tdengine_parse_precision(defGetString(def)) < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be one of \"ms\", \"us\" or \"ns\"",
+                                def->defname)));
+        }
+
+        // 校验：布尔类型的选项
+        if (strcmp(def->defname, "async_capable") == 0 ||
+            strcmp(def->defname, "use_remote_estimate") == 0 ||
+            strcmp(def->defname, "pipelined_insert") == 0 ||
+            strcmp(def->defname, "tail") == 0)
+            (void) defGetBoolean(def);
+
+        // 校验：成本选项必须是非负数
+        if (strcmp(def->defname, "fdw_startup_cost") == 0 ||
+            strcmp(def->defname, "fdw_tuple_cost") == 0)
+        {
+            double cost;
+
+            if (!parse_real(defGetString(def), &cost, 0, NULL) || cost < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a floating point value greater than or equal to zero",
+                                def->defname)));
+        }
+
+        // 校验：超级表名，超级表本身就是远程表，不能同时指定 table 选项
+        if (strcmp(def->defname, "stable_name") == 0)
+        {
+            ListCell *lc;
+
+            if (defGetString(def)[0] == '\0')
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must not be empty", def->defname)));
+
+            foreach(lc, options_list)
+            {
+                DefElem *def2 = (DefElem *) lfirst(lc);
+
+                if (strcmp(def2->defname, "table") == 0)
+                    ereport(ERROR,
+                            (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                             errmsg("options \"stable_name\" and \"table\" cannot be specified together")));
+            }
+        }
+
+        // 校验：订阅的主题，订阅必须属于一个消费组
+        if (strcmp(def->defname, "topic") == 0)
+        {
+            ListCell *lc;
+            bool has_group = false;
+
+            if (defGetString(def)[0] == '\0')
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must not be empty", def->defname)));
+
+            foreach(lc, options_list)
+            {
+                DefElem *def2 = (DefElem *) lfirst(lc);
+
+                if (strcmp(def2->defname, "group_id") == 0 && defGetString(def2)[0] != '\0')
+                    has_group = true;
+            }
+
+            if (!has_group)
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                         errmsg("option \"group_id\" must be specified together with \"topic\"")));
+        }
     }
 
     PG_RETURN_VOID();
@@ -155,12 +362,167 @@ bool tdengine_is_valid_option(const char *option, Oid context)
     return false;
 }
 
+/*
+ * 从缓存中取得外部表的选项条目，不存在时解析选项并加入缓存
+ */
+static OptionsCacheEntry *
+tdengine_get_options_entry(Oid foreigntableid, Oid userid)
+{
+    OptionsCacheKey key;
+    OptionsCacheEntry *entry;
+    MemoryContext cxt;
+    MemoryContext oldcontext;
+    tdengine_opt *opt;
+    HASHCTL tagctl;
+    ListCell *lc;
+    bool found;
+
+    if (OptionsHash == NULL)
+    {
+        HASHCTL ctl;
+
+        ctl.keysize = sizeof(OptionsCacheKey);
+        ctl.entrysize = sizeof(OptionsCacheEntry);
+        OptionsHash = hash_create("tdengine_fdw options", 64,
+                                  &ctl, HASH_ELEM | HASH_BLOBS);
+
+        /* 外部表、服务器和用户映射的选项变化时都需要重新解析 */
+        CacheRegisterRelcacheCallback(tdengine_options_inval_relcache, (Datum) 0);
+        CacheRegisterSyscacheCallback(FOREIGNSERVEROID, tdengine_options_inval_syscache, (Datum) 0);
+        CacheRegisterSyscacheCallback(USERMAPPINGOID, tdengine_options_inval_syscache, (Datum) 0);
+        CacheRegisterSyscacheCallback(FOREIGNTABLEREL, tdengine_options_inval_syscache, (Datum) 0);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.relid = foreigntableid;
+    key.userid = userid;
+
+    entry = (OptionsCacheEntry *) hash_search(OptionsHash, &key, HASH_FIND, NULL);
+    if (entry != NULL)
+        return entry;
+
+    /* 先在条目自己的上下文中解析，出错时只需删除上下文 */
+    cxt = AllocSetContextCreate(CacheMemoryContext, "tdengine_fdw options", ALLOCSET_SMALL_SIZES);
+    PG_TRY();
+    {
+        tdengine_opt *parsed = tdengine_parse_options(foreigntableid, userid);
+
+        oldcontext = MemoryContextSwitchTo(cxt);
+        opt = tdengine_copy_options(parsed);
+        MemoryContextSwitchTo(oldcontext);
+    }
+    PG_CATCH();
+    {
+        MemoryContextDelete(cxt);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    memset(&tagctl, 0, sizeof(tagctl));
+    tagctl.keysize = NAMEDATALEN;
+    tagctl.entrysize = NAMEDATALEN;
+    tagctl.hcxt = cxt;
+
+    entry = (OptionsCacheEntry *) hash_search(OptionsHash, &key, HASH_ENTER, &found);
+    entry->cxt = cxt;
+    entry->opt = opt;
+    entry->tags = hash_create("tdengine_fdw tag names", Max(list_length(opt->tags_list), 8),
+                              &tagctl, HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+    foreach(lc, opt->tags_list)
+        (void) hash_search(entry->tags, (char *) lfirst(lc), HASH_ENTER, NULL);
+
+    return entry;
+}
+
 /*
  * 获取TDengine外部表的配置选项
  *
+ * 选项按外部表和用户缓存，返回的是缓存的副本，调用方可以修改
+ *
  * @foreigntableid 外部表的OID
  */
 tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
+{
+    return tdengine_copy_options(tdengine_get_options_entry(foreigntableid, userid)->opt);
+}
+
+/*
+ * tdengine_options_is_tag - 列是否为外部表的标签列，使用缓存的标签列集合
+ */
+bool tdengine_options_is_tag(Oid foreigntableid, Oid userid, const char *colname)
+{
+    OptionsCacheEntry *entry = tdengine_get_options_entry(foreigntableid, userid);
+
+    if (strlen(colname) >= NAMEDATALEN)
+        return false;
+
+    return hash_search(entry->tags, colname, HASH_FIND, NULL) != NULL;
+}
+
+/*
+ * 在当前内存上下文中深拷贝选项
+ */
+static tdengine_opt *
+tdengine_copy_options(const tdengine_opt *src)
+{
+    tdengine_opt *opt = (tdengine_opt *) palloc(sizeof(tdengine_opt));
+    ListCell *lc;
+
+    *opt = *src;
+    opt->driver = src->driver ? pstrdup(src->driver) : NULL;
+    opt->protocol = src->protocol ? pstrdup(src->protocol) : NULL;
+    opt->svr_database = src->svr_database ? pstrdup(src->svr_database) : NULL;
+    opt->svr_table = src->svr_table ? pstrdup(src->svr_table) : NULL;
+    opt->svr_address = src->svr_address ? pstrdup(src->svr_address) : NULL;
+    opt->svr_username = src->svr_username ? pstrdup(src->svr_username) : NULL;
+    opt->svr_password = src->svr_password ? pstrdup(src->svr_password) : NULL;
+    opt->stable_name = src->stable_name ? pstrdup(src->stable_name) : NULL;
+    opt->topic = src->topic ? pstrdup(src->topic) : NULL;
+    opt->group_id = src->group_id ? pstrdup(src->group_id) : NULL;
+    opt->client_id = src->client_id ? pstrdup(src->client_id) : NULL;
+
+    opt->tags_list = NIL;
+    foreach(lc, src->tags_list)
+        opt->tags_list = lappend(opt->tags_list, pstrdup((char *) lfirst(lc)));
+
+    return opt;
+}
+
+/*
+ * 外部表定义变化时丢弃其缓存的选项
+ */
+static void
+tdengine_options_inval_relcache(Datum arg, Oid relid)
+{
+    HASH_SEQ_STATUS scan;
+    OptionsCacheEntry *entry;
+
+    hash_seq_init(&scan, OptionsHash);
+    while ((entry = (OptionsCacheEntry *) hash_seq_search(&scan)))
+    {
+        if (relid == InvalidOid || entry->key.relid == relid)
+        {
+            MemoryContextDelete(entry->cxt);
+            hash_search(OptionsHash, &entry->key, HASH_REMOVE, NULL);
+        }
+    }
+}
+
+/*
+ * 服务器、用户映射或外部表选项变化时丢弃所有缓存的选项，这类变化很少发生
+ */
+static void
+tdengine_options_inval_syscache(Datum arg, int cacheid, uint32 hashvalue)
+{
+    tdengine_options_inval_relcache(arg, InvalidOid);
+}
+
+/*
+ * 解析TDengine外部表的配置选项
+ *
+ * @foreigntableid 外部表的OID
+ */
+static tdengine_opt *tdengine_parse_options(Oid foreigntableid, Oid userid)
 {
     /* 声明变量 */
     ForeignTable *f_table;
@@ -169,9 +531,20 @@ tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
     List *options;
     ListCell *lc;
     tdengine_opt *opt;
+    bool async_capable_set = false;
+    bool use_remote_estimate_set = false;
+    bool precision_set = false;
+    bool pipelined_insert_set = false;
 
     /* 分配并初始化选项结构体 */
     opt = (tdengine_opt *) palloc0(sizeof(tdengine_opt));
+    opt->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+    opt->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
+    opt->keepalive_idle = DEFAULT_KEEPALIVE_IDLE;
+    opt->precision = TDENGINE_PRECISION_MS;
+    opt->max_payload_bytes = DEFAULT_MAX_PAYLOAD_BYTES;
+    opt->poll_timeout = DEFAULT_TMQ_POLL_TIMEOUT;
+    opt->max_messages = DEFAULT_TMQ_MAX_MESSAGES;
 
     /* 
      * 尝试获取外部表和服务器信息
@@ -190,7 +563,7 @@ tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
     PG_END_TRY();
     
     /* 获取用户映射信息 */
-    f_mapping = GetUserMapping(GetUserId(), f_server->serverid);
+    f_mapping = GetUserMapping(userid, f_server->serverid);
 
     /* 合并所有选项 */
     options = NIL;
@@ -232,6 +605,10 @@ tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
         if (strcmp(def->defname, "table_name") == 0)
             opt->svr_table = defGetString(def);
 
+        /* 超级表名选项 */
+        if (strcmp(def->defname, "stable_name") == 0)
+            opt->stable_name = defGetString(def);
+
         /* Tags列表选项 */
         if (strcmp(def->defname, "tags") == 0)
             opt->tags_list = tdengineExtractTagsList(defGetString(def));
@@ -239,8 +616,78 @@ tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
         /* 无模式选项 */
         if (strcmp(def->defname, "schemaless") == 0)
             opt->schemaless = defGetBoolean(def);
+
+        /* 流式扫描批大小选项，表选项排在前面，因此优先于服务器选项 */
+        if (strcmp(def->defname, "fetch_size") == 0 && opt->fetch_size == 0)
+            (void) parse_int(defGetString(def), &opt->fetch_size, 0, NULL);
+
+        /* 异步执行选项，同样以表选项优先 */
+        if (strcmp(def->defname, "async_capable") == 0 && !async_capable_set)
+        {
+            opt->async_capable = defGetBoolean(def);
+            async_capable_set = true;
+        }
+
+        /* 远程估算选项，同样以表选项优先 */
+        if (strcmp(def->defname, "use_remote_estimate") == 0 && !use_remote_estimate_set)
+        {
+            opt->use_remote_estimate = defGetBoolean(def);
+            use_remote_estimate_set = true;
+        }
+
+        /* 成本选项 */
+        if (strcmp(def->defname, "fdw_startup_cost") == 0)
+            (void) parse_real(defGetString(def), &opt->fdw_startup_cost, 0, NULL);
+        if (strcmp(def->defname, "fdw_tuple_cost") == 0)
+            (void) parse_real(defGetString(def), &opt->fdw_tuple_cost, 0, NULL);
+
+        /* 连接空闲探测间隔 */
+        if (strcmp(def->defname, "keepalive_idle") == 0)
+            (void) parse_int(defGetString(def), &opt->keepalive_idle, GUC_UNIT_S, NULL);
+
+        /* 流水线插入选项，以表选项优先 */
+        if (strcmp(def->defname, "pipelined_insert") == 0 && !pipelined_insert_set)
+        {
+            opt->pipelined_insert = defGetBoolean(def);
+            pipelined_insert_set = true;
+        }
+
+        /* 增量扫描选项，只能在外部表上设置 */
+        if (strcmp(def->defname, "tail") == 0)
+            opt->tail = defGetBoolean(def);
+
+        /* 订阅表选项，只能在外部表上设置 */
+        if (strcmp(def->defname, "topic") == 0)
+            opt->topic = defGetString(def);
+        if (strcmp(def->defname, "group_id") == 0)
+            opt->group_id = defGetString(def);
+        if (strcmp(def->defname, "client_id") == 0)
+            opt->client_id = defGetString(def);
+        if (strcmp(def->defname, "poll_timeout") == 0)
+            (void) parse_int(defGetString(def), &opt->poll_timeout, GUC_UNIT_MS, NULL);
+        if (strcmp(def->defname, "max_messages") == 0)
+            (void) parse_int(defGetString(def), &opt->max_messages, 0, NULL);
+
+        /* 结果缓存的有效期 */
+        if (strcmp(def->defname, "cache_ttl") == 0)
+            (void) parse_int(defGetString(def), &opt->cache_ttl, GUC_UNIT_S, NULL);
+
+        /* 单次插入提交的最大字节数 */
+        if (strcmp(def->defname, "max_payload_bytes") == 0)
+            (void) parse_int(defGetString(def), &opt->max_payload_bytes, GUC_UNIT_BYTE, NULL);
+
+        /* 时间精度，以表选项优先 */
+        if (strcmp(def->defname, "precision") == 0 && !precision_set)
+        {
+            opt->precision = tdengine_parse_precision(defGetString(def));
+            precision_set = true;
+        }
     }
 
+    /* 超级表作为远程表 */
+    if (opt->stable_name)
+        opt->svr_table = opt->stable_name;
+
     /* 如果没有显式设置表名，使用PostgreSQL中的表名 */
     if (!opt->svr_table && f_table)
         opt->svr_table = get_rel_name(foreigntableid);
@@ -263,9 +710,79 @@ tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid)
     if (!opt->svr_port)
         opt->svr_port = 6041;  /* TDengine REST API默认端口 */
 
+    if (opt->fetch_size <= 0)
+        opt->fetch_size = DEFAULT_FETCH_SIZE;
+
+    /* 超级表没有显式指定 tags 时，从超级表的模式中获取标签列 */
+    if (opt->stable_name && opt->tags_list == NIL && f_table)
+        opt->tags_list = tdengine_get_stable_tags(foreigntableid, f_mapping, opt);
+
     return opt;
 }
 
+/*
+ * tdengine_get_stable_tags - 获取超级表的标签列，包括 tbname 伪列
+ *
+ * 结果按外部表缓存在当前后端中，外部表定义变化时失效
+ */
+static List *
+tdengine_get_stable_tags(Oid foreigntableid, UserMapping *user, tdengine_opt *opt)
+{
+    StableTagsCacheEntry *entry;
+    bool found;
+
+    if (StableTagsHash == NULL)
+    {
+        HASHCTL ctl;
+
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(StableTagsCacheEntry);
+        StableTagsHash = hash_create("tdengine_fdw stable tags", 16,
+                                     &ctl, HASH_ELEM | HASH_BLOBS);
+
+        CacheRegisterRelcacheCallback(tdengine_stable_tags_inval_callback, (Datum) 0);
+    }
+
+    entry = (StableTagsCacheEntry *) hash_search(StableTagsHash, &foreigntableid, HASH_FIND, &found);
+    if (!found)
+    {
+        List *tags = TDengineDescribeTags(user, opt, opt->stable_name);
+        List *cached = NIL;
+        MemoryContext oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+        ListCell *lc;
+
+        foreach(lc, tags)
+            cached = lappend(cached, pstrdup((char *) lfirst(lc)));
+        cached = lappend(cached, pstrdup(TDENGINE_TBNAME_COLUMN));
+        MemoryContextSwitchTo(oldcontext);
+
+        entry = (StableTagsCacheEntry *) hash_search(StableTagsHash, &foreigntableid, HASH_ENTER, &found);
+        entry->tags = cached;
+    }
+
+    return entry->tags;
+}
+
+/*
+ * 外部表定义变化时丢弃缓存的标签列
+ */
+static void
+tdengine_stable_tags_inval_callback(Datum arg, Oid relid)
+{
+    HASH_SEQ_STATUS scan;
+    StableTagsCacheEntry *entry;
+
+    hash_seq_init(&scan, StableTagsHash);
+    while ((entry = (StableTagsCacheEntry *) hash_seq_search(&scan)))
+    {
+        if (relid == InvalidOid || entry->relid == relid)
+        {
+            list_free_deep(entry->tags);
+            hash_search(StableTagsHash, &entry->relid, HASH_REMOVE, NULL);
+        }
+    }
+}
+
 /*
  * tdengineExtractTagsList: 解析逗号分隔的字符串并返回标签键列表
  *   @in_string: 输入的逗号分隔的标签字符串
@@ -283,3 +800,18 @@ static List *tdengineExtractTagsList(char *in_string)
 
     return tags_list;
 }
+
+/*
+ * tdengine_parse_precision: 将时间精度选项解析为 TDENGINE_PRECISION_*，无效时返回 -1
+ *   @value: 选项值，"ms"、"us" 或 "ns"
+ */
+static int tdengine_parse_precision(const char *value)
+{
+    if (pg_strcasecmp(value, "ms") == 0)
+        return TDENGINE_PRECISION_MS;
+    if (pg_strcasecmp(value, "us") == 0)
+        return TDENGINE_PRECISION_US;
+    if (pg_strcasecmp(value, "ns") == 0)
+        return TDENGINE_PRECISION_NS;
+    return -1;
+}
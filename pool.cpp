@@ -0,0 +1,971 @@
+extern "C" {
+#include "postgres.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shmem.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+}
+
+#include "pool.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+ * 共享连接池
+ *
+ * 启用 tdengine_fdw.pool_size 后，postmaster 启动固定数量的后台进程，每个
+ * 后台进程占用一个槽位并持有自己的 TDengine 连接。后端执行查询时租用一个
+ * 空闲槽位，通过槽位上的两个 shm_mq 发送查询并接收结果，查询结束后归还
+ * 槽位。连接由后台进程长期持有，新后端的第一个查询无需重新建立连接，远程
+ * 连接数也只取决于 pool_size 而与 max_connections 无关。
+ *
+ * 每个槽位一次只服务一个查询。结果以消息的形式传递:
+ *   'H' 结果头: int32 列数, int32 时间精度, 每列 uint8 类型和以 0 结尾的列名
+ *   'D' 数据: int32 行数, 每个值为 uint8 空值标志, 非空时跟 uint8 类型、
+ *       uint32 长度和原始字节
+ *   'C' 结果已读完
+ *   'E' 错误: int32 错误码和以 0 结尾的错误信息
+ */
+
+/* 池中最多的后台进程数 */
+#define TDENGINE_POOL_MAX_SIZE 64
+
+/* 每个消息队列的大小，超过的消息由 shm_mq 分段传递 */
+#define TDENGINE_POOL_QUEUE_SIZE (64 * 1024)
+
+/* 每个后台进程缓存的连接数，按最近使用淘汰 */
+#define TDENGINE_POOL_MAX_CONNS 4
+
+#define TDENGINE_POOL_MSG_HEADER 'H'
+#define TDENGINE_POOL_MSG_DATA 'D'
+#define TDENGINE_POOL_MSG_COMPLETE 'C'
+#define TDENGINE_POOL_MSG_ERROR 'E'
+
+typedef enum TDenginePoolSlotState
+{
+    TDENGINE_POOL_SLOT_IDLE,      /* 空闲 */
+    TDENGINE_POOL_SLOT_LEASED,    /* 已被后端租用，队列正在初始化 */
+    TDENGINE_POOL_SLOT_SUBMITTED, /* 队列已就绪，等待后台进程处理 */
+    TDENGINE_POOL_SLOT_RUNNING    /* 后台进程正在执行查询 */
+} TDenginePoolSlotState;
+
+typedef struct TDenginePoolSlot
+{
+    PGPROC *worker;               /* 负责该槽位的后台进程，尚未启动时为 NULL */
+    TDenginePoolSlotState state;
+    int refcount;                 /* 仍在使用队列的进程数，为 0 时槽位空闲 */
+} TDenginePoolSlot;
+
+typedef struct TDenginePoolShared
+{
+    LWLock *lock;                 /* 保护所有槽位的状态 */
+    ConditionVariable slot_cv;    /* 槽位归还时唤醒等待的后端 */
+    int nslots;
+    TDenginePoolSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} TDenginePoolShared;
+
+/* 后端中正在执行的池化查询 */
+struct TDenginePoolQuery
+{
+    int slotno;                   /* 租用的槽位，-1 表示已归还 */
+    PGPROC *worker;               /* 租用时负责该槽位的后台进程 */
+    shm_mq_handle *outq;          /* 发送查询的队列 */
+    shm_mq_handle *inq;           /* 接收结果的队列 */
+    std::vector<std::string> names; /* 结果列名 */
+    int ncol;
+    bool done;                    /* 是否已收到结果结束消息 */
+
+    const char *pos;              /* 当前数据消息中下一行的位置 */
+    int rows_left;                /* 当前数据消息中剩余的行数 */
+
+    /* 当前行的各列，定长值复制到对齐的位置后再返回 */
+    std::vector<const void *> values;
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> lens;
+    std::vector<uint64_t> fixed;
+};
+
+/* 后台进程中缓存的连接 */
+typedef struct TDenginePoolConn
+{
+    char *dsn;
+    WS_TAOS *conn;
+    uint64 last_used;
+} TDenginePoolConn;
+
+static int tdengine_pool_size = 0;
+static TDenginePoolShared *TDenginePool = NULL;
+
+/* 当前后端租用中的槽位数，游标关闭前一直占用 */
+static int pool_slots_held = 0;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static TDenginePoolConn worker_conns[TDENGINE_POOL_MAX_CONNS];
+static uint64 worker_use_counter = 0;
+static int worker_slotno = -1;
+static bool worker_serving = false;    /* 是否持有槽位的引用 */
+static shm_mq_handle *worker_inq = NULL;
+static shm_mq_handle *worker_outq = NULL;
+
+static Size tdengine_pool_shmem_size(void);
+static void tdengine_pool_shmem_request(void);
+static void tdengine_pool_shmem_startup(void);
+static shm_mq *tdengine_pool_queue(int slotno, bool request);
+static void tdengine_pool_release_slot(int slotno);
+static void tdengine_pool_check_worker(TDenginePoolQuery *query);
+static void tdengine_pool_wait(TDenginePoolQuery *query);
+static void tdengine_pool_receive(TDenginePoolQuery *query, Size *nbytes, void **data);
+static int tdengine_pool_fixed_size(uint8_t type);
+static void tdengine_pool_worker_exit(int code, Datum arg);
+static void tdengine_pool_serve(MemoryContext request_cxt);
+static WS_TAOS *tdengine_pool_worker_connect(const char *dsn, StringInfo err);
+static void tdengine_pool_worker_disconnect(WS_TAOS *conn);
+static bool tdengine_pool_worker_send(StringInfo msg);
+static void tdengine_pool_worker_send_error(int code, const char *errstr);
+
+/*
+ * tdengine_pool_init - 注册连接池的配置参数、共享内存和后台进程
+ *
+ * 只有通过 shared_preload_libraries 加载且 pool_size 大于 0 时才启用连接池
+ */
+void
+tdengine_pool_init(void)
+{
+    int i;
+
+    DefineCustomIntVariable("tdengine_fdw.pool_size",
+                            "Number of TDengine connections shared by all backends.",
+                            "Zero disables the shared pool and every backend opens its own connections. "
+                            "Requires tdengine_fdw in shared_preload_libraries.",
+                            &tdengine_pool_size,
+                            0, 0, TDENGINE_POOL_MAX_SIZE,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress || tdengine_pool_size == 0)
+        return;
+
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = tdengine_pool_shmem_request;
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = tdengine_pool_shmem_startup;
+
+    for (i = 0; i < tdengine_pool_size; i++)
+    {
+        BackgroundWorker worker;
+
+        memset(&worker, 0, sizeof(worker));
+        worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+        worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+        worker.bgw_restart_time = 10;
+        snprintf(worker.bgw_library_name, BGW_MAXLEN, "tdengine_fdw");
+        snprintf(worker.bgw_function_name, BGW_MAXLEN, "tdengine_pool_worker_main");
+        snprintf(worker.bgw_name, BGW_MAXLEN, "tdengine_fdw pool worker %d", i);
+        snprintf(worker.bgw_type, BGW_MAXLEN, "tdengine_fdw pool worker");
+        worker.bgw_main_arg = Int32GetDatum(i);
+        RegisterBackgroundWorker(&worker);
+    }
+}
+
+/*
+ * 共享内存布局: 槽位数组之后依次是每个槽位的请求队列和结果队列
+ */
+static Size
+tdengine_pool_shmem_size(void)
+{
+    Size size = offsetof(TDenginePoolShared, slots);
+
+    size = add_size(size, mul_size(tdengine_pool_size, sizeof(TDenginePoolSlot)));
+    size = MAXALIGN(size);
+    size = add_size(size, mul_size(tdengine_pool_size, 2 * TDENGINE_POOL_QUEUE_SIZE));
+
+    return size;
+}
+
+static void
+tdengine_pool_shmem_request(void)
+{
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+
+    RequestAddinShmemSpace(tdengine_pool_shmem_size());
+    RequestNamedLWLockTranche("tdengine_fdw pool", 1);
+}
+
+static void
+tdengine_pool_shmem_startup(void)
+{
+    bool found;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    TDenginePool = (TDenginePoolShared *) ShmemInitStruct("tdengine_fdw pool", tdengine_pool_shmem_size(), &found);
+    if (!found)
+    {
+        int i;
+
+        TDenginePool->lock = &(GetNamedLWLockTranche("tdengine_fdw pool"))->lock;
+        ConditionVariableInit(&TDenginePool->slot_cv);
+        TDenginePool->nslots = tdengine_pool_size;
+        for (i = 0; i < tdengine_pool_size; i++)
+        {
+            TDenginePool->slots[i].worker = NULL;
+            TDenginePool->slots[i].state = TDENGINE_POOL_SLOT_IDLE;
+            TDenginePool->slots[i].refcount = 0;
+        }
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * 返回槽位的请求队列或结果队列
+ */
+static shm_mq *
+tdengine_pool_queue(int slotno, bool request)
+{
+    char *base = (char *) TDenginePool +
+        MAXALIGN(offsetof(TDenginePoolShared, slots) + TDenginePool->nslots * sizeof(TDenginePoolSlot));
+
+    base += (Size) slotno * 2 * TDENGINE_POOL_QUEUE_SIZE;
+    if (!request)
+        base += TDENGINE_POOL_QUEUE_SIZE;
+
+    return (shm_mq *) base;
+}
+
+/*
+ * 使用队列的一方结束后调用，双方都结束后槽位才能被再次租用
+ */
+static void
+tdengine_pool_release_slot(int slotno)
+{
+    TDenginePoolSlot *slot = &TDenginePool->slots[slotno];
+
+    LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+    if (--slot->refcount <= 0)
+    {
+        slot->refcount = 0;
+        slot->state = TDENGINE_POOL_SLOT_IDLE;
+    }
+    LWLockRelease(TDenginePool->lock);
+
+    ConditionVariableBroadcast(&TDenginePool->slot_cv);
+}
+
+/*
+ * 定长类型的字节数，变长类型返回 -1
+ */
+static int
+tdengine_pool_fixed_size(uint8_t type)
+{
+    switch (type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+        case TSDB_DATA_TYPE_TINYINT:
+        case TSDB_DATA_TYPE_UTINYINT:
+            return 1;
+        case TSDB_DATA_TYPE_SMALLINT:
+        case TSDB_DATA_TYPE_USMALLINT:
+            return 2;
+        case TSDB_DATA_TYPE_INT:
+        case TSDB_DATA_TYPE_UINT:
+        case TSDB_DATA_TYPE_FLOAT:
+            return 4;
+        case TSDB_DATA_TYPE_BIGINT:
+        case TSDB_DATA_TYPE_UBIGINT:
+        case TSDB_DATA_TYPE_TIMESTAMP:
+        case TSDB_DATA_TYPE_DOUBLE:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * tdengine_pool_enabled - 当前后端是否使用共享连接池
+ */
+bool
+tdengine_pool_enabled(void)
+{
+    return TDenginePool != NULL;
+}
+
+/*
+ * tdengine_pool_begin - 租用一个空闲槽位，没有空闲槽位时等待
+ *
+ * 结果按需拉取，游标关闭前一直占用槽位。当前后端已经占用槽位时（嵌套循环、
+ * 多个子节点的 Append、重新扫描的内侧扫描）只有它自己能归还槽位，等待可能
+ * 永远阻塞，此时报错。不改用本后端自己的连接，远程连接数严格受 pool_size 限制
+ */
+TDenginePoolQuery *
+tdengine_pool_begin(void)
+{
+    TDenginePoolQuery *query;
+    int slotno = -1;
+
+    Assert(tdengine_pool_enabled());
+
+    for (;;)
+    {
+        int i;
+
+        LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+        for (i = 0; i < TDenginePool->nslots; i++)
+        {
+            TDenginePoolSlot *slot = &TDenginePool->slots[i];
+
+            if (slot->worker != NULL && slot->state == TDENGINE_POOL_SLOT_IDLE)
+            {
+                slot->state = TDENGINE_POOL_SLOT_LEASED;
+                slot->refcount = 2;
+                slotno = i;
+                break;
+            }
+        }
+        LWLockRelease(TDenginePool->lock);
+
+        if (slotno >= 0)
+            break;
+
+        if (pool_slots_held > 0)
+        {
+            ConditionVariableCancelSleep();
+            ereport(ERROR,
+                    (errcode(ERRCODE_TOO_MANY_CONNECTIONS),
+                     errmsg("tdengine_fdw : no idle connection pool slot while this query holds %d", pool_slots_held),
+                     errhint("Increase tdengine_fdw.pool_size to at least the number of foreign scans open at once in one query.")));
+        }
+
+        ConditionVariableSleep(&TDenginePool->slot_cv, PG_WAIT_EXTENSION);
+    }
+    ConditionVariableCancelSleep();
+    pool_slots_held++;
+
+    query = new TDenginePoolQuery();
+    query->slotno = slotno;
+    query->worker = TDenginePool->slots[slotno].worker;
+    query->outq = NULL;
+    query->inq = NULL;
+    query->ncol = 0;
+    query->done = false;
+    query->pos = NULL;
+    query->rows_left = 0;
+
+    return query;
+}
+
+/*
+ * tdengine_pool_send - 初始化槽位的队列并把查询发送给后台进程
+ */
+void
+tdengine_pool_send(TDenginePoolQuery *query, const char *dsn, const char *sql)
+{
+    TDenginePoolSlot *slot = &TDenginePool->slots[query->slotno];
+    shm_mq *req = tdengine_pool_queue(query->slotno, true);
+    shm_mq *resp = tdengine_pool_queue(query->slotno, false);
+    MemoryContext oldcontext;
+    StringInfoData msg;
+    shm_mq_result res;
+
+    /* 双方的角色都由后端设置，后台进程只需挂接 */
+    req = shm_mq_create(req, TDENGINE_POOL_QUEUE_SIZE);
+    resp = shm_mq_create(resp, TDENGINE_POOL_QUEUE_SIZE);
+    shm_mq_set_sender(req, MyProc);
+    shm_mq_set_receiver(req, slot->worker);
+    shm_mq_set_sender(resp, slot->worker);
+    shm_mq_set_receiver(resp, MyProc);
+
+    /* 队列句柄的生命周期与游标相同，不能分配在会被重置的上下文中 */
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    query->outq = shm_mq_attach(req, NULL, NULL);
+    query->inq = shm_mq_attach(resp, NULL, NULL);
+    MemoryContextSwitchTo(oldcontext);
+
+    /* 查询可能比队列大，必须先唤醒后台进程再发送 */
+    LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+    slot->state = TDENGINE_POOL_SLOT_SUBMITTED;
+    LWLockRelease(TDenginePool->lock);
+    SetLatch(&slot->worker->procLatch);
+
+    initStringInfo(&msg);
+    appendBinaryStringInfo(&msg, dsn, strlen(dsn) + 1);
+    appendBinaryStringInfo(&msg, sql, strlen(sql) + 1);
+
+    /* 不阻塞地发送，等待期间检查后台进程是否仍在运行 */
+    while ((res = shm_mq_send(query->outq, msg.len, msg.data, true, true)) == SHM_MQ_WOULD_BLOCK)
+        tdengine_pool_wait(query);
+    pfree(msg.data);
+
+    if (res != SHM_MQ_SUCCESS)
+        elog(ERROR, "tdengine_fdw : could not send query to connection pool worker");
+}
+
+/*
+ * 租用时的后台进程已经退出时报错
+ *
+ * 池中的后台进程在 postmaster 启动时静态注册，后端拿不到它们的
+ * BackgroundWorkerHandle，无法交给 shm_mq_attach() 检测对方退出。后台进程
+ * 退出时会清除槽位上的进程，这里据此判断
+ */
+static void
+tdengine_pool_check_worker(TDenginePoolQuery *query)
+{
+    TDenginePoolSlot *slot = &TDenginePool->slots[query->slotno];
+    bool alive;
+
+    LWLockAcquire(TDenginePool->lock, LW_SHARED);
+    alive = (slot->worker == query->worker);
+    LWLockRelease(TDenginePool->lock);
+
+    if (!alive)
+        elog(ERROR, "tdengine_fdw : connection pool worker terminated unexpectedly");
+}
+
+/*
+ * 队列暂时不可读写时等待，期间定期检查后台进程并响应中断
+ */
+static void
+tdengine_pool_wait(TDenginePoolQuery *query)
+{
+    tdengine_pool_check_worker(query);
+
+    (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, 1000L, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * 从结果队列接收一条消息，后台进程退出时报错而不是一直等待
+ */
+static void
+tdengine_pool_receive(TDenginePoolQuery *query, Size *nbytes, void **data)
+{
+    shm_mq_result res;
+
+    while ((res = shm_mq_receive(query->inq, nbytes, data, true)) == SHM_MQ_WOULD_BLOCK)
+        tdengine_pool_wait(query);
+
+    if (res != SHM_MQ_SUCCESS)
+        elog(ERROR, "tdengine_fdw : connection pool worker terminated unexpectedly");
+}
+
+/*
+ * tdengine_pool_read_header - 等待查询执行完成并读取结果头
+ */
+void
+tdengine_pool_read_header(TDenginePoolQuery *query, int *ncol, int *precision)
+{
+    Size nbytes;
+    void *data;
+    const char *p;
+    int i;
+
+    tdengine_pool_receive(query, &nbytes, &data);
+
+    p = (const char *) data;
+    if (*p == TDENGINE_POOL_MSG_ERROR)
+    {
+        int32 code;
+
+        memcpy(&code, p + 1, sizeof(int32));
+        elog(ERROR, "tdengine_fdw : %s (error code: %d)", p + 1 + sizeof(int32), code);
+    }
+
+    Assert(*p == TDENGINE_POOL_MSG_HEADER);
+    p++;
+
+    memcpy(ncol, p, sizeof(int32));
+    p += sizeof(int32);
+    memcpy(precision, p, sizeof(int32));
+    p += sizeof(int32);
+
+    query->ncol = *ncol;
+    for (i = 0; i < *ncol; i++)
+    {
+        p++;                    /* 列类型，每个值都带有类型，这里不需要 */
+        query->names.push_back(std::string(p));
+        p += strlen(p) + 1;
+    }
+
+    query->values.resize(*ncol);
+    query->types.resize(*ncol);
+    query->lens.resize(*ncol);
+    query->fixed.resize(*ncol);
+}
+
+/*
+ * 返回结果列名
+ */
+const char *
+tdengine_pool_column_name(TDenginePoolQuery *query, int col)
+{
+    return query->names[col].c_str();
+}
+
+/*
+ * tdengine_pool_next_row - 移动到结果的下一行，没有更多行时返回 false
+ *
+ * 行中变长值指向队列中的消息，在下一次调用前有效
+ */
+bool
+tdengine_pool_next_row(TDenginePoolQuery *query)
+{
+    int i;
+
+    while (query->rows_left == 0)
+    {
+        Size nbytes;
+        void *data;
+        const char *p;
+
+        if (query->done)
+            return false;
+
+        tdengine_pool_receive(query, &nbytes, &data);
+
+        p = (const char *) data;
+        if (*p == TDENGINE_POOL_MSG_COMPLETE)
+        {
+            query->done = true;
+            return false;
+        }
+        if (*p == TDENGINE_POOL_MSG_ERROR)
+        {
+            int32 code;
+
+            memcpy(&code, p + 1, sizeof(int32));
+            elog(ERROR, "tdengine_fdw : could not fetch result block: %s (error code: %d)",
+                 p + 1 + sizeof(int32), code);
+        }
+
+        Assert(*p == TDENGINE_POOL_MSG_DATA);
+        memcpy(&query->rows_left, p + 1, sizeof(int32));
+        query->pos = p + 1 + sizeof(int32);
+    }
+
+    for (i = 0; i < query->ncol; i++)
+    {
+        const char *p = query->pos;
+
+        if (*p++ != 0)
+        {
+            query->values[i] = NULL;
+            query->types[i] = 0;
+            query->lens[i] = 0;
+        }
+        else
+        {
+            uint32_t len;
+
+            query->types[i] = (uint8_t) *p++;
+            memcpy(&len, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+
+            query->lens[i] = len;
+            if (tdengine_pool_fixed_size(query->types[i]) > 0)
+            {
+                /* 消息中的值没有对齐 */
+                query->fixed[i] = 0;
+                memcpy(&query->fixed[i], p, len);
+                query->values[i] = &query->fixed[i];
+            }
+            else
+                query->values[i] = p;
+            p += len;
+        }
+
+        query->pos = p;
+    }
+
+    query->rows_left--;
+    return true;
+}
+
+/*
+ * 返回当前行中一列的值，与 ws_get_value_in_block() 的约定相同，空值返回 NULL
+ */
+const void *
+tdengine_pool_get_value(TDenginePoolQuery *query, int col, uint8_t *type, uint32_t *len)
+{
+    *type = query->types[col];
+    *len = query->lens[col];
+    return query->values[col];
+}
+
+/*
+ * tdengine_pool_close - 断开队列并归还槽位
+ *
+ * 结果未读完时后台进程在发送下一条消息时发现队列已断开，随即释放结果
+ */
+void
+tdengine_pool_close(TDenginePoolQuery *query)
+{
+    if (query == NULL)
+        return;
+
+    if (query->outq)
+        shm_mq_detach(query->outq);
+    if (query->inq)
+        shm_mq_detach(query->inq);
+
+    if (query->slotno >= 0)
+    {
+        /* 队列尚未初始化时后台进程不会参与，需要替它归还 */
+        if (query->outq == NULL)
+            tdengine_pool_release_slot(query->slotno);
+        tdengine_pool_release_slot(query->slotno);
+        pool_slots_held--;
+    }
+
+    delete query;
+}
+
+/*
+ * 后台进程退出时断开队列并归还正在服务的槽位
+ */
+static void
+tdengine_pool_worker_exit(int code, Datum arg)
+{
+    int i;
+
+    if (TDenginePool != NULL && worker_slotno >= 0)
+    {
+        TDenginePoolSlot *slot = &TDenginePool->slots[worker_slotno];
+        bool serving;
+
+        LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+        slot->worker = NULL;
+        if (slot->state == TDENGINE_POOL_SLOT_SUBMITTED)
+        {
+            slot->state = TDENGINE_POOL_SLOT_RUNNING;
+            worker_serving = true;
+        }
+        serving = worker_serving;
+        LWLockRelease(TDenginePool->lock);
+
+        /* 已提交但尚未处理的查询也要断开队列，否则后端会一直等待 */
+        if (serving && worker_inq == NULL)
+        {
+            worker_inq = shm_mq_attach(tdengine_pool_queue(worker_slotno, true), NULL, NULL);
+            worker_outq = shm_mq_attach(tdengine_pool_queue(worker_slotno, false), NULL, NULL);
+        }
+
+        if (worker_outq)
+            shm_mq_detach(worker_outq);
+        if (worker_inq)
+            shm_mq_detach(worker_inq);
+        worker_outq = worker_inq = NULL;
+
+        if (serving)
+            tdengine_pool_release_slot(worker_slotno);
+    }
+
+    for (i = 0; i < TDENGINE_POOL_MAX_CONNS; i++)
+    {
+        if (worker_conns[i].conn)
+            ws_close(worker_conns[i].conn);
+        worker_conns[i].conn = NULL;
+    }
+}
+
+/*
+ * tdengine_pool_worker_main - 连接池后台进程的入口
+ */
+void
+tdengine_pool_worker_main(Datum main_arg)
+{
+    TDenginePoolSlot *slot;
+    MemoryContext request_cxt;
+
+    worker_slotno = DatumGetInt32(main_arg);
+
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    slot = &TDenginePool->slots[worker_slotno];
+    before_shmem_exit(tdengine_pool_worker_exit, (Datum) 0);
+
+    request_cxt = AllocSetContextCreate(TopMemoryContext, "tdengine_fdw pool request", ALLOCSET_DEFAULT_SIZES);
+
+    LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+    slot->worker = MyProc;
+    LWLockRelease(TDenginePool->lock);
+    ConditionVariableBroadcast(&TDenginePool->slot_cv);
+
+    for (;;)
+    {
+        bool submitted = false;
+
+        CHECK_FOR_INTERRUPTS();
+
+        LWLockAcquire(TDenginePool->lock, LW_EXCLUSIVE);
+        if (slot->state == TDENGINE_POOL_SLOT_SUBMITTED)
+        {
+            slot->state = TDENGINE_POOL_SLOT_RUNNING;
+            worker_serving = submitted = true;
+        }
+        LWLockRelease(TDenginePool->lock);
+
+        if (submitted)
+        {
+            tdengine_pool_serve(request_cxt);
+            worker_serving = false;
+            tdengine_pool_release_slot(worker_slotno);
+            continue;
+        }
+
+        (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, -1L, PG_WAIT_EXTENSION);
+        ResetLatch(MyLatch);
+    }
+}
+
+/*
+ * 执行槽位上的一个查询，把结果按数据块发送给后端
+ */
+static void
+tdengine_pool_serve(MemoryContext request_cxt)
+{
+    MemoryContext oldcontext = MemoryContextSwitchTo(request_cxt);
+    StringInfoData msg;
+    StringInfoData err;
+    Size nbytes;
+    void *data;
+    char *dsn;
+    char *sql;
+    WS_TAOS *conn;
+    WS_RES *res;
+    int code;
+    int ncol;
+    int i;
+
+    worker_inq = shm_mq_attach(tdengine_pool_queue(worker_slotno, true), NULL, NULL);
+    worker_outq = shm_mq_attach(tdengine_pool_queue(worker_slotno, false), NULL, NULL);
+
+    if (shm_mq_receive(worker_inq, &nbytes, &data, false) != SHM_MQ_SUCCESS)
+        goto done;
+
+    dsn = pstrdup((char *) data);
+    sql = pstrdup((char *) data + strlen(dsn) + 1);
+
+    initStringInfo(&err);
+    conn = tdengine_pool_worker_connect(dsn, &err);
+    if (conn == NULL)
+    {
+        tdengine_pool_worker_send_error(ws_errno(NULL), err.data);
+        goto done;
+    }
+
+    res = ws_query(conn, sql);
+    code = ws_errno(res);
+
+    /* 与后端中的游标相同，只读查询遇到连接级错误时重新连接并重试一次 */
+    if (code != 0 && tdengine_is_connection_error(code) && tdengine_is_read_only_query(sql))
+    {
+        ws_free_result(res);
+        tdengine_pool_worker_disconnect(conn);
+
+        conn = tdengine_pool_worker_connect(dsn, &err);
+        if (conn == NULL)
+        {
+            tdengine_pool_worker_send_error(ws_errno(NULL), err.data);
+            goto done;
+        }
+
+        res = ws_query(conn, sql);
+        code = ws_errno(res);
+    }
+
+    if (code != 0)
+    {
+        tdengine_pool_worker_send_error(code, ws_errstr(res));
+        ws_free_result(res);
+        goto done;
+    }
+
+    /* 结果头 */
+    ncol = ws_field_count(res);
+    {
+        const WS_FIELD *fields = ws_fetch_fields(res);
+        int32 n = ncol;
+        int32 precision = ws_result_precision(res);
+
+        initStringInfo(&msg);
+        appendStringInfoChar(&msg, TDENGINE_POOL_MSG_HEADER);
+        appendBinaryStringInfo(&msg, (const char *) &n, sizeof(int32));
+        appendBinaryStringInfo(&msg, (const char *) &precision, sizeof(int32));
+        for (i = 0; i < ncol; i++)
+        {
+            appendStringInfoChar(&msg, (char) fields[i].type);
+            appendBinaryStringInfo(&msg, fields[i].name, strlen(fields[i].name) + 1);
+        }
+    }
+
+    /* 每个数据块作为一条消息发送，后端断开队列后停止 */
+    for (;;)
+    {
+        const void *block = NULL;
+        int32_t rows = 0;
+        int32 r;
+
+        if (!tdengine_pool_worker_send(&msg))
+            break;
+
+        code = ws_fetch_raw_block(res, &block, &rows);
+        if (code != 0)
+        {
+            tdengine_pool_worker_send_error(code, ws_errstr(res));
+            break;
+        }
+
+        resetStringInfo(&msg);
+        if (rows == 0)
+        {
+            appendStringInfoChar(&msg, TDENGINE_POOL_MSG_COMPLETE);
+            (void) tdengine_pool_worker_send(&msg);
+            break;
+        }
+
+        appendStringInfoChar(&msg, TDENGINE_POOL_MSG_DATA);
+        appendBinaryStringInfo(&msg, (const char *) &rows, sizeof(int32));
+        for (r = 0; r < rows; r++)
+        {
+            for (i = 0; i < ncol; i++)
+            {
+                uint8_t type = 0;
+                uint32_t len = 0;
+                const void *value = ws_get_value_in_block(res, r, i, &type, &len);
+                int fixed;
+
+                if (value == NULL)
+                {
+                    appendStringInfoChar(&msg, 1);
+                    continue;
+                }
+
+                fixed = tdengine_pool_fixed_size(type);
+                if (fixed > 0)
+                    len = fixed;
+
+                appendStringInfoChar(&msg, 0);
+                appendStringInfoChar(&msg, (char) type);
+                appendBinaryStringInfo(&msg, (const char *) &len, sizeof(uint32_t));
+                appendBinaryStringInfo(&msg, (const char *) value, len);
+            }
+        }
+    }
+
+    ws_free_result(res);
+
+done:
+    shm_mq_detach(worker_outq);
+    shm_mq_detach(worker_inq);
+    worker_outq = worker_inq = NULL;
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextReset(request_cxt);
+}
+
+/*
+ * 取得 DSN 对应的连接，缓存已满时关闭最久未使用的连接
+ */
+static WS_TAOS *
+tdengine_pool_worker_connect(const char *dsn, StringInfo err)
+{
+    TDenginePoolConn *victim = &worker_conns[0];
+    int i;
+
+    for (i = 0; i < TDENGINE_POOL_MAX_CONNS; i++)
+    {
+        TDenginePoolConn *entry = &worker_conns[i];
+
+        if (entry->conn != NULL && strcmp(entry->dsn, dsn) == 0)
+        {
+            entry->last_used = ++worker_use_counter;
+            return entry->conn;
+        }
+
+        if (entry->conn == NULL)
+            victim = entry;
+        else if (victim->conn != NULL && entry->last_used < victim->last_used)
+            victim = entry;
+    }
+
+    if (victim->conn != NULL)
+    {
+        ws_close(victim->conn);
+        victim->conn = NULL;
+        pfree(victim->dsn);
+    }
+
+    victim->conn = ws_connect(dsn);
+    if (victim->conn == NULL)
+    {
+        appendStringInfo(err, "could not connect to TDengine: %s", ws_errstr(NULL));
+        return NULL;
+    }
+
+    victim->dsn = MemoryContextStrdup(TopMemoryContext, dsn);
+    victim->last_used = ++worker_use_counter;
+
+    return victim->conn;
+}
+
+/*
+ * 关闭并移除缓存中的一个连接
+ */
+static void
+tdengine_pool_worker_disconnect(WS_TAOS *conn)
+{
+    int i;
+
+    for (i = 0; i < TDENGINE_POOL_MAX_CONNS; i++)
+    {
+        if (worker_conns[i].conn == conn)
+        {
+            ws_close(conn);
+            worker_conns[i].conn = NULL;
+            pfree(worker_conns[i].dsn);
+            return;
+        }
+    }
+}
+
+/*
+ * 向后端发送一条消息，后端已断开时返回 false
+ */
+static bool
+tdengine_pool_worker_send(StringInfo msg)
+{
+    return shm_mq_send(worker_outq, msg->len, msg->data, false, true) == SHM_MQ_SUCCESS;
+}
+
+static void
+tdengine_pool_worker_send_error(int code, const char *errstr)
+{
+    StringInfoData msg;
+    int32 c = code;
+
+    initStringInfo(&msg);
+    appendStringInfoChar(&msg, TDENGINE_POOL_MSG_ERROR);
+    appendBinaryStringInfo(&msg, (const char *) &c, sizeof(int32));
+    appendBinaryStringInfo(&msg, errstr, strlen(errstr) + 1);
+    (void) tdengine_pool_worker_send(&msg);
+}
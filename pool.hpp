@@ -0,0 +1,25 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include "connection.hpp"
+
+/* 通过共享连接池执行的一个查询，定义在 pool.cpp 中 */
+struct TDenginePoolQuery;
+
+extern bool tdengine_pool_enabled(void);
+
+extern TDenginePoolQuery* tdengine_pool_begin(void);
+
+extern void tdengine_pool_send(TDenginePoolQuery *query, const char *dsn, const char *sql);
+
+extern void tdengine_pool_read_header(TDenginePoolQuery *query, int *ncol, int *precision);
+
+extern const char* tdengine_pool_column_name(TDenginePoolQuery *query, int col);
+
+extern bool tdengine_pool_next_row(TDenginePoolQuery *query);
+
+extern const void* tdengine_pool_get_value(TDenginePoolQuery *query, int col, uint8_t *type, uint32_t *len);
+
+extern void tdengine_pool_close(TDenginePoolQuery *query);
+
+#endif /* POOL_HPP */
@@ -0,0 +1,1779 @@
+extern "C" {
+#include "postgres.h"
+#include "access/xact.h"
+#include "lib/stringinfo.h"
+#include "utils/builtins.h"
+#include "utils/datetime.h"
+#include "utils/float.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+}
+
+#include "cache.hpp"
+#include "connection.hpp"
+#include "pool.hpp"
+#include "tmq.hpp"
+
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+/* 每个后端缓存的远程预处理查询语句个数，0 表示不缓存 */
+static int tdengine_stmt_cache_size = 32;
+
+/*
+ * 缓存的远程预处理查询语句，按 (连接, 查询) 查找
+ *
+ * 带参数的查询（嵌套循环的内侧、反复执行的预备语句）每次重新扫描只有参数
+ * 值不同，准备一次后只需重新绑定参数，远程不再重复解析和规划查询文本
+ */
+struct TDengineStmtCacheEntry
+{
+    WS_STMT2 *stmt;             /* 已准备好的语句，远程无法准备时为 NULL */
+    WS_TAOS *conn;              /* 准备语句时所用的连接，连接关闭后为 NULL */
+    std::string query;          /* 反解析得到的查询，参数以 $n 表示 */
+    std::vector<int> param_order; /* 按出现顺序，每个 ? 占位符对应的参数序号（从 0 开始） */
+    int precision;              /* 远程数据库的时间精度，时间参数按该精度绑定 */
+    bool in_use;                /* 是否有游标正在读取该语句的结果 */
+
+    struct TDengineStmtCacheEntry *prev; /* LRU 链表，表头为最近使用的语句 */
+    struct TDengineStmtCacheEntry *next;
+};
+
+static TDengineStmtCacheEntry *stmt_cache_head = NULL;
+static TDengineStmtCacheEntry *stmt_cache_tail = NULL;
+static int stmt_cache_count = 0;
+
+/*
+ * 流式查询游标，按需从 TDengine 拉取数据块
+ */
+struct TDengineCursor
+{
+    WS_RES *res;                /* 远程查询结果句柄 */
+    WS_TAOS *conn;              /* 执行查询的本后端连接，结果未释放前不能关闭；使用连接池时为 NULL */
+    bool own_conn;              /* conn 是否为异步查询独占的连接，关闭游标时一并关闭 */
+    int ncol;                   /* 结果列数 */
+    const WS_FIELD *fields;     /* 结果列描述 */
+    int precision;              /* 结果中时间戳的精度 */
+    int32_t block_rows;         /* 当前数据块中的行数 */
+    int32_t block_pos;          /* 当前数据块中下一行的位置 */
+    bool eof;                   /* 是否已读完所有数据块 */
+    TDengineAsyncQuery *pending; /* 尚未完成的异步查询，同步打开时为 NULL */
+    TDenginePoolQuery *pooled;  /* 通过共享连接池执行的查询，未启用连接池时为 NULL */
+    bool header_read;           /* 是否已读取池化查询的结果头 */
+    TDengineStmtCacheEntry *cached; /* 结果来自缓存的预处理语句时为该语句，结果随语句释放 */
+
+    /* 共享结果缓存 */
+    bool replaying;             /* 结果来自共享缓存，不访问远程 */
+    bool recording;             /* 读取结果的同时记录下来，读完后存入缓存 */
+    std::string cache_data;     /* 命中的缓存结果，或正在记录的各行 */
+    size_t replay_pos;          /* 缓存结果中下一个值的位置 */
+    std::vector<std::string> names; /* 缓存结果的列名 */
+    std::vector<uint64_t> fixed;    /* 从缓存结果中读取的短值，复制到对齐的位置后返回 */
+    TDengineCacheScan cache_scan;
+    uint64 cache_generations[TDENGINE_CACHE_MAX_RELS]; /* 未命中时所读各表的失效代数 */
+
+    /* 订阅表 */
+    TDengineTmqConsumer *consumer; /* 读取消息的消费者，不是订阅表时为 NULL */
+    int messages;               /* 已读取的消息数 */
+
+    std::string sql;            /* 发送的查询，用于连接断开后重试 */
+    UserMapping *user;
+    tdengine_opt *options;
+    int nest_level;             /* 打开游标时的子事务层级 */
+
+    struct TDengineCursor *prev; /* 已打开游标链表 */
+    struct TDengineCursor *next;
+};
+
+/* 当前后端中所有已打开的游标，用于事务中止时释放结果句柄 */
+static TDengineCursor *open_cursors = NULL;
+
+/* 正在提交的一列数据，从调用者的绑定数组复制而来 */
+struct TDengineBindBuffer
+{
+    std::vector<char> values;
+    std::vector<int32_t> lengths;
+    std::vector<char> is_null;
+};
+
+/*
+ * 插入用的参数绑定语句，同一次 INSERT 的各批次复用同一个语句
+ *
+ * 开启 pipelined_insert 时每批数据在后台线程中提交，提交前参数数组被复制到
+ * 语句自身的缓冲区中，调用者可以立即重用自己的缓冲区准备下一批。后台线程
+ * 不调用任何 PostgreSQL 函数。未开启时在当前线程中同步提交
+ */
+struct TDengineInsertStmt
+{
+    WS_STMT *stmt;              /* 已准备好的语句，尚未准备时为 NULL */
+    WS_TAOS *conn;              /* 准备语句时所用的连接 */
+    bool own_conn;              /* conn 是否为语句独占的连接，关闭语句时一并关闭 */
+    std::string sql;            /* 带 ? 占位符的插入语句 */
+    std::vector<int> field_types; /* 准备后由服务器返回的各占位符对应列的类型 */
+    int precision;              /* 远程数据库的时间精度，取自时间列 */
+    UserMapping *user;
+    tdengine_opt *options;
+
+    /* 正在提交的一批数据 */
+    bool in_flight;             /* 是否有尚未等待的提交 */
+    std::thread worker;         /* 执行提交的线程 */
+    std::vector<TDengineBindBuffer> buffers;
+    std::vector<WS_MULTI_BIND> binds;
+    int nrow;                   /* 本批的行数 */
+    int code;                   /* 提交结果，线程结束后有效 */
+    std::string errmsg;
+    int32_t affected_rows;
+    double elapsed_ms;          /* 提交的耗时 */
+    int nest_level;             /* 准备语句时的子事务层级 */
+
+    struct TDengineInsertStmt *prev; /* 已打开语句链表 */
+    struct TDengineInsertStmt *next;
+};
+
+/* 当前后端中所有已打开的插入语句，用于事务中止时释放 */
+static TDengineInsertStmt *open_insert_stmts = NULL;
+
+static char *tdengine_bind_query_params(const char *query, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, int param_num);
+static void tdengine_append_param_literal(StringInfo buf, TDengineType type, TDengineValue *value);
+static void tdengine_read_cell(uint8_t type, const void *value, uint32_t len, TDengineCell *cell);
+static TDengineCursor *tdengine_cursor_new(const char *sql, UserMapping *user, tdengine_opt *options);
+static void tdengine_cursor_attach_result(TDengineCursor *cursor, WS_RES *res);
+static bool tdengine_cursor_next_message(TDengineCursor *cursor);
+static void tdengine_cursor_replay(TDengineCursor *cursor);
+static const void *tdengine_cursor_replay_value(TDengineCursor *cursor, int col, uint8_t *type, uint32_t *len);
+static void tdengine_cursor_record_value(TDengineCursor *cursor, const void *value, uint8_t type, uint32_t len);
+static void tdengine_cursor_store_result(TDengineCursor *cursor);
+static TDengineStmtCacheEntry *tdengine_stmt_cache_lookup(WS_TAOS *conn, const char *query, int param_num);
+static void tdengine_stmt_cache_unlink(TDengineStmtCacheEntry *entry);
+static void tdengine_stmt_cache_release(TDengineStmtCacheEntry *entry);
+static WS_RES *tdengine_stmt_cache_execute(TDengineStmtCacheEntry *entry, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values);
+static int tdengine_database_precision(WS_TAOS *conn);
+
+/*
+ * TDengineCursorOpen - 发送查询并返回一个尚未拉取任何数据的游标
+ *
+ * async 为 true 时查询在后台线程中执行，函数立即返回，可以通过
+ * TDengineCursorWaitFd() 等待查询完成；第一次拉取数据时会等待查询结束。
+ *
+ * 参数:
+ *   @query: 反解析得到的远程查询，参数以 $n 表示
+ *   @user: 用户映射
+ *   @options: 连接选项
+ *   @param_tdengine_types/@param_tdengine_values: 已绑定的参数
+ *   @param_num: 参数个数
+ *   @async: 是否异步执行查询
+ *   @cache: 使用共享结果缓存时为所读外部表的缓存设置，否则为 NULL
+ */
+TDengineCursor *
+TDengineCursorOpen(char *query, UserMapping *user, tdengine_opt *options, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, int param_num, bool async, const TDengineCacheScan *cache)
+{
+    char *sql = query;
+    TDengineCursor *cursor;
+    TDengineStmtCacheEntry *entry = NULL;
+    bool use_cache = (cache != NULL && cache->ttl > 0 && tdengine_result_cache_enabled());
+
+    /*
+     * 本函数中的调用可能 elog(ERROR)，longjmp 不会执行 C++ 对象的析构函数，
+     * 因此不使用 std::string 等局部对象：缓存结果直接读入游标，游标已登记在
+     * 已打开游标链表中，出错时由事务中止回调释放
+     */
+
+    /* 结果缓存以绑定参数后的查询文本为键，命中时不访问远程 */
+    if (use_cache)
+    {
+        if (param_num > 0)
+            sql = tdengine_bind_query_params(query, param_tdengine_types, param_tdengine_values, param_num);
+
+        cursor = tdengine_cursor_new(sql, user, options);
+        if (tdengine_result_cache_lookup(user->serverid, user->userid, sql, cache, cursor->cache_generations, &cursor->cache_data))
+        {
+            elog(DEBUG1, "tdengine_fdw : open cursor (cached): %s", sql);
+            tdengine_cursor_replay(cursor);
+            return cursor;
+        }
+
+        /* 未命中时记录读到的结果，读完后存入缓存 */
+        cursor->recording = true;
+        cursor->cache_scan = *cache;
+    }
+
+    /*
+     * 同步执行的带参数查询优先使用缓存的预处理语句，只发送参数值。
+     * 共享连接池中的连接不属于当前后端，不缓存语句
+     */
+    if (param_num > 0 && !async && tdengine_stmt_cache_size > 0 && !tdengine_pool_enabled())
+        entry = tdengine_stmt_cache_lookup(tdengine_get_connection(user, options), query, param_num);
+
+    if (!use_cache)
+    {
+        if (entry == NULL && param_num > 0)
+            sql = tdengine_bind_query_params(query, param_tdengine_types, param_tdengine_values, param_num);
+        cursor = tdengine_cursor_new(sql, user, options);
+    }
+
+    elog(DEBUG1, "tdengine_fdw : open cursor%s: %s",
+         entry ? " (prepared)" : async ? " (async)" : "", sql);
+
+    /*
+     * 使用共享连接池时查询由后台进程执行，发送后立即返回，
+     * 第一次拉取数据时再等待结果，因此同样可以与其他扫描重叠执行
+     */
+    if (tdengine_pool_enabled())
+    {
+        char dsn[TDENGINE_DSN_LEN];
+
+        cursor->pooled = tdengine_pool_begin();
+        tdengine_build_dsn(options, dsn, sizeof(dsn));
+        tdengine_pool_send(cursor->pooled, dsn, sql);
+        return cursor;
+    }
+
+    if (entry != NULL)
+    {
+        WS_RES *res = tdengine_stmt_cache_execute(entry, param_tdengine_types, param_tdengine_values);
+
+        if (res != NULL)
+        {
+            cursor->res = res;
+            cursor->conn = entry->conn;
+            cursor->ncol = ws_field_count(res);
+            cursor->fields = ws_fetch_fields(res);
+            cursor->precision = ws_result_precision(res);
+            cursor->cached = entry;
+            entry->in_use = true;
+            return cursor;
+        }
+
+        /* 执行失败时丢弃该语句，改为发送查询文本，连接错误由下面的重试处理 */
+        tdengine_stmt_cache_unlink(entry);
+        tdengine_stmt_cache_release(entry);
+        cursor->sql = tdengine_bind_query_params(query, param_tdengine_types, param_tdengine_values, param_num);
+    }
+
+    /*
+     * 异步查询在后台线程中使用连接，后端主线程同时可能在缓存的连接上执行
+     * 其他查询，因此为其单独建立连接，关闭游标时关闭
+     */
+    if (async)
+    {
+        char dsn[TDENGINE_DSN_LEN];
+
+        tdengine_build_dsn(options, dsn, sizeof(dsn));
+        cursor->conn = create_tdengine_connection(dsn);
+        cursor->own_conn = true;
+        cursor->pending = tdengine_submit_query(cursor->conn, cursor->sql.c_str());
+    }
+    else
+    {
+        cursor->conn = tdengine_get_connection(user, options);
+        tdengine_cursor_attach_result(cursor, ws_query(cursor->conn, cursor->sql.c_str()));
+    }
+
+    return cursor;
+}
+
+/*
+ * 从读入 cache_data 的缓存结果中读取结果头，之后的拉取从缓存结果中返回各行
+ */
+static void
+tdengine_cursor_replay(TDengineCursor *cursor)
+{
+    const char *p;
+    int32 ncol;
+    int32 precision;
+    int i;
+
+    p = cursor->cache_data.data();
+
+    memcpy(&ncol, p, sizeof(int32));
+    p += sizeof(int32);
+    memcpy(&precision, p, sizeof(int32));
+    p += sizeof(int32);
+
+    for (i = 0; i < ncol; i++)
+    {
+        cursor->names.push_back(p);
+        p += strlen(p) + 1;
+    }
+
+    cursor->ncol = ncol;
+    cursor->precision = precision;
+    cursor->fixed.resize(ncol);
+    cursor->replay_pos = p - cursor->cache_data.data();
+    cursor->replaying = true;
+}
+
+/*
+ * 从缓存结果中读取下一个值，与 ws_get_value_in_block() 的约定相同，空值返回 NULL
+ */
+static const void *
+tdengine_cursor_replay_value(TDengineCursor *cursor, int col, uint8_t *type, uint32_t *len)
+{
+    const char *p = cursor->cache_data.data() + cursor->replay_pos;
+    const void *value;
+
+    *type = 0;
+    *len = 0;
+    if (*p++ == 0)
+    {
+        cursor->replay_pos++;
+        return NULL;
+    }
+
+    *type = (uint8_t) *p++;
+    memcpy(len, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+
+    /* 缓存结果中的值没有对齐 */
+    if (*len <= sizeof(uint64_t))
+    {
+        cursor->fixed[col] = 0;
+        memcpy(&cursor->fixed[col], p, *len);
+        value = &cursor->fixed[col];
+    }
+    else
+        value = p;
+
+    cursor->replay_pos = (p + *len) - cursor->cache_data.data();
+    return value;
+}
+
+/*
+ * 将读到的一个值追加到记录的结果中，结果超过单个条目的上限时放弃记录
+ */
+static void
+tdengine_cursor_record_value(TDengineCursor *cursor, const void *value, uint8_t type, uint32_t len)
+{
+    if (value == NULL)
+        cursor->cache_data.push_back(0);
+    else
+    {
+        cursor->cache_data.push_back(1);
+        cursor->cache_data.push_back((char) type);
+        cursor->cache_data.append((const char *) &len, sizeof(uint32_t));
+        cursor->cache_data.append((const char *) value, len);
+    }
+
+    if (cursor->cache_data.size() > tdengine_result_cache_max_entry())
+    {
+        cursor->recording = false;
+        std::string().swap(cursor->cache_data);
+    }
+}
+
+/*
+ * 结果读完后加上结果头存入共享缓存
+ */
+static void
+tdengine_cursor_store_result(TDengineCursor *cursor)
+{
+    StringInfoData header;
+    int32 ncol = cursor->ncol;
+    int32 precision = cursor->precision;
+    int i;
+
+    /* 存入缓存可能 elog(ERROR)，结果头先写入 palloc 的缓冲区，不使用 std::string 局部对象 */
+    initStringInfo(&header);
+    appendBinaryStringInfo(&header, (const char *) &ncol, sizeof(int32));
+    appendBinaryStringInfo(&header, (const char *) &precision, sizeof(int32));
+    for (i = 0; i < cursor->ncol; i++)
+    {
+        const char *name = cursor->pooled ? tdengine_pool_column_name(cursor->pooled, i) : cursor->fields[i].name;
+
+        appendBinaryStringInfo(&header, name, strlen(name) + 1);
+    }
+    cursor->cache_data.insert(0, header.data, header.len);
+    pfree(header.data);
+
+    tdengine_result_cache_store(cursor->user->serverid, cursor->user->userid, cursor->sql.c_str(), &cursor->cache_scan, cursor->cache_generations, cursor->cache_data);
+
+    cursor->recording = false;
+    std::string().swap(cursor->cache_data);
+}
+
+/*
+ * 创建游标并登记到已打开游标链表
+ */
+static TDengineCursor *
+tdengine_cursor_new(const char *sql, UserMapping *user, tdengine_opt *options)
+{
+    TDengineCursor *cursor = new TDengineCursor();
+
+    cursor->res = NULL;
+    cursor->conn = NULL;
+    cursor->own_conn = false;
+    cursor->ncol = 0;
+    cursor->fields = NULL;
+    cursor->precision = TDENGINE_PRECISION_MS;
+    cursor->block_rows = 0;
+    cursor->block_pos = 0;
+    cursor->eof = false;
+    cursor->pending = NULL;
+    cursor->pooled = NULL;
+    cursor->header_read = false;
+    cursor->cached = NULL;
+    cursor->replaying = false;
+    cursor->recording = false;
+    cursor->replay_pos = 0;
+    cursor->consumer = NULL;
+    cursor->messages = 0;
+    cursor->sql = sql;
+    cursor->user = user;
+    cursor->options = options;
+    cursor->nest_level = GetCurrentTransactionNestLevel();
+
+    /* 先登记到已打开游标链表，查询出错时由事务中止回调释放 */
+    cursor->prev = NULL;
+    cursor->next = open_cursors;
+    if (open_cursors)
+        open_cursors->prev = cursor;
+    open_cursors = cursor;
+
+    return cursor;
+}
+
+/*
+ * TDengineCursorOpenTopic - 打开读取订阅表新消息的游标
+ *
+ * 游标依次拉取消息，读完 options->max_messages 条消息或等待
+ * options->poll_timeout 毫秒仍没有新消息时结束。第一条消息在打开时拉取，
+ * 以便得到结果列。读过的消息在事务结束时确认或放弃，见 tmq.cpp
+ */
+TDengineCursor *
+TDengineCursorOpenTopic(UserMapping *user, tdengine_opt *options)
+{
+    TDengineTmqConsumer *consumer = tdengine_tmq_get_consumer(user, options);
+    TDengineCursor *cursor;
+
+    elog(DEBUG1, "tdengine_fdw : open cursor (topic): %s", options->topic);
+
+    cursor = tdengine_cursor_new(options->topic, user, options);
+    cursor->consumer = consumer;
+    if (!tdengine_cursor_next_message(cursor))
+        cursor->eof = true;
+
+    return cursor;
+}
+
+/*
+ * 释放订阅游标的当前消息并拉取下一条，没有更多消息时返回 false
+ */
+static bool
+tdengine_cursor_next_message(TDengineCursor *cursor)
+{
+    WS_RES *res;
+
+    if (cursor->res != NULL)
+    {
+        ws_free_result(cursor->res);
+        cursor->res = NULL;
+    }
+
+    if (cursor->messages >= cursor->options->max_messages)
+        return false;
+
+    res = tdengine_tmq_poll(cursor->consumer, cursor->options->poll_timeout);
+    if (res == NULL)
+        return false;
+
+    /* 各条消息来自同一主题的查询，结果列相同 */
+    cursor->messages++;
+    cursor->res = res;
+    cursor->ncol = ws_field_count(res);
+    cursor->fields = ws_fetch_fields(res);
+    cursor->precision = ws_result_precision(res);
+    cursor->block_rows = 0;
+    cursor->block_pos = 0;
+
+    return true;
+}
+
+/*
+ * 检查查询结果，无错误时将其关联到游标上
+ *
+ * 只读查询因连接级错误失败时重新连接并重试一次，避免长期存在的后端
+ * 因连接被服务器或负载均衡器断开而报错
+ */
+static void
+tdengine_cursor_attach_result(TDengineCursor *cursor, WS_RES *res)
+{
+    int code = ws_errno(res);
+
+    if (code != 0 && tdengine_is_connection_error(code) &&
+        tdengine_is_read_only_query(cursor->sql.c_str()))
+    {
+        WS_TAOS *conn = tdengine_reset_connection(cursor->user, cursor->options);
+
+        if (conn != NULL)
+        {
+            elog(DEBUG1, "tdengine_fdw : retrying query after connection error: %s (error code: %d)",
+                 ws_errstr(res), code);
+            ws_free_result(res);
+            /* 异步查询独占的连接已不可用，重试改用缓存的连接 */
+            if (cursor->own_conn)
+            {
+                ws_close(cursor->conn);
+                cursor->own_conn = false;
+            }
+            cursor->conn = conn;
+            res = ws_query(conn, cursor->sql.c_str());
+            code = ws_errno(res);
+        }
+    }
+
+    if (code != 0)
+    {
+        char *err = pstrdup(ws_errstr(res));
+
+        ws_free_result(res);
+        elog(ERROR, "tdengine_fdw : %s (error code: %d)", err, code);
+    }
+
+    cursor->res = res;
+    cursor->ncol = ws_field_count(res);
+    cursor->fields = ws_fetch_fields(res);
+    cursor->precision = ws_result_precision(res);
+}
+
+/*
+ * TDengineCursorWaitFd - 返回等待异步查询完成所用的文件描述符
+ */
+int
+TDengineCursorWaitFd(TDengineCursor *cursor)
+{
+    Assert(cursor->pending != NULL);
+    return tdengine_query_wait_fd(cursor->pending);
+}
+
+/*
+ * TDengineCursorIsReady - 游标的查询是否已经完成，完成后拉取数据不会等待查询
+ */
+bool
+TDengineCursorIsReady(TDengineCursor *cursor)
+{
+    return cursor->pending == NULL || tdengine_query_is_done(cursor->pending);
+}
+
+/*
+ * TDengineCursorFetch - 从游标中最多读取 max_rows 行到 result 中
+ *
+ * binary 为 true 时每行以 TDengineCell 数组的形式返回原生类型的值，
+ * 否则以文本形式返回。行数据分配在当前内存上下文中。只有在远程结果
+ * 读完时才会返回少于 max_rows 的行数，返回 0 表示没有更多数据。
+ */
+int
+TDengineCursorFetch(TDengineCursor *cursor, TDengineResult *result, int max_rows, bool binary)
+{
+    int nrow = 0;
+    int i;
+
+    /* 异步查询尚未取回结果时等待其完成 */
+    if (cursor->pending != NULL)
+    {
+        WS_RES *res = tdengine_finish_query(cursor->pending);
+
+        cursor->pending = NULL;
+        tdengine_cursor_attach_result(cursor, res);
+    }
+
+    /* 池化查询等待后台进程返回结果头 */
+    if (cursor->pooled != NULL && !cursor->header_read)
+    {
+        tdengine_pool_read_header(cursor->pooled, &cursor->ncol, &cursor->precision);
+        cursor->header_read = true;
+    }
+
+    result->ncol = cursor->ncol;
+    result->columns = (char **) palloc0(sizeof(char *) * cursor->ncol);
+    for (i = 0; i < cursor->ncol; i++)
+        result->columns[i] = pstrdup(cursor->replaying ? cursor->names[i].c_str() :
+                                     cursor->pooled ? tdengine_pool_column_name(cursor->pooled, i) : cursor->fields[i].name);
+    result->rows = (TDengineRow *) palloc0(sizeof(TDengineRow) * max_rows);
+    result->tagkeys = NULL;
+    result->ntag = 0;
+    result->precision = cursor->precision;
+
+    while (nrow < max_rows && !cursor->eof)
+    {
+        TDengineRow *row;
+
+        /* 缓存结果按值顺序存放，读到末尾即结束 */
+        if (cursor->replaying)
+        {
+            if (cursor->replay_pos >= cursor->cache_data.size())
+            {
+                cursor->eof = true;
+                break;
+            }
+        }
+        /* 池化查询按行从消息队列中读取 */
+        else if (cursor->pooled != NULL)
+        {
+            if (!tdengine_pool_next_row(cursor->pooled))
+            {
+                cursor->eof = true;
+                break;
+            }
+        }
+        /* 当前数据块已消费完，拉取下一个数据块 */
+        else if (cursor->block_pos >= cursor->block_rows)
+        {
+            const void *block = NULL;
+            int32_t rows = 0;
+            int code = ws_fetch_raw_block(cursor->res, &block, &rows);
+
+            if (code != 0)
+                elog(ERROR, "tdengine_fdw : could not fetch result block: %s (error code: %d)",
+                     ws_errstr(cursor->res), code);
+
+            if (rows == 0)
+            {
+                /* 订阅游标读完一条消息后继续读取下一条消息 */
+                if (cursor->consumer != NULL && tdengine_cursor_next_message(cursor))
+                    continue;
+
+                cursor->eof = true;
+                break;
+            }
+
+            cursor->block_rows = rows;
+            cursor->block_pos = 0;
+        }
+
+        row = &result->rows[nrow];
+        if (binary)
+        {
+            row->tuple = NULL;
+            row->cells = (TDengineCell *) palloc(sizeof(TDengineCell) * cursor->ncol);
+        }
+        else
+        {
+            row->tuple = (char **) palloc(sizeof(char *) * cursor->ncol);
+            row->cells = NULL;
+        }
+
+        for (i = 0; i < cursor->ncol; i++)
+        {
+            uint8_t type = 0;
+            uint32_t len = 0;
+            const void *value;
+
+            if (cursor->replaying)
+                value = tdengine_cursor_replay_value(cursor, i, &type, &len);
+            else if (cursor->pooled != NULL)
+                value = tdengine_pool_get_value(cursor->pooled, i, &type, &len);
+            else
+                value = ws_get_value_in_block(cursor->res, cursor->block_pos, i, &type, &len);
+
+            if (cursor->recording)
+                tdengine_cursor_record_value(cursor, value, type, len);
+
+            if (binary)
+                tdengine_read_cell(type, value, len, &row->cells[i]);
+            else if (value == NULL)
+                row->tuple[i] = NULL;
+            else
+            {
+                TDengineCell cell;
+
+                tdengine_read_cell(type, value, len, &cell);
+                row->tuple[i] = tdengine_cell_to_cstring(&cell, cursor->precision);
+            }
+        }
+
+        cursor->block_pos++;
+        nrow++;
+    }
+
+    /* 结果完整读完才存入缓存，提前关闭的游标不缓存 */
+    if (cursor->eof && cursor->recording)
+        tdengine_cursor_store_result(cursor);
+
+    result->nrow = nrow;
+    return nrow;
+}
+
+/*
+ * TDengineCursorClose - 释放游标及其远程结果句柄
+ */
+void
+TDengineCursorClose(TDengineCursor *cursor)
+{
+    if (cursor == NULL)
+        return;
+
+    if (cursor->prev)
+        cursor->prev->next = cursor->next;
+    else
+        open_cursors = cursor->next;
+    if (cursor->next)
+        cursor->next->prev = cursor->prev;
+
+    /* 订阅游标在读完前关闭时，本事务读过的消息不能确认 */
+    if (cursor->consumer && !cursor->eof)
+        tdengine_tmq_mark_incomplete(cursor->consumer);
+
+    /* 异步查询无法取消，只能等待其结束后释放结果 */
+    if (cursor->pending)
+        cursor->res = tdengine_finish_query(cursor->pending);
+
+    /* 预处理语句的结果由语句管理，下一次执行或关闭语句时释放 */
+    if (cursor->cached)
+    {
+        cursor->cached->in_use = false;
+        if (cursor->cached->conn == NULL)
+            tdengine_stmt_cache_release(cursor->cached);
+    }
+    else if (cursor->res)
+        ws_free_result(cursor->res);
+
+    if (cursor->own_conn)
+        ws_close(cursor->conn);
+
+    if (cursor->pooled)
+        tdengine_pool_close(cursor->pooled);
+
+    delete cursor;
+}
+
+/*
+ * tdengine_connection_in_use - 是否有游标的查询或结果、或插入语句仍在使用连接，
+ * 此时关闭连接会释放它们持有的结果或语句
+ */
+bool
+tdengine_connection_in_use(WS_TAOS *conn)
+{
+    TDengineCursor *cursor;
+    TDengineInsertStmt *stmt;
+
+    for (cursor = open_cursors; cursor != NULL; cursor = cursor->next)
+    {
+        if (cursor->conn == conn && (cursor->res != NULL || cursor->pending != NULL))
+            return true;
+    }
+
+    for (stmt = open_insert_stmts; stmt != NULL; stmt = stmt->next)
+    {
+        if (stmt->conn == conn && stmt->stmt != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * TDengineCursorCloseAll - 释放所有已打开的游标，事务中止时调用
+ */
+void
+TDengineCursorCloseAll(void)
+{
+    while (open_cursors)
+        TDengineCursorClose(open_cursors);
+}
+
+/*
+ * TDengineCursorCloseSubXact - 释放在 level 层或更深的子事务中打开的游标，
+ * 子事务中止时调用
+ */
+void
+TDengineCursorCloseSubXact(int level)
+{
+    TDengineCursor *cursor = open_cursors;
+
+    while (cursor != NULL)
+    {
+        TDengineCursor *next = cursor->next;
+
+        if (cursor->nest_level >= level)
+            TDengineCursorClose(cursor);
+        cursor = next;
+    }
+}
+
+/*
+ * TDengineDescribeTags - 通过 DESCRIBE 获取超级表的标签列名
+ *
+ * DESCRIBE 的结果中 note 列为 TAG 的行即为标签列
+ */
+List *
+TDengineDescribeTags(UserMapping *user, tdengine_opt *options, const char *stable_name)
+{
+    StringInfoData sql;
+    TDengineCursor *cursor;
+    TDengineResult result;
+    List *tags = NIL;
+    int note_col = -1;
+    int i;
+
+    initStringInfo(&sql);
+    tdengine_deparse_describe_stmt(&sql, stable_name);
+
+    cursor = TDengineCursorOpen(sql.data, user, options, NULL, NULL, 0, false, NULL);
+
+    for (;;)
+    {
+        int nrow = TDengineCursorFetch(cursor, &result, DEFAULT_FETCH_SIZE, false);
+
+        if (note_col < 0)
+        {
+            for (i = 0; i < result.ncol; i++)
+            {
+                if (pg_strcasecmp(result.columns[i], "note") == 0)
+                    note_col = i;
+            }
+            if (note_col < 0)
+            {
+                TDengineCursorClose(cursor);
+                elog(ERROR, "tdengine_fdw : unexpected result of DESCRIBE on super table \"%s\"", stable_name);
+            }
+        }
+
+        for (i = 0; i < nrow; i++)
+        {
+            char **tuple = result.rows[i].tuple;
+
+            if (tuple[0] != NULL && tuple[note_col] != NULL &&
+                pg_strcasecmp(tuple[note_col], "TAG") == 0)
+                tags = lappend(tags, tuple[0]);
+        }
+
+        if (nrow < DEFAULT_FETCH_SIZE)
+            break;
+    }
+
+    TDengineCursorClose(cursor);
+
+    if (tags == NIL)
+        elog(ERROR, "tdengine_fdw : \"%s\" is not a super table", stable_name);
+
+    return tags;
+}
+
+/*
+ * TDengineQueryCount - 执行 SELECT COUNT(*) 查询并返回计数
+ *
+ * 用于 use_remote_estimate，空表上 TDengine 可能不返回任何行，此时视为 0
+ */
+double
+TDengineQueryCount(UserMapping *user, tdengine_opt *options, char *query)
+{
+    TDengineCursor *cursor;
+    TDengineResult result;
+    double count = 0;
+    int nrow;
+
+    cursor = TDengineCursorOpen(query, user, options, NULL, NULL, 0, false, NULL);
+    nrow = TDengineCursorFetch(cursor, &result, 1, false);
+
+    if (nrow > 0 && result.ncol > 0 && result.rows[0].tuple[0] != NULL)
+        count = strtod(result.rows[0].tuple[0], NULL);
+
+    TDengineCursorClose(cursor);
+
+    return count;
+}
+
+/*
+ * TDengineInsertPrepare - 创建插入用的参数绑定语句
+ *
+ * 语句在第一次执行时才在连接上准备，之后各批次只重新绑定参数。
+ * 开启 pipelined_insert 时后台线程的提交与执行器在主线程中的扫描
+ * （例如 INSERT INTO ft SELECT ... FROM ft2）同时进行，因此语句使用独占的连接，
+ * 不与缓存的连接共用
+ *
+ * 参数:
+ *   @sql: tdengine_deparse_insert() 生成的插入语句
+ *   @user: 用户映射
+ *   @options: 连接选项
+ */
+TDengineInsertStmt *
+TDengineInsertPrepare(const char *sql, UserMapping *user, tdengine_opt *options)
+{
+    TDengineInsertStmt *stmt = new TDengineInsertStmt();
+
+    stmt->stmt = NULL;
+    stmt->conn = NULL;
+    stmt->own_conn = options->pipelined_insert;
+    stmt->sql = sql;
+    stmt->precision = TDENGINE_PRECISION_MS;
+    stmt->user = user;
+    stmt->options = options;
+    stmt->in_flight = false;
+    stmt->nrow = 0;
+    stmt->code = 0;
+    stmt->affected_rows = 0;
+    stmt->elapsed_ms = 0;
+    stmt->nest_level = GetCurrentTransactionNestLevel();
+
+    stmt->prev = NULL;
+    stmt->next = open_insert_stmts;
+    if (open_insert_stmts)
+        open_insert_stmts->prev = stmt;
+    open_insert_stmts = stmt;
+
+    return stmt;
+}
+
+/*
+ * 在连接上准备插入语句，并从服务器取得各占位符对应列的类型和时间精度。
+ * 成功时返回 NULL，失败时返回错误信息
+ */
+static char *
+tdengine_insert_prepare(TDengineInsertStmt *stmt)
+{
+    struct StmtField *fields = NULL;
+    int nfields = 0;
+    int code;
+    int i;
+
+    elog(DEBUG1, "tdengine_fdw : prepare insert: %s", stmt->sql.c_str());
+
+    /*
+     * 共用缓存的连接时，语句未关闭前连接不会被关闭或重建；
+     * 独占的连接在第一次提交时建立，关闭语句时关闭
+     */
+    if (!stmt->own_conn)
+        stmt->conn = tdengine_get_connection(stmt->user, stmt->options);
+    else if (stmt->conn == NULL)
+    {
+        char dsn[TDENGINE_DSN_LEN];
+
+        tdengine_build_dsn(stmt->options, dsn, sizeof(dsn));
+        stmt->conn = create_tdengine_connection(dsn);
+    }
+
+    stmt->stmt = ws_stmt_init(stmt->conn);
+    if (stmt->stmt == NULL)
+        return psprintf("failed to init stmt: %s", ws_stmt_errstr(NULL));
+
+    code = ws_stmt_prepare(stmt->stmt, stmt->sql.c_str(), stmt->sql.length());
+    if (code == 0)
+        code = ws_stmt_get_col_fields(stmt->stmt, &nfields, &fields);
+    if (code != 0)
+    {
+        char *err = psprintf("failed to prepare \"%s\": %s (error code: %d)",
+                             stmt->sql.c_str(), ws_stmt_errstr(stmt->stmt), code);
+
+        ws_stmt_close(stmt->stmt);
+        stmt->stmt = NULL;
+        return err;
+    }
+
+    /* 时间戳按时间列的精度绑定，不依赖 precision 选项 */
+    stmt->field_types.resize(nfields);
+    for (i = 0; i < nfields; i++)
+    {
+        stmt->field_types[i] = fields[i].field_type;
+        if (fields[i].field_type == TSDB_DATA_TYPE_TIMESTAMP)
+            stmt->precision = fields[i].precision;
+    }
+    ws_stmt_reclaim_fields(stmt->stmt, &fields, nfields);
+
+    return NULL;
+}
+
+/*
+ * TDengineInsertDescribe - 准备插入语句（尚未准备时），返回各占位符对应的远程列类型
+ *
+ * 绑定的缓冲区类型必须与远程列类型一致，调用者按返回的类型转换各列的值。
+ * *types 分配在当前内存上下文中。成功时返回 NULL，失败时返回错误信息
+ *
+ * 参数:
+ *   @stmt: TDengineInsertPrepare() 创建的语句
+ *   @types/@ncol: 输出参数，各占位符对应的远程列类型 TSDB_DATA_TYPE_*
+ *   @precision: 输出参数，远程数据库的时间精度
+ */
+char *
+TDengineInsertDescribe(TDengineInsertStmt *stmt, int **types, int *ncol, int *precision)
+{
+    size_t i;
+
+    if (stmt->stmt == NULL)
+    {
+        char *err = tdengine_insert_prepare(stmt);
+
+        if (err != NULL)
+            return err;
+    }
+
+    *ncol = (int) stmt->field_types.size();
+    *types = (int *) palloc(sizeof(int) * Max(*ncol, 1));
+    for (i = 0; i < stmt->field_types.size(); i++)
+        (*types)[i] = stmt->field_types[i];
+    *precision = stmt->precision;
+
+    return NULL;
+}
+
+/*
+ * 绑定并执行 stmt 中已复制好的一批数据，结果记录在 stmt 中。
+ * 可能在后台线程中执行，不调用任何 PostgreSQL 函数
+ */
+static void
+tdengine_insert_execute(TDengineInsertStmt *stmt)
+{
+    auto start = std::chrono::steady_clock::now();
+    int rc;
+
+    rc = ws_stmt_bind_param_batch(stmt->stmt, stmt->binds.data(), (uint32_t) stmt->binds.size());
+    if (rc == 0)
+        rc = ws_stmt_add_batch(stmt->stmt);
+    if (rc == 0)
+        rc = ws_stmt_execute(stmt->stmt, &stmt->affected_rows);
+    if (rc != 0)
+    {
+        const char *err = ws_stmt_errstr(stmt->stmt);
+
+        stmt->errmsg = err ? err : "";
+    }
+    stmt->code = rc;
+    stmt->elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * TDengineInsertSubmit - 以列式参数绑定的方式提交一批数据，开启 pipelined_insert 时不等待提交完成
+ *
+ * 每列的 nrow 个值一次绑定，整批数据通过一次 ws_stmt_execute() 提交。
+ * 开启 pipelined_insert 时提交在后台线程中、在语句独占的连接上执行，否则在
+ * 当前线程中同步执行。两种情况下结果都通过 TDengineInsertWait() 获取，同一
+ * 语句同时只能有一批数据在提交。成功时返回 NULL，失败时返回错误信息
+ *
+ * 参数:
+ *   @stmt: TDengineInsertPrepare() 创建的语句
+ *   @columns: 各列的绑定数组，顺序与插入语句中的占位符一致，返回后即可释放
+ *   @ncol: 列数
+ *   @nrow: 行数
+ */
+char *
+TDengineInsertSubmit(TDengineInsertStmt *stmt, TDengineBindColumn *columns, int ncol, int nrow)
+{
+    char errbuf[256] = {0};
+    sigset_t blocked;
+    sigset_t saved;
+    int i;
+
+    Assert(!stmt->in_flight);
+
+    if (stmt->stmt == NULL)
+    {
+        char *err = tdengine_insert_prepare(stmt);
+
+        if (err != NULL)
+            return err;
+    }
+
+    stmt->buffers.resize(ncol);
+    stmt->binds.resize(ncol);
+    for (i = 0; i < ncol; i++)
+    {
+        TDengineBindBuffer &buf = stmt->buffers[i];
+        WS_MULTI_BIND &bind = stmt->binds[i];
+
+        buf.values.assign(columns[i].values, columns[i].values + (size_t) columns[i].elem_size * nrow);
+        buf.lengths.assign(columns[i].lengths, columns[i].lengths + nrow);
+        buf.is_null.assign(columns[i].is_null, columns[i].is_null + nrow);
+
+        memset(&bind, 0, sizeof(bind));
+        bind.buffer_type = columns[i].type;
+        bind.buffer = buf.values.data();
+        bind.buffer_length = columns[i].elem_size;
+        bind.length = buf.lengths.data();
+        bind.is_null = buf.is_null.data();
+        bind.num = nrow;
+    }
+
+    stmt->nrow = nrow;
+    stmt->code = 0;
+    stmt->errmsg.clear();
+    stmt->affected_rows = 0;
+
+    /* 共用缓存的连接时同步提交，返回时提交已经完成 */
+    if (!stmt->own_conn)
+    {
+        tdengine_insert_execute(stmt);
+        stmt->in_flight = true;
+        return NULL;
+    }
+
+    /*
+     * 新线程继承创建时的信号屏蔽字。创建期间屏蔽所有信号，保证信号只会
+     * 递送到后端主线程，由 PostgreSQL 的处理函数处理
+     */
+    sigfillset(&blocked);
+    pthread_sigmask(SIG_SETMASK, &blocked, &saved);
+
+    try
+    {
+        stmt->worker = std::thread(tdengine_insert_execute, stmt);
+    }
+    catch (const std::system_error &e)
+    {
+        snprintf(errbuf, sizeof(errbuf), "%s", e.what());
+    }
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (errbuf[0] != '\0')
+        return psprintf("could not start insert: %s", errbuf);
+
+    stmt->in_flight = true;
+
+    return NULL;
+}
+
+/*
+ * TDengineInsertWait - 等待上一次 TDengineInsertSubmit() 的提交完成
+ *
+ * 成功或没有正在提交的数据时返回 NULL，失败时返回错误信息。elapsed_ms 不为 NULL 时
+ * 通过它返回提交的耗时
+ */
+char *
+TDengineInsertWait(TDengineInsertStmt *stmt, double *elapsed_ms)
+{
+    if (!stmt->in_flight)
+        return NULL;
+
+    if (stmt->worker.joinable())
+        stmt->worker.join();
+    stmt->in_flight = false;
+
+    if (elapsed_ms)
+        *elapsed_ms = stmt->elapsed_ms;
+
+    if (stmt->code != 0)
+        return psprintf("failed to insert %d rows: %s (error code: %d)",
+                        stmt->nrow, stmt->errmsg.c_str(), stmt->code);
+
+    elog(DEBUG1, "tdengine_fdw : inserted %d rows", stmt->affected_rows);
+
+    return NULL;
+}
+
+/*
+ * TDengineSchemalessInsert - 通过无模式写入接口提交一批行协议数据
+ *
+ * 时间戳按选项中的时间精度解释。成功时返回 NULL，失败时返回错误信息
+ *
+ * 参数:
+ *   @user: 用户映射
+ *   @options: 连接选项
+ *   @lines/@len: 以换行分隔的行协议数据
+ */
+char *
+TDengineSchemalessInsert(UserMapping *user, tdengine_opt *options, const char *lines, int len)
+{
+    WS_TAOS *conn = tdengine_get_connection(user, options);
+    int32_t total_rows = 0;
+    int precision;
+    WS_RES *res;
+    int code;
+
+    switch (options->precision)
+    {
+        case TDENGINE_PRECISION_US:
+            precision = WS_TSDB_SML_TIMESTAMP_MICRO_SECONDS;
+            break;
+        case TDENGINE_PRECISION_NS:
+            precision = WS_TSDB_SML_TIMESTAMP_NANO_SECONDS;
+            break;
+        default:
+            precision = WS_TSDB_SML_TIMESTAMP_MILLI_SECONDS;
+            break;
+    }
+
+    res = ws_schemaless_insert_raw(conn, lines, len, &total_rows, WS_TSDB_SML_LINE_PROTOCOL, precision);
+    code = ws_errno(res);
+    if (code != 0)
+    {
+        char *err = psprintf("failed to insert schemaless data: %s (error code: %d)", ws_errstr(res), code);
+
+        ws_free_result(res);
+        return err;
+    }
+    ws_free_result(res);
+
+    elog(DEBUG1, "tdengine_fdw : inserted %d schemaless rows", total_rows);
+
+    return NULL;
+}
+
+/*
+ * TDengineInsertClose - 释放插入语句
+ */
+void
+TDengineInsertClose(TDengineInsertStmt *stmt)
+{
+    if (stmt == NULL)
+        return;
+
+    if (stmt->prev)
+        stmt->prev->next = stmt->next;
+    else
+        open_insert_stmts = stmt->next;
+    if (stmt->next)
+        stmt->next->prev = stmt->prev;
+
+    /* 提交无法取消，只能等待其结束后释放语句 */
+    if (stmt->in_flight && stmt->worker.joinable())
+        stmt->worker.join();
+
+    if (stmt->stmt)
+        ws_stmt_close(stmt->stmt);
+    if (stmt->own_conn && stmt->conn)
+        ws_close(stmt->conn);
+
+    delete stmt;
+}
+
+/*
+ * TDengineInsertCloseAll - 释放所有已打开的插入语句，事务中止时调用
+ */
+void
+TDengineInsertCloseAll(void)
+{
+    while (open_insert_stmts)
+        TDengineInsertClose(open_insert_stmts);
+}
+
+/*
+ * TDengineInsertCloseSubXact - 释放在 level 层或更深的子事务中准备的插入语句，
+ * 子事务中止时调用
+ */
+void
+TDengineInsertCloseSubXact(int level)
+{
+    TDengineInsertStmt *stmt = open_insert_stmts;
+
+    while (stmt != NULL)
+    {
+        TDengineInsertStmt *next = stmt->next;
+
+        if (stmt->nest_level >= level)
+            TDengineInsertClose(stmt);
+        stmt = next;
+    }
+}
+
+/*
+ * tdengine_stmt_cache_init - 注册预处理语句缓存的配置参数
+ */
+void
+tdengine_stmt_cache_init(void)
+{
+    DefineCustomIntVariable("tdengine_fdw.prepared_statement_cache_size",
+                            "Number of remote prepared queries cached by each backend.",
+                            "Parameterized scans reuse a cached statement and only send parameter values "
+                            "on rescan. Zero disables the cache.",
+                            &tdengine_stmt_cache_size,
+                            32, 0, 1024,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+}
+
+/*
+ * 查找 (conn, query) 对应的预处理语句，不存在时准备一个并加入缓存
+ *
+ * 返回 NULL 表示无法使用预处理语句：语句正被其他游标使用、缓存已满且都在
+ * 使用中，或者远程无法准备该查询（例如占位符出现在不支持参数的位置）。
+ * 无法准备的查询同样留在缓存中，避免每次重新扫描都重复尝试
+ */
+static TDengineStmtCacheEntry *
+tdengine_stmt_cache_lookup(WS_TAOS *conn, const char *query, int param_num)
+{
+    TDengineStmtCacheEntry *entry;
+    StringInfoData sql;
+    const char *p;
+    char quote = '\0';
+    int code;
+
+    for (entry = stmt_cache_head; entry != NULL; entry = entry->next)
+    {
+        if (entry->conn == conn && entry->query == query)
+        {
+            /* 移到表头 */
+            if (entry != stmt_cache_head)
+            {
+                tdengine_stmt_cache_unlink(entry);
+                entry->next = stmt_cache_head;
+                stmt_cache_head->prev = entry;
+                stmt_cache_head = entry;
+                stmt_cache_count++;
+            }
+            return (entry->stmt != NULL && !entry->in_use) ? entry : NULL;
+        }
+    }
+
+    /* 淘汰最久未使用且没有游标在读取的语句 */
+    while (stmt_cache_count >= tdengine_stmt_cache_size)
+    {
+        TDengineStmtCacheEntry *victim = stmt_cache_tail;
+
+        while (victim != NULL && victim->in_use)
+            victim = victim->prev;
+        if (victim == NULL)
+            return NULL;
+
+        tdengine_stmt_cache_unlink(victim);
+        tdengine_stmt_cache_release(victim);
+    }
+
+    entry = new TDengineStmtCacheEntry();
+    entry->stmt = NULL;
+    entry->conn = conn;
+    entry->query = query;
+    entry->precision = TDENGINE_PRECISION_MS;
+    entry->in_use = false;
+
+    /*
+     * 将 $n 替换为 ? 占位符，跳过字符串字面量和带引号的标识符。
+     * 参数越界时 elog(ERROR)，改写结果用 palloc 的缓冲区而不是 std::string
+     */
+    initStringInfo(&sql);
+    for (p = query; *p;)
+    {
+        if (quote != '\0')
+        {
+            if (*p == quote)
+                quote = '\0';
+            appendStringInfoChar(&sql, *p++);
+            continue;
+        }
+
+        if (*p == '\'' || *p == '"' || *p == '`')
+        {
+            quote = *p;
+            appendStringInfoChar(&sql, *p++);
+            continue;
+        }
+
+        if (*p == '$' && isdigit((unsigned char) p[1]))
+        {
+            int idx = 0;
+
+            p++;
+            while (isdigit((unsigned char) *p))
+                idx = idx * 10 + (*p++ - '0');
+
+            if (idx < 1 || idx > param_num)
+            {
+                delete entry;
+                elog(ERROR, "tdengine_fdw : parameter $%d out of range", idx);
+            }
+
+            entry->param_order.push_back(idx - 1);
+            appendStringInfoChar(&sql, '?');
+            continue;
+        }
+
+        appendStringInfoChar(&sql, *p++);
+    }
+
+    elog(DEBUG1, "tdengine_fdw : prepare query: %s", sql.data);
+
+    entry->stmt = ws_stmt2_init(conn, NULL);
+    if (entry->stmt != NULL)
+    {
+        code = ws_stmt2_prepare(entry->stmt, sql.data, sql.len);
+        if (code != 0)
+        {
+            elog(DEBUG1, "tdengine_fdw : failed to prepare query, sending it as text: %s (error code: %d)",
+                 ws_stmt2_error(entry->stmt), code);
+            ws_stmt2_close(entry->stmt);
+            entry->stmt = NULL;
+        }
+        else
+            entry->precision = tdengine_database_precision(conn);
+    }
+    pfree(sql.data);
+
+    entry->prev = NULL;
+    entry->next = stmt_cache_head;
+    if (stmt_cache_head)
+        stmt_cache_head->prev = entry;
+    stmt_cache_head = entry;
+    if (stmt_cache_tail == NULL)
+        stmt_cache_tail = entry;
+    stmt_cache_count++;
+
+    return entry->stmt != NULL ? entry : NULL;
+}
+
+/*
+ * 将语句从缓存链表中摘除，语句本身不释放
+ */
+static void
+tdengine_stmt_cache_unlink(TDengineStmtCacheEntry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        stmt_cache_head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        stmt_cache_tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+    stmt_cache_count--;
+}
+
+/*
+ * 关闭已摘除的语句；仍有游标在读取其结果时推迟到游标关闭时释放
+ */
+static void
+tdengine_stmt_cache_release(TDengineStmtCacheEntry *entry)
+{
+    if (entry->in_use)
+    {
+        entry->conn = NULL;
+        return;
+    }
+
+    if (entry->stmt)
+        ws_stmt2_close(entry->stmt);
+    delete entry;
+}
+
+/*
+ * tdengine_stmt_cache_forget - 释放在 conn 上准备的所有语句，关闭连接前调用
+ */
+void
+tdengine_stmt_cache_forget(WS_TAOS *conn)
+{
+    TDengineStmtCacheEntry *entry = stmt_cache_head;
+
+    while (entry != NULL)
+    {
+        TDengineStmtCacheEntry *next = entry->next;
+
+        if (entry->conn == conn)
+        {
+            tdengine_stmt_cache_unlink(entry);
+            tdengine_stmt_cache_release(entry);
+        }
+        entry = next;
+    }
+}
+
+/*
+ * 查询连接当前数据库的时间精度，准备语句时调用。查询失败时按毫秒处理
+ *
+ * 外部服务器的 precision 选项只描述无模式写入发送的时间戳，与数据库的
+ * 精度无关，绑定的时间戳必须使用数据库自身的精度
+ */
+static int
+tdengine_database_precision(WS_TAOS *conn)
+{
+    WS_RES *res = ws_query(conn, "SELECT `precision` FROM information_schema.ins_databases WHERE name = DATABASE()");
+    int precision = TDENGINE_PRECISION_MS;
+    const void *block = NULL;
+    int32_t rows = 0;
+
+    if (ws_errno(res) == 0 && ws_fetch_raw_block(res, &block, &rows) == 0 && rows > 0)
+    {
+        uint8_t type = 0;
+        uint32_t len = 0;
+        const char *value = (const char *) ws_get_value_in_block(res, 0, 0, &type, &len);
+
+        if (value != NULL && len == 2 && strncmp(value, "us", 2) == 0)
+            precision = TDENGINE_PRECISION_US;
+        else if (value != NULL && len == 2 && strncmp(value, "ns", 2) == 0)
+            precision = TDENGINE_PRECISION_NS;
+    }
+    else
+        elog(DEBUG1, "tdengine_fdw : could not read database precision, assuming milliseconds: %s",
+             ws_errstr(res));
+
+    ws_free_result(res);
+
+    return precision;
+}
+
+/*
+ * 绑定参数并执行缓存的语句，返回结果集；执行失败时返回 NULL
+ *
+ * 时间参数按准备语句时取得的数据库精度以时间戳绑定，其余参数按原生类型绑定
+ */
+static WS_RES *
+tdengine_stmt_cache_execute(TDengineStmtCacheEntry *entry, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values)
+{
+    size_t nbind = entry->param_order.size();
+    std::vector<WS_STMT2_BIND> binds(nbind);
+    std::vector<int64_t> ints(nbind);
+    std::vector<double> doubles(nbind);
+    std::vector<int8_t> bools(nbind);
+    std::vector<int32_t> lengths(nbind);
+    std::vector<char> is_null(nbind);
+    WS_STMT2_BIND *cols;
+    WS_STMT2_BINDV bindv;
+    int affected_rows;
+    int code;
+    size_t i;
+
+    for (i = 0; i < nbind; i++)
+    {
+        int idx = entry->param_order[i];
+        TDengineValue *value = &param_tdengine_values[idx];
+        WS_STMT2_BIND *bind = &binds[i];
+
+        bind->length = &lengths[i];
+        bind->is_null = &is_null[i];
+        bind->num = 1;
+        is_null[i] = 0;
+
+        switch (param_tdengine_types[idx])
+        {
+            case TDENGINE_INT64:
+                ints[i] = value->i;
+                bind->buffer_type = TSDB_DATA_TYPE_BIGINT;
+                bind->buffer = &ints[i];
+                lengths[i] = sizeof(int64_t);
+                break;
+            case TDENGINE_DOUBLE:
+                doubles[i] = value->d;
+                bind->buffer_type = TSDB_DATA_TYPE_DOUBLE;
+                bind->buffer = &doubles[i];
+                lengths[i] = sizeof(double);
+                break;
+            case TDENGINE_BOOLEAN:
+                bools[i] = value->b ? 1 : 0;
+                bind->buffer_type = TSDB_DATA_TYPE_BOOL;
+                bind->buffer = &bools[i];
+                lengths[i] = sizeof(int8_t);
+                break;
+            case TDENGINE_STRING:
+                bind->buffer_type = TSDB_DATA_TYPE_VARCHAR;
+                bind->buffer = value->s;
+                lengths[i] = (int32_t) strlen(value->s);
+                break;
+            case TDENGINE_TIME:
+                /* 绑定的时间参数以纳秒表示 */
+                ints[i] = tdengine_time_from_pg(tdengine_time_to_pg(value->i, TDENGINE_PRECISION_NS), entry->precision);
+                bind->buffer_type = TSDB_DATA_TYPE_TIMESTAMP;
+                bind->buffer = &ints[i];
+                lengths[i] = sizeof(int64_t);
+                break;
+            case TDENGINE_NULL:
+                bind->buffer_type = TSDB_DATA_TYPE_VARCHAR;
+                bind->buffer = NULL;
+                lengths[i] = 0;
+                is_null[i] = 1;
+                break;
+        }
+    }
+
+    cols = binds.data();
+    bindv.count = 1;
+    bindv.tbnames = NULL;
+    bindv.tags = NULL;
+    bindv.bind_cols = &cols;
+
+    code = ws_stmt2_bind_param(entry->stmt, &bindv, -1);
+    if (code == 0)
+        code = ws_stmt2_exec(entry->stmt, &affected_rows);
+    if (code != 0)
+    {
+        elog(DEBUG1, "tdengine_fdw : failed to execute prepared query: %s (error code: %d)",
+             ws_stmt2_error(entry->stmt), code);
+        return NULL;
+    }
+
+    return ws_stmt2_result(entry->stmt);
+}
+
+/*
+ * 将查询中的 $n 占位符替换为对应参数的字面量
+ */
+static char *
+tdengine_bind_query_params(const char *query, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, int param_num)
+{
+    StringInfoData buf;
+    const char *p = query;
+    char quote = '\0';
+
+    initStringInfo(&buf);
+
+    while (*p)
+    {
+        /* 跳过字符串字面量和带引号的标识符中的内容 */
+        if (quote != '\0')
+        {
+            if (*p == quote)
+                quote = '\0';
+            appendStringInfoChar(&buf, *p++);
+            continue;
+        }
+
+        if (*p == '\'' || *p == '"' || *p == '`')
+        {
+            quote = *p;
+            appendStringInfoChar(&buf, *p++);
+            continue;
+        }
+
+        if (*p == '$' && isdigit((unsigned char) p[1]))
+        {
+            int idx = 0;
+
+            p++;
+            while (isdigit((unsigned char) *p))
+                idx = idx * 10 + (*p++ - '0');
+
+            if (idx < 1 || idx > param_num)
+                elog(ERROR, "tdengine_fdw : parameter $%d out of range", idx);
+
+            tdengine_append_param_literal(&buf, param_tdengine_types[idx - 1], &param_tdengine_values[idx - 1]);
+            continue;
+        }
+
+        appendStringInfoChar(&buf, *p++);
+    }
+
+    return buf.data;
+}
+
+/*
+ * 将一个已绑定的参数以 TDengine 字面量的形式追加到缓冲区
+ */
+static void
+tdengine_append_param_literal(StringInfo buf, TDengineType type, TDengineValue *value)
+{
+    switch (type)
+    {
+        case TDENGINE_INT64:
+            appendStringInfo(buf, "%lld", value->i);
+            break;
+        case TDENGINE_DOUBLE:
+            appendStringInfoString(buf, float8out_internal(value->d));
+            break;
+        case TDENGINE_BOOLEAN:
+            appendStringInfoString(buf, value->b ? "true" : "false");
+            break;
+        case TDENGINE_STRING:
+            tdengine_deparse_string_literal(buf, value->s);
+            break;
+        case TDENGINE_TIME:
+            /* 绑定的时间参数以纳秒表示 */
+            appendStringInfoString(buf, tdengine_format_time_literal(tdengine_time_to_pg(value->i, TDENGINE_PRECISION_NS)));
+            break;
+        case TDENGINE_NULL:
+            appendStringInfoString(buf, "NULL");
+            break;
+    }
+}
+
+/*
+ * 将数据块中的一个值读取为 TDengineCell
+ *
+ * 数据块在拉取下一个数据块时会被覆盖，因此变长类型的值需要复制出来
+ */
+static void
+tdengine_read_cell(uint8_t type, const void *value, uint32_t len, TDengineCell *cell)
+{
+    cell->type = type;
+    cell->len = len;
+    cell->isnull = (value == NULL);
+    cell->v.u = 0;
+
+    if (cell->isnull)
+        return;
+
+    switch (type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+            cell->v.b = (*(const int8_t *) value != 0);
+            break;
+        case TSDB_DATA_TYPE_TINYINT:
+            cell->v.i = *(const int8_t *) value;
+            break;
+        case TSDB_DATA_TYPE_SMALLINT:
+            cell->v.i = *(const int16_t *) value;
+            break;
+        case TSDB_DATA_TYPE_INT:
+            cell->v.i = *(const int32_t *) value;
+            break;
+        case TSDB_DATA_TYPE_BIGINT:
+        case TSDB_DATA_TYPE_TIMESTAMP:
+            cell->v.i = *(const int64_t *) value;
+            break;
+        case TSDB_DATA_TYPE_UTINYINT:
+            cell->v.u = *(const uint8_t *) value;
+            break;
+        case TSDB_DATA_TYPE_USMALLINT:
+            cell->v.u = *(const uint16_t *) value;
+            break;
+        case TSDB_DATA_TYPE_UINT:
+            cell->v.u = *(const uint32_t *) value;
+            break;
+        case TSDB_DATA_TYPE_UBIGINT:
+            cell->v.u = *(const uint64_t *) value;
+            break;
+        case TSDB_DATA_TYPE_FLOAT:
+            cell->v.d = *(const float *) value;
+            break;
+        case TSDB_DATA_TYPE_DOUBLE:
+            cell->v.d = *(const double *) value;
+            break;
+        default:
+            /* VARCHAR/NCHAR/JSON 等变长类型 */
+            cell->v.s = pnstrdup((const char *) value, len);
+            break;
+    }
+}
+
+/*
+ * tdengine_cell_to_cstring - 将一个非空单元格转换为文本形式
+ *
+ * 时间戳一律按 UTC 输出并带 +00 偏移，与二进制转换路径、时间字面量和增量扫描的
+ * 高水位一致，不随会话的 TimeZone 变化。timestamp 列因此得到 UTC 时间，
+ * timestamptz 列得到同一时刻
+ */
+char *
+tdengine_cell_to_cstring(TDengineCell *cell, int precision)
+{
+    switch (cell->type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+            return pstrdup(cell->v.b ? "true" : "false");
+        case TSDB_DATA_TYPE_TINYINT:
+        case TSDB_DATA_TYPE_SMALLINT:
+        case TSDB_DATA_TYPE_INT:
+        case TSDB_DATA_TYPE_BIGINT:
+            return psprintf(INT64_FORMAT, (int64) cell->v.i);
+        case TSDB_DATA_TYPE_UTINYINT:
+        case TSDB_DATA_TYPE_USMALLINT:
+        case TSDB_DATA_TYPE_UINT:
+        case TSDB_DATA_TYPE_UBIGINT:
+            return psprintf(UINT64_FORMAT, (uint64) cell->v.u);
+        case TSDB_DATA_TYPE_FLOAT:
+            return DatumGetCString(DirectFunctionCall1(float4out, Float4GetDatum((float4) cell->v.d)));
+        case TSDB_DATA_TYPE_DOUBLE:
+            return float8out_internal(cell->v.d);
+        case TSDB_DATA_TYPE_TIMESTAMP:
+            {
+                Timestamp ts = tdengine_time_to_pg(cell->v.i, precision);
+                struct pg_tm tm;
+                fsec_t fsec;
+                char buf[MAXDATELEN + 1];
+
+                if (timestamp2tm(ts, NULL, &tm, &fsec, NULL, NULL) != 0)
+                    ereport(ERROR,
+                            (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                             errmsg("timestamp out of range")));
+                EncodeDateTime(&tm, fsec, true, 0, NULL, USE_ISO_DATES, buf);
+
+                return pstrdup(buf);
+            }
+        default:
+            return cell->v.s;
+    }
+}
@@ -41,10 +41,27 @@ struct TDengineQuery_return
     TDengineResult *r0; 
     char *r1;           
 };
+/* 二进制结果中的一个单元格，保存 TDengine 原生类型的值 */
+typedef struct TDengineCell
+{
+    int type;    /* TSDB_DATA_TYPE_* */
+    bool isnull; 
+    int len;     /* 变长类型的字节数 */
+    union
+    {
+        long long int i;          /* 有符号整数和时间戳 */
+        unsigned long long int u; /* 无符号整数 */
+        double d;                 /* FLOAT 和 DOUBLE */
+        bool b;                   
+        char *s;                  /* VARCHAR/NCHAR/JSON 等，以 '\0' 结尾 */
+    } v;
+} TDengineCell;
+
 /* 一行数据 */
 typedef struct TDengineRow
 {
-    char **tuple; 
+    char **tuple;        /* 文本形式的值 */
+    TDengineCell *cells; /* 二进制形式的值，文本结果中为 NULL */
 } TDengineRow;
 
 /* TDengine 查询结果集*/
@@ -56,8 +73,25 @@ typedef struct TDengineResult
     char **columns;    
     char **tagkeys;    
     int ntag;          
+    int precision;     /* 结果中时间戳的精度 */
 } TDengineResult;
 
+/* 流式查询游标，定义在 query.cpp 中 */
+typedef struct TDengineCursor TDengineCursor;
+
+/* 插入用的参数绑定语句，定义在 query.cpp 中 */
+typedef struct TDengineInsertStmt TDengineInsertStmt;
+
+/* 列式参数绑定中的一列，values 中依次保存 nrow 个定长的值 */
+typedef struct TDengineBindColumn
+{
+    int type;         /* TSDB_DATA_TYPE_* */
+    int elem_size;    /* 每个值占用的字节数，变长类型为该列中最长值的长度 */
+    char *values;     /* nrow * elem_size 字节 */
+    int32_t *lengths; /* 每个值的实际长度 */
+    char *is_null;    /* 每个值是否为 NULL */
+} TDengineBindColumn;
+
 /* 数据类型的信息 */
 typedef enum TDengineType
 {
@@ -5,6 +5,7 @@
 #include "parser/parse_oper.h"
 #include "parser/parse_type.h"
 #include "utils/builtins.h"
+#include "utils/jsonb.h"
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "tdengine_fdw.h"
@@ -21,6 +22,8 @@ typedef struct pull_slvars_context
 static bool tdengine_slvars_walker(Node *node, pull_slvars_context *context);
 static bool tdengine_is_att_dropped(Oid relid, AttrNumber attnum);
 static void tdengine_validate_foreign_table_sc(Oid reloid);
+static void tdengine_append_lp_escaped(StringInfo buf, const char *str, int len, const char *specials);
+static bool tdengine_append_lp_pairs(StringInfo buf, Jsonb *jb, bool is_fields);
 
 /*
  * 检查节点是否为无模式(schemaless)类型变量
@@ -436,3 +439,126 @@ static void tdengine_validate_foreign_table_sc(Oid reloid)
         attnum++;
     }
 }
+
+/*
+ * 按行协议的规则转义 specials 中的字符和反斜杠后追加到 buf
+ *
+ * 行协议以换行分隔记录且无法转义换行，值中的换行会被当作新的一行写入
+ * （可能写入其他表），因此含有 CR/LF 时报错
+ */
+static void tdengine_append_lp_escaped(StringInfo buf, const char *str, int len, const char *specials)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (str[i] == '\n' || str[i] == '\r')
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("tdengine_fdw : line breaks are not allowed in schemaless table names, keys or values"),
+                     errdetail("Value: \"%s\"", pnstrdup(str, len))));
+
+        if (str[i] == '\\' || strchr(specials, str[i]) != NULL)
+            appendStringInfoChar(buf, '\\');
+        appendStringInfoChar(buf, str[i]);
+    }
+}
+
+/*
+ * 将 jsonb 对象的各个键值对以 key=value 的形式追加到 buf，返回是否追加了键值对
+ *
+ * 值为 null 的键被忽略。标签值一律按字符串写入；字段中的数值写为 64 位浮点数，
+ * 布尔值写为 t/f，字符串和嵌套的对象或数组写为带引号的字符串
+ */
+static bool tdengine_append_lp_pairs(StringInfo buf, Jsonb *jb, bool is_fields)
+{
+    JsonbIterator *it;
+    JsonbValue v;
+    JsonbIteratorToken r;
+    bool first = true;
+    char *key = NULL;
+    int keylen = 0;
+
+    if (!JB_ROOT_IS_OBJECT(jb))
+        elog(ERROR, "tdengine_fdw : %s value must be a jsonb object", is_fields ? "fields" : "tags");
+
+    it = JsonbIteratorInit(&jb->root);
+    while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+    {
+        char *val;
+        int vallen;
+
+        if (r == WJB_KEY)
+        {
+            key = v.val.string.val;
+            keylen = v.val.string.len;
+            continue;
+        }
+        if (r != WJB_VALUE || v.type == jbvNull)
+            continue;
+
+        switch (v.type)
+        {
+            case jbvString:
+                val = v.val.string.val;
+                vallen = v.val.string.len;
+                break;
+            case jbvNumeric:
+                val = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v.val.numeric)));
+                vallen = strlen(val);
+                break;
+            case jbvBool:
+                val = v.val.boolean ? "t" : "f";
+                vallen = 1;
+                break;
+            default:
+                /* 嵌套的对象或数组 */
+                val = JsonbToCString(NULL, v.val.binary.data, v.val.binary.len);
+                vallen = strlen(val);
+                break;
+        }
+
+        appendStringInfoChar(buf, first ? (is_fields ? ' ' : ',') : ',');
+        first = false;
+
+        tdengine_append_lp_escaped(buf, key, keylen, ",= ");
+        appendStringInfoChar(buf, '=');
+
+        if (!is_fields)
+            tdengine_append_lp_escaped(buf, val, vallen, ",= ");
+        else if (v.type == jbvNumeric || v.type == jbvBool)
+            appendBinaryStringInfo(buf, val, vallen);
+        else
+        {
+            appendStringInfoChar(buf, '"');
+            tdengine_append_lp_escaped(buf, val, vallen, "\"");
+            appendStringInfoChar(buf, '"');
+        }
+    }
+
+    return !first;
+}
+
+/*
+ * tdengine_append_line_protocol - 将无模式外部表的一行编码为 InfluxDB 行协议追加到 buf
+ *
+ * 参数说明:
+ * @buf 输出缓冲区
+ * @measurement 远程表名
+ * @tags/@fields tags 列和 fields 列的 jsonb 值，为 NULL 时以 (Datum) 0 表示
+ * @has_time 是否指定了时间，为 false 时由服务器使用当前时间
+ * @ts 时间戳，精度与写入时指定的精度一致
+ */
+void tdengine_append_line_protocol(StringInfo buf, const char *measurement, Datum tags, Datum fields, bool has_time, int64 ts)
+{
+    tdengine_append_lp_escaped(buf, measurement, strlen(measurement), ", ");
+
+    if (tags != (Datum) 0)
+        (void) tdengine_append_lp_pairs(buf, DatumGetJsonbP(tags), false);
+
+    if (fields == (Datum) 0 || !tdengine_append_lp_pairs(buf, DatumGetJsonbP(fields), true))
+        elog(ERROR, "tdengine_fdw : at least one non-null field is required when inserting into a schemaless foreign table");
+
+    if (has_time)
+        appendStringInfo(buf, " " INT64_FORMAT, ts);
+}
@@ -0,0 +1,292 @@
+extern "C" {
+#include "postgres.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "tdengine_fdw.h"
+}
+
+#include <string>
+#include <vector>
+
+/*
+ * 增量（tail）扫描
+ *
+ * 设置了 tail 选项的外部表，在会话设置了 tdengine_fdw.tail_consumer 时只返回
+ * 该消费者上次读到的位置之后的数据。扫描在远程查询中追加
+ * time > 高水位 AND time <= 上界，上界为语句开始时间减去 tdengine_fdw.tail_lag。
+ * 结果完整读完且事务提交后，高水位推进到本次实际读到的最大远程时间，而不是
+ * 上界：本地时钟与远程时间无关，写入有延迟时，时间在上界之前但尚未写入的行
+ * 留给下一次扫描。没有读到任何行时高水位不变。轮询的代价因此只与新数据的多少
+ * 有关。
+ *
+ * 时间早于已读到的最大时间、却在其后才写入的乱序数据不会再被读到。允许的乱序
+ * 程度用 tail_lag 表示：上界比语句开始时间早 tail_lag，晚于该时间的行留到
+ * 之后的扫描。
+ *
+ * 高水位按 (数据库, 外部表, 消费者) 保存在共享内存中，服务重启后丢失，之后
+ * 第一次扫描重新从头读取。
+ */
+
+typedef struct TDengineTailEntry
+{
+    bool valid;
+    Oid dbid;
+    Oid relid;
+    char consumer[NAMEDATALEN];
+    Timestamp hwm;              /* 已读到的位置，之后的扫描只返回更新的数据 */
+} TDengineTailEntry;
+
+typedef struct TDengineTailShared
+{
+    LWLock *lock;
+    int nentries;
+    TDengineTailEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} TDengineTailShared;
+
+/* 当前事务中读完的增量扫描，提交时推进高水位 */
+struct TDengineTailPending
+{
+    Oid relid;
+    std::string consumer;
+    Timestamp hwm;
+};
+
+/* 当前会话的消费者名，为空时增量表按普通表扫描 */
+char *tdengine_tail_consumer = NULL;
+
+/* 增量扫描的上界比语句开始时间早的毫秒数，容许延迟写入或乱序到达的数据 */
+int tdengine_tail_lag = 0;
+
+static int tdengine_max_tail_consumers = 256;
+static TDengineTailShared *TDengineTail = NULL;
+static std::vector<TDengineTailPending> tail_pending;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size tdengine_tail_shmem_size(void);
+static void tdengine_tail_shmem_request(void);
+static void tdengine_tail_shmem_startup(void);
+static TDengineTailEntry *tdengine_tail_find(Oid relid, const char *consumer);
+
+/*
+ * tdengine_tail_init - 注册增量扫描的配置参数和共享内存
+ */
+void
+tdengine_tail_init(void)
+{
+    DefineCustomStringVariable("tdengine_fdw.tail_consumer",
+                               "Consumer name used by scans of foreign tables with the tail option.",
+                               "Each consumer only reads rows newer than the last scan it completed. "
+                               "Empty means tail tables are scanned in full.",
+                               &tdengine_tail_consumer,
+                               "",
+                               PGC_USERSET,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomIntVariable("tdengine_fdw.tail_lag",
+                            "How far behind the statement start time tail scans stop reading.",
+                            "Rows with a timestamp within this interval of the statement start are left "
+                            "for a later scan, so rows written late or out of order are not skipped.",
+                            &tdengine_tail_lag,
+                            0, 0, INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("tdengine_fdw.max_tail_consumers",
+                            "Maximum number of (foreign table, consumer) positions kept for tail scans.",
+                            "Requires tdengine_fdw in shared_preload_libraries.",
+                            &tdengine_max_tail_consumers,
+                            256, 1, 65536,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = tdengine_tail_shmem_request;
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = tdengine_tail_shmem_startup;
+}
+
+static Size
+tdengine_tail_shmem_size(void)
+{
+    Size size = offsetof(TDengineTailShared, entries);
+
+    return add_size(size, mul_size(tdengine_max_tail_consumers, sizeof(TDengineTailEntry)));
+}
+
+static void
+tdengine_tail_shmem_request(void)
+{
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+
+    RequestAddinShmemSpace(tdengine_tail_shmem_size());
+    RequestNamedLWLockTranche("tdengine_fdw tail", 1);
+}
+
+static void
+tdengine_tail_shmem_startup(void)
+{
+    bool found;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    TDengineTail = (TDengineTailShared *) ShmemInitStruct("tdengine_fdw tail", tdengine_tail_shmem_size(), &found);
+    if (!found)
+    {
+        int i;
+
+        TDengineTail->lock = &(GetNamedLWLockTranche("tdengine_fdw tail"))->lock;
+        TDengineTail->nentries = tdengine_max_tail_consumers;
+        for (i = 0; i < TDengineTail->nentries; i++)
+            TDengineTail->entries[i].valid = false;
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * 查找当前数据库中 (relid, consumer) 的条目，调用者需持有锁
+ */
+static TDengineTailEntry *
+tdengine_tail_find(Oid relid, const char *consumer)
+{
+    int i;
+
+    for (i = 0; i < TDengineTail->nentries; i++)
+    {
+        TDengineTailEntry *entry = &TDengineTail->entries[i];
+
+        if (entry->valid && entry->dbid == MyDatabaseId && entry->relid == relid &&
+            strncmp(entry->consumer, consumer, NAMEDATALEN) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * tdengine_tail_position - 读取消费者在外部表上的高水位，尚未读过时返回 false
+ */
+bool
+tdengine_tail_position(Oid relid, const char *consumer, Timestamp *hwm)
+{
+    TDengineTailEntry *entry;
+    bool found = false;
+
+    if (TDengineTail == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("tdengine_fdw : tail scans require tdengine_fdw in shared_preload_libraries")));
+
+    LWLockAcquire(TDengineTail->lock, LW_SHARED);
+    entry = tdengine_tail_find(relid, consumer);
+    if (entry != NULL)
+    {
+        *hwm = entry->hwm;
+        found = true;
+    }
+    LWLockRelease(TDengineTail->lock);
+
+    return found;
+}
+
+/*
+ * tdengine_tail_advance - 记录一次读完的增量扫描，事务提交时推进高水位
+ */
+void
+tdengine_tail_advance(Oid relid, const char *consumer, Timestamp hwm)
+{
+    TDengineTailPending pending;
+
+    for (auto &p : tail_pending)
+    {
+        if (p.relid == relid && p.consumer == consumer)
+        {
+            p.hwm = Max(p.hwm, hwm);
+            return;
+        }
+    }
+
+    pending.relid = relid;
+    pending.consumer = consumer;
+    pending.hwm = hwm;
+    tail_pending.push_back(pending);
+}
+
+/*
+ * tdengine_tail_xact_end - 事务提交前写入本事务推进的高水位，中止时丢弃
+ */
+void
+tdengine_tail_xact_end(bool commit)
+{
+    if (commit && !tail_pending.empty() && TDengineTail != NULL)
+    {
+        LWLockAcquire(TDengineTail->lock, LW_EXCLUSIVE);
+        for (auto &p : tail_pending)
+        {
+            TDengineTailEntry *entry = tdengine_tail_find(p.relid, p.consumer.c_str());
+            int i;
+
+            for (i = 0; entry == NULL && i < TDengineTail->nentries; i++)
+            {
+                if (!TDengineTail->entries[i].valid)
+                {
+                    entry = &TDengineTail->entries[i];
+                    entry->valid = true;
+                    entry->dbid = MyDatabaseId;
+                    entry->relid = p.relid;
+                    strlcpy(entry->consumer, p.consumer.c_str(), NAMEDATALEN);
+                    entry->hwm = p.hwm;
+                }
+            }
+
+            if (entry == NULL)
+            {
+                LWLockRelease(TDengineTail->lock);
+                tail_pending.clear();
+                ereport(ERROR,
+                        (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                         errmsg("tdengine_fdw : too many tail consumers"),
+                         errhint("Increase tdengine_fdw.max_tail_consumers or reset unused consumers.")));
+            }
+
+            /* 并发的扫描可能已经推进得更远 */
+            entry->hwm = Max(entry->hwm, p.hwm);
+        }
+        LWLockRelease(TDengineTail->lock);
+    }
+
+    tail_pending.clear();
+}
+
+/*
+ * tdengine_tail_reset - 删除消费者在外部表上的高水位，之后的扫描重新从头读取
+ */
+void
+tdengine_tail_reset(Oid relid, const char *consumer)
+{
+    TDengineTailEntry *entry;
+
+    if (TDengineTail == NULL)
+        return;
+
+    LWLockAcquire(TDengineTail->lock, LW_EXCLUSIVE);
+    entry = tdengine_tail_find(relid, consumer);
+    if (entry != NULL)
+        entry->valid = false;
+    LWLockRelease(TDengineTail->lock);
+}
@@ -8,8 +8,10 @@
 #include "optimizer/optimizer.h"
 #include "access/table.h"
 #include "fmgr.h"
+#include "funcapi.h"
 
 #include "utils/rel.h"
+#include "storage/spin.h"
 
 /* 等待超时时间设置(毫秒)，0表示无限等待 */
 #define WAIT_TIMEOUT 0
@@ -19,6 +21,8 @@
 #define TDENGINE_TIME_COLUMN "time"
 #define TDENGINE_TIME_TEXT_COLUMN "time_text"
 #define TDENGINE_TAGS_COLUMN "tags"
+/* 超级表中表示子表名的伪列 */
+#define TDENGINE_TBNAME_COLUMN "tbname"
 #define TDENGINE_FIELDS_COLUMN "fields"
 
 #define TDENGINE_TAGS_PGTYPE "jsonb"
@@ -34,6 +38,39 @@
 /* 无错误返回码定义 */
 #define CR_NO_ERROR 0
 
+/* 流式扫描时每次从 TDengine 拉取的默认行数 */
+#define DEFAULT_FETCH_SIZE 1000
+
+/* 远程访问的默认成本，含义与 postgres_fdw 相同 */
+#define DEFAULT_FDW_STARTUP_COST 100.0
+#define DEFAULT_FDW_TUPLE_COST 0.01
+
+/* 单次插入提交的默认最大字节数，与 TDengine 默认的 maxSQLLength 一致 */
+#define DEFAULT_MAX_PAYLOAD_BYTES (1024 * 1024)
+
+/*
+ * batch_size 为 'auto' 时，执行器每次最多交给 FDW 的行数、第一次提交的行数，
+ * 以及单次提交的目标耗时(毫秒)，超过该耗时后减半批量
+ */
+#define TDENGINE_AUTO_BATCH_MAX_ROWS 10000
+#define TDENGINE_AUTO_BATCH_INIT_ROWS 100
+#define TDENGINE_AUTO_BATCH_TARGET_MS 500
+
+/* 缓存的连接空闲超过该秒数后，复用前先探测连接是否可用 */
+#define DEFAULT_KEEPALIVE_IDLE 60
+
+/* 订阅表每次拉取消息的默认等待毫秒数，以及每次扫描默认最多读取的消息数 */
+#define DEFAULT_TMQ_POLL_TIMEOUT 100
+#define DEFAULT_TMQ_MAX_MESSAGES 100
+
+/* 一个缓存结果最多关联的外部表数，读取更多表的查询不缓存 */
+#define TDENGINE_CACHE_MAX_RELS 4
+
+/* TDengine 时间精度，与 ws_result_precision() 的返回值一致 */
+#define TDENGINE_PRECISION_MS 0
+#define TDENGINE_PRECISION_US 1
+#define TDENGINE_PRECISION_NS 2
+
 /*
  * 宏定义：用于检查目标列表中聚合函数和非聚合函数的混合情况
  */
@@ -55,7 +92,6 @@ typedef struct schemaless_info
 
 /*
  * 用于存储 TDengine 服务器信息
- * TODO: 支持超级表
  */
 typedef struct tdengine_opt
 {
@@ -68,7 +104,24 @@ typedef struct tdengine_opt
     char *svr_username; 
     char *svr_password; 
     List *tags_list;    
+    char *stable_name;  /* 超级表名，设置后外部表映射到该超级表 */
     int schemaless;     
+    int fetch_size;     /* 流式扫描每批拉取的行数 */
+    bool async_capable; /* 扫描是否可以在 Append 下异步执行 */
+    bool use_remote_estimate; /* 是否通过远程查询估算行数 */
+    double fdw_startup_cost;  /* 远程查询的启动成本 */
+    double fdw_tuple_cost;    /* 每行数据的传输成本 */
+    int keepalive_idle;       /* 连接空闲多少秒后复用前需要探测，0 表示不探测 */
+    int precision;            /* 无模式写入时发送的时间戳的精度，参数绑定插入使用服务器返回的精度 */
+    int max_payload_bytes;    /* 单次插入提交的最大字节数 */
+    bool pipelined_insert;    /* 插入时是否不等待上一批提交完成即返回 */
+    int cache_ttl;            /* 查询结果在共享缓存中的有效秒数，0 表示不缓存 */
+    bool tail;                /* 是否按 tdengine_fdw.tail_consumer 增量扫描 */
+    char *topic;              /* 订阅的主题，设置后扫描从消息队列读取新写入的数据 */
+    char *group_id;           /* 订阅所属的消费组 */
+    char *client_id;          /* 消费者在消费组中的标识 */
+    int poll_timeout;         /* 每次拉取消息最多等待的毫秒数 */
+    int max_messages;         /* 每次扫描最多读取的消息数 */
 } tdengine_opt;
 
 typedef struct TDengineFdwRelationInfo
@@ -151,9 +204,53 @@ typedef struct TDengineFdwRelationInfo
     ForeignTable *table;
     ForeignServer *server;
     UserMapping *user; 
+    Oid userid;         /* 访问外部表所用的用户，即 checkAsUser 或当前用户 */
 
     int fetch_size; 
+    bool async_capable; /* 扫描是否可以异步执行 */
+
+    /*
+     * 反解析得到的远程查询中 WHERE 子句的结束位置，执行时可以在此处
+     * 追加额外的时间条件
+     */
+    int where_end;
+    bool has_where;
+
+    /* 下推条件中时间列的取值范围，用于并行扫描划分时间段 */
+    bool has_time_range;
+    Timestamp time_lower;
+    Timestamp time_upper;
+
+    /* 是否为订阅表，订阅表从消息队列读取，不下推任何操作 */
+    bool is_topic;
+
+    /* 是否为增量扫描表，只生成基表扫描路径，见 tdengineGetForeignRelSize() */
+    bool is_tail;
 } TDengineFdwRelationInfo;
+
+/*
+ * 并行扫描的共享状态，保存在 DSM 中。下推条件中的时间范围被划分为
+ * nchunks 个互不相交的时间段，各进程依次领取并执行各自的远程查询
+ */
+typedef struct TDengineParallelScanState
+{
+    slock_t mutex;   /* 保护 next_chunk */
+    int next_chunk;  /* 下一个待领取的时间段 */
+    int nchunks;     /* 时间段总数 */
+    Timestamp lower; /* 时间范围下界 */
+    Timestamp upper; /* 时间范围上界 */
+} TDengineParallelScanState;
+
+/*
+ * 扫描使用共享结果缓存的方式，由扫描传给 TDengineCursorOpen
+ */
+typedef struct TDengineCacheScan
+{
+    int ttl;         /* 结果的有效秒数，取所读外部表 cache_ttl 的最小值 */
+    int nrels;       /* 查询读取的外部表数 */
+    uint32 tables[TDENGINE_CACHE_MAX_RELS]; /* 各外部表对应远程表的键，见 tdengine_result_cache_table_key() */
+} TDengineCacheScan;
+
 /*
  * 用于 ForeignScanState 中 fdw_state 的特定于 FDW 的信息
  */
@@ -181,13 +278,59 @@ typedef struct TDengineFdwExecState
     tdengine_opt *tdengineFdwOptions; /* TDengine FDW 选项 */
 
     int batch_size;    /* FDW 选项 "batch_size" 的值 */
+    TDengineInsertStmt *insert_stmt; /* 插入用的参数绑定语句，各批次复用 */
+    int *bind_types;        /* 各占位符对应的远程列类型，第一次提交前从服务器取得 */
+    int bind_ncol;
+    int bind_precision;     /* 远程数据库的时间精度 */
+    bool batch_auto;        /* batch_size 是否为 'auto' */
+    int batch_rows;         /* 自适应模式下一次提交的行数 */
+    double batch_row_bytes; /* 自适应模式下每行编码后的平均字节数，尚未提交时为 0 */
+    int inflight_rows;      /* 正在提交的一批的行数，没有时为 0 */
+    bool cache_write_started; /* 是否已在第一次提交前使远程表的缓存结果失效 */
+    Size inflight_bytes;    /* 正在提交的一批的字节数 */
+
+    /* COPY 时逐行插入的元组在这里缓冲，攒满 batch_size 行后一次提交 */
+    TupleTableSlot **buffered_slots; /* 不缓冲时为 NULL */
+    int num_buffered;
     List *attr_list;   
     List *column_list; 
 
-    int64 row_nums;     /* 行数 */
-    Datum **rows;       /* 扫描的所有行 */
-    int64 rowidx;       /* 当前行的索引 */
+    int64 row_nums;     /* 当前批次中的行数 */
+    Datum **rows;       
+    int64 rowidx;       /* 当前批次中下一行的索引 */
     bool **rows_isnull; 
+
+    /* 流式扫描状态 */
+    TDengineCursor *cursor; /* 远程查询游标 */
+    TDengineResult batch;   /* 当前批次的行窗口 */
+    int fetch_size;         /* 每批最多拉取的行数 */
+    bool eof_reached;       /* 远程结果是否已读完 */
+    MemoryContext batch_cxt; /* 当前批次所用的内存上下文 */
+    int *attr_colidx;        /* retrieved_attrs 中各属性在结果中的列下标 */
+    TDengineColumnType *col_types; /* 无模式扫描时结果中各列的类型 */
+    AttInMetadata *attinmeta; /* 扫描元组各属性的类型输入信息 */
+
+    /* 在远程查询中追加时间条件所需的信息 */
+    char *base_query;        /* 反解析得到的原始查询 */
+    int where_end;           /* WHERE 子句的结束位置 */
+    bool has_where;          /* 原始查询中是否有 WHERE 子句 */
+
+    /* 并行扫描状态 */
+    bool time_range_valid;   /* 计划中是否带有时间范围 */
+    Timestamp time_lower;    
+    Timestamp time_upper;    
+    TDengineParallelScanState *pstate; /* 共享状态，非并行执行时为 NULL */
+
+    TDengineCacheScan cache_scan; /* 结果缓存的有效期和读取的外部表，ttl 为 0 时不缓存 */
+
+    /* 增量扫描状态 */
+    char *tail_consumer;     /* 消费者名，不是增量扫描时为 NULL */
+    Timestamp tail_upper;    /* 本次扫描的上界，语句开始时间减去 tdengine_fdw.tail_lag */
+    bool tail_advance;       /* 读完后是否推进高水位，远程带 LIMIT 时不推进 */
+    int tail_time_attnum;    /* 扫描元组中时间列的属性号，没有时为 0 */
+    bool tail_seen;          /* 是否读到过带时间的行 */
+    Timestamp tail_max;      /* 读到的最大远程时间，读完后高水位推进到这里 */
+
     bool for_update;    
     bool is_agg;        
     List *tlist;        
@@ -203,8 +346,6 @@ typedef struct TDengineFdwExecState
 
     /* 无模式信息 */
     schemaless_info slinfo;
-
-    void *temp_result;
 } TDengineFdwExecState;
 
 
@@ -215,6 +356,7 @@ extern bool tdengine_is_foreign_function_tlist(PlannerInfo *root,RelOptInfo *bas
 /* option.c headers */
 
 extern tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid);
+extern bool tdengine_options_is_tag(Oid foreigntableid, Oid userid, const char *colname);
 extern void tdengine_deparse_insert(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *targetAttrs);
 extern void tdengine_deparse_update(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *targetAttrs, List *attname);
 extern void tdengine_deparse_delete(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *attname);
@@ -224,14 +366,23 @@ extern void tdengine_deparse_drop_measurement_stmt(StringInfo buf, Relation rel)
 /* deparse.c headers */
 
 extern void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,List *tlist, List *remote_conds, List *pathkeys,bool is_subquery, List **retrieved_attrs,List **params_list, bool has_limit);
-extern void tdengine_deparse_analyze(StringInfo buf, char *dbname, char *relname);
+extern void tdengine_deparse_analyze(StringInfo buf, Relation rel, List **retrieved_attrs);
+extern void tdengine_deparse_analyze_probe(StringInfo buf, Relation rel);
+extern void tdengine_deparse_describe_stmt(StringInfo buf, const char *stable_name);
+extern void tdengine_deparse_count_stmt(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel, List *remote_conds);
 extern void tdengine_deparse_string_literal(StringInfo buf, const char *val);
+extern bool tdengine_extract_time_range(PlannerInfo *root, RelOptInfo *baserel, List *remote_conds, Timestamp *lower, Timestamp *upper);
+extern char *tdengine_splice_time_condition(const char *query, int where_end, bool has_where, const char *cond);
 extern List *tdengine_build_tlist_to_deparse(RelOptInfo *foreignrel);
 extern int tdengine_set_transmission_modes(void);
 extern void tdengine_reset_transmission_modes(int nestlevel);
 extern bool tdengine_is_select_all(RangeTblEntry *rte, List *tlist, schemaless_info *pslinfo);
 extern List *tdengine_pull_func_clause(Node *node);
 extern List *tdengine_build_tlist_to_deparse(RelOptInfo *foreignrel);
+extern bool tdengine_is_interval_func(Expr *expr);
+extern bool tdengine_is_window_func(Expr *expr);
+extern bool tdengine_is_time_key_expr(PlannerInfo *root, RelOptInfo *rel, Expr *expr);
+extern Expr *tdengine_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel);
 
 extern char *tdengine_get_data_type_name(Oid data_type_id);
 extern char *tdengine_get_column_name(Oid relid, int attnum);
@@ -247,10 +398,63 @@ extern char *tdengine_get_slvar(Expr *node, schemaless_info *slinfo);
 extern bool tdengine_is_slvar(Oid oid, int attnum, schemaless_info *pslinfo, bool *is_tags, bool *is_fields);
 extern bool tdengine_is_slvar_fetch(Node *node, schemaless_info *pslinfo);
 extern bool tdengine_is_param_fetch(Node *node, schemaless_info *pslinfo);
+extern void tdengine_append_line_protocol(StringInfo buf, const char *measurement, Datum tags, Datum fields, bool has_time, int64 ts);
 
 /* tdengine_query.c headers */
 extern Datum tdengine_convert_to_pg(Oid pgtyp, int pgtypmod, char *value);
 extern Datum tdengine_convert_record_to_datum(Oid pgtyp, int pgtypmod, char **row, int attnum, int ntags, int nfield,char **column, char *opername, Oid relid, int ncol, bool is_schemaless);
 
 extern void tdengine_bind_sql_var(Oid type, int attnum, Datum value, TDengineColumnInfo *param_column_info,TDengineType * param_tdengine_types, TDengineValue * param_tdengine_values);
+extern Timestamp tdengine_time_to_pg(int64 value, int precision);
+extern char *tdengine_format_time_literal(Timestamp ts);
+extern int64 tdengine_time_from_pg(Timestamp ts, int precision);
+extern void tdengine_bind_column(Oid type, int remote_type, Datum *values, bool *isnull, int nrow, int precision, TDengineBindColumn *col);
+extern Datum tdengine_convert_cell_to_datum(Oid pgtyp, int pgtypmod, FmgrInfo *typinput, Oid typioparam, TDengineCell *cell, int precision);
+extern Datum tdengine_convert_text_to_datum(Oid pgtyp, int pgtypmod, FmgrInfo *typinput, Oid typioparam, char *value);
+
+/* query.cpp headers */
+extern TDengineCursor *TDengineCursorOpen(char *query, UserMapping *user, tdengine_opt *options, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, int param_num, bool async, const TDengineCacheScan *cache);
+extern int TDengineCursorWaitFd(TDengineCursor *cursor);
+extern List *TDengineDescribeTags(UserMapping *user, tdengine_opt *options, const char *stable_name);
+extern double TDengineQueryCount(UserMapping *user, tdengine_opt *options, char *query);
+extern bool TDengineCursorIsReady(TDengineCursor *cursor);
+extern int TDengineCursorFetch(TDengineCursor *cursor, TDengineResult *result, int max_rows, bool binary);
+extern void TDengineCursorClose(TDengineCursor *cursor);
+extern TDengineCursor *TDengineCursorOpenTopic(UserMapping *user, tdengine_opt *options);
+extern void TDengineCursorCloseAll(void);
+extern void TDengineCursorCloseSubXact(int level);
+extern char *tdengine_cell_to_cstring(TDengineCell *cell, int precision);
+extern TDengineInsertStmt *TDengineInsertPrepare(const char *sql, UserMapping *user, tdengine_opt *options);
+extern char *TDengineInsertDescribe(TDengineInsertStmt *stmt, int **types, int *ncol, int *precision);
+extern char *TDengineInsertSubmit(TDengineInsertStmt *stmt, TDengineBindColumn *columns, int ncol, int nrow);
+extern char *TDengineInsertWait(TDengineInsertStmt *stmt, double *elapsed_ms);
+extern char *TDengineSchemalessInsert(UserMapping *user, tdengine_opt *options, const char *lines, int len);
+extern void TDengineInsertClose(TDengineInsertStmt *stmt);
+extern void TDengineInsertCloseAll(void);
+extern void TDengineInsertCloseSubXact(int level);
+extern void tdengine_stmt_cache_init(void);
+
+/* cache.cpp headers */
+extern void tdengine_result_cache_init(void);
+extern uint32 tdengine_result_cache_table_key(Oid serverid, tdengine_opt *options);
+extern void tdengine_result_cache_invalidate(uint32 table);
+extern void tdengine_result_cache_begin_write(uint32 table);
+extern void tdengine_result_cache_xact_end(bool commit);
+
+/* tail.cpp headers */
+extern char *tdengine_tail_consumer;
+extern int tdengine_tail_lag;
+extern void tdengine_tail_init(void);
+extern bool tdengine_tail_position(Oid relid, const char *consumer, Timestamp *hwm);
+extern void tdengine_tail_advance(Oid relid, const char *consumer, Timestamp hwm);
+extern void tdengine_tail_xact_end(bool commit);
+extern void tdengine_tail_reset(Oid relid, const char *consumer);
+
+/* tmq.cpp headers */
+extern void tdengine_tmq_xact_end(bool commit);
+extern void tdengine_tmq_cleanup(void);
+
+/* pool.cpp headers */
+extern void tdengine_pool_init(void);
+extern PGDLLEXPORT void tdengine_pool_worker_main(Datum main_arg);
 
@@ -7,6 +7,7 @@
 #include "access/reloptions.h"
 #include "access/htup_details.h"
 #include "access/sysattr.h"
+#include "access/xact.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "optimizer/appendinfo.h"
@@ -28,6 +29,8 @@
 #include "utils/array.h"
 #include "utils/date.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/json.h"
 #include "utils/timestamp.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
@@ -41,12 +44,16 @@
 #include "commands/defrem.h"
 #include "commands/explain.h"
 #include "commands/vacuum.h"
+#include "common/hashfn.h"
+#include "executor/execAsync.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "parser/parsetree.h"
+#include "utils/acl.h"
+#include "utils/sampling.h"
 #include "utils/typcache.h"
 #include "utils/selfuncs.h"
 #include "utils/syscache.h"
@@ -54,15 +61,61 @@
 /* If no remote estimates, assume a sort costs 20% extra */
 #define DEFAULT_FDW_SORT_MULTIPLIER 1.2
 
+/* 并行扫描时每个参与进程平均分到的时间段数，多于 1 个以平衡各进程的负载 */
+#define TDENGINE_PARALLEL_CHUNKS_PER_WORKER 4
+
+/* ANALYZE 时远程行数超过采样行数的该倍数后，改为按时间段分段采样 */
+#define TDENGINE_ANALYZE_FULL_SCAN_FACTOR 10
+
+/* ANALYZE 分段采样时把时间范围切分成的段数 */
+#define TDENGINE_ANALYZE_STRIDES 100
+
+/* ANALYZE 分段采样时读取的行数为采样行数的该倍数，由蓄水池抽样从中选取样本 */
+#define TDENGINE_ANALYZE_OVERSAMPLE 10
+
+/* attr_colidx 中的特殊值：结果中不存在该列，或该列为无模式的 tags/fields 列 */
+#define TDENGINE_COLIDX_NONE (-1)
+#define TDENGINE_COLIDX_SL_TAGS (-2)
+#define TDENGINE_COLIDX_SL_FIELDS (-3)
+
+/* 每个后端最多缓存的远程行数估算结果数，超过时淘汰最早取得的结果 */
+#define TDENGINE_REMOTE_COUNT_CACHE_SIZE 1024
+
+/* 缓存的远程行数的有效毫秒数，时序数据持续写入，过期后重新查询 */
+#define TDENGINE_REMOTE_COUNT_TTL_MS 60000
+
+/* 远程行数估算结果的缓存项，键为外部表 OID 与 COUNT(*) 语句的哈希值 */
+typedef struct RemoteCountCacheKey
+{
+    Oid relid;
+    uint32 sql_hash;
+} RemoteCountCacheKey;
+
+typedef struct RemoteCountCacheEntry
+{
+    RemoteCountCacheKey key;
+    char *sql;    /* 用于排除哈希冲突，分配在 CacheMemoryContext 中 */
+    double count;
+    TimestampTz fetched; /* 取得计数的时间 */
+} RemoteCountCacheEntry;
+
+static HTAB *RemoteCountHash = NULL;
+
 extern PGDLLEXPORT void _PG_init(void);
 
 static void tdengine_fdw_exit(int code, Datum arg);
+static void tdengine_fdw_xact_callback(XactEvent event, void *arg);
+static void tdengine_fdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                          SubTransactionId parentSubid, void *arg);
+static double tdengine_remote_count(Oid relid, UserMapping *user, tdengine_opt *options, char *sql);
+static void tdengine_remote_count_inval_callback(Datum arg, Oid relid);
 
 extern Datum tdengine_fdw_handler(PG_FUNCTION_ARGS);
 extern Datum tdengine_fdw_validator(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(tdengine_fdw_handler);
 PG_FUNCTION_INFO_V1(tdengine_fdw_version);
+PG_FUNCTION_INFO_V1(tdengine_reset_tail);
 
 // 用于估计外部表的大小和成本，为查询规划器提供必要的信息。
 static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
@@ -70,6 +123,10 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
 static void tdengineGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
 // 根据选择的最佳路径生成外部扫描计划。
 static ForeignScan *tdengineGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan);
+// 为同一服务器上外部表之间的连接生成在远程执行的路径
+static void tdengineGetForeignJoinPaths(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel, RelOptInfo *innerrel, JoinType jointype, JoinPathExtraData *extra);
+// 为分组聚合、排序和 LIMIT 等上层处理生成在远程执行的路径
+static void tdengineGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage, RelOptInfo *input_rel, RelOptInfo *output_rel, void *extra);
 // 获取执行ForeignScan算子所需的信息，并将它们组织并保存在ForeignScanState中
 static void tdengineBeginForeignScan(ForeignScanState *node,
                                      int eflags);
@@ -79,17 +136,67 @@ static TupleTableSlot *tdengineIterateForeignScan(ForeignScanState *node);
 static void tdengineReScanForeignScan(ForeignScanState *node);
 // 释放整个ForeignScan算子执行过程中占用的外部资源或FDW中的资源
 static void tdengineEndForeignScan(ForeignScanState *node);
+// 并行扫描支持
+static bool tdengineIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte);
+static Size tdengineEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt);
+static void tdengineInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate);
+static void tdengineReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate);
+static void tdengineInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate);
+// 异步执行支持
+static bool tdengineIsForeignPathAsyncCapable(ForeignPath *path);
+static void tdengineForeignAsyncRequest(AsyncRequest *areq);
+static void tdengineForeignAsyncConfigureWait(AsyncRequest *areq);
+static void tdengineForeignAsyncNotify(AsyncRequest *areq);
+// 插入支持
+static List *tdenginePlanForeignModify(PlannerInfo *root, ModifyTable *plan, Index resultRelation, int subplan_index);
+static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo, List *fdw_private, int subplan_index, int eflags);
+static TupleTableSlot *tdengineExecForeignInsert(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot *slot, TupleTableSlot *planSlot);
+static TupleTableSlot **tdengineExecForeignBatchInsert(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot **slots, TupleTableSlot **planSlots, int *numSlots);
+static int tdengineGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+static void tdengineEndForeignModify(EState *estate, ResultRelInfo *resultRelInfo);
+static void tdengineBeginForeignInsert(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo);
+static void tdengineEndForeignInsert(EState *estate, ResultRelInfo *resultRelInfo);
+static TDengineFdwExecState *create_foreign_modify(EState *estate, RangeTblEntry *rte, ResultRelInfo *resultRelInfo, CmdType operation, Plan *subplan, char *query, List *target_attrs);
+// ANALYZE 支持
+static bool tdengineAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages);
+static int tdengineAcquireSampleRowsFunc(Relation relation, int elevel, HeapTuple *rows, int targrows, double *totalrows, double *totaldeadrows);
 
 static void tdengine_to_pg_type(StringInfo str, char *typname);
 
-static void prepare_query_params(PlanState *node, List *fdw_exprs, List *remote_exprs, Oid foreigntableid, int numParams, FmgrInfo **param_flinfo, List **param_exprs, const char ***param_values, Oid **param_types, TDengineType **param_tdengine_types, TDengineValue **param_tdengine_values, TDengineColumnInfo **param_column_info);
+static bool tdengine_foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel, Node *havingQual);
+static double tdengine_estimate_num_groups(PlannerInfo *root, RelOptInfo *grouped_rel, double input_rows);
+static void add_foreign_grouping_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *grouped_rel, GroupPathExtraData *extra);
+static void add_foreign_ordered_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *ordered_rel);
+static void add_foreign_final_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *final_rel, FinalPathExtraData *extra);
+static void tdengine_copy_fpinfo(TDengineFdwRelationInfo *fpinfo, TDengineFdwRelationInfo *ifpinfo);
+static bool tdengine_time_pathkeys_ok(PlannerInfo *root, RelOptInfo *baserel, List *pathkeys);
+static List *tdengine_param_path_infos(PlannerInfo *root, RelOptInfo *baserel);
+static bool ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec, EquivalenceMember *em, void *arg);
+static bool tdengine_join_clause_ok(PlannerInfo *root, RelOptInfo *outerrel, RelOptInfo *innerrel, Expr *clause, bool *has_time, bool *has_tag);
+
+static void prepare_query_params(PlanState *node, List *fdw_exprs, List *param_column_types, Oid foreigntableid, int numParams, FmgrInfo **param_flinfo, List **param_exprs, const char ***param_values, Oid **param_types, TDengineType **param_tdengine_types, TDengineValue **param_tdengine_values, TDengineColumnInfo **param_column_info);
+static List *tdengine_param_column_types(PlannerInfo *root, RelOptInfo *baserel, List *remote_exprs, List *params_list);
+static bool tdengine_param_belong_to_qual(Node *qual, Node *param);
 
 static void process_query_params(ExprContext *econtext, FmgrInfo *param_flinfo, List *param_exprs, const char **param_values, Oid *param_types, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, TDengineColumnInfo *param_column_info);
 
 static void create_cursor(ForeignScanState *node);
+static void fetch_more_data(ForeignScanState *node);
+static void close_cursor(TDengineFdwExecState *festate);
+static bool tdengine_next_parallel_chunk(ForeignScanState *node);
+static void map_result_columns(ForeignScanState *node);
+static void make_tuple_from_result_row(TDengineRow *result_row, TDengineResult *result, TupleDesc tupleDescriptor, Datum *row, bool *is_null, Oid relid, TDengineFdwExecState *festate, bool is_agg);
+static char *make_schemaless_jsonb(TDengineRow *result_row, TDengineResult *result, TDengineFdwExecState *festate, TDengineColumnType want);
 static void execute_dml_stmt(ForeignScanState *node);
 static TupleTableSlot **execute_foreign_insert_modify(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot **slots, TupleTableSlot **planSlots, int numSlots);
-static int tdengine_get_batch_size_option(Relation rel);
+static Timestamp tdengine_insert_time_value(Oid type, Datum value);
+static int tdengine_bind_insert_rows(TDengineFdwExecState *fmstate, TupleDesc tupdesc, char *tablename, TupleTableSlot **slots, int nrow, TDengineBindColumn *columns, Size *bytes);
+static void tdengine_adjust_batch_rows(TDengineFdwExecState *fmstate, int nrow, Size bytes, double elapsed_ms);
+static void tdengine_finish_insert(TDengineFdwExecState *fmstate);
+static void tdengine_insert_schemaless_rows(TDengineFdwExecState *fmstate, TupleDesc tupdesc, char *tablename, TupleTableSlot **slots, int nrow);
+static void tdengine_flush_buffered_inserts(EState *estate, ResultRelInfo *resultRelInfo, TDengineFdwExecState *fmstate);
+static void finish_foreign_modify(EState *estate, ResultRelInfo *resultRelInfo, TDengineFdwExecState *fmstate);
+static int tdengine_get_batch_size_option(Relation rel, bool *is_auto);
 
 /*
  * 此枚举描述了 ForeignPath 的 fdw_private 列表中存储的内容。
@@ -100,6 +207,15 @@ enum FdwPathPrivateIndex
     FdwPathPrivateHasLimit,
 };
 
+/*
+ * ec_member_matches_foreign 的状态，用于逐个列举等价类中可以作为参数化条件的表达式
+ */
+typedef struct
+{
+    Expr *current;      /* 当前处理的表达式，未选定时为 NULL */
+    List *already_used; /* 已经处理过的表达式 */
+} ec_member_foreign_arg;
+
 enum FdwModifyPrivateIndex
 {
     FdwModifyPrivateUpdateSql,
@@ -112,7 +228,8 @@ enum FdwDirectModifyPrivateIndex
     FdwDirectModifyPrivateHasReturning,
     FdwDirectModifyPrivateRetrievedAttrs,
     FdwDirectModifyPrivateSetProcessed,
-    FdwDirectModifyRemoteExprs
+    FdwDirectModifyRemoteExprs,
+    FdwDirectModifyParamColumnTypes
 };
 
 typedef struct TDengineFdwDirectModifyState
@@ -156,6 +273,22 @@ void _PG_init(void)
 {
     /* 注册进程退出回调函数 */
     on_proc_exit(&tdengine_fdw_exit, PointerGetDatum(NULL));
+
+    /* 注册事务回调函数，事务中止时释放未关闭的远程游标 */
+    RegisterXactCallback(tdengine_fdw_xact_callback, NULL);
+    RegisterSubXactCallback(tdengine_fdw_subxact_callback, NULL);
+
+    /* 带参数查询的远程预处理语句缓存 */
+    tdengine_stmt_cache_init();
+
+    /* 共享连接池，需要通过 shared_preload_libraries 加载 */
+    tdengine_pool_init();
+
+    /* 共享结果缓存，同样需要通过 shared_preload_libraries 加载 */
+    tdengine_result_cache_init();
+
+    /* 增量扫描的消费者位置保存在共享内存中 */
+    tdengine_tail_init();
 }
 
 /*
@@ -168,6 +301,51 @@ static void tdengine_fdw_exit(int code, Datum arg)
 {
     /* 清理TDengine C++客户端连接 */
     cleanup_cxx_client_connection();
+
+    /* 关闭订阅表的消费者，未确认的消息重新投递给消费组 */
+    tdengine_tmq_cleanup();
+}
+
+/*
+ * TDengine FDW 事务回调函数
+ *
+ * 事务中止时执行器不会调用 EndForeignScan/EndForeignModify，需要在这里释放仍然打开的
+ * 远程游标和插入语句
+ */
+static void tdengine_fdw_xact_callback(XactEvent event, void *arg)
+{
+    if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    {
+        TDengineCursorCloseAll();
+        TDengineInsertCloseAll();
+        tdengine_result_cache_xact_end(false);
+        tdengine_tail_xact_end(false);
+        tdengine_tmq_xact_end(false);
+    }
+
+    /* 增量扫描的高水位和订阅表读过的消息在提交前确认，失败时事务中止 */
+    if (event == XACT_EVENT_PRE_COMMIT)
+    {
+        tdengine_tail_xact_end(true);
+        tdengine_tmq_xact_end(true);
+        tdengine_result_cache_xact_end(true);
+    }
+}
+
+/*
+ * TDengine FDW 子事务回调函数
+ *
+ * 子事务中止时(例如 PL/pgSQL 的 EXCEPTION 块捕获错误)外层事务继续执行，
+ * 需要释放在该子事务中打开的远程游标和插入语句，否则它们一直保留到顶层事务结束
+ */
+static void tdengine_fdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                          SubTransactionId parentSubid, void *arg)
+{
+    if (event != SUBXACT_EVENT_ABORT_SUB)
+        return;
+
+    TDengineCursorCloseSubXact(GetCurrentTransactionNestLevel());
+    TDengineInsertCloseSubXact(GetCurrentTransactionNestLevel());
 }
 
 Datum tdengine_fdw_version(PG_FUNCTION_ARGS)
@@ -175,6 +353,34 @@ Datum tdengine_fdw_version(PG_FUNCTION_ARGS)
     PG_RETURN_INT32(CODE_VERSION);
 }
 
+/*
+ * tdengine_reset_tail(rel regclass, consumer text) - 清除消费者在外部表上的
+ * 增量扫描位置，之后该消费者重新从头读取。位置由所有用户共享，只有外部表的
+ * 属主可以清除
+ */
+Datum tdengine_reset_tail(PG_FUNCTION_ARGS)
+{
+    Oid relid = PG_GETARG_OID(0);
+    char *consumer = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char relkind = get_rel_relkind(relid);
+
+    if (relkind != RELKIND_FOREIGN_TABLE)
+        ereport(ERROR,
+                (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                 errmsg("tdengine_fdw : relation with OID %u is not a foreign table", relid)));
+
+#if PG_VERSION_NUM >= 160000
+    if (!object_ownercheck(RelationRelationId, relid, GetUserId()))
+#else
+    if (!pg_class_ownercheck(relid, GetUserId()))
+#endif
+        aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_FOREIGN_TABLE, get_rel_name(relid));
+
+    tdengine_tail_reset(relid, consumer);
+
+    PG_RETURN_VOID();
+}
+
 /**
  * =====================注册回调函数======================
  */
@@ -187,16 +393,126 @@ Datum tdengine_fdw_handler(PG_FUNCTION_ARGS)
     fdwroutine->GetForeignRelSize = tdengineGetForeignRelSize;
     fdwroutine->GetForeignPaths = tdengineGetForeignPaths;
     fdwroutine->GetForeignPlan = tdengineGetForeignPlan;
+    fdwroutine->GetForeignJoinPaths = tdengineGetForeignJoinPaths;
+    fdwroutine->GetForeignUpperPaths = tdengineGetForeignUpperPaths;
 
     fdwroutine->BeginForeignScan = tdengineBeginForeignScan;
     fdwroutine->IterateForeignScan = tdengineIterateForeignScan;
     fdwroutine->ReScanForeignScan = tdengineReScanForeignScan;
     fdwroutine->EndForeignScan = tdengineEndForeignScan;
 
+    fdwroutine->IsForeignScanParallelSafe = tdengineIsForeignScanParallelSafe;
+    fdwroutine->EstimateDSMForeignScan = tdengineEstimateDSMForeignScan;
+    fdwroutine->InitializeDSMForeignScan = tdengineInitializeDSMForeignScan;
+    fdwroutine->ReInitializeDSMForeignScan = tdengineReInitializeDSMForeignScan;
+    fdwroutine->InitializeWorkerForeignScan = tdengineInitializeWorkerForeignScan;
+
+    fdwroutine->IsForeignPathAsyncCapable = tdengineIsForeignPathAsyncCapable;
+    fdwroutine->ForeignAsyncRequest = tdengineForeignAsyncRequest;
+    fdwroutine->ForeignAsyncConfigureWait = tdengineForeignAsyncConfigureWait;
+    fdwroutine->ForeignAsyncNotify = tdengineForeignAsyncNotify;
+
+    fdwroutine->PlanForeignModify = tdenginePlanForeignModify;
+    fdwroutine->BeginForeignModify = tdengineBeginForeignModify;
+    fdwroutine->ExecForeignInsert = tdengineExecForeignInsert;
+    fdwroutine->ExecForeignBatchInsert = tdengineExecForeignBatchInsert;
+    fdwroutine->GetForeignModifyBatchSize = tdengineGetForeignModifyBatchSize;
+    fdwroutine->EndForeignModify = tdengineEndForeignModify;
+    fdwroutine->BeginForeignInsert = tdengineBeginForeignInsert;
+    fdwroutine->EndForeignInsert = tdengineEndForeignInsert;
+
+    fdwroutine->AnalyzeForeignTable = tdengineAnalyzeForeignTable;
+
     PG_RETURN_POINTER(fdwroutine);
 }
 
 //========================= GetForeignRelSize ===========================
+/*
+ * 执行 COUNT(*) 查询获取远程行数，结果按外部表缓存
+ *
+ * 外部表定义变化或执行 ANALYZE 时，relcache 失效回调会丢弃缓存；结果超过
+ * TDENGINE_REMOTE_COUNT_TTL_MS 后重新查询。缓存最多保存
+ * TDENGINE_REMOTE_COUNT_CACHE_SIZE 个结果，已满时淘汰最早取得的结果
+ */
+static double
+tdengine_remote_count(Oid relid, UserMapping *user, tdengine_opt *options, char *sql)
+{
+    RemoteCountCacheKey key;
+    RemoteCountCacheEntry *entry;
+    bool found;
+    double count;
+
+    if (RemoteCountHash == NULL)
+    {
+        HASHCTL ctl;
+
+        ctl.keysize = sizeof(RemoteCountCacheKey);
+        ctl.entrysize = sizeof(RemoteCountCacheEntry);
+        RemoteCountHash = hash_create("tdengine_fdw remote counts", 64,
+                                      &ctl, HASH_ELEM | HASH_BLOBS);
+
+        CacheRegisterRelcacheCallback(tdengine_remote_count_inval_callback, (Datum) 0);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.relid = relid;
+    key.sql_hash = hash_bytes((const unsigned char *) sql, strlen(sql));
+
+    entry = (RemoteCountCacheEntry *) hash_search(RemoteCountHash, &key, HASH_FIND, &found);
+    if (found && strcmp(entry->sql, sql) == 0 &&
+        !TimestampDifferenceExceeds(entry->fetched, GetCurrentTimestamp(), TDENGINE_REMOTE_COUNT_TTL_MS))
+        return entry->count;
+
+    count = TDengineQueryCount(user, options, sql);
+
+    /* 已满时淘汰最早取得的结果 */
+    if (!found && hash_get_num_entries(RemoteCountHash) >= TDENGINE_REMOTE_COUNT_CACHE_SIZE)
+    {
+        HASH_SEQ_STATUS scan;
+        RemoteCountCacheEntry *oldest = NULL;
+        RemoteCountCacheEntry *cur;
+
+        hash_seq_init(&scan, RemoteCountHash);
+        while ((cur = (RemoteCountCacheEntry *) hash_seq_search(&scan)))
+        {
+            if (oldest == NULL || cur->fetched < oldest->fetched)
+                oldest = cur;
+        }
+
+        pfree(oldest->sql);
+        hash_search(RemoteCountHash, &oldest->key, HASH_REMOVE, NULL);
+    }
+
+    entry = (RemoteCountCacheEntry *) hash_search(RemoteCountHash, &key, HASH_ENTER, &found);
+    if (found)
+        pfree(entry->sql);
+    entry->sql = MemoryContextStrdup(CacheMemoryContext, sql);
+    entry->count = count;
+    entry->fetched = GetCurrentTimestamp();
+
+    return count;
+}
+
+/*
+ * 外部表失效时丢弃缓存的远程行数
+ */
+static void
+tdengine_remote_count_inval_callback(Datum arg, Oid relid)
+{
+    HASH_SEQ_STATUS scan;
+    RemoteCountCacheEntry *entry;
+
+    hash_seq_init(&scan, RemoteCountHash);
+    while ((entry = (RemoteCountCacheEntry *) hash_seq_search(&scan)))
+    {
+        if (relid == InvalidOid || entry->key.relid == relid)
+        {
+            pfree(entry->sql);
+            hash_search(RemoteCountHash, &entry->key, HASH_REMOVE, NULL);
+        }
+    }
+}
+
 /*
  * 获取给定外部关系的外部扫描的成本和大小估计
  */
@@ -211,16 +527,114 @@ estimate_path_cost_size(PlannerInfo *root, RelOptInfo *foreignrel, List *param_j
     Cost total_cost;
     Cost cpu_per_tuple;
 
-    if (fpinfo->use_remote_estimate)
+    if (IS_UPPER_REL(foreignrel))
+    {
+        /*
+         * 分组聚合在远程执行：在外部关系的扫描代价上加上聚合的代价，
+         * 但只需要取回每个分组的一行
+         */
+        TDengineFdwRelationInfo *ofpinfo = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
+        AggClauseCosts aggcosts;
+        double input_rows = ofpinfo->rows;
+        double num_groups;
+        Cost run_cost;
+
+        Assert(fpinfo->stage == UPPERREL_GROUP_AGG);
+
+        MemSet(&aggcosts, 0, sizeof(AggClauseCosts));
+        if (root->parse->hasAggs)
+            get_agg_clause_costs(root, AGGSPLIT_SIMPLE, &aggcosts);
+
+        num_groups = tdengine_estimate_num_groups(root, foreignrel, input_rows);
+
+        retrieved_rows = num_groups;
+        rows = clamp_row_est(num_groups * fpinfo->local_conds_sel);
+        width = foreignrel->reltarget->width;
+
+        startup_cost = ofpinfo->rel_startup_cost;
+        startup_cost += aggcosts.transCost.startup;
+        startup_cost += aggcosts.transCost.per_tuple * input_rows;
+        startup_cost += aggcosts.finalCost.startup;
+        startup_cost += (cpu_operator_cost * list_length(root->parse->groupClause)) * input_rows;
+
+        run_cost = ofpinfo->rel_total_cost - ofpinfo->rel_startup_cost;
+        run_cost += aggcosts.finalCost.per_tuple * num_groups;
+        run_cost += cpu_tuple_cost * num_groups;
+
+        /* HAVING 中不能下推的条件在本地对每个分组计算 */
+        startup_cost += fpinfo->local_conds_cost.startup;
+        run_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
+
+        if (pathkeys != NIL)
+        {
+            startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+            run_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+        }
+
+        total_cost = startup_cost + run_cost;
+    }
+    else if (IS_JOIN_REL(foreignrel))
     {
-        ereport(ERROR, (errmsg("Remote estimation is unsupported")));
+        /*
+         * TDengine 按时间戳对齐两边的数据，连接的代价与两边的行数之和成正比，
+         * 取回的只是连接的结果
+         */
+        TDengineFdwRelationInfo *fpinfo_o = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
+        TDengineFdwRelationInfo *fpinfo_i = (TDengineFdwRelationInfo *)fpinfo->innerrel->fdw_private;
+        QualCost join_cost;
+        Cost run_cost;
+
+        rows = foreignrel->rows;
+        width = foreignrel->reltarget->width;
+        retrieved_rows = rows;
+
+        cost_qual_eval(&join_cost, fpinfo->joinclauses, root);
+
+        startup_cost = fpinfo_o->rel_startup_cost + fpinfo_i->rel_startup_cost;
+        startup_cost += join_cost.startup;
+
+        run_cost = fpinfo_o->rel_total_cost - fpinfo_o->rel_startup_cost;
+        run_cost += fpinfo_i->rel_total_cost - fpinfo_i->rel_startup_cost;
+        run_cost += (fpinfo_o->rows + fpinfo_i->rows) * join_cost.per_tuple;
+        run_cost += cpu_tuple_cost * rows;
+
+        if (pathkeys != NIL)
+        {
+            startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+            run_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+        }
+
+        total_cost = startup_cost + run_cost;
     }
-    else
+    else if (fpinfo->use_remote_estimate)
     {
         Cost run_cost = 0;
+
         /*
+         * 行数来自 tdengineGetForeignRelSize 中的远程 COUNT(*) 查询。
+         * 远程过滤的代价按每行一次运算符计算，取回的每行再计算本地条件的代价
          */
-        Assert(param_join_conds == NIL);
+        rows = foreignrel->rows;
+        width = foreignrel->reltarget->width;
+        retrieved_rows = fpinfo->retrieved_rows;
+
+        startup_cost = foreignrel->baserestrictcost.startup;
+        run_cost += cpu_operator_cost * foreignrel->tuples;
+        cpu_per_tuple = cpu_tuple_cost + foreignrel->baserestrictcost.per_tuple;
+        run_cost += cpu_per_tuple * retrieved_rows;
+
+        if (pathkeys != NIL)
+        {
+            startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+            run_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+        }
+
+        total_cost = startup_cost + run_cost;
+    }
+    else
+    {
+        Cost run_cost = 0;
+
         /*
          * 对基本对外关系使用set_baserel_size_estimates（）进行的行/宽度估计，
          * 对外关系之间的连接使用set_joinrel_size_estimates（）进行的行/宽度估计。
@@ -269,6 +683,25 @@ estimate_path_cost_size(PlannerInfo *root, RelOptInfo *foreignrel, List *param_j
 
         total_cost = startup_cost + run_cost;
     }
+
+    /*
+     * 参数化路径的连接条件在远程计算，每次扫描只取回满足条件的行。TDengine
+     * 按子表（标签）和时间定位数据，扫描的代价也按条件的选择性缩小
+     */
+    if (param_join_conds != NIL)
+    {
+        Selectivity param_sel = clauselist_selectivity(root, param_join_conds, foreignrel->relid, JOIN_INNER, NULL);
+        QualCost param_cost;
+
+        cost_qual_eval(&param_cost, param_join_conds, root);
+
+        rows = clamp_row_est(rows * param_sel);
+        retrieved_rows = clamp_row_est(retrieved_rows * param_sel);
+        total_cost = startup_cost + (total_cost - startup_cost) * param_sel;
+        startup_cost += param_cost.startup;
+        total_cost += param_cost.startup + param_cost.per_tuple * retrieved_rows;
+    }
+
     // 检查当前扫描是否没有指定排序键（pathkeys）且没有与外部关系的参数化连接条件（param_join_conds）
     // 若满足条件，则进行成本缓存操作
     if (pathkeys == NIL && param_join_conds == NIL)
@@ -350,6 +783,7 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
     baserel->fdw_private = (void *)fpinfo;
 
     userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+    fpinfo->userid = userid;
 
     options = tdengine_get_options(foreigntableid, userid);
 
@@ -357,6 +791,37 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
     tdengine_get_schemaless_info(&(fpinfo->slinfo), options->schemaless, foreigntableid);
 
     fpinfo->pushdown_safe = true;
+    fpinfo->fetch_size = options->fetch_size;
+    fpinfo->async_capable = options->async_capable;
+    fpinfo->use_remote_estimate = options->use_remote_estimate;
+    fpinfo->fdw_startup_cost = options->fdw_startup_cost;
+    fpinfo->fdw_tuple_cost = options->fdw_tuple_cost;
+
+    /*
+     * 订阅表返回的是消费者读到的新消息，不是远程查询的结果：条件都在本地计算，
+     * 也不下推排序、聚合和连接。消费者属于当前后端，不能在并行进程中扫描
+     */
+    if (options->topic != NULL)
+    {
+        fpinfo->is_topic = true;
+        fpinfo->pushdown_safe = false;
+        fpinfo->async_capable = false;
+        fpinfo->use_remote_estimate = false;
+        baserel->consider_parallel = false;
+    }
+
+    /*
+     * 增量扫描的高水位条件只加入基表扫描的查询，聚合、连接下推的查询和并行
+     * 扫描按时间段改写的查询中都没有，会读取整个表，因此增量表不生成这些路径。
+     * 通用计划会在 tdengine_fdw.tail_consumer 改变后继续使用，这里不能只在
+     * 规划时设置了消费者才关闭下推
+     */
+    if (options->topic == NULL && options->tail)
+    {
+        fpinfo->is_tail = true;
+        fpinfo->pushdown_safe = false;
+        baserel->consider_parallel = false;
+    }
 
     // 从系统目录中获取外部表定义信息
     fpinfo->table = GetForeignTable(foreigntableid);
@@ -372,7 +837,7 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
     {
         RestrictInfo *ri = (RestrictInfo *)lfirst(lc);
 
-        if (tdengine_is_foreign_expr(root, baserel, ri->clause, false))
+        if (!fpinfo->is_topic && tdengine_is_foreign_expr(root, baserel, ri->clause, false))
             fpinfo->remote_conds = lappend(fpinfo->remote_conds, ri);
         else
             fpinfo->local_conds = lappend(fpinfo->local_conds, ri);
@@ -385,12 +850,59 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
         pull_varattnos((Node *)rinfo->clause, baserel->relid, &fpinfo->attrs_used);
     }
 
+    /* 增量扫描按读到的最大时间推进高水位，查询未引用时间列时也要取回该列 */
+    if (fpinfo->is_tail)
+    {
+        AttrNumber attnum;
+
+        for (attnum = 1; attnum <= baserel->max_attr; attnum++)
+        {
+            if (get_atttype(foreigntableid, attnum) != InvalidOid &&
+                TDENGINE_IS_TIME_COLUMN(tdengine_get_column_name(foreigntableid, attnum)))
+            {
+                fpinfo->attrs_used = bms_add_member(fpinfo->attrs_used, attnum - FirstLowInvalidHeapAttributeNumber);
+                break;
+            }
+        }
+    }
+
+    // 提取下推条件中时间列的取值范围，用于并行扫描
+    fpinfo->has_time_range = tdengine_extract_time_range(root, baserel, fpinfo->remote_conds, &fpinfo->time_lower, &fpinfo->time_upper);
+
     fpinfo->local_conds_sel = clauselist_selectivity(root, fpinfo->local_conds, baserel->relid, JOIN_INNER, NULL);
     fpinfo->rel_startup_cost = -1;
     fpinfo->rel_total_cost = -1;
     if (fpinfo->use_remote_estimate)
     {
-        ereport(ERROR, (errmsg("Remote estimation is unsupported")));
+        StringInfoData sql;
+        double retrieved;
+
+        fpinfo->user = GetUserMapping(userid, fpinfo->server->serverid);
+
+        /* 表的总行数 */
+        initStringInfo(&sql);
+        tdengine_deparse_count_stmt(&sql, root, baserel, NIL);
+        baserel->tuples = tdengine_remote_count(foreigntableid, fpinfo->user, options, sql.data);
+
+        /* 满足下推条件（包括时间范围）的行数，即实际取回的行数 */
+        if (fpinfo->remote_conds != NIL)
+        {
+            resetStringInfo(&sql);
+            tdengine_deparse_count_stmt(&sql, root, baserel, fpinfo->remote_conds);
+            retrieved = tdengine_remote_count(foreigntableid, fpinfo->user, options, sql.data);
+        }
+        else
+            retrieved = baserel->tuples;
+
+        /* 计算目标列宽度，再用远程行数覆盖本地估算的行数 */
+        set_baserel_size_estimates(root, baserel);
+
+        baserel->pages = (BlockNumber) ceil(baserel->tuples *
+                                            (baserel->reltarget->width + MAXALIGN(SizeofHeapTupleHeader)) / BLCKSZ);
+        fpinfo->retrieved_rows = clamp_row_est(retrieved);
+        baserel->rows = clamp_row_est(retrieved * fpinfo->local_conds_sel);
+
+        estimate_path_cost_size(root, baserel, NIL, NIL, &fpinfo->rows, &fpinfo->width, &fpinfo->startup_cost, &fpinfo->total_cost);
     }
     else
     {
@@ -416,90 +928,918 @@ static void tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oi
 static void
 tdengineGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
 {
-    // 启动成本初始化为 10
-    Cost startup_cost = 10;
-    Cost total_cost = baserel->rows + startup_cost;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)baserel->fdw_private;
+    // 使用 tdengineGetForeignRelSize 中估算的成本
+    Cost startup_cost = fpinfo->startup_cost;
+    Cost total_cost = fpinfo->total_cost;
+    ListCell *lc;
 
     // 输出调试信息，显示当前函数名
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
-    // 重新设置总成本为表的行数
-    total_cost = baserel->rows;
 
     /* 创建一个 ForeignPath 节点并将其作为唯一可能的路径添加 */
     add_path(baserel, (Path *)
     // 创建一个外部扫描路径
     create_foreignscan_path(root, baserel, NULL, baserel->rows, startup_cost, total_cost, NIL, baserel->lateral_relids, NULL, NULL));
-}
 
-//====================== GetForeignPlan ======================
-/*
- * 获取一个外部扫描计划节点
- */
-static ForeignScan *
-tdengineGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
-{
-    // 将外部关系的私有数据转换为 TDengineFdwRelationInfo
-    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)baserel->fdw_private;
-    // 获取扫描关系的ID
-    Index scan_relid = baserel->relid;
-    // 传递给执行器的私有数据列表
-    List *fdw_private = NULL;
-    // 本地执行的表达式列表
-    List *local_exprs = NULL;
-    // 远程执行的表达式列表
-    List *remote_exprs = NULL;
-    // 参数列表
-    List *params_list = NULL;
-    // 传递给外部服务器的目标列表
-    List *fdw_scan_tlist = NIL;
-    // 远程条件列表
-    List *remote_conds = NIL;
+    /* 订阅表只有这一条路径 */
+    if (fpinfo->is_topic)
+        return;
 
-    StringInfoData sql;
-    // 从远程服务器检索的属性列表
-    List *retrieved_attrs;
-    ListCell *lc;
-    List *fdw_recheck_quals = NIL;
-    // 表示是否为 FOR UPDATE 操作的标志
-    int for_update;
-    // 表示查询是否有 LIMIT 子句的标志
-    bool has_limit = false;
+    /*
+     * 查询按时间列排序时（包括降序），再添加一个由远程排序的路径。TDengine 按时间
+     * 存储数据，按时间排序的代价很小，配合 LIMIT 下推可以只取回最新的若干行
+     */
+    if (tdengine_time_pathkeys_ok(root, baserel, root->query_pathkeys))
+    {
+        double rows;
+        int width;
+        Cost sorted_startup_cost;
+        Cost sorted_total_cost;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+        fpinfo->qp_is_pushdown_safe = true;
+
+        estimate_path_cost_size(root, baserel, NIL, root->query_pathkeys, &rows, &width, &sorted_startup_cost, &sorted_total_cost);
 
-    // 决定是否在目标列表中支持函数下推
-    fpinfo->is_tlist_func_pushdown = tdengine_is_foreign_function_tlist(root, baserel, tlist);
+        add_path(baserel, (Path *)create_foreignscan_path(root, baserel, NULL, rows, sorted_startup_cost, sorted_total_cost, root->query_pathkeys, baserel->lateral_relids, NULL, NULL));
+    }
 
     /*
-     * 获取由 tdengineGetForeignUpperPaths() 创建的 FDW 私有数据
+     * 为可以下推的连接条件添加参数化路径：嵌套循环中每个外层行的值作为参数
+     * 代入远程查询，只取回与该行匹配的数据
      */
-    if (best_path->fdw_private)
+    foreach (lc, tdengine_param_path_infos(root, baserel))
     {
-        has_limit = boolVal(list_nth(best_path->fdw_private, FdwPathPrivateHasLimit));
-    }
+        ParamPathInfo *param_info = (ParamPathInfo *)lfirst(lc);
+        double rows;
+        int width;
+        Cost param_startup_cost;
+        Cost param_total_cost;
 
-    // 初始化 SQL 查询字符串
-    initStringInfo(&sql);
+        estimate_path_cost_size(root, baserel, param_info->ppi_clauses, NIL, &rows, &width, &param_startup_cost, &param_total_cost);
 
-    if ((baserel->reloptkind == RELOPT_BASEREL ||
-         baserel->reloptkind == RELOPT_OTHER_MEMBER_REL) &&
-        fpinfo->is_tlist_func_pushdown == false)
+        /* 与规划器对同一参数化关系的行数估计保持一致 */
+        param_info->ppi_rows = rows;
+
+        add_path(baserel, (Path *)create_foreignscan_path(root, baserel, NULL, rows, param_startup_cost, param_total_cost, NIL, param_info->ppi_req_outer, NULL, NIL));
+    }
+
+    /*
+     * 下推条件限定了时间范围时，添加一个并行感知的部分路径，
+     * 各进程分别扫描时间范围内互不相交的时间段。部分路径不能参数化，
+     * 引用了 LATERAL 外层关系的表不生成
+     */
+    if (baserel->consider_parallel && max_parallel_workers_per_gather > 0 &&
+        baserel->lateral_relids == NULL && fpinfo->has_time_range)
     {
-        // 提取实际要从远程 TDengine 获取的列
-        tdengine_extract_slcols(fpinfo, root, baserel, tlist);
+        int parallel_workers = max_parallel_workers_per_gather;
+        double parallel_divisor = parallel_workers + (parallel_leader_participation ? 1.0 : 0.0);
+        ForeignPath *ppath;
+
+        ppath = create_foreignscan_path(root, baserel, NULL, clamp_row_est(baserel->rows / parallel_divisor), startup_cost, startup_cost + (total_cost - startup_cost) / parallel_divisor, NIL, NULL, NULL, NULL);
+        ppath->path.parallel_aware = true;
+        ppath->path.parallel_safe = true;
+        ppath->path.parallel_workers = parallel_workers;
+        add_partial_path(baserel, (Path *)ppath);
+    }
+}
 
-        // 遍历扫描子句列表
-        foreach (lc, scan_clauses)
-        {
-            // 获取当前的限制信息节点
-            RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+/*
+ * tdengine_time_pathkeys_ok - 判断路径键是否都是该外部表的时间列，可以由远程排序
+ */
+static bool
+tdengine_time_pathkeys_ok(PlannerInfo *root, RelOptInfo *baserel, List *pathkeys)
+{
+    ListCell *lc;
 
-            Assert(IsA(rinfo, RestrictInfo));
+    if (pathkeys == NIL)
+        return false;
 
-            if (rinfo->pseudoconstant)
-                continue;
+    foreach (lc, pathkeys)
+    {
+        PathKey *pathkey = (PathKey *)lfirst(lc);
+        EquivalenceClass *ec = pathkey->pk_eclass;
 
-            if (list_member_ptr(fpinfo->remote_conds, rinfo))
+        /* 包含易变表达式的等价类不能下推 */
+        if (ec->ec_has_volatile)
+            return false;
+
+        if (!tdengine_is_time_key_expr(root, baserel, tdengine_find_em_expr_for_rel(ec, baserel)))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * tdengine_param_path_infos - 收集可以用于参数化路径的连接条件，按所需的外层关系分组
+ *
+ * 连接条件既可能在 joininfo 中，也可能是由等价类推导出的等值条件
+ */
+static List *
+tdengine_param_path_infos(PlannerInfo *root, RelOptInfo *baserel)
+{
+    List *ppi_list = NIL;
+    ListCell *lc;
+
+    foreach (lc, baserel->joininfo)
+    {
+        RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+        Relids required_outer;
+
+        if (!join_clause_is_movable_to(rinfo, baserel))
+            continue;
+
+        if (!tdengine_is_foreign_expr(root, baserel, rinfo->clause, false))
+            continue;
+
+        required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+        required_outer = bms_del_member(required_outer, baserel->relid);
+        if (bms_is_empty(required_outer))
+            continue;
+
+        ppi_list = list_append_unique_ptr(ppi_list, get_baserel_parampathinfo(root, baserel, required_outer));
+    }
+
+    if (baserel->has_eclass_joins)
+    {
+        ec_member_foreign_arg arg;
+
+        arg.already_used = NIL;
+        for (;;)
+        {
+            List *clauses;
+
+            /* 每次处理该关系在等价类中的一个表达式 */
+            arg.current = NULL;
+            clauses = generate_implied_equalities_for_column(root, baserel, ec_member_matches_foreign, (void *)&arg, baserel->lateral_referencers);
+
+            if (arg.current == NULL)
+                break;
+
+            foreach (lc, clauses)
+            {
+                RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+                Relids required_outer;
+
+                if (!join_clause_is_movable_to(rinfo, baserel))
+                    continue;
+
+                if (!tdengine_is_foreign_expr(root, baserel, rinfo->clause, false))
+                    continue;
+
+                required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+                required_outer = bms_del_member(required_outer, baserel->relid);
+                if (bms_is_empty(required_outer))
+                    continue;
+
+                ppi_list = list_append_unique_ptr(ppi_list, get_baserel_parampathinfo(root, baserel, required_outer));
+            }
+
+            arg.already_used = lappend(arg.already_used, arg.current);
+        }
+    }
+
+    return ppi_list;
+}
+
+/*
+ * ec_member_matches_foreign - generate_implied_equalities_for_column 的回调
+ *
+ * 每次只接受一个尚未处理过的表达式，使推导出的条件都针对同一个列
+ */
+static bool
+ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec, EquivalenceMember *em, void *arg)
+{
+    ec_member_foreign_arg *state = (ec_member_foreign_arg *)arg;
+    Expr *expr = em->em_expr;
+
+    if (state->current != NULL)
+        return equal(expr, state->current);
+
+    if (list_member(state->already_used, expr))
+        return false;
+
+    state->current = expr;
+    return true;
+}
+
+//===================== GetForeignJoinPaths =====================
+/*
+ * tdengine_join_clause_ok - 判断连接条件是否为 TDengine 支持的形式
+ *
+ * TDengine 的连接按时间戳对齐，连接条件只能是两表时间列相等或标签列相等。
+ * 时间列相等时设置 *has_time，标签列相等时设置 *has_tag
+ */
+static bool
+tdengine_join_clause_ok(PlannerInfo *root, RelOptInfo *outerrel, RelOptInfo *innerrel, Expr *clause, bool *has_time, bool *has_tag)
+{
+    OpExpr *op;
+    Var *left;
+    Var *right;
+    char *opname;
+
+    if (!IsA(clause, OpExpr) || list_length(((OpExpr *)clause)->args) != 2)
+        return false;
+
+    op = (OpExpr *)clause;
+    opname = get_opname(op->opno);
+    if (opname == NULL || strcmp(opname, "=") != 0)
+        return false;
+
+    left = (Var *)strip_implicit_coercions((Node *)linitial(op->args));
+    right = (Var *)strip_implicit_coercions((Node *)lsecond(op->args));
+    if (!IsA(left, Var) || !IsA(right, Var))
+        return false;
+
+    /* 统一为左边来自外部关系、右边来自内部关系 */
+    if (bms_is_member(left->varno, innerrel->relids))
+    {
+        Var *tmp = left;
+
+        left = right;
+        right = tmp;
+    }
+    if (!bms_is_member(left->varno, outerrel->relids) || !bms_is_member(right->varno, innerrel->relids))
+        return false;
+
+    if (tdengine_is_time_key_expr(root, outerrel, (Expr *)left) &&
+        tdengine_is_time_key_expr(root, innerrel, (Expr *)right))
+    {
+        *has_time = true;
+        return true;
+    }
+
+    if (left->varattno > 0 && right->varattno > 0)
+    {
+        Oid outer_relid = planner_rt_fetch(left->varno, root)->relid;
+        Oid inner_relid = planner_rt_fetch(right->varno, root)->relid;
+
+        if (tdengine_is_tag_key(tdengine_get_column_name(outer_relid, left->varattno), outer_relid) &&
+            tdengine_is_tag_key(tdengine_get_column_name(inner_relid, right->varattno), inner_relid))
+        {
+            *has_tag = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * tdengineGetForeignJoinPaths - 为同一服务器、同一数据库中两个外部表的内连接添加下推路径
+ *
+ * 只支持 TDengine 能执行的连接：两表时间列相等的内连接，可以附加标签列相等的条件，
+ * 映射到超级表时必须带有标签列相等的条件。下推路径与本地连接按代价比较
+ */
+static void
+tdengineGetForeignJoinPaths(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel, RelOptInfo *innerrel, JoinType jointype, JoinPathExtraData *extra)
+{
+    TDengineFdwRelationInfo *fpinfo;
+    TDengineFdwRelationInfo *fpinfo_o = (TDengineFdwRelationInfo *)outerrel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo_i = (TDengineFdwRelationInfo *)innerrel->fdw_private;
+    tdengine_opt *options_o;
+    tdengine_opt *options_i;
+    ForeignPath *joinpath;
+    bool has_time = false;
+    bool has_tag = false;
+    ListCell *lc;
+    double rows;
+    int width;
+    Cost startup_cost;
+    Cost total_cost;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 同一个连接关系可能被调用多次，只需处理一次 */
+    if (joinrel->fdw_private)
+        return;
+
+    /* TDengine 不支持行锁，修改语句中的连接需要 EPQ 重新检查，都不下推 */
+    if (root->parse->commandType != CMD_SELECT || root->rowMarks)
+        return;
+
+    fpinfo = (TDengineFdwRelationInfo *)palloc0(sizeof(TDengineFdwRelationInfo));
+    fpinfo->pushdown_safe = false;
+    joinrel->fdw_private = fpinfo;
+
+    if (jointype != JOIN_INNER)
+        return;
+
+    /* 两边都必须是可以下推的普通外部表扫描 */
+    if (!fpinfo_o || !fpinfo_o->pushdown_safe || !fpinfo_i || !fpinfo_i->pushdown_safe)
+        return;
+    if (outerrel->reloptkind != RELOPT_BASEREL || innerrel->reloptkind != RELOPT_BASEREL)
+        return;
+    if (fpinfo_o->server->serverid != fpinfo_i->server->serverid)
+        return;
+
+    /* 两边以不同用户访问时使用不同的用户映射，不能在同一个连接上执行 */
+    if (fpinfo_o->userid != fpinfo_i->userid)
+        return;
+    if (fpinfo_o->slinfo.schemaless || fpinfo_i->slinfo.schemaless)
+        return;
+
+    /* 两边的本地条件需要在连接前计算 */
+    if (fpinfo_o->local_conds || fpinfo_i->local_conds)
+        return;
+
+    /* 两个表必须在同一个数据库中 */
+    options_o = tdengine_get_options(fpinfo_o->table->relid, fpinfo_o->userid);
+    options_i = tdengine_get_options(fpinfo_i->table->relid, fpinfo_i->userid);
+    if ((options_o->svr_database == NULL) != (options_i->svr_database == NULL) ||
+        (options_o->svr_database && strcmp(options_o->svr_database, options_i->svr_database) != 0))
+        return;
+
+    foreach (lc, extra->restrictlist)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+        if (rinfo->pseudoconstant)
+            return;
+
+        if (!tdengine_join_clause_ok(root, outerrel, innerrel, rinfo->clause, &has_time, &has_tag))
+            return;
+
+        fpinfo->joinclauses = lappend(fpinfo->joinclauses, rinfo);
+    }
+
+    /* 连接必须按时间对齐；超级表之间还需要按标签对应子表 */
+    if (!has_time)
+        return;
+    if ((options_o->stable_name || options_i->stable_name) && !has_tag)
+        return;
+
+    fpinfo->outerrel = outerrel;
+    fpinfo->innerrel = innerrel;
+    fpinfo->jointype = jointype;
+    tdengine_copy_fpinfo(fpinfo, fpinfo_o);
+
+    /* 两边的下推条件和连接条件一起写在远程查询的 WHERE 子句中 */
+    fpinfo->remote_conds = list_concat(list_copy(fpinfo_o->remote_conds), fpinfo_i->remote_conds);
+    fpinfo->remote_conds = list_concat(fpinfo->remote_conds, fpinfo->joinclauses);
+    fpinfo->local_conds = NIL;
+    fpinfo->local_conds_sel = 1.0;
+    fpinfo->joinclause_sel = clauselist_selectivity(root, fpinfo->joinclauses, 0, JOIN_INNER, extra->sjinfo);
+    fpinfo->rel_startup_cost = -1;
+    fpinfo->rel_total_cost = -1;
+    fpinfo->pushdown_safe = true;
+    fpinfo->relation_name = psprintf("(%s) INNER JOIN (%s)", fpinfo_o->relation_name, fpinfo_i->relation_name);
+
+    estimate_path_cost_size(root, joinrel, NIL, NIL, &rows, &width, &startup_cost, &total_cost);
+
+    fpinfo->rows = rows;
+    fpinfo->width = width;
+    fpinfo->startup_cost = startup_cost;
+    fpinfo->total_cost = total_cost;
+
+    joinpath = create_foreign_join_path(root, joinrel, NULL, rows, startup_cost, total_cost, NIL, joinrel->lateral_relids, NULL, NIL);
+
+    add_path(joinrel, (Path *)joinpath);
+}
+
+//===================== GetForeignUpperPaths =====================
+/*
+ * tdengineGetForeignUpperPaths - 为上层关系添加在远程执行的路径
+ *
+ * 目前支持分组聚合（包括按 tdengine_time() 等窗口函数划分窗口）、对分组结果的排序
+ * 和 LIMIT/OFFSET，下推的路径与本地执行的路径按代价比较
+ */
+static void
+tdengineGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage, RelOptInfo *input_rel, RelOptInfo *output_rel, void *extra)
+{
+    TDengineFdwRelationInfo *fpinfo;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 输入关系本身不能下推时，上层处理也不能下推 */
+    if (!input_rel->fdw_private ||
+        !((TDengineFdwRelationInfo *)input_rel->fdw_private)->pushdown_safe)
+        return;
+
+    /* 只处理分组聚合、排序和最终的 LIMIT */
+    if (stage != UPPERREL_GROUP_AGG &&
+        stage != UPPERREL_ORDERED &&
+        stage != UPPERREL_FINAL)
+        return;
+
+    /* 同一个上层关系可能被调用多次，只需处理一次 */
+    if (output_rel->fdw_private)
+        return;
+
+    fpinfo = (TDengineFdwRelationInfo *)palloc0(sizeof(TDengineFdwRelationInfo));
+    fpinfo->pushdown_safe = false;
+    fpinfo->stage = stage;
+    output_rel->fdw_private = fpinfo;
+
+    switch (stage)
+    {
+        case UPPERREL_GROUP_AGG:
+            add_foreign_grouping_paths(root, input_rel, output_rel, (GroupPathExtraData *)extra);
+            break;
+        case UPPERREL_ORDERED:
+            add_foreign_ordered_paths(root, input_rel, output_rel);
+            break;
+        case UPPERREL_FINAL:
+            add_foreign_final_paths(root, input_rel, output_rel, (FinalPathExtraData *)extra);
+            break;
+        default:
+            elog(ERROR, "unexpected upper relation: %d", (int)stage);
+            break;
+    }
+}
+
+/*
+ * tdengine_copy_fpinfo - 从输入关系复制外部表、服务器和代价相关的选项
+ */
+static void
+tdengine_copy_fpinfo(TDengineFdwRelationInfo *fpinfo, TDengineFdwRelationInfo *ifpinfo)
+{
+    fpinfo->table = ifpinfo->table;
+    fpinfo->server = ifpinfo->server;
+    fpinfo->user = ifpinfo->user;
+    fpinfo->userid = ifpinfo->userid;
+    fpinfo->slinfo = ifpinfo->slinfo;
+    fpinfo->fetch_size = ifpinfo->fetch_size;
+    fpinfo->async_capable = ifpinfo->async_capable;
+    fpinfo->use_remote_estimate = ifpinfo->use_remote_estimate;
+    fpinfo->fdw_startup_cost = ifpinfo->fdw_startup_cost;
+    fpinfo->fdw_tuple_cost = ifpinfo->fdw_tuple_cost;
+    fpinfo->shippable_extensions = ifpinfo->shippable_extensions;
+}
+
+/*
+ * tdengine_foreign_grouping_ok - 判断分组聚合能否整体下推，并构建下推的目标列表
+ *
+ * 分组表达式和聚合函数都必须能在远程执行；HAVING 条件在本地对聚合结果计算，
+ * 其中用到的聚合函数加入下推的目标列表
+ */
+static bool
+tdengine_foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel, Node *havingQual)
+{
+    Query *query = root->parse;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)grouped_rel->fdw_private;
+    PathTarget *grouping_target = grouped_rel->reltarget;
+    TDengineFdwRelationInfo *ofpinfo = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
+    List *tlist = NIL;
+    ListCell *lc;
+    bool has_window = false;
+    int i;
+
+    /* TDengine 不支持分组集 */
+    if (query->groupingSets)
+        return false;
+
+    /* 扫描还有本地条件时，远程聚合的输入与本地不同 */
+    if (ofpinfo->local_conds)
+        return false;
+
+    i = 0;
+    foreach (lc, grouping_target->exprs)
+    {
+        Expr *expr = (Expr *)lfirst(lc);
+        Index sgref = get_pathtarget_sortgroupref(grouping_target, i);
+        ListCell *l;
+
+        if (sgref && get_sortgroupref_clause_noerr(sgref, query->groupClause))
+        {
+            TargetEntry *tle;
+
+            /* 分组表达式必须能在远程计算 */
+            if (!tdengine_is_foreign_expr(root, grouped_rel, expr, true))
+                return false;
+
+            /* 一个查询只能有一个窗口子句 */
+            if (tdengine_is_window_func(expr))
+            {
+                if (has_window)
+                    return false;
+                has_window = true;
+            }
+
+            /* 重复的分组表达式无法与结果列一一对应，不下推 */
+            if (tlist_member(expr, tlist))
+                return false;
+
+            tle = makeTargetEntry(expr, list_length(tlist) + 1, NULL, false);
+            tle->ressortgroupref = sgref;
+            tlist = lappend(tlist, tle);
+        }
+        else if (tdengine_is_foreign_expr(root, grouped_rel, expr, true))
+        {
+            tlist = add_to_flat_tlist(tlist, list_make1(expr));
+        }
+        else
+        {
+            /* 表达式本身不能下推时，其中的聚合函数必须能下推，其余部分在本地计算 */
+            List *aggvars = pull_var_clause((Node *)expr, PVC_INCLUDE_AGGREGATES);
+
+            if (!tdengine_is_foreign_expr(root, grouped_rel, (Expr *)aggvars, true))
+                return false;
+
+            foreach (l, aggvars)
+            {
+                Expr *aggref = (Expr *)lfirst(l);
+
+                if (IsA(aggref, Aggref))
+                    tlist = add_to_flat_tlist(tlist, list_make1(aggref));
+            }
+        }
+
+        i++;
+    }
+
+    /* HAVING 条件在本地对远程返回的聚合结果计算 */
+    if (havingQual)
+    {
+        foreach (lc, (List *)havingQual)
+        {
+            Expr *expr = (Expr *)lfirst(lc);
+            RestrictInfo *rinfo;
+
+            rinfo = make_restrictinfo(root, expr, true, false, false, root->qual_security_level, grouped_rel->relids, NULL, NULL);
+            fpinfo->local_conds = lappend(fpinfo->local_conds, rinfo);
+        }
+    }
+
+    /* 本地条件中用到的聚合函数需要在远程计算 */
+    if (fpinfo->local_conds)
+    {
+        List *aggvars = NIL;
+
+        foreach (lc, fpinfo->local_conds)
+        {
+            RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+            aggvars = list_concat(aggvars, pull_var_clause((Node *)rinfo->clause, PVC_INCLUDE_AGGREGATES));
+        }
+
+        foreach (lc, aggvars)
+        {
+            Expr *expr = (Expr *)lfirst(lc);
+
+            if (IsA(expr, Aggref))
+            {
+                if (!tdengine_is_foreign_expr(root, grouped_rel, expr, true))
+                    return false;
+
+                tlist = add_to_flat_tlist(tlist, list_make1(expr));
+            }
+        }
+    }
+
+    fpinfo->grouped_tlist = tlist;
+    fpinfo->pushdown_safe = true;
+
+    /* 本地条件的代价和选择性 */
+    fpinfo->local_conds_sel = clauselist_selectivity(root, fpinfo->local_conds, 0, JOIN_INNER, NULL);
+    cost_qual_eval(&fpinfo->local_conds_cost, fpinfo->local_conds, root);
+
+    fpinfo->relation_name = psprintf("Aggregate on (%s)", ofpinfo->relation_name);
+
+    return true;
+}
+
+/*
+ * tdengine_estimate_num_groups - 估计远程分组聚合返回的行数
+ *
+ * tdengine_time()/tdengine_interval() 时间窗口的数量按下推条件中的时间范围和
+ * 窗口的步长计算；时间范围未知时，以及会话、状态和事件窗口，按默认的不同值
+ * 个数估计；其余分组列按统计信息估计
+ */
+static double
+tdengine_estimate_num_groups(PlannerInfo *root, RelOptInfo *grouped_rel, double input_rows)
+{
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)grouped_rel->fdw_private;
+    TDengineFdwRelationInfo *ofpinfo = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
+    List *group_exprs = NIL;
+    double num_groups = 1;
+    ListCell *lc;
+
+    if (root->parse->groupClause == NIL)
+        return 1;
+
+    foreach (lc, get_sortgrouplist_exprs(root->parse->groupClause, fpinfo->grouped_tlist))
+    {
+        Expr *expr = (Expr *)lfirst(lc);
+
+        if (tdengine_is_window_func(expr))
+        {
+            List *args = ((FuncExpr *)expr)->args;
+            Node *width = NULL;
+            double windows = DEFAULT_NUM_DISTINCT;
+
+            /* 滑动窗口的个数由滑动步长决定 */
+            if (tdengine_is_interval_func(expr))
+                width = (Node *)(strcmp(get_func_name(((FuncExpr *)expr)->funcid), "tdengine_interval") == 0 ?
+                                 lthird(args) : lsecond(args));
+
+            if (ofpinfo->has_time_range && width != NULL && IsA(width, Const) &&
+                ((Const *)width)->consttype == INTERVALOID && !((Const *)width)->constisnull)
+            {
+                Interval *interval = DatumGetIntervalP(((Const *)width)->constvalue);
+                double usecs = interval->time + (interval->day + interval->month * (double)DAYS_PER_MONTH) * USECS_PER_DAY;
+
+                if (usecs > 0)
+                    windows = ceil((ofpinfo->time_upper - ofpinfo->time_lower) / usecs);
+            }
+            num_groups *= Max(windows, 1);
+        }
+        else
+            group_exprs = lappend(group_exprs, expr);
+    }
+
+    if (group_exprs != NIL)
+        num_groups *= estimate_num_groups(root, group_exprs, input_rows, NULL, NULL);
+
+    return clamp_row_est(Min(num_groups, input_rows));
+}
+
+/*
+ * add_foreign_grouping_paths - 添加在远程执行分组聚合的路径
+ */
+static void
+add_foreign_grouping_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *grouped_rel, GroupPathExtraData *extra)
+{
+    Query *parse = root->parse;
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)grouped_rel->fdw_private;
+    ForeignPath *grouppath;
+    double rows;
+    int width;
+    Cost startup_cost;
+    Cost total_cost;
+
+    /* 没有聚合和分组时不需要处理 */
+    if (!parse->groupClause && !parse->hasAggs)
+        return;
+
+    /* 部分聚合无法在远程完成 */
+    if (extra->patype != PARTITIONWISE_AGGREGATE_NONE &&
+        extra->patype != PARTITIONWISE_AGGREGATE_FULL)
+        return;
+
+    /* 目前只对单个外部表的扫描做聚合下推 */
+    if (input_rel->reloptkind != RELOPT_BASEREL &&
+        input_rel->reloptkind != RELOPT_OTHER_MEMBER_REL)
+        return;
+
+    fpinfo->outerrel = input_rel;
+    tdengine_copy_fpinfo(fpinfo, ifpinfo);
+
+    if (!tdengine_foreign_grouping_ok(root, grouped_rel, extra->havingQual))
+        return;
+
+    estimate_path_cost_size(root, grouped_rel, NIL, NIL, &rows, &width, &startup_cost, &total_cost);
+
+    fpinfo->rows = rows;
+    fpinfo->width = width;
+    fpinfo->startup_cost = startup_cost;
+    fpinfo->total_cost = total_cost;
+
+    grouppath = create_foreign_upper_path(root, grouped_rel, grouped_rel->reltarget, rows, startup_cost, total_cost, NIL, NULL, NIL);
+
+    add_path(grouped_rel, (Path *)grouppath);
+}
+
+/*
+ * add_foreign_ordered_paths - 添加在远程对分组聚合结果排序的路径
+ *
+ * 基本关系的排序由扫描路径本身的路径键处理，这里只记录能否下推
+ */
+static void
+add_foreign_ordered_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *ordered_rel)
+{
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)ordered_rel->fdw_private;
+    RelOptInfo *scanrel;
+    ForeignPath *ordered_path;
+    List *fdw_private;
+    ListCell *lc;
+    double rows;
+    int width;
+    Cost startup_cost;
+    Cost total_cost;
+
+    /* 目标列表中包含返回集合的函数时不能下推 */
+    if (root->parse->hasTargetSRFs)
+        return;
+
+    /*
+     * 基本关系的查询路径键就是最终的排序键，是否能下推已在
+     * tdengineGetForeignPaths 中确定，排序由扫描路径本身完成
+     */
+    if (input_rel->reloptkind == RELOPT_BASEREL ||
+        input_rel->reloptkind == RELOPT_OTHER_MEMBER_REL)
+    {
+        Assert(root->query_pathkeys == root->sort_pathkeys);
+        fpinfo->outerrel = input_rel;
+        tdengine_copy_fpinfo(fpinfo, ifpinfo);
+        fpinfo->pushdown_safe = ifpinfo->qp_is_pushdown_safe;
+        return;
+    }
+
+    if (input_rel->reloptkind != RELOPT_UPPER_REL || ifpinfo->stage != UPPERREL_GROUP_AGG)
+        return;
+
+    scanrel = ifpinfo->outerrel;
+
+    /* 每个排序键都必须能在远程计算 */
+    foreach (lc, root->sort_pathkeys)
+    {
+        PathKey *pathkey = (PathKey *)lfirst(lc);
+        Expr *em_expr = tdengine_find_em_expr_for_rel(pathkey->pk_eclass, scanrel);
+
+        if (em_expr == NULL)
+            return;
+
+        if (!tdengine_is_window_func(em_expr) &&
+            !tdengine_is_foreign_expr(root, input_rel, em_expr, true))
+            return;
+    }
+
+    fpinfo->outerrel = input_rel;
+    tdengine_copy_fpinfo(fpinfo, ifpinfo);
+    fpinfo->pushdown_safe = true;
+
+    estimate_path_cost_size(root, input_rel, NIL, root->sort_pathkeys, &rows, &width, &startup_cost, &total_cost);
+
+    /* 最终排序在远程执行，没有 LIMIT */
+    fdw_private = list_make2(makeBoolean(true), makeBoolean(false));
+
+    ordered_path = create_foreign_upper_path(root, input_rel, root->upper_targets[UPPERREL_ORDERED], rows, startup_cost, total_cost, root->sort_pathkeys, NULL, fdw_private);
+
+    add_path(ordered_rel, (Path *)ordered_path);
+}
+
+/*
+ * add_foreign_final_paths - 添加在远程执行 LIMIT/OFFSET 的路径
+ */
+static void
+add_foreign_final_paths(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *final_rel, FinalPathExtraData *extra)
+{
+    Query *parse = root->parse;
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)final_rel->fdw_private;
+    bool has_final_sort = false;
+    List *pathkeys = NIL;
+    ForeignPath *final_path;
+    List *fdw_private;
+    double rows;
+    int width;
+    Cost startup_cost;
+    Cost total_cost;
+
+    /* 只处理带 LIMIT 的 SELECT，TDengine 不支持行锁 */
+    if (parse->commandType != CMD_SELECT || parse->rowMarks || !extra->limit_needed)
+        return;
+
+    if (parse->hasTargetSRFs)
+        return;
+
+    fpinfo->outerrel = input_rel;
+    tdengine_copy_fpinfo(fpinfo, ifpinfo);
+
+    /* 输入是已下推的排序时，改为在其输入关系上同时执行排序和 LIMIT */
+    if (input_rel->reloptkind == RELOPT_UPPER_REL && ifpinfo->stage == UPPERREL_ORDERED)
+    {
+        input_rel = ifpinfo->outerrel;
+        ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+        has_final_sort = true;
+        pathkeys = root->sort_pathkeys;
+    }
+
+    /* 输入应为外部表的扫描或下推的分组聚合 */
+    if (input_rel->reloptkind == RELOPT_UPPER_REL)
+    {
+        if (ifpinfo->stage != UPPERREL_GROUP_AGG)
+            return;
+    }
+    else if (input_rel->reloptkind != RELOPT_BASEREL &&
+             input_rel->reloptkind != RELOPT_OTHER_MEMBER_REL)
+        return;
+
+    /* 还有本地条件时，远程返回的行数与本地不同 */
+    if (ifpinfo->local_conds)
+        return;
+
+    /*
+     * 窗口与其他分组列同时使用时远程以 PARTITION BY 分组，
+     * 此时 TDengine 的 LIMIT 作用于每个分组，不能下推
+     */
+    if (input_rel->reloptkind == RELOPT_UPPER_REL && list_length(parse->groupClause) > 1)
+    {
+        ListCell *lc;
+
+        foreach (lc, get_sortgrouplist_exprs(parse->groupClause, ifpinfo->grouped_tlist))
+        {
+            if (tdengine_is_window_func((Expr *)lfirst(lc)))
+                return;
+        }
+    }
+
+    if (!tdengine_is_foreign_expr(root, input_rel, (Expr *)parse->limitOffset, false) ||
+        !tdengine_is_foreign_expr(root, input_rel, (Expr *)parse->limitCount, false))
+        return;
+
+    fpinfo->pushdown_safe = true;
+
+    estimate_path_cost_size(root, input_rel, NIL, pathkeys, &rows, &width, &startup_cost, &total_cost);
+    adjust_limit_rows_costs(&rows, &startup_cost, &total_cost, extra->offset_est, extra->count_est);
+
+    fdw_private = list_make2(makeBoolean(has_final_sort), makeBoolean(true));
+
+    final_path = create_foreign_upper_path(root, input_rel, root->upper_targets[UPPERREL_FINAL], rows, startup_cost, total_cost, pathkeys, NULL, fdw_private);
+
+    add_path(final_rel, (Path *)final_path);
+}
+
+//====================== GetForeignPlan ======================
+/*
+ * 获取一个外部扫描计划节点
+ */
+static ForeignScan *
+tdengineGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid, ForeignPath *best_path, List *tlist, List *scan_clauses, Plan *outer_plan)
+{
+    // 将外部关系的私有数据转换为 TDengineFdwRelationInfo
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)baserel->fdw_private;
+    // 获取扫描关系的ID
+    Index scan_relid = baserel->relid;
+    // 传递给执行器的私有数据列表
+    List *fdw_private = NULL;
+    // 本地执行的表达式列表
+    List *local_exprs = NULL;
+    // 远程执行的表达式列表
+    List *remote_exprs = NULL;
+    // 参数列表
+    List *params_list = NULL;
+    // 传递给外部服务器的目标列表
+    List *fdw_scan_tlist = NIL;
+    // 远程条件列表
+    List *remote_conds = NIL;
+
+    StringInfoData sql;
+    // 从远程服务器检索的属性列表
+    List *retrieved_attrs;
+    ListCell *lc;
+    List *fdw_recheck_quals = NIL;
+    // 表示是否为 FOR UPDATE 操作的标志
+    int for_update;
+    // 表示查询是否有 LIMIT 子句的标志
+    bool has_limit = false;
+    // 每批从远程拉取的行数
+    int fetch_size;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    // 决定是否在目标列表中支持函数下推，订阅表的消息中只有主题查询的结果列
+    fpinfo->is_tlist_func_pushdown = !fpinfo->is_topic && !fpinfo->is_tail && tdengine_is_foreign_function_tlist(root, baserel, tlist);
+
+    /*
+     * 获取由 tdengineGetForeignUpperPaths() 创建的 FDW 私有数据
+     */
+    if (best_path->fdw_private)
+    {
+        has_limit = boolVal(list_nth(best_path->fdw_private, FdwPathPrivateHasLimit));
+    }
+
+    /* LIMIT 下推后远程最多返回 LIMIT + OFFSET 行，每批不必拉取更多 */
+    fetch_size = fpinfo->fetch_size;
+    if (has_limit && root->parse->limitCount && IsA(root->parse->limitCount, Const) &&
+        !((Const *)root->parse->limitCount)->constisnull)
+    {
+        int64 limit_rows = DatumGetInt64(((Const *)root->parse->limitCount)->constvalue);
+
+        if (root->parse->limitOffset && IsA(root->parse->limitOffset, Const) &&
+            !((Const *)root->parse->limitOffset)->constisnull)
+            limit_rows += DatumGetInt64(((Const *)root->parse->limitOffset)->constvalue);
+
+        if (limit_rows > 0 && limit_rows < fetch_size)
+            fetch_size = (int)limit_rows;
+    }
+
+    // 初始化 SQL 查询字符串
+    initStringInfo(&sql);
+
+    if ((baserel->reloptkind == RELOPT_BASEREL ||
+         baserel->reloptkind == RELOPT_OTHER_MEMBER_REL) &&
+        fpinfo->is_tlist_func_pushdown == false)
+    {
+        // 提取实际要从远程 TDengine 获取的列
+        tdengine_extract_slcols(fpinfo, root, baserel, tlist);
+
+        // 遍历扫描子句列表
+        foreach (lc, scan_clauses)
+        {
+            // 获取当前的限制信息节点
+            RestrictInfo *rinfo = (RestrictInfo *)lfirst(lc);
+
+            Assert(IsA(rinfo, RestrictInfo));
+
+            if (rinfo->pseudoconstant)
+                continue;
+
+            if (list_member_ptr(fpinfo->remote_conds, rinfo))
             {
                 remote_exprs = lappend(remote_exprs, rinfo->clause);
             }
@@ -516,393 +1856,911 @@ tdengineGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntablei
                 local_exprs = lappend(local_exprs, rinfo->clause);
             }
 
-            fdw_recheck_quals = remote_exprs;
-        }
-    }
-    else
+            fdw_recheck_quals = remote_exprs;
+        }
+    }
+    else
+    {
+        scan_relid = 0;
+
+        if (fpinfo->is_tlist_func_pushdown == false)
+        {
+            // 确保扫描子句列表为空
+            Assert(!scan_clauses);
+        }
+
+        // 提取实际的远程条件子句
+        remote_exprs = extract_actual_clauses(fpinfo->remote_conds, false);
+        // 提取实际的本地条件子句
+        local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
+        if (fpinfo->is_tlist_func_pushdown == true)
+        {
+            // 遍历目标列表
+            foreach (lc, tlist)
+            {
+                // 获取当前的目标项
+                TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+                if (fpinfo->is_tlist_func_pushdown == true && IsA((Node *)tle->expr, FieldSelect))
+                {
+                    // 将提取的函数添加到 fdw_scan_tlist 中
+                    fdw_scan_tlist = add_to_flat_tlist(fdw_scan_tlist, tdengine_pull_func_clause((Node *)tle->expr));
+                }
+                else
+                {
+                    // 否则将目标项添加到 fdw_scan_tlist 中
+                    fdw_scan_tlist = lappend(fdw_scan_tlist, tle);
+                }
+            }
+
+            // 遍历本地条件列表
+            foreach (lc, fpinfo->local_conds)
+            {
+                // 获取当前的限制信息节点
+                RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+                // 存储变量列表
+                List *varlist = NIL;
+
+                // 从条件子句中提取无模式变量
+                varlist = tdengine_pull_slvars(rinfo->clause, baserel->relid,
+                                               varlist, true, NULL, &(fpinfo->slinfo));
+
+                if (varlist == NIL)
+                {
+                    varlist = pull_var_clause((Node *)rinfo->clause,
+                                              PVC_RECURSE_PLACEHOLDERS);
+                }
+
+                fdw_scan_tlist = add_to_flat_tlist(fdw_scan_tlist, varlist);
+            }
+        }
+        else
+        {
+            // 构建要解析的目标列表
+            fdw_scan_tlist = tdengine_build_tlist_to_deparse(baserel);
+        }
+
+        if (outer_plan)
+        {
+            /*
+             * 目前，我们只考虑连接之外的分组和聚合。
+             * 涉及聚合或分组的查询不需要 EPQ 机制，因此这里不应该有外部计划。
+             */
+            Assert(baserel->reloptkind != RELOPT_UPPER_REL);
+            // 设置外部计划的目标列表
+            outer_plan->targetlist = fdw_scan_tlist;
+
+            // 遍历本地表达式列表
+            foreach (lc, local_exprs)
+            {
+                // 将外部计划转换为连接计划
+                Join *join_plan = (Join *)outer_plan;
+                // 获取当前的条件子句
+                Node *qual = lfirst(lc);
+
+                // 从外部计划的条件中移除当前条件子句
+                outer_plan->qual = list_delete(outer_plan->qual, qual);
+
+                if (join_plan->jointype == JOIN_INNER)
+                {
+                    // 从连接计划的连接条件中移除当前条件子句
+                    join_plan->joinqual = list_delete(join_plan->joinqual,
+                                                      qual);
+                }
+            }
+        }
+    }
+
+    // 重新初始化 SQL 查询字符串
+    initStringInfo(&sql);
+    // 为关系解析 SELECT 语句
+    tdengine_deparse_select_stmt_for_rel(&sql, root, baserel, fdw_scan_tlist,
+                                         remote_exprs, best_path->path.pathkeys,
+                                         false, &retrieved_attrs, &params_list, has_limit);
+
+    // 记住远程表达式，供 tdenginePlanDirectModify 可能使用
+    fpinfo->final_remote_exprs = remote_exprs;
+
+    for_update = false;
+    if (baserel->relid == root->parse->resultRelation &&
+        (root->parse->commandType == CMD_UPDATE ||
+         root->parse->commandType == CMD_DELETE))
+    {
+        /* 关系是 UPDATE/DELETE 目标，因此使用 FOR UPDATE */
+        for_update = true;
+    }
+
+    // 获取远程条件
+    if (baserel->reloptkind == RELOPT_UPPER_REL)
+    {
+        TDengineFdwRelationInfo *ofpinfo;
+
+        ofpinfo = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
+        remote_conds = ofpinfo->remote_conds;
+    }
+    else
+        remote_conds = remote_exprs;
+
+    // 创建包含 SQL 查询字符串、检索的属性和 FOR UPDATE 标志的列表
+    fdw_private = list_make3(makeString(sql.data), retrieved_attrs, makeInteger(for_update));
+    // 将 fdw_scan_tlist 添加到 fdw_private 列表中
+    fdw_private = lappend(fdw_private, fdw_scan_tlist);
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->is_tlist_func_pushdown));
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->slinfo.schemaless));
+    fdw_private = lappend(fdw_private, remote_conds);
+    fdw_private = lappend(fdw_private, makeInteger(fetch_size));
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->where_end));
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->has_where));
+    // 并行路径需要的时间范围，以字符串保存 64 位时间戳
+    if (best_path->path.parallel_aware)
+        fdw_private = lappend(fdw_private, list_make2(makeString(psprintf(INT64_FORMAT, fpinfo->time_lower)), makeString(psprintf(INT64_FORMAT, fpinfo->time_upper))));
+    else
+        fdw_private = lappend(fdw_private, NIL);
+    // 远程查询是否带有 LIMIT，增量扫描此时不推进高水位
+    fdw_private = lappend(fdw_private, makeInteger(has_limit));
+    // 每个远程参数对应的本表列类型，执行阶段据此决定时间参数的绑定方式
+    fdw_private = lappend(fdw_private, tdengine_param_column_types(root, baserel, remote_exprs, params_list));
+
+    /*
+     * 根据目标列表、本地过滤表达式、远程参数表达式和 FDW 私有信息创建 ForeignScan 节点。
+     */
+    return make_foreignscan(tlist, local_exprs, scan_relid, params_list, fdw_private, fdw_scan_tlist, fdw_recheck_quals, outer_plan);
+}
+
+//========================== BeginForeignScan =====================
+/*
+ * tdengineBeginForeignScan - 初始化外部表扫描
+ * 功能: 为TDengine外部表扫描初始化执行状态,准备查询参数和连接信息
+ * 参数:
+ *   @node: ForeignScanState节点,包含扫描状态信息
+ *   @eflags: 执行标志位,指示扫描的执行方式
+ */
+static void
+tdengineBeginForeignScan(ForeignScanState *node, int eflags)
+{
+    // 执行状态结构体
+    TDengineFdwExecState *festate = NULL;
+    // 执行状态
+    EState *estate = node->ss.ps.state;
+    // 外部扫描计划节点
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    // 范围表条目
+    RangeTblEntry *rte;
+    // 参数数量
+    int numParams;
+    // 扫描关系ID
+    int rtindex;
+    // 无模式标志
+    bool schemaless;
+    // 用户ID
+    Oid userid;
+
+    ForeignTable *ftable;
+
+    // 调试日志
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 初始化执行状态 */
+    festate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
+    node->fdw_state = (void *)festate;
+    festate->rowidx = 0;
+
+    /* 从计划节点中提取信息 */
+    festate->query = strVal(list_nth(fsplan->fdw_private, 0));                                 // SQL查询字符串
+    festate->retrieved_attrs = list_nth(fsplan->fdw_private, 1);                               // 需要检索的属性
+    festate->for_update = intVal(list_nth(fsplan->fdw_private, 2)) ? true : false;             // FOR UPDATE标志
+    festate->tlist = (List *)list_nth(fsplan->fdw_private, 3);                                 // 目标列表
+    festate->is_tlist_func_pushdown = intVal(list_nth(fsplan->fdw_private, 4)) ? true : false; // 函数下推标志
+    schemaless = intVal(list_nth(fsplan->fdw_private, 5)) ? true : false;                      // 无模式标志
+    festate->fetch_size = intVal(list_nth(fsplan->fdw_private, 7));                            // 每批拉取的行数
+    festate->where_end = intVal(list_nth(fsplan->fdw_private, 8));                             // WHERE子句结束位置
+    festate->has_where = intVal(list_nth(fsplan->fdw_private, 9)) ? true : false;              // 是否有WHERE子句
+    festate->base_query = festate->query;
+
+    /* 并行计划中的时间范围 */
+    if (list_nth(fsplan->fdw_private, 10) != NIL)
+    {
+        List *range = (List *)list_nth(fsplan->fdw_private, 10);
+
+        festate->time_range_valid = true;
+        festate->time_lower = strtoi64(strVal(linitial(range)), NULL, 10);
+        festate->time_upper = strtoi64(strVal(lsecond(range)), NULL, 10);
+    }
+
+    festate->cursor_exists = false;
+    festate->cursor = NULL;
+    festate->eof_reached = false;
+    festate->row_nums = 0;
+
+    /* 每批结果行使用独立的内存上下文，拉取下一批前整体释放 */
+    festate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+                                               "tdengine_fdw tuple data",
+                                               ALLOCSET_DEFAULT_SIZES);
+
+    /* 确定扫描关系ID */
+    if (fsplan->scan.scanrelid > 0)
+        rtindex = fsplan->scan.scanrelid;
+    else
+        rtindex = bms_next_member(fsplan->fs_relids, -1);
+
+    // 获取范围表条目
+    rte = exec_rt_fetch(rtindex, estate);
+    festate->relid = rte->relid;
+
+    /* 获取用户ID */
+    userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+    /* 获取连接选项和用户映射 */
+    festate->tdengineFdwOptions = tdengine_get_options(rte->relid, userid);
+    ftable = GetForeignTable(rte->relid);
+    festate->user = GetUserMapping(userid, ftable->serverid);
+
+    /* 初始化无模式信息 */
+    tdengine_get_schemaless_info(&(festate->slinfo), schemaless, rte->relid);
+
+    /* 扫描的所有外部表都设置了 cache_ttl 时使用共享结果缓存，有效期取最小值 */
+    festate->cache_scan.ttl = 0;
+    festate->cache_scan.nrels = 0;
+    rtindex = -1;
+    while ((rtindex = bms_next_member(fsplan->fs_relids, rtindex)) >= 0)
     {
-        scan_relid = 0;
+        RangeTblEntry *scan_rte = exec_rt_fetch(rtindex, estate);
+        tdengine_opt *scan_options = tdengine_get_options(scan_rte->relid, userid);
 
-        if (fpinfo->is_tlist_func_pushdown == false)
+        if (scan_options->cache_ttl <= 0 || scan_options->topic != NULL ||
+            festate->cache_scan.nrels >= TDENGINE_CACHE_MAX_RELS)
         {
-            // 确保扫描子句列表为空
-            Assert(!scan_clauses);
+            festate->cache_scan.ttl = 0;
+            break;
         }
 
-        // 提取实际的远程条件子句
-        remote_exprs = extract_actual_clauses(fpinfo->remote_conds, false);
-        // 提取实际的本地条件子句
-        local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
-        if (fpinfo->is_tlist_func_pushdown == true)
+        if (festate->cache_scan.nrels == 0 || scan_options->cache_ttl < festate->cache_scan.ttl)
+            festate->cache_scan.ttl = scan_options->cache_ttl;
+        festate->cache_scan.tables[festate->cache_scan.nrels++] =
+            tdengine_result_cache_table_key(GetForeignTable(scan_rte->relid)->serverid, scan_options);
+    }
+
+    /*
+     * 增量扫描：只读取消费者高水位之后、上界之前的数据，上界为语句开始时间
+     * 减去 tdengine_fdw.tail_lag，之后的数据留给下一次扫描。增量表不会生成
+     * 聚合、连接下推和并行路径，见 tdengineGetForeignRelSize()
+     */
+    festate->tail_consumer = NULL;
+    if (fsplan->scan.scanrelid > 0 && festate->tdengineFdwOptions->tail &&
+        festate->tdengineFdwOptions->topic == NULL && !festate->time_range_valid && !(eflags & EXEC_FLAG_EXPLAIN_ONLY) &&
+        tdengine_tail_consumer != NULL && tdengine_tail_consumer[0] != '\0')
+    {
+        StringInfoData cond;
+        Timestamp hwm;
+
+        TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+        int i;
+
+        festate->tail_consumer = pnstrdup(tdengine_tail_consumer, NAMEDATALEN - 1);
+        festate->tail_upper = (Timestamp)GetCurrentStatementStartTimestamp() - (int64)tdengine_tail_lag * USECS_PER_MSEC;
+        festate->tail_advance = !intVal(list_nth(fsplan->fdw_private, 11));
+
+        /* 找到扫描元组中的时间列，读取时记录最大时间 */
+        festate->tail_time_attnum = 0;
+        festate->tail_seen = false;
+        for (i = 0; i < tupdesc->natts; i++)
         {
-            // 遍历目标列表
-            foreach (lc, tlist)
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+            if (!attr->attisdropped &&
+                (attr->atttypid == TIMESTAMPOID || attr->atttypid == TIMESTAMPTZOID) &&
+                TDENGINE_IS_TIME_COLUMN(tdengine_get_column_name(festate->relid, attr->attnum)))
             {
-                // 获取当前的目标项
-                TargetEntry *tle = lfirst_node(TargetEntry, lc);
-                */
-                    if (fpinfo->is_tlist_func_pushdown == true && IsA((Node *)tle->expr, FieldSelect))
-                {
-                    // 将提取的函数添加到 fdw_scan_tlist 中
-                    fdw_scan_tlist = add_to_flat_tlist(fdw_scan_tlist, tdengine_pull_func_clause((Node *)tle->expr));
-                }
-                else
-                {
-                    // 否则将目标项添加到 fdw_scan_tlist 中
-                    fdw_scan_tlist = lappend(fdw_scan_tlist, tle);
-                }
+                festate->tail_time_attnum = attr->attnum;
+                break;
             }
+        }
 
-            // 遍历本地条件列表
-            foreach (lc, fpinfo->local_conds)
-            {
-                // 获取当前的限制信息节点
-                RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
-                // 存储变量列表
-                List *varlist = NIL;
+        initStringInfo(&cond);
+        if (tdengine_tail_position(festate->relid, festate->tail_consumer, &hwm))
+            appendStringInfo(&cond, "%s > %s AND ", TDENGINE_TIME_COLUMN, tdengine_format_time_literal(hwm));
+        appendStringInfo(&cond, "%s <= %s", TDENGINE_TIME_COLUMN, tdengine_format_time_literal(festate->tail_upper));
 
-                // 从条件子句中提取无模式变量
-                varlist = tdengine_pull_slvars(rinfo->clause, baserel->relid,
-                                               varlist, true, NULL, &(fpinfo->slinfo));
+        festate->query = tdengine_splice_time_condition(festate->base_query, festate->where_end, festate->has_where, cond.data);
+        festate->base_query = festate->query;
 
-                if (varlist == NIL)
-                {
-                    varlist = pull_var_clause((Node *)rinfo->clause,
-                                              PVC_RECURSE_PLACEHOLDERS);
-                }
+        elog(DEBUG1, "tdengine_fdw : tail scan for consumer \"%s\": %s", festate->tail_consumer, festate->query);
+    }
 
-                fdw_scan_tlist = add_to_flat_tlist(fdw_scan_tlist, varlist);
-            }
-        }
-        else
+    /* 预先解析扫描元组各属性的类型输入函数，避免逐个单元格查询系统缓存 */
+    festate->attinmeta = TupleDescGetAttInMetadata(node->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
+
+    /* 准备查询参数 */
+    numParams = list_length(fsplan->fdw_exprs);
+    festate->numParams = numParams;
+    if (numParams > 0)
+    {
+        prepare_query_params((PlanState *)node, fsplan->fdw_exprs, (List *)list_nth(fsplan->fdw_private, 12), rte->relid, numParams, &festate->param_flinfo, &festate->param_exprs, &festate->param_values, &festate->param_types, &festate->param_tdengine_types, &festate->param_tdengine_values, &festate->param_column_info);
+    }
+}
+
+//======================== IterateForeignScan ==================
+/*
+ * 逐个迭代从 TDengine 获取行，并将其放入元组槽中
+ */
+static TupleTableSlot *
+tdengineIterateForeignScan(ForeignScanState *node)
+{
+    // 获取执行状态
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TupleTableSlot *tupleSlot = node->ss.ss_ScanTupleSlot;
+    EState *estate = node->ss.ps.state;
+    TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    RangeTblEntry *rte;
+    int rtindex;
+    // 是否为聚合操作
+    bool is_agg;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+    if (fsplan->scan.scanrelid > 0)
+    {
+        rtindex = fsplan->scan.scanrelid;
+        is_agg = false;
+    }
+    else
+    {
+        rtindex = bms_next_member(fsplan->fs_relids, -1);
+        is_agg = true;
+    }
+    rte = rt_fetch(rtindex, estate->es_range_table);
+
+    // 初始化元组槽的值为 0
+    memset(tupleSlot->tts_values, 0, sizeof(Datum) * tupleDescriptor->natts);
+    // 初始化元组槽的空值标记为 true
+    memset(tupleSlot->tts_isnull, true, sizeof(bool) * tupleDescriptor->natts);
+    // 清空元组槽
+    ExecClearTuple(tupleSlot);
+
+    for (;;)
+    {
+        // 第一次调用时打开远程游标；并行扫描时先领取一个时间段
+        if (!festate->cursor_exists)
         {
-            // 构建要解析的目标列表
-            fdw_scan_tlist = tdengine_build_tlist_to_deparse(baserel);
+            if (festate->pstate != NULL && !tdengine_next_parallel_chunk(node))
+                break;
+            create_cursor(node);
         }
 
-        if (outer_plan)
+        // 当前批次已消费完，从游标中拉取下一批
+        if (festate->rowidx >= festate->row_nums && !festate->eof_reached)
+            fetch_more_data(node);
+
+        if (festate->rowidx < festate->row_nums)
         {
-            /*
-             * 目前，我们只考虑连接之外的分组和聚合。
-             * 涉及聚合或分组的查询不需要 EPQ 机制，因此这里不应该有外部计划。
-             */
-            Assert(baserel->reloptkind != RELOPT_UPPER_REL);
-            // 设置外部计划的目标列表
-            outer_plan->targetlist = fdw_scan_tlist;
+            // 从结果行创建元组，行数据保存在批次内存上下文中直到拉取下一批
+            make_tuple_from_result_row(&(festate->batch.rows[festate->rowidx]), &festate->batch, tupleDescriptor, tupleSlot->tts_values, tupleSlot->tts_isnull, rte->relid, festate, is_agg);
 
-            // 遍历本地表达式列表
-            foreach (lc, local_exprs)
+            // 增量扫描记录读到的最大远程时间
+            if (festate->tail_consumer != NULL && festate->tail_time_attnum > 0 &&
+                !tupleSlot->tts_isnull[festate->tail_time_attnum - 1])
             {
-                // 将外部计划转换为连接计划
-                Join *join_plan = (Join *)outer_plan;
-                // 获取当前的条件子句
-                Node *qual = lfirst(lc);
+                Timestamp ts = DatumGetTimestamp(tupleSlot->tts_values[festate->tail_time_attnum - 1]);
 
-                // 从外部计划的条件中移除当前条件子句
-                outer_plan->qual = list_delete(outer_plan->qual, qual);
+                if (!festate->tail_seen || ts > festate->tail_max)
+                    festate->tail_max = ts;
+                festate->tail_seen = true;
+            }
 
-                if (join_plan->jointype == JOIN_INNER)
-                {
-                    // 从连接计划的连接条件中移除当前条件子句
-                    join_plan->joinqual = list_delete(join_plan->joinqual,
-                                                      qual);
-                }
+            // 存储虚拟元组
+            ExecStoreVirtualTuple(tupleSlot);
+            // 行索引加 1
+            festate->rowidx++;
+            break;
+        }
+
+        // 非并行扫描时结果已读完；增量扫描读完后在提交时把高水位推进到读到的最大时间
+        if (festate->pstate == NULL)
+        {
+            if (festate->tail_consumer != NULL && festate->tail_advance && festate->eof_reached)
+            {
+                if (festate->tail_time_attnum == 0)
+                    tdengine_tail_advance(festate->relid, festate->tail_consumer, festate->tail_upper);
+                else if (festate->tail_seen)
+                    tdengine_tail_advance(festate->relid, festate->tail_consumer, Min(festate->tail_max, festate->tail_upper));
             }
+            break;
         }
+
+        // 当前时间段已读完，关闭游标后继续领取下一个时间段
+        close_cursor(festate);
     }
 
-    // 重新初始化 SQL 查询字符串
-    initStringInfo(&sql);
-    // 为关系解析 SELECT 语句
-    tdengine_deparse_select_stmt_for_rel(&sql, root, baserel, fdw_scan_tlist,
-                                         remote_exprs, best_path->path.pathkeys,
-                                         false, &retrieved_attrs, &params_list, has_limit);
+    // 返回元组槽
+    return tupleSlot;
+}
 
-    // 记住远程表达式，供 tdenginePlanDirectModify 可能使用
-    fpinfo->final_remote_exprs = remote_exprs;
+//===================== ReScanForeignScan =====================
+/*
+ * 从扫描的起始位置重新开始扫描
+ */
+static void
+tdengineReScanForeignScan(ForeignScanState *node)
+{
 
-    for_update = false;
-    if (baserel->relid == root->parse->resultRelation &&
-        (root->parse->commandType == CMD_UPDATE ||
-         root->parse->commandType == CMD_DELETE))
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    // 关闭当前游标，下次迭代时使用新的参数重新打开
+    close_cursor(festate);
+}
+
+//===================== EndForeignScan =======================
+/*
+ * 结束对外部表的扫描，并释放本次扫描所使用的对象
+ */
+static void
+tdengineEndForeignScan(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    if (festate != NULL)
     {
-        /* 关系是 UPDATE/DELETE 目标，因此使用 FOR UPDATE */
-        for_update = true;
+        close_cursor(festate);
+        MemoryContextDelete(festate->batch_cxt);
+        festate->batch_cxt = NULL;
     }
+}
+
+//===================== 并行扫描 =======================
+/*
+ * 外部扫描是否可以在并行工作进程中执行
+ *
+ * 每个进程通过自己缓存的连接执行远程查询，不共享任何连接状态
+ */
+static bool
+tdengineIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
+{
+    return true;
+}
+
+/*
+ * 估算并行扫描共享状态所需的 DSM 大小
+ */
+static Size
+tdengineEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    return sizeof(TDengineParallelScanState);
+}
+
+/*
+ * 初始化并行扫描共享状态：将计划中的时间范围划分为若干时间段
+ */
+static void
+tdengineInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TDengineParallelScanState *pstate = (TDengineParallelScanState *)coordinate;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    SpinLockInit(&pstate->mutex);
+    pstate->next_chunk = 0;
+    pstate->nchunks = (pcxt->nworkers + 1) * TDENGINE_PARALLEL_CHUNKS_PER_WORKER;
+    pstate->lower = festate->time_lower;
+    pstate->upper = festate->time_upper;
+
+    if (festate->time_range_valid)
+        festate->pstate = pstate;
+}
+
+/*
+ * 重新扫描前重置并行扫描共享状态
+ */
+static void
+tdengineReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    TDengineParallelScanState *pstate = (TDengineParallelScanState *)coordinate;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    SpinLockAcquire(&pstate->mutex);
+    pstate->next_chunk = 0;
+    SpinLockRelease(&pstate->mutex);
+}
+
+/*
+ * 在并行工作进程中关联共享状态
+ */
+static void
+tdengineInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    if (festate->time_range_valid)
+        festate->pstate = (TDengineParallelScanState *)coordinate;
+}
+
+/*
+ * tdengine_next_parallel_chunk - 领取下一个时间段，并生成只扫描该时间段的远程查询
+ *
+ * 第一个和最后一个时间段不限制外侧边界，外侧边界由原查询中的条件约束，
+ * 因此不必关心原条件是开区间还是闭区间。没有剩余时间段时返回 false。
+ */
+static bool
+tdengine_next_parallel_chunk(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TDengineParallelScanState *pstate = festate->pstate;
+    MemoryContext oldcontext;
+    StringInfoData cond;
+    Timestamp width;
+    Timestamp start;
+    int chunk;
+
+    SpinLockAcquire(&pstate->mutex);
+    chunk = pstate->next_chunk;
+    if (chunk < pstate->nchunks)
+        pstate->next_chunk++;
+    SpinLockRelease(&pstate->mutex);
+
+    if (chunk >= pstate->nchunks)
+        return false;
+
+    width = (pstate->upper - pstate->lower) / pstate->nchunks;
+    start = pstate->lower + width * chunk;
+
+    oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+    initStringInfo(&cond);
+    if (chunk > 0)
+        appendStringInfo(&cond, "%s >= %s", TDENGINE_TIME_COLUMN, tdengine_format_time_literal(start));
+    if (chunk < pstate->nchunks - 1)
+        appendStringInfo(&cond, "%s%s < %s", chunk > 0 ? " AND " : "", TDENGINE_TIME_COLUMN, tdengine_format_time_literal(start + width));
+
+    if (festate->query != festate->base_query)
+        pfree(festate->query);
+    if (cond.len > 0)
+        festate->query = tdengine_splice_time_condition(festate->base_query, festate->where_end, festate->has_where, cond.data);
+    else
+        festate->query = festate->base_query;
+
+    pfree(cond.data);
+    MemoryContextSwitchTo(oldcontext);
+
+    elog(DEBUG1, "tdengine_fdw : parallel chunk %d/%d: %s", chunk + 1, pstate->nchunks, festate->query);
+
+    return true;
+}
+
+//===================== 异步执行 =======================
+/*
+ * 外部扫描路径是否可以异步执行，由 async_capable 选项决定
+ */
+static bool
+tdengineIsForeignPathAsyncCapable(ForeignPath *path)
+{
+    RelOptInfo *rel = ((Path *)path)->parent;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)rel->fdw_private;
+
+    return fpinfo->async_capable;
+}
+
+/*
+ * Append 请求下一行数据
+ *
+ * 第一次请求时在后台提交远程查询，查询未完成前将请求标记为等待状态，
+ * 这样 Append 可以同时向其他子节点发出请求
+ */
+static void
+tdengineForeignAsyncRequest(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
 
-    // 获取远程条件
-    if (baserel->reloptkind == RELOPT_UPPER_REL)
-    {
-        TDengineFdwRelationInfo *ofpinfo;
+    /* 并行扫描按时间段依次打开游标，不使用异步提交 */
+    if (festate->pstate == NULL && !festate->cursor_exists)
+        create_cursor(node);
 
-        ofpinfo = (TDengineFdwRelationInfo *)fpinfo->outerrel->fdw_private;
-        remote_conds = ofpinfo->remote_conds;
+    if (festate->cursor != NULL && !TDengineCursorIsReady(festate->cursor))
+    {
+        ExecAsyncRequestPending(areq);
+        return;
     }
-    else
-        remote_conds = remote_exprs;
-
-    // 创建包含 SQL 查询字符串、检索的属性和 FOR UPDATE 标志的列表
-    fdw_private = list_make3(makeString(sql.data), retrieved_attrs, makeInteger(for_update));
-    // 将 fdw_scan_tlist 添加到 fdw_private 列表中
-    fdw_private = lappend(fdw_private, fdw_scan_tlist);
-    fdw_private = lappend(fdw_private, makeInteger(fpinfo->is_tlist_func_pushdown));
-    fdw_private = lappend(fdw_private, makeInteger(fpinfo->slinfo.schemaless));
-    fdw_private = lappend(fdw_private, remote_conds);
 
-    /*
-     * 根据目标列表、本地过滤表达式、远程参数表达式和 FDW 私有信息创建 ForeignScan 节点。
-     */
-    return make_foreignscan(tlist, local_exprs, scan_relid, params_list, fdw_private, fdw_scan_tlist, fdw_recheck_quals, outer_plan);
+    ExecAsyncRequestDone(areq, ExecProcNode((PlanState *)node));
 }
 
-//========================== BeginForeignScan =====================
 /*
- * tdengineBeginForeignScan - 初始化外部表扫描
- * 功能: 为TDengine外部表扫描初始化执行状态,准备查询参数和连接信息
- * 参数:
- *   @node: ForeignScanState节点,包含扫描状态信息
- *   @eflags: 执行标志位,指示扫描的执行方式
+ * 将等待远程查询完成的文件描述符加入 Append 的等待事件集合
  */
 static void
-tdengineBeginForeignScan(ForeignScanState *node, int eflags)
+tdengineForeignAsyncConfigureWait(AsyncRequest *areq)
 {
-    // 执行状态结构体
-    TDengineFdwExecState *festate = NULL;
-    // 执行状态
-    EState *estate = node->ss.ps.state;
-    // 外部扫描计划节点
-    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
-    // 范围表条目
-    RangeTblEntry *rte;
-    // 参数数量
-    int numParams;
-    // 扫描关系ID
-    int rtindex;
-    // 无模式标志
-    bool schemaless;
-    // 用户ID
-    Oid userid;
-
-    ForeignTable *ftable;
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    AppendState *requestor = (AppendState *)areq->requestor;
 
-    List *remote_exprs;
+    Assert(areq->callback_pending);
+    /* 查询可能已经在后台完成，此时文件描述符已可读，等待会立即返回 */
+    Assert(festate->cursor != NULL);
 
-    // 调试日志
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+    AddWaitEventToSet(requestor->as_eventset, WL_SOCKET_READABLE, TDengineCursorWaitFd(festate->cursor), NULL, areq);
+}
 
-    /* 初始化执行状态 */
-    festate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
-    node->fdw_state = (void *)festate;
-    festate->rowidx = 0;
+/*
+ * 远程查询已完成，返回第一行数据
+ */
+static void
+tdengineForeignAsyncNotify(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
 
-    /* 从计划节点中提取信息 */
-    festate->query = strVal(list_nth(fsplan->fdw_private, 0));                                 // SQL查询字符串
-    festate->retrieved_attrs = list_nth(fsplan->fdw_private, 1);                               // 需要检索的属性
-    festate->for_update = intVal(list_nth(fsplan->fdw_private, 2)) ? true : false;             // FOR UPDATE标志
-    festate->tlist = (List *)list_nth(fsplan->fdw_private, 3);                                 // 目标列表
-    festate->is_tlist_func_pushdown = intVal(list_nth(fsplan->fdw_private, 4)) ? true : false; // 函数下推标志
-    schemaless = intVal(list_nth(fsplan->fdw_private, 5)) ? true : false;                      // 无模式标志
-    remote_exprs = (List *)list_nth(fsplan->fdw_private, 6);                                   // 远程表达式列表
+    ExecAsyncRequestDone(areq, ExecProcNode((PlanState *)node));
+}
 
-    festate->cursor_exists = false;
+//===================== ANALYZE =======================
+/* ANALYZE 采样过程的状态 */
+typedef struct TDengineAnalyzeState
+{
+    Relation rel;
+    TDengineFdwExecState *festate; /* 只使用其中的列映射和类型输入信息 */
+    MemoryContext anl_cxt;         /* 采样行所在的内存上下文 */
+    MemoryContext temp_cxt;        /* 每批结果转换时使用的临时上下文 */
+
+    HeapTuple *rows;
+    int targrows;
+    int numrows;
+    double samplerows;             /* 已读取的行数 */
+    double rowstoskip;             /* 蓄水池抽样中还需跳过的行数 */
+    ReservoirStateData rstate;
+} TDengineAnalyzeState;
 
-    /* 确定扫描关系ID */
-    if (fsplan->scan.scanrelid > 0)
-        rtindex = fsplan->scan.scanrelid;
-    else
-        rtindex = bms_next_member(fsplan->fs_relids, -1);
+/*
+ * 判断外部表是否可以 ANALYZE，无模式表的列结构不固定，不收集统计信息；
+ * 订阅表读取的消息会被消费，同样不收集
+ */
+static bool
+tdengineAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages)
+{
+    tdengine_opt *options;
+    TupleDesc tupdesc = RelationGetDescr(relation);
+    UserMapping *user;
+    StringInfoData sql;
+    double rows;
+    int32 width = 0;
+    int i;
 
-    // 获取范围表条目
-    rte = exec_rt_fetch(rtindex, estate);
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
 
-    /* 获取用户ID */
-    userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+    options = tdengine_get_options(RelationGetRelid(relation), GetUserId());
+    if (options->schemaless || options->topic != NULL)
+        return false;
 
-    /* 获取连接选项和用户映射 */
-    festate->tdengineFdwOptions = tdengine_get_options(rte->relid, userid);
-    ftable = GetForeignTable(rte->relid);
-    festate->user = GetUserMapping(userid, ftable->serverid);
+    *func = tdengineAcquireSampleRowsFunc;
 
-    /* 初始化无模式信息 */
-    tdengine_get_schemaless_info(&(festate->slinfo), schemaless, rte->relid);
+    /*
+     * TDengine 没有页的概念。页数写入 relpages，规划器据此按页估算扫描代价，
+     * 因此按远程行数和本地行宽折算，与 use_remote_estimate 时的算法相同
+     */
+    user = GetUserMapping(GetUserId(), GetForeignTable(RelationGetRelid(relation))->serverid);
+    initStringInfo(&sql);
+    tdengine_deparse_analyze_probe(&sql, relation);
+    rows = TDengineQueryCount(user, options, sql.data);
+    pfree(sql.data);
 
-    /* 准备查询参数 */
-    numParams = list_length(fsplan->fdw_exprs);
-    festate->numParams = numParams;
-    if (numParams > 0)
+    for (i = 0; i < tupdesc->natts; i++)
     {
-        prepare_query_params((PlanState *)node, fsplan->fdw_exprs, remote_exprs, rte->relid, numParams, &festate->param_flinfo, &festate->param_exprs, &festate->param_values, &festate->param_types, &festate->param_tdengine_types, &festate->param_tdengine_values, &festate->param_column_info);
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+        if (!attr->attisdropped)
+            width += get_typavgwidth(attr->atttypid, attr->atttypmod);
     }
+
+    *totalpages = (BlockNumber) Max(ceil(rows * (width + MAXALIGN(SizeofHeapTupleHeader)) / BLCKSZ), 1.0);
+
+    return true;
 }
 
-//======================== IterateForeignScan ==================
 /*
- * 逐个迭代从 TDengine 获取行，并将其放入元组槽中
+ * 将一行远程结果加入样本，样本已满时按蓄水池抽样随机替换
  */
-static TupleTableSlot *
-tdengineIterateForeignScan(ForeignScanState *node)
+static void
+tdengine_analyze_row(TDengineAnalyzeState *astate, TDengineRow *result_row, TDengineResult *result)
 {
-    // 获取执行状态
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
-    TupleTableSlot *tupleSlot = node->ss.ss_ScanTupleSlot;
-    EState *estate = node->ss.ps.state;
-    TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
-    tdengine_opt *options;
-    // 存储查询返回结果
-    struct TDengineQuery_return volatile ret;
-    // 存储查询结果
-    struct TDengineResult volatile *result = NULL;
-    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
-    RangeTblEntry *rte;
-    int rtindex;
-    // 是否为聚合操作
-    bool is_agg;
+    TupleDesc tupdesc = RelationGetDescr(astate->rel);
+    Datum *values = (Datum *)palloc0(sizeof(Datum) * tupdesc->natts);
+    bool *nulls = (bool *)palloc(sizeof(bool) * tupdesc->natts);
+    MemoryContext oldcontext;
+    int pos = -1;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
-    if (fsplan->scan.scanrelid > 0)
-    {
-        rtindex = fsplan->scan.scanrelid;
-        is_agg = false;
-    }
+    if (astate->numrows < astate->targrows)
+        pos = astate->numrows++;
     else
     {
-        rtindex = bms_next_member(fsplan->fs_relids, -1);
-        is_agg = true;
-    }
-    rte = rt_fetch(rtindex, estate->es_range_table);
+        if (astate->rowstoskip < 0)
+            astate->rowstoskip = reservoir_get_next_S(&astate->rstate, astate->samplerows, astate->targrows);
 
-    // 获取 TDengine 选项
-    options = festate->tdengineFdwOptions;
-    if (!festate->cursor_exists)
-        create_cursor(node);
+        if (astate->rowstoskip <= 0)
+        {
+            pos = (int)(astate->targrows * sampler_random_fract(&astate->rstate.randstate));
+            Assert(pos >= 0 && pos < astate->targrows);
+            heap_freetuple(astate->rows[pos]);
+        }
 
-    // 初始化元组槽的值为 0
-    memset(tupleSlot->tts_values, 0, sizeof(Datum) * tupleDescriptor->natts);
-    // 初始化元组槽的空值标记为 true
-    memset(tupleSlot->tts_isnull, true, sizeof(bool) * tupleDescriptor->natts);
-    // 清空元组槽
-    ExecClearTuple(tupleSlot);
+        astate->rowstoskip -= 1;
+    }
 
-    if (festate->rowidx == 0)
+    if (pos >= 0)
     {
-        // 保存旧的内存上下文
-        MemoryContext oldcontext = NULL;
-
-        // 异常处理开始
-        PG_TRY();
-        {
-            oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
-            ret = TDengineQuery(festate->query, festate->user, options, festate->param_tdengine_types, festate->param_tdengine_values, festate->numParams);
-            if (ret.r1 != NULL)
-            {
-                // 复制错误信息
-                char *err = pstrdup(ret.r1);
-                // 释放原错误信息
-                free(ret.r1);
-                ret.r1 = err;
-                // 打印错误信息
-                elog(ERROR, "tdengine_fdw : %s", err);
-            }
+        memset(nulls, true, sizeof(bool) * tupdesc->natts);
+        make_tuple_from_result_row(result_row, result, tupdesc, values, nulls, RelationGetRelid(astate->rel), astate->festate, false);
 
-            result = ret.r0;
-            festate->temp_result = (void *)result;
+        oldcontext = MemoryContextSwitchTo(astate->anl_cxt);
+        astate->rows[pos] = heap_form_tuple(tupdesc, values, nulls);
+        MemoryContextSwitchTo(oldcontext);
+    }
 
-            // 获取结果集的行数
-            festate->row_nums = result->nrow;
-            // 打印查询信息
-            elog(DEBUG1, "tdengine_fdw : query: %s", festate->query);
+    astate->samplerows += 1;
+}
 
-            // 切换回旧的内存上下文
-            MemoryContextSwitchTo(oldcontext);
-            // 释放结果集
-            TDengineFreeResult((TDengineResult *)result);
-        }
-        // 异常处理捕获部分
-        PG_CATCH();
-        {
-            if (ret.r1 == NULL)
-            {
-                // 释放结果集
-                TDengineFreeResult((TDengineResult *)result);
-            }
+/*
+ * 执行一条采样查询，把结果逐行交给蓄水池抽样
+ */
+static void
+tdengine_analyze_query(TDengineAnalyzeState *astate, char *query, UserMapping *user, tdengine_opt *options)
+{
+    TDengineCursor *cursor;
+    TDengineResult result;
+    int fetch_size = options->fetch_size;
 
-            if (oldcontext)
-                // 切换回旧的内存上下文
-                MemoryContextSwitchTo(oldcontext);
+    elog(DEBUG1, "tdengine_fdw : analyze query: %s", query);
 
-            // 重新抛出异常
-            PG_RE_THROW();
-        }
-        // 异常处理结束
-        PG_END_TRY();
-    }
+    cursor = TDengineCursorOpen(query, user, options, NULL, NULL, 0, false, NULL);
 
-    if (festate->rowidx < festate->row_nums)
+    for (;;)
     {
-        // 保存旧的内存上下文
-        MemoryContext oldcontext = NULL;
-
-        // 获取结果集
-        result = (TDengineResult *)festate->temp_result;
-        // 从结果行创建元组
-        make_tuple_from_result_row(&(result->rows[festate->rowidx]),(TDengineResult *)result,tupleDescriptor,tupleSlot->tts_values,tupleSlot->tts_isnull,rte->relid,festate,is_agg);
-        // 切换到查询上下文
-        oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+        MemoryContext oldcontext;
+        int nrow;
+        int i;
 
-        // 释放结果行
-        freeTDengineResultRow(festate, festate->rowidx);
+        MemoryContextReset(astate->temp_cxt);
+        oldcontext = MemoryContextSwitchTo(astate->temp_cxt);
 
-        if (festate->rowidx == (festate->row_nums - 1))
+        nrow = TDengineCursorFetch(cursor, &result, fetch_size, true);
+        for (i = 0; i < nrow; i++)
         {
-            // 释放结果集
-            freeTDengineResult(festate);
+            vacuum_delay_point();
+            tdengine_analyze_row(astate, &result.rows[i], &result);
         }
 
-        // 切换回旧的内存上下文
         MemoryContextSwitchTo(oldcontext);
 
-        // 存储虚拟元组
-        ExecStoreVirtualTuple(tupleSlot);
-        // 行索引加 1
-        festate->rowidx++;
+        if (nrow < fetch_size)
+            break;
     }
 
-    // 返回元组槽
-    return tupleSlot;
+    TDengineCursorClose(cursor);
 }
 
-//===================== ReScanForeignScan =====================
 /*
- * 从扫描的起始位置重新开始扫描
+ * 从 TDengine 获取 ANALYZE 的样本行
+ *
+ * 先查询总行数和时间范围。行数不多时读取全表做蓄水池抽样；否则把时间
+ * 范围切分成若干段，每段从段内随机的时间点开始用 LIMIT 只取少量行，避免
+ * 读取整张大表。各段合计读取采样行数的若干倍，由蓄水池抽样从中选取样本，
+ * 而不是只取每段开头的数据。
+ *
+ * 超级表的结果按子表依次返回，不排序时 LIMIT 取到的只是前几个子表的数据，
+ * 因此每段都按时间排序，从所有子表中取起点之后最早的各行。
  */
-static void
-tdengineReScanForeignScan(ForeignScanState *node)
+static int
+tdengineAcquireSampleRowsFunc(Relation relation, int elevel, HeapTuple *rows, int targrows, double *totalrows, double *totaldeadrows)
 {
-
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    Oid relid = RelationGetRelid(relation);
+    ForeignTable *table = GetForeignTable(relid);
+    UserMapping *user = GetUserMapping(GetUserId(), table->serverid);
+    tdengine_opt *options = tdengine_get_options(relid, GetUserId());
+    TDengineAnalyzeState astate;
+    TDengineFdwExecState *festate;
+    StringInfoData sql;
+    TDengineCursor *cursor;
+    TDengineResult result;
+    double remote_rows = 0;
+    Timestamp min_time = 0;
+    Timestamp max_time = 0;
+    bool has_range = false;
+    int natts;
+    int i;
 
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
 
-    festate->cursor_exists = false;
-    festate->rowidx = 0;
-}
+    /* 探测远程表的总行数和时间范围 */
+    initStringInfo(&sql);
+    tdengine_deparse_analyze_probe(&sql, relation);
 
-//===================== EndForeignScan =======================
-/*
- * 结束对外部表的扫描，并释放本次扫描所使用的对象
- */
-static void
-tdengineEndForeignScan(ForeignScanState *node)
-{
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    cursor = TDengineCursorOpen(sql.data, user, options, NULL, NULL, 0, false, NULL);
+    if (TDengineCursorFetch(cursor, &result, 1, true) > 0 && result.ncol >= 3)
+    {
+        TDengineCell *cells = result.rows[0].cells;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+        if (!cells[0].isnull)
+            remote_rows = DatumGetFloat8(tdengine_convert_cell_to_datum(FLOAT8OID, -1, NULL, InvalidOid, &cells[0], result.precision));
+        if (!cells[1].isnull && !cells[2].isnull)
+        {
+            min_time = DatumGetTimestamp(tdengine_convert_cell_to_datum(TIMESTAMPOID, -1, NULL, InvalidOid, &cells[1], result.precision));
+            max_time = DatumGetTimestamp(tdengine_convert_cell_to_datum(TIMESTAMPOID, -1, NULL, InvalidOid, &cells[2], result.precision));
+            has_range = (min_time < max_time);
+        }
+    }
+    TDengineCursorClose(cursor);
 
-    if (festate != NULL)
+    /* 采样查询按属性顺序返回各列，结果列与属性一一对应 */
+    festate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
+    festate->attinmeta = TupleDescGetAttInMetadata(RelationGetDescr(relation));
+
+    resetStringInfo(&sql);
+    tdengine_deparse_analyze(&sql, relation, &festate->retrieved_attrs);
+
+    natts = list_length(festate->retrieved_attrs);
+    festate->attr_colidx = (int *)palloc(sizeof(int) * Max(natts, 1));
+    for (i = 0; i < natts; i++)
+        festate->attr_colidx[i] = i;
+
+    astate.rel = relation;
+    astate.festate = festate;
+    astate.anl_cxt = CurrentMemoryContext;
+    astate.temp_cxt = AllocSetContextCreate(CurrentMemoryContext, "tdengine_fdw analyze data", ALLOCSET_DEFAULT_SIZES);
+    astate.rows = rows;
+    astate.targrows = targrows;
+    astate.numrows = 0;
+    astate.samplerows = 0;
+    astate.rowstoskip = -1;
+    reservoir_init_selection_state(&astate.rstate, targrows);
+
+    if (!has_range || remote_rows <= (double)targrows * TDENGINE_ANALYZE_FULL_SCAN_FACTOR)
+        tdengine_analyze_query(&astate, sql.data, user, options);
+    else
     {
-        festate->cursor_exists = false;
-        festate->rowidx = 0;
+        int per_stride = (int)ceil((double)targrows * TDENGINE_ANALYZE_OVERSAMPLE / TDENGINE_ANALYZE_STRIDES);
+        double width = (double)(max_time - min_time) / TDENGINE_ANALYZE_STRIDES;
+        double stride_rows = remote_rows / TDENGINE_ANALYZE_STRIDES;
+
+        /* 起点之后的预计行数不少于 per_stride，起点只在段内靠前的部分中选取 */
+        double span = width * Max(1.0 - per_stride / stride_rows, 0.0);
+
+        for (i = 0; i < TDENGINE_ANALYZE_STRIDES; i++)
+        {
+            Timestamp lower = min_time + (Timestamp)(width * i + span * sampler_random_fract(&astate.rstate.randstate));
+            StringInfoData cond;
+            char *query;
+
+            initStringInfo(&cond);
+            appendStringInfo(&cond, "time >= %s", tdengine_format_time_literal(lower));
+            if (i < TDENGINE_ANALYZE_STRIDES - 1)
+                appendStringInfo(&cond, " AND time < %s", tdengine_format_time_literal(min_time + (Timestamp)(width * (i + 1))));
+
+            query = tdengine_splice_time_condition(sql.data, sql.len, false, cond.data);
+            query = psprintf("%s ORDER BY time LIMIT %d", query, per_stride);
+
+            tdengine_analyze_query(&astate, query, user, options);
+
+            pfree(cond.data);
+            pfree(query);
+        }
     }
+
+    MemoryContextDelete(astate.temp_cxt);
+
+    /* 分段采样时只读取了部分行，总行数以探测结果为准 */
+    *totalrows = Max(remote_rows, astate.samplerows);
+    *totaldeadrows = 0;
+
+    ereport(elevel,
+            (errmsg("\"%s\": table contains %.0f rows, %d rows in sample",
+                    RelationGetRelationName(relation), *totalrows, astate.numrows)));
+
+    return astate.numrows;
 }
 
 /*
@@ -1022,8 +2880,11 @@ static List * tdenginePlanForeignModify(PlannerInfo *root, ModifyTable *plan, In
     switch (operation)
     {
     case CMD_INSERT:
+        // 构建参数绑定的INSERT语句
+        tdengine_deparse_insert(&sql, root, resultRelation, rel, targetAttrs);
+        break;
     case CMD_UPDATE:
-        break; // INSERT和UPDATE操作暂不处理SQL构建
+        break; // UPDATE操作暂不处理SQL构建
     case CMD_DELETE:
         // 构建DELETE语句
         tdengine_deparse_delete(&sql, root, resultRelation, rel, targetAttrs);
@@ -1040,20 +2901,20 @@ static List * tdenginePlanForeignModify(PlannerInfo *root, ModifyTable *plan, In
 }
 
 /*
- * tdengineBeginForeignModify - 初始化外部表修改操作
+ * create_foreign_modify - 创建外部表修改操作的执行状态
  * 参数:
- *   @mtstate: 修改表操作状态
+ *   @estate: 执行状态
+ *   @rte: 目标关系的范围表条目，用于确定用户身份
  *   @resultRelInfo: 结果关系信息
- *   @fdw_private: FDW私有数据列表
- *   @subplan_index: 子计划索引
- *   @eflags: 执行标志位
+ *   @operation: 操作类型
+ *   @subplan: 子计划，用于查找junk列；COPY 和分区路由时为 NULL
+ *   @query: 反解析得到的远程语句
+ *   @target_attrs: 目标属性列表
  */
-static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo, List *fdw_private, int subplan_index, int eflags)
+static TDengineFdwExecState *create_foreign_modify(EState *estate, RangeTblEntry *rte, ResultRelInfo *resultRelInfo, CmdType operation, Plan *subplan, char *query, List *target_attrs)
 {
     // 执行状态结构体
     TDengineFdwExecState *fmstate = NULL;
-    // 执行状态
-    EState *estate = mtstate->ps.state;
     // 目标关系
     Relation rel = resultRelInfo->ri_RelationDesc;
     // 参数数量
@@ -1068,46 +2929,37 @@ static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo
     ListCell *lc = NULL;
     // 外部表OID
     Oid foreignTableId = InvalidOid;
-    // 子计划
-    Plan *subplan;
     int i;
-    // 范围表条目
-    RangeTblEntry *rte;
     // 外部表信息
     ForeignTable *ftable;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
-
-    /* 如果是EXPLAIN ONLY模式，直接返回 */
-    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-        return;
-
     // 获取外部表OID
     foreignTableId = RelationGetRelid(rel);
-    // 获取子计划
-    subplan = outerPlanState(mtstate)->plan;
 
     // 初始化执行状态结构体
     fmstate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
     fmstate->rowidx = 0;
 
     /* 获取用户身份 */
-    rte = exec_rt_fetch(resultRelInfo->ri_RangeTableIndex,
-                        mtstate->ps.state);
     userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
 
     /* 获取连接选项和用户映射 */
     fmstate->tdengineFdwOptions = tdengine_get_options(foreignTableId, userid);
+    if (fmstate->tdengineFdwOptions->topic != NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("cannot modify foreign table \"%s\"", RelationGetRelationName(rel)),
+                 errdetail("Foreign tables with the \"topic\" option are read-only.")));
     ftable = GetForeignTable(foreignTableId);
     fmstate->user = GetUserMapping(userid, ftable->serverid);
 
     // 设置查询语句和检索属性
     fmstate->rel = rel;
-    fmstate->query = strVal(list_nth(fdw_private, FdwModifyPrivateUpdateSql));
-    fmstate->retrieved_attrs = (List *)list_nth(fdw_private, FdwModifyPrivateTargetAttnums);
+    fmstate->query = query;
+    fmstate->retrieved_attrs = target_attrs;
 
     /* 为INSERT/DELETE操作准备列信息 */
-    if (mtstate->operation == CMD_INSERT || mtstate->operation == CMD_DELETE)
+    if (operation == CMD_INSERT || operation == CMD_DELETE)
     {
         fmstate->column_list = NIL;
 
@@ -1132,9 +2984,19 @@ static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo
             }
         }
         // 设置批量大小选项
-        fmstate->batch_size = tdengine_get_batch_size_option(rel);
+        fmstate->batch_size = tdengine_get_batch_size_option(rel, &fmstate->batch_auto);
+        fmstate->batch_rows = TDENGINE_AUTO_BATCH_INIT_ROWS;
     }
 
+    /*
+     * INSERT 的各批次复用同一个参数绑定语句；无模式外部表的 tags/fields 列没有
+     * 固定的远程列，改为编码为行协议通过无模式写入接口提交
+     */
+    if (operation == CMD_INSERT && fmstate->tdengineFdwOptions->schemaless)
+        tdengine_get_schemaless_info(&fmstate->slinfo, true, foreignTableId);
+    else if (operation == CMD_INSERT)
+        fmstate->insert_stmt = TDengineInsertPrepare(fmstate->query, fmstate->user, fmstate->tdengineFdwOptions);
+
     /* 计算参数总数(检索属性数+1) */
     n_params = list_length(fmstate->retrieved_attrs) + 1;
 
@@ -1167,20 +3029,52 @@ static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo
     }
     Assert(fmstate->p_nums <= n_params); // 验证参数数量不超过总数
 
-    /* 分配并初始化junk属性索引数组 */
+    /* 分配并初始化junk属性索引数组，没有子计划时所有列都不是junk列 */
     fmstate->junk_idx = palloc0(RelationGetDescr(rel)->natts * sizeof(AttrNumber));
 
     /* 遍历表的所有列 */
-    for (i = 0; i < RelationGetDescr(rel)->natts; i++)
+    for (i = 0; subplan != NULL && i < RelationGetDescr(rel)->natts; i++)
     {
 
         fmstate->junk_idx[i] =
             ExecFindJunkAttributeInTlist(subplan->targetlist,get_attname(foreignTableId, i + 1,false));
     }
 
-    fmstate->aux_fmstate = NULL;
+    fmstate->aux_fmstate = NULL;
+
+    return fmstate;
+}
+
+/*
+ * tdengineBeginForeignModify - 初始化外部表修改操作
+ * 参数:
+ *   @mtstate: 修改表操作状态
+ *   @resultRelInfo: 结果关系信息
+ *   @fdw_private: FDW私有数据列表
+ *   @subplan_index: 子计划索引
+ *   @eflags: 执行标志位
+ */
+static void tdengineBeginForeignModify(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo, List *fdw_private, int subplan_index, int eflags)
+{
+    // 范围表条目
+    RangeTblEntry *rte;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 如果是EXPLAIN ONLY模式，直接返回 */
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
 
-    resultRelInfo->ri_FdwState = fmstate;
+    rte = exec_rt_fetch(resultRelInfo->ri_RangeTableIndex,
+                        mtstate->ps.state);
+
+    resultRelInfo->ri_FdwState = create_foreign_modify(mtstate->ps.state,
+                                                       rte,
+                                                       resultRelInfo,
+                                                       mtstate->operation,
+                                                       outerPlanState(mtstate)->plan,
+                                                       strVal(list_nth(fdw_private, FdwModifyPrivateUpdateSql)),
+                                                       (List *)list_nth(fdw_private, FdwModifyPrivateTargetAttnums));
 }
 
 /*
@@ -1209,11 +3103,26 @@ static TupleTableSlot * tdengineExecForeignInsert(EState *estate, ResultRelInfo
     if (fmstate->aux_fmstate)
         resultRelInfo->ri_FdwState = fmstate->aux_fmstate;
 
+    /* COPY 时先缓冲元组，攒满一批后再提交 */
+    if (((TDengineFdwExecState *)resultRelInfo->ri_FdwState)->buffered_slots != NULL)
+    {
+        TDengineFdwExecState *cur = (TDengineFdwExecState *)resultRelInfo->ri_FdwState;
+
+        ExecCopySlot(cur->buffered_slots[cur->num_buffered++], slot);
+        if (cur->num_buffered >= cur->batch_size)
+            tdengine_flush_buffered_inserts(estate, resultRelInfo, cur);
+
+        if (fmstate->aux_fmstate)
+            resultRelInfo->ri_FdwState = fmstate;
+        return slot;
+    }
+
     // 执行实际的插入操作
-    rslot = execute_foreign_insert_modify(estate, resultRelInfo, &slot, &planSlot, numSlots)
-            /* 恢复原始执行状态 */
-            if (fmstate->aux_fmstate)
-                resultRelInfo->ri_FdwState = fmstate;
+    rslot = execute_foreign_insert_modify(estate, resultRelInfo, &slot, &planSlot, numSlots);
+
+    /* 恢复原始执行状态 */
+    if (fmstate->aux_fmstate)
+        resultRelInfo->ri_FdwState = fmstate;
 
     return rslot ? *rslot : NULL;
 }
@@ -1273,7 +3182,7 @@ static int tdengineGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
     if (fmstate)
         batch_size = fmstate->batch_size;
     else
-        batch_size = tdengine_get_batch_size_option(resultRelInfo->ri_RelationDesc);
+        batch_size = tdengine_get_batch_size_option(resultRelInfo->ri_RelationDesc, NULL);
 
     /*
      * 检查禁用批量操作的条件:
@@ -1394,10 +3303,157 @@ static void tdengineEndForeignModify(EState *estate, ResultRelInfo *resultRelInf
 
     // 检查并重置执行状态
     if (fmstate != NULL)
+        finish_foreign_modify(estate, resultRelInfo, fmstate);
+}
+
+/*
+ * tdengineBeginForeignInsert - 为 COPY FROM 或分区路由准备向外部表插入
+ *
+ * 与 tdengineBeginForeignModify 共用执行状态和参数绑定语句。COPY 时执行器逐行
+ * 调用 ExecForeignInsert，这里为其准备元组缓冲区，攒满一批后通过同一个语句提交；
+ * 未显式设置 batch_size 时按 'auto' 调整每次提交的行数
+ * 参数:
+ *   @mtstate: 修改表操作状态，COPY 时其计划为 NULL
+ *   @resultRelInfo: 结果关系信息
+ */
+static void tdengineBeginForeignInsert(ModifyTableState *mtstate, ResultRelInfo *resultRelInfo)
+{
+    TDengineFdwExecState *fmstate;
+    ModifyTable *plan = (ModifyTable *)mtstate->ps.plan;
+    EState *estate = mtstate->ps.state;
+    Relation rel = resultRelInfo->ri_RelationDesc;
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    RangeTblEntry *rte;
+    Index resultRelation;
+    StringInfoData sql;
+    List *targetAttrs = NIL;
+    int attnum;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    // 检查不支持的特性
+    if (plan && plan->operation == CMD_UPDATE)
+        elog(ERROR, "UPDATE is not supported");
+    if (plan && plan->returningLists)
+        elog(ERROR, "RETURNING is not supported");
+    if (plan && plan->onConflictAction != ONCONFLICT_NONE)
+        elog(ERROR, "ON CONFLICT is not supported");
+
+    // 收集所有非删除列
+    for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+
+        if (!attr->attisdropped)
+            targetAttrs = lappend_int(targetAttrs, attnum);
+    }
+
+    /*
+     * 分区路由时外部表分区可能没有自己的范围表条目，此时使用根表的条目确定用户身份
+     */
+    if (resultRelInfo->ri_RangeTableIndex == 0)
+    {
+        ResultRelInfo *rootResultRelInfo = resultRelInfo->ri_RootResultRelInfo;
+
+        rte = exec_rt_fetch(rootResultRelInfo->ri_RangeTableIndex, estate);
+        rte = copyObject(rte);
+        rte->relid = RelationGetRelid(rel);
+        rte->relkind = RELKIND_FOREIGN_TABLE;
+        resultRelation = rootResultRelInfo->ri_RangeTableIndex;
+    }
+    else
+    {
+        resultRelation = resultRelInfo->ri_RangeTableIndex;
+        rte = exec_rt_fetch(resultRelation, estate);
+    }
+
+    // 构建参数绑定的INSERT语句
+    initStringInfo(&sql);
+    tdengine_deparse_insert(&sql, NULL, resultRelation, rel, targetAttrs);
+
+    fmstate = create_foreign_modify(estate, rte, resultRelInfo, CMD_INSERT, NULL, sql.data, targetAttrs);
+
+    /* COPY 时缓冲逐行插入的元组，行级触发器和 WITH CHECK 需要逐行处理，此时不缓冲 */
+    if (plan == NULL &&
+        resultRelInfo->ri_WithCheckOptions == NIL &&
+        !(resultRelInfo->ri_TrigDesc &&
+          (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+           resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+    {
+        int i;
+
+        if (!fmstate->batch_auto && fmstate->batch_size <= 1)
+        {
+            fmstate->batch_auto = true;
+            fmstate->batch_size = TDENGINE_AUTO_BATCH_MAX_ROWS;
+        }
+
+        fmstate->buffered_slots = (TupleTableSlot **)palloc(sizeof(TupleTableSlot *) * fmstate->batch_size);
+        for (i = 0; i < fmstate->batch_size; i++)
+            fmstate->buffered_slots[i] = MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+        fmstate->num_buffered = 0;
+    }
+
+    resultRelInfo->ri_FdwState = fmstate;
+}
+
+/*
+ * tdengineEndForeignInsert - 结束 COPY FROM 或分区路由的插入，提交缓冲中剩余的元组
+ */
+static void tdengineEndForeignInsert(EState *estate, ResultRelInfo *resultRelInfo)
+{
+    TDengineFdwExecState *fmstate = (TDengineFdwExecState *)resultRelInfo->ri_FdwState;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    Assert(fmstate != NULL);
+
+    finish_foreign_modify(estate, resultRelInfo, fmstate);
+}
+
+/*
+ * finish_foreign_modify - 提交缓冲中剩余的元组，等待尚未完成的插入并释放插入语句
+ */
+static void finish_foreign_modify(EState *estate, ResultRelInfo *resultRelInfo, TDengineFdwExecState *fmstate)
+{
+    if (fmstate->buffered_slots != NULL)
     {
-        fmstate->cursor_exists = false; // 重置游标状态
-        fmstate->rowidx = 0;            // 重置行索引
+        int i;
+
+        tdengine_flush_buffered_inserts(estate, resultRelInfo, fmstate);
+        for (i = 0; i < fmstate->batch_size; i++)
+            ExecDropSingleTupleTableSlot(fmstate->buffered_slots[i]);
+        fmstate->buffered_slots = NULL;
     }
+
+    // 等待尚未完成的插入，然后释放插入语句
+    tdengine_finish_insert(fmstate);
+    TDengineInsertClose(fmstate->insert_stmt);
+    fmstate->insert_stmt = NULL;
+
+    // 远程数据已变化，丢弃写入期间缓存的读取了该表的结果
+    if (fmstate->cache_write_started)
+        tdengine_result_cache_invalidate(tdengine_result_cache_table_key(fmstate->user->serverid, fmstate->tdengineFdwOptions));
+
+    fmstate->cursor_exists = false; // 重置游标状态
+    fmstate->rowidx = 0;            // 重置行索引
+}
+
+/*
+ * tdengine_flush_buffered_inserts - 提交 COPY 时缓冲的元组
+ */
+static void tdengine_flush_buffered_inserts(EState *estate, ResultRelInfo *resultRelInfo, TDengineFdwExecState *fmstate)
+{
+    int i;
+
+    if (fmstate->num_buffered == 0)
+        return;
+
+    execute_foreign_insert_modify(estate, resultRelInfo, fmstate->buffered_slots, NULL, fmstate->num_buffered);
+
+    for (i = 0; i < fmstate->num_buffered; i++)
+        ExecClearTuple(fmstate->buffered_slots[i]);
+    fmstate->num_buffered = 0;
 }
 /*
  * tdengineBeginDirectModify - 准备直接修改外部表
@@ -1424,7 +3480,7 @@ static void tdengineBeginDirectModify(ForeignScanState *node, int eflags)
     // 参数数量
     int numParams;
     ForeignTable *ftable;
-    List *remote_exprs;
+    List *param_column_types = NIL;
 
     // 记录调试日志
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
@@ -1473,8 +3529,9 @@ static void tdengineBeginDirectModify(ForeignScanState *node, int eflags)
     dmstate->retrieved_attrs = (List *)list_nth(fsplan->fdw_private, FdwDirectModifyPrivateRetrievedAttrs);
     dmstate->set_processed = boolVal(list_nth(fsplan->fdw_private, FdwDirectModifyPrivateSetProcessed));
 
-    // 从计划节点获取远程表达式列表
-    remote_exprs = (List *)list_nth(fsplan->fdw_private,FdwDirectModifyRemoteExprs);
+    // 从计划节点获取远程参数对应的列类型
+    if (list_length(fsplan->fdw_private) > FdwDirectModifyParamColumnTypes)
+        param_column_types = (List *)list_nth(fsplan->fdw_private, FdwDirectModifyParamColumnTypes);
 
     /*
      * 准备远程查询参数处理
@@ -1484,7 +3541,7 @@ static void tdengineBeginDirectModify(ForeignScanState *node, int eflags)
 
     /* 如果有参数需要处理 */
     if (numParams > 0)
-        prepare_query_params((PlanState *)node, fsplan->fdw_exprs, remote_exprs, rte->relid, numParams, &dmstate->param_flinfo, &dmstate->param_exprs, &dmstate->param_values, &dmstate->param_types, &dmstate->param_tdengine_types, &dmstate->param_tdengine_values, &dmstate->param_column_info);
+        prepare_query_params((PlanState *)node, fsplan->fdw_exprs, param_column_types, rte->relid, numParams, &dmstate->param_flinfo, &dmstate->param_exprs, &dmstate->param_values, &dmstate->param_types, &dmstate->param_tdengine_types, &dmstate->param_tdengine_values, &dmstate->param_column_info);
 }
 
 /*
@@ -1507,9 +3564,15 @@ static TupleTableSlot *tdengineIterateDirectModify(ForeignScanState *node)
 
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
 
-    /* 首次调用时执行DML语句 */
+    /* 首次调用时执行DML语句，执行前后都丢弃读取了该远程表的缓存结果 */
     if (dmstate->num_tuples == -1)
+    {
+        uint32 table = tdengine_result_cache_table_key(dmstate->user->serverid, dmstate->tdengineFdwOptions);
+
+        tdengine_result_cache_begin_write(table);
         execute_dml_stmt(node);
+        tdengine_result_cache_invalidate(table);
+    }
 
     Assert(!dmstate->has_returning);
 
@@ -1551,7 +3614,7 @@ void tdengine_reset_transmission_modes(int nestlevel)
     AtEOXact_GUC(true, nestlevel);
 }
 
-static void prepare_query_params(PlanState *node, List *fdw_exprs, List *remote_exprs, Oid foreigntableid, int numParams, FmgrInfo **param_flinfo, List **param_exprs, const char ***param_values, Oid **param_types, TDengineType **param_tdengine_types, TDengineValue **param_tdengine_values, TDengineColumnInfo **param_column_info)
+static void prepare_query_params(PlanState *node, List *fdw_exprs, List *param_column_types, Oid foreigntableid, int numParams, FmgrInfo **param_flinfo, List **param_exprs, const char ***param_values, Oid **param_types, TDengineType **param_tdengine_types, TDengineValue **param_tdengine_values, TDengineColumnInfo **param_column_info)
 {
     int i;
     ListCell *lc;
@@ -1579,124 +3642,377 @@ static void prepare_query_params(PlanState *node, List *fdw_exprs, List *remote_
         getTypeOutputInfo(exprType(param_expr), &typefnoid, &isvarlena);
         fmgr_info(typefnoid, &(*param_flinfo)[i]);
 
-        /* 如果是时间类型参数 */
-        if (TDENGINE_IS_TIME_TYPE((*param_types)[i]))
+        /*
+         * 参数对应的列类型在计划阶段已按原始的外层 Var 确定；执行阶段 fdw_exprs
+         * 已被替换为 PARAM_EXEC 参数，无法再与远程条件匹配
+         */
+        if (i < list_length(param_column_types))
+            (*param_column_info)[i].column_type = (TDengineColumnType)intVal(list_nth(param_column_types, i));
+        i++;
+    }
+
+    /* 初始化参数表达式列表 */
+    *param_exprs = (List *)ExecInitExprList(fdw_exprs, node);
+    /* 分配参数值缓冲区 */
+    *param_values = (const char **)palloc0(numParams * sizeof(char *));
+}
+
+/*
+ * 检查参数是否属于条件表达式
+ *
+ * 参数:
+ *   @qual: 条件表达式树节点
+ *   @param: 要检查的参数节点
+ */
+static bool tdengine_param_belong_to_qual(Node *qual, Node *param)
+{
+    /* 空条件直接返回false */
+    if (qual == NULL)
+        return false;
+
+    /* 当前节点与参数匹配则返回true */
+    if (equal(qual, param))
+        return true;
+
+    /* 递归检查表达式树的所有子节点 */
+    return expression_tree_walker(qual, tdengine_param_belong_to_qual, param);
+}
+
+/*
+ * 在计划阶段确定每个远程参数所比较的本表列类型
+ *
+ * params_list 中保存的是反解析时收集的原始表达式（外层关系的 Var 等），
+ * 此时仍能在远程条件中按 equal() 找到它们，再取条件中属于本关系的列。
+ * 返回与 params_list 等长的整数列表，元素为 TDengineColumnType。
+ */
+static List *tdengine_param_column_types(PlannerInfo *root, RelOptInfo *baserel, List *remote_exprs, List *params_list)
+{
+    List *result = NIL;
+    ListCell *lc;
+
+    foreach (lc, params_list)
+    {
+        Node *param_expr = (Node *)lfirst(lc);
+        TDengineColumnType column_type = TDENGINE_UNKNOWN_KEY;
+        ListCell *expr_cell;
+
+        foreach (expr_cell, remote_exprs)
+        {
+            Node *qual = (Node *)lfirst(expr_cell);
+            List *column_list;
+            ListCell *var_cell;
+
+            if (!tdengine_param_belong_to_qual(qual, param_expr))
+                continue;
+
+            column_list = pull_var_clause(qual, PVC_RECURSE_PLACEHOLDERS);
+            foreach (var_cell, column_list)
+            {
+                Var *col = (Var *)lfirst(var_cell);
+                RangeTblEntry *rte;
+                char *column_name;
+
+                /* 只取本关系自己的列，外层关系的列就是参数本身 */
+                if (!IsA(col, Var) || col->varlevelsup != 0 ||
+                    !bms_is_member(col->varno, baserel->relids) ||
+                    equal(col, param_expr))
+                    continue;
+
+                rte = planner_rt_fetch(col->varno, root);
+                column_name = tdengine_get_column_name(rte->relid, col->varattno);
+
+                if (TDENGINE_IS_TIME_COLUMN(column_name))
+                    column_type = TDENGINE_TIME_KEY;
+                else if (tdengine_is_tag_key(column_name, rte->relid))
+                    column_type = TDENGINE_TAG_KEY;
+                else
+                    column_type = TDENGINE_FIELD_KEY;
+                break;
+            }
+            if (column_type != TDENGINE_UNKNOWN_KEY)
+                break;
+        }
+        result = lappend(result, makeInteger(column_type));
+    }
+
+    return result;
+}
+
+static void process_query_params(ExprContext *econtext, FmgrInfo *param_flinfo, List *param_exprs, const char **param_values, Oid *param_types, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, TDengineColumnInfo *param_column_info)
+{
+    int nestlevel;
+    int i;
+    ListCell *lc;
+
+    nestlevel = tdengine_set_transmission_modes();
+
+    i = 0;
+    foreach (lc, param_exprs)
+    {
+        ExprState *expr_state = (ExprState *)lfirst(lc);
+        Datum expr_value;
+        bool isNull;
+
+        expr_value = ExecEvalExpr(expr_state, econtext, &isNull);
+
+        if (isNull)
+        {
+            elog(ERROR, "tdengine_fdw : cannot bind NULL due to TDengine does not support to filter NULL value");
+        }
+        else
+        {
+            /* Bind parameters */
+            tdengine_bind_sql_var(param_types[i], i, expr_value, param_column_info, param_tdengine_types, param_tdengine_values);
+            param_values[i] = OutputFunctionCall(&param_flinfo[i], expr_value);
+        }
+        i++;
+    }
+    tdengine_reset_transmission_modes(nestlevel);
+}
+
+static void create_cursor(ForeignScanState *node)
+{
+    // 获取执行状态
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    // 获取表达式上下文
+    ExprContext *econtext = node->ss.ps.ps_ExprContext;
+    // 获取参数数量
+    int numParams = festate->numParams;
+    // 获取参数值数组
+    const char **values = festate->param_values;
+
+    /* 如果有查询参数需要处理 */
+    if (numParams > 0)
+    {
+        MemoryContext oldcontext;
+
+        /* 切换到每元组内存上下文 */
+        oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+        // 分配参数存储空间
+        festate->params = palloc(numParams);
+        // 处理查询参数(类型转换和绑定)
+        process_query_params(econtext, festate->param_flinfo, festate->param_exprs, values, festate->param_types, festate->param_tdengine_types, festate->param_tdengine_values, festate->param_column_info);
+
+        /* 切换回原始内存上下文 */
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    /* 订阅表读取消费者拉取到的新消息，不发送查询 */
+    if (festate->tdengineFdwOptions->topic != NULL)
+        festate->cursor = TDengineCursorOpenTopic(festate->user, festate->tdengineFdwOptions);
+    /* 发送查询，结果留在远程按批拉取；异步执行时不等待查询完成 */
+    else
+        festate->cursor = TDengineCursorOpen(festate->query, festate->user, festate->tdengineFdwOptions, festate->param_tdengine_types, festate->param_tdengine_values, numParams, node->ss.ps.async_capable, festate->cache_scan.ttl > 0 ? &festate->cache_scan : NULL);
+
+    festate->cursor_exists = true;
+    festate->eof_reached = false;
+    festate->rowidx = 0;
+    festate->row_nums = 0;
+}
+
+/*
+ * fetch_more_data - 从远程游标中拉取下一批结果
+ *
+ * 上一批的数据在批次内存上下文中统一释放，因此扫描过程中常驻内存的
+ * 只有一批(最多 fetch_size 行)数据
+ */
+static void fetch_more_data(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    MemoryContext oldcontext;
+
+    MemoryContextReset(festate->batch_cxt);
+    oldcontext = MemoryContextSwitchTo(festate->batch_cxt);
+
+    festate->row_nums = TDengineCursorFetch(festate->cursor, &festate->batch, festate->fetch_size, true);
+    festate->rowidx = 0;
+
+    /* 返回的行数少于请求的行数说明远程结果已读完 */
+    festate->eof_reached = (festate->row_nums < festate->fetch_size);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    /*
+     * 第一批结果到达后确定属性与结果列的对应关系，同一扫描中只需计算一次。
+     * 订阅表没有读到消息时结果中没有列，留到读到消息时再计算
+     */
+    if (festate->attr_colidx == NULL && festate->batch.ncol > 0)
+        map_result_columns(node);
+}
+
+/*
+ * map_result_columns - 计算 retrieved_attrs 中每个属性在远程结果中的列下标
+ *
+ * 连接和聚合的结果按目标列表的位置对应；普通扫描按列名对应，时间列
+ * 在远程结果中固定名为 time。
+ */
+static void map_result_columns(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    TDengineResult *result = &festate->batch;
+    MemoryContext oldcontext;
+    ListCell *lc;
+    int i = 0;
+    int j;
+
+    oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+    festate->attr_colidx = (int *)palloc(sizeof(int) * Max(list_length(festate->retrieved_attrs), 1));
+
+    foreach (lc, festate->retrieved_attrs)
+    {
+        int attnum = lfirst_int(lc);
+        int colidx = TDENGINE_COLIDX_NONE;
+
+        if (fsplan->scan.scanrelid == 0)
+        {
+            /* 连接或聚合：结果列与 fdw_scan_tlist 按位置对应 */
+            if (i < result->ncol)
+                colidx = i;
+        }
+        else
         {
-            ListCell *expr_cell;
+            char *colname = tdengine_get_column_name(festate->relid, attnum);
 
-            foreach (expr_cell, remote_exprs)
+            if (festate->slinfo.schemaless && strcmp(colname, TDENGINE_TAGS_COLUMN) == 0)
+                colidx = TDENGINE_COLIDX_SL_TAGS;
+            else if (festate->slinfo.schemaless && strcmp(colname, TDENGINE_FIELDS_COLUMN) == 0)
+                colidx = TDENGINE_COLIDX_SL_FIELDS;
+            else
             {
-                Node *qual = (Node *)lfirst(expr_cell);
+                if (TDENGINE_IS_TIME_COLUMN(colname))
+                    colname = TDENGINE_TIME_COLUMN;
+
+                for (j = 0; j < result->ncol; j++)
+                {
+                    if (strcmp(result->columns[j], colname) == 0)
+                    {
+                        colidx = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        festate->attr_colidx[i++] = colidx;
+    }
 
-                if (tdengine_param_belong_to_qual(qual, param_expr))
-                {
-                    Var *col;
-                    char *column_name;
-                    List *column_list = pull_var_clause(qual, PVC_RECURSE_PLACEHOLDERS);
-
-                    /* 提取相关列信息 */
-                    col = linitial(column_list);
-                    column_name = tdengine_get_column_name(foreigntableid, col->varattno);
-
-                    if (TDENGINE_IS_TIME_COLUMN(column_name))
-                        (*param_column_info)[i].column_type = TDENGINE_TIME_KEY;
-                    else if (tdengine_is_tag_key(column_name, foreigntableid))
-                        (*param_column_info)[i].column_type = TDENGINE_TAG_KEY;
-                    else
-                        (*param_column_info)[i].column_type = TDENGINE_FIELD_KEY;
-                }
-            }
+    /* 无模式扫描需要区分结果中的时间列、标签列和字段列 */
+    if (festate->slinfo.schemaless)
+    {
+        festate->col_types = (TDengineColumnType *)palloc(sizeof(TDengineColumnType) * Max(result->ncol, 1));
+        for (j = 0; j < result->ncol; j++)
+        {
+            /* TDengine 表的第一列总是时间戳主键 */
+            if (j == 0 || TDENGINE_IS_TIME_COLUMN(result->columns[j]))
+                festate->col_types[j] = TDENGINE_TIME_KEY;
+            else if (tdengine_is_tag_key(result->columns[j], festate->relid))
+                festate->col_types[j] = TDENGINE_TAG_KEY;
+            else
+                festate->col_types[j] = TDENGINE_FIELD_KEY;
         }
-        i++;
     }
 
-    /* 初始化参数表达式列表 */
-    *param_exprs = (List *)ExecInitExprList(fdw_exprs, node);
-    /* 分配参数值缓冲区 */
-    *param_values = (const char **)palloc0(numParams * sizeof(char *));
+    MemoryContextSwitchTo(oldcontext);
 }
 
 /*
- * 检查参数是否属于条件表达式
+ * make_tuple_from_result_row - 将一行二进制结果转换为元组的各个属性值
  *
  * 参数:
- *   @qual: 条件表达式树节点
- *   @param: 要检查的参数节点
+ *   @result_row: 当前结果行
+ *   @result: 当前批次的结果集
+ *   @tupleDescriptor: 扫描元组描述符
+ *   @row/@is_null: 输出的属性值和空值标记，调用前已初始化为空
+ *   @relid: 外部表 OID
+ *   @festate: 扫描执行状态
+ *   @is_agg: 是否为聚合/连接扫描，列的对应关系已在 map_result_columns 中确定
  */
-static bool tdengine_param_belong_to_qual(Node *qual, Node *param)
+static void
+make_tuple_from_result_row(TDengineRow *result_row, TDengineResult *result, TupleDesc tupleDescriptor, Datum *row, bool *is_null, Oid relid, TDengineFdwExecState *festate, bool is_agg)
 {
-    /* 空条件直接返回false */
-    if (qual == NULL)
-        return false;
+    AttInMetadata *attinmeta = festate->attinmeta;
+    ListCell *lc;
+    int i = 0;
 
-    /* 当前节点与参数匹配则返回true */
-    if (equal(qual, param))
-        return true;
+    foreach (lc, festate->retrieved_attrs)
+    {
+        int attnum = lfirst_int(lc) - 1;
+        Form_pg_attribute attr = TupleDescAttr(tupleDescriptor, attnum);
+        int colidx = festate->attr_colidx[i++];
+        TDengineCell *cell;
 
-    /* 递归检查表达式树的所有子节点 */
-    return expression_tree_walker(qual, tdengine_param_belong_to_qual, param);
+        if (colidx == TDENGINE_COLIDX_SL_TAGS || colidx == TDENGINE_COLIDX_SL_FIELDS)
+        {
+            char *jsstr = make_schemaless_jsonb(result_row, result, festate, colidx == TDENGINE_COLIDX_SL_TAGS ? TDENGINE_TAG_KEY : TDENGINE_FIELD_KEY);
+
+            row[attnum] = tdengine_convert_text_to_datum(attr->atttypid, attr->atttypmod, &attinmeta->attinfuncs[attnum], attinmeta->attioparams[attnum], jsstr);
+            is_null[attnum] = false;
+            continue;
+        }
+
+        /* 结果中不存在的列保持为空 */
+        if (colidx < 0)
+            continue;
+
+        cell = &result_row->cells[colidx];
+        if (cell->isnull)
+            continue;
+
+        row[attnum] = tdengine_convert_cell_to_datum(attr->atttypid, attr->atttypmod, &attinmeta->attinfuncs[attnum], attinmeta->attioparams[attnum], cell, result->precision);
+        is_null[attnum] = false;
+    }
 }
 
-static void process_query_params(ExprContext *econtext, FmgrInfo *param_flinfo, List *param_exprs, const char **param_values, Oid *param_types, TDengineType *param_tdengine_types, TDengineValue *param_tdengine_values, TDengineColumnInfo *param_column_info)
+/*
+ * make_schemaless_jsonb - 将结果行中的标签列或字段列组合为 jsonb 对象的文本
+ */
+static char *
+make_schemaless_jsonb(TDengineRow *result_row, TDengineResult *result, TDengineFdwExecState *festate, TDengineColumnType want)
 {
-    int nestlevel;
-    int i;
-    ListCell *lc;
+    StringInfoData buf;
+    bool first = true;
+    int j;
 
-    nestlevel = tdengine_set_transmission_modes();
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '{');
 
-    i = 0;
-    foreach (lc, param_exprs)
+    for (j = 0; j < result->ncol; j++)
     {
-        ExprState *expr_state = (ExprState *)lfirst(lc);
-        Datum expr_value;
-        bool isNull;
+        TDengineCell *cell = &result_row->cells[j];
 
-        expr_value = ExecEvalExpr(expr_state, econtext, &isNull);
+        if (festate->col_types[j] != want || cell->isnull)
+            continue;
 
-        if (isNull)
-        {
-            elog(ERROR, "tdengine_fdw : cannot bind NULL due to TDengine does not support to filter NULL value");
-        }
-        else
-        {
-            /* Bind parameters */
-            tdengine_bind_sql_var(param_types[i], i, expr_value, param_column_info, param_tdengine_types, param_tdengine_values);
-            param_values[i] = OutputFunctionCall(&param_flinfo[i], expr_value);
-        }
-        i++;
+        if (!first)
+            appendStringInfoString(&buf, ", ");
+        escape_json(&buf, result->columns[j]);
+        appendStringInfoString(&buf, ": ");
+        escape_json(&buf, tdengine_cell_to_cstring(cell, result->precision));
+        first = false;
     }
-    tdengine_reset_transmission_modes(nestlevel);
+
+    appendStringInfoChar(&buf, '}');
+
+    return buf.data;
 }
 
-static void create_cursor(ForeignScanState *node)
+/*
+ * close_cursor - 关闭远程游标并重置扫描状态
+ */
+static void close_cursor(TDengineFdwExecState *festate)
 {
-    // 获取执行状态
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
-    // 获取表达式上下文
-    ExprContext *econtext = node->ss.ps.ps_ExprContext;
-    // 获取参数数量
-    int numParams = festate->numParams;
-    // 获取参数值数组
-    const char **values = festate->param_values;
-
-    /* 如果有查询参数需要处理 */
-    if (numParams > 0)
+    if (festate->cursor != NULL)
     {
-        MemoryContext oldcontext;
-
-        /* 切换到每元组内存上下文 */
-        oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
-        // 分配参数存储空间
-        festate->params = palloc(numParams);
-        // 处理查询参数(类型转换和绑定)
-        process_query_params(econtext, festate->param_flinfo, festate->param_exprs, values, festate->param_types, festate->param_tdengine_types, festate->param_tdengine_values, festate->param_column_info);
-
-        /* 切换回原始内存上下文 */
-        MemoryContextSwitchTo(oldcontext);
+        TDengineCursorClose(festate->cursor);
+        festate->cursor = NULL;
     }
 
-    festate->cursor_exists = true;
+    festate->cursor_exists = false;
+    festate->eof_reached = false;
+    festate->rowidx = 0;
+    festate->row_nums = 0;
 }
 
 /*
@@ -1756,116 +4072,401 @@ execute_dml_stmt(ForeignScanState *node)
     dmstate->num_tuples = 0;
 }
 
-static TupleTableSlot **execute_foreign_insert_modify(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot **slots, TupleTableSlot **planSlots, int numSlots)
+/*
+ * tdengine_insert_time_value - 将插入 time 或 time_text 列的值转换为时间戳
+ *
+ * time_text 列为文本类型，按 timestamptz 的输入格式解析
+ */
+static Timestamp tdengine_insert_time_value(Oid type, Datum value)
 {
-    // 获取执行状态
-    TDengineFdwExecState *fmstate = (TDengineFdwExecState *)resultRelInfo->ri_FdwState;
-    uint32_t bindnum = 0;
-    char *ret;
-    int i;
-    // 获取表信息和描述符
-    Relation rel = resultRelInfo->ri_RelationDesc;
-    TupleDesc tupdesc = RelationGetDescr(rel);
-    char *tablename = tdengine_get_table_name(rel);
-    bool time_had_value = false;
-    int bind_num_time_column = 0;
-    MemoryContext oldcontext;
+    char *str;
+    Oid typefnoid;
+    bool isvarlena;
 
-    // 切换到临时内存上下文处理参数
-    oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+    if (type == TIMESTAMPOID || type == TIMESTAMPTZOID)
+        return DatumGetTimestamp(value);
+
+    getTypeOutputInfo(type, &typefnoid, &isvarlena);
+    str = OidOutputFunctionCall(typefnoid, value);
+
+    return DatumGetTimestampTz(DirectFunctionCall3(timestamptz_in,
+                                                   CStringGetDatum(str),
+                                                   ObjectIdGetDatum(InvalidOid),
+                                                   Int32GetDatum(-1)));
+}
+
+/*
+ * tdengine_bind_insert_rows - 将 nrow 个元组按列转置为绑定数组
+ *
+ * 将各元组按列转置为 TDengine 原生类型的定长数组和空值标记，数值和时间戳不经过文本格式化。
+ * 列的顺序与 tdengine_deparse_insert() 生成的占位符一致，返回绑定的列数，
+ * *bytes 返回这些数组的总字节数
+ */
+static int tdengine_bind_insert_rows(TDengineFdwExecState *fmstate, TupleDesc tupdesc, char *tablename,
+                                     TupleTableSlot **slots, int nrow, TDengineBindColumn *columns, Size *bytes)
+{
+    int precision = fmstate->bind_precision;
+    AttrNumber time_attnum = InvalidAttrNumber;
+    AttrNumber time_text_attnum = InvalidAttrNumber;
+    Datum *values = (Datum *)palloc(sizeof(Datum) * nrow);
+    bool *isnull = (bool *)palloc(sizeof(bool) * nrow);
+    bool time_added = false;
+    int ncolumns = 0;
+    int nestlevel;
+    ListCell *lc;
+    ListCell *lc2;
+    int i;
 
-    // 重新分配参数存储空间以适应批量操作
-    fmstate->param_tdengine_types = (TDengineType *)repalloc(fmstate->param_tdengine_types, sizeof(TDengineType) * fmstate->p_nums * numSlots);
-    fmstate->param_tdengine_values = (TDengineValue *)repalloc(fmstate->param_tdengine_values, sizeof(TDengineValue) * fmstate->p_nums * numSlots);
-    fmstate->param_column_info = (TDengineColumnInfo *)repalloc(fmstate->param_column_info, sizeof(TDengineColumnInfo) * fmstate->p_nums * numSlots);
+    *bytes = 0;
 
-    /* 从元组槽获取参数并绑定 */
-    if (slots != NULL && fmstate->retrieved_attrs != NIL)
+    /* time 和 time_text 合并为一个时间列，两者都有值时以 time_text 为准 */
+    forboth (lc, fmstate->retrieved_attrs, lc2, fmstate->column_list)
     {
-        int nestlevel;
-        ListCell *lc;
+        struct TDengineColumnInfo *col = (TDengineColumnInfo *)lfirst(lc2);
+
+        if (strcmp(col->column_name, TDENGINE_TIME_TEXT_COLUMN) == 0)
+            time_text_attnum = lfirst_int(lc);
+        else if (strcmp(col->column_name, TDENGINE_TIME_COLUMN) == 0)
+            time_attnum = lfirst_int(lc);
+    }
+
+    // 设置数据传输模式
+    nestlevel = tdengine_set_transmission_modes();
 
-        // 设置数据传输模式
-        nestlevel = tdengine_set_transmission_modes();
+    forboth (lc, fmstate->retrieved_attrs, lc2, fmstate->column_list)
+    {
+        int attnum = lfirst_int(lc) - 1;
+        struct TDengineColumnInfo *col = (TDengineColumnInfo *)lfirst(lc2);
+        Oid type = TupleDescAttr(tupdesc, attnum)->atttypid;
+        TDengineBindColumn *column;
 
-        // 遍历每个元组槽
-        for (i = 0; i < numSlots; i++)
+        if (TDENGINE_IS_TIME_COLUMN(col->column_name))
         {
-            /* 绑定值到参数 */
-            foreach (lc, fmstate->retrieved_attrs)
+            if (time_added)
+                continue;
+            time_added = true;
+
+            for (i = 0; i < nrow; i++)
             {
-                int attnum = lfirst_int(lc) - 1;
-                Oid type = TupleDescAttr(slots[i]->tts_tupleDescriptor, attnum)->atttypid;
-                Datum value;
-                bool is_null;
-                // 获取列信息
-                struct TDengineColumnInfo *col = list_nth(fmstate->column_list, (int)bindnum % fmstate->p_nums);
-
-                // 设置列名和类型
-                fmstate->param_column_info[bindnum].column_name = col->column_name;
-                fmstate->param_column_info[bindnum].column_type = col->column_type;
-                // 获取属性值
-                value = slot_getattr(slots[i], attnum + 1, &is_null);
-
-                /* 检查值是否为空 */
-                if (is_null)
-                {
-                    // 检查非空约束
-                    if (TupleDescAttr(tupdesc, attnum)->attnotnull)
-                        elog(ERROR, "tdengine_fdw : null value in column \"%s\" of relation \"%s\" violates not-null constraint", col->column_name, tablename);
-                    // 设置空值标记
-                    fmstate->param_tdengine_types[bindnum] = TDENGINE_NULL;
-                    fmstate->param_tdengine_values[bindnum].i = 0;
-                }
-                else
+                bool time_null = time_attnum == InvalidAttrNumber || slots[i]->tts_isnull[time_attnum - 1];
+                bool text_null = time_text_attnum == InvalidAttrNumber || slots[i]->tts_isnull[time_text_attnum - 1];
+
+                isnull[i] = time_null && text_null;
+                if (!text_null)
                 {
-                    if (TDENGINE_IS_TIME_COLUMN(col->column_name))
-                    {
-                        if (!time_had_value)
-                        {
-                            tdengine_bind_sql_var(type, bindnum, value, fmstate->param_column_info,
-                                                  fmstate->param_tdengine_types, fmstate->param_tdengine_values);
-                            bind_num_time_column = bindnum;
-                            time_had_value = true;
-                        }
-                        else
-                        {
-                            elog(WARNING, "Inserting value has both \'time_text\' and \'time\' columns specified. The \'time\' will be ignored.");
-                            if (strcmp(col->column_name, TDENGINE_TIME_TEXT_COLUMN) == 0)
-                            {
-                                tdengine_bind_sql_var(type, bind_num_time_column, value, fmstate->param_column_info, fmstate->param_tdengine_types, fmstate->param_tdengine_values);
-                            }
-                            // 忽略重复时间列
-                            fmstate->param_tdengine_types[bindnum] = TDENGINE_NULL;
-                            fmstate->param_tdengine_values[bindnum].i = 0;
-                        }
-                    }
-                    else
-                    {
-                        // 绑定普通列值
-                        tdengine_bind_sql_var(type, bindnum, value, fmstate->param_column_info, fmstate->param_tdengine_types, fmstate->param_tdengine_values);
-                    }
+                    if (!time_null)
+                        elog(WARNING, "Inserting value has both \'time_text\' and \'time\' columns specified. The \'time\' will be ignored.");
+                    values[i] = TimestampGetDatum(tdengine_insert_time_value(TupleDescAttr(tupdesc, time_text_attnum - 1)->atttypid,
+                                                                             slots[i]->tts_values[time_text_attnum - 1]));
                 }
-                bindnum++; // 递增绑定计数器
+                else if (!time_null)
+                    values[i] = TimestampGetDatum(tdengine_insert_time_value(TupleDescAttr(tupdesc, time_attnum - 1)->atttypid,
+                                                                             slots[i]->tts_values[time_attnum - 1]));
+            }
+            type = TIMESTAMPOID;
+        }
+        else
+        {
+            for (i = 0; i < nrow; i++)
+            {
+                values[i] = slots[i]->tts_values[attnum];
+                isnull[i] = slots[i]->tts_isnull[attnum];
             }
         }
-        tdengine_reset_transmission_modes(nestlevel);
+
+        /* 检查非空约束 */
+        for (i = 0; i < nrow; i++)
+        {
+            if (isnull[i] && TupleDescAttr(tupdesc, attnum)->attnotnull)
+                elog(ERROR, "tdengine_fdw : null value in column \"%s\" of relation \"%s\" violates not-null constraint", col->column_name, tablename);
+        }
+
+        if (ncolumns >= fmstate->bind_ncol)
+            elog(ERROR, "tdengine_fdw : insert into relation \"%s\" has more values than the remote statement has placeholders", tablename);
+
+        column = &columns[ncolumns];
+        tdengine_bind_column(type, fmstate->bind_types[ncolumns], values, isnull, nrow, precision, column);
+        ncolumns++;
+
+        /* 值数组、长度数组和空值标记 */
+        *bytes += (Size)nrow * (column->elem_size + sizeof(int32_t) + 1);
     }
+    tdengine_reset_transmission_modes(nestlevel);
+
+    return ncolumns;
+}
+
+/*
+ * tdengine_adjust_batch_rows - batch_size 为 'auto' 时根据上一次提交调整下一次提交的行数
+ *
+ * 行数向 max_payload_bytes 的一半逼近，预留余量给宽度不一的行；提交耗时超过
+ * TDENGINE_AUTO_BATCH_TARGET_MS 时减半，否则每次最多翻倍
+ */
+static void tdengine_adjust_batch_rows(TDengineFdwExecState *fmstate, int nrow, Size bytes, double elapsed_ms)
+{
+    double row_bytes = (double)bytes / nrow;
+    double target_rows;
+    int rows;
 
-    Assert(bindnum == fmstate->p_nums * numSlots);
+    /* 每行字节数取指数平均，避免个别宽行造成批量剧烈波动 */
+    if (fmstate->batch_row_bytes > 0)
+        row_bytes = (fmstate->batch_row_bytes + row_bytes) / 2;
+    fmstate->batch_row_bytes = row_bytes;
 
-    ret = TDengineInsert(tablename, fmstate->user, fmstate->tdengineFdwOptions,
-                         fmstate->param_column_info, fmstate->param_tdengine_types, fmstate->param_tdengine_values, fmstate->p_nums, numSlots);
-    if (ret != NULL)
-        elog(ERROR, "tdengine_fdw : %s", ret);
+    target_rows = fmstate->tdengineFdwOptions->max_payload_bytes / 2 / row_bytes;
+
+    if (elapsed_ms > TDENGINE_AUTO_BATCH_TARGET_MS)
+        rows = nrow / 2;
+    else
+        rows = (int)Min((double)nrow * 2, target_rows);
+
+    fmstate->batch_rows = Max(Min(rows, TDENGINE_AUTO_BATCH_MAX_ROWS), 1);
+
+    elog(DEBUG1, "tdengine_fdw : inserted %d rows (%zu bytes) in %.3f ms, next batch %d rows",
+         nrow, bytes, elapsed_ms, fmstate->batch_rows);
+}
+
+/*
+ * tdengine_insert_schemaless_rows - 将无模式外部表的一批元组编码为行协议提交
+ *
+ * tags/fields 列中的 jsonb 键值对分别作为标签和字段，远程表和列由服务器按需创建。
+ * 单次提交的字节数不超过 max_payload_bytes
+ */
+static void tdengine_insert_schemaless_rows(TDengineFdwExecState *fmstate, TupleDesc tupdesc, char *tablename, TupleTableSlot **slots, int nrow)
+{
+    tdengine_opt *options = fmstate->tdengineFdwOptions;
+    int natts = list_length(fmstate->retrieved_attrs);
+    AttrNumber *attnums = (AttrNumber *)palloc(sizeof(AttrNumber) * natts);
+    char *roles = (char *)palloc(natts);
+    StringInfoData buf;
+    StringInfoData line;
+    MemoryContext oldcontext;
+    ListCell *lc;
+    char *ret;
+    int i;
+    int j = 0;
+
+    /* 每列的作用：'t' 时间、'T' time_text、'g' 标签、'f' 字段 */
+    foreach (lc, fmstate->retrieved_attrs)
+    {
+        int attnum = lfirst_int(lc);
+        char *colname = tdengine_get_column_name(RelationGetRelid(fmstate->rel), attnum);
+        Oid type = TupleDescAttr(tupdesc, attnum - 1)->atttypid;
+        bool is_tags = false;
+        bool is_fields = false;
+
+        attnums[j] = attnum;
+        if (strcmp(colname, TDENGINE_TIME_TEXT_COLUMN) == 0)
+            roles[j] = 'T';
+        else if (TDENGINE_IS_TIME_COLUMN(colname))
+            roles[j] = 't';
+        else if (tdengine_is_slvar(type, attnum, &fmstate->slinfo, &is_tags, &is_fields) && is_tags)
+            roles[j] = 'g';
+        else
+            roles[j] = 'f';
+        j++;
+    }
+
+    oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+    initStringInfo(&buf);
+    initStringInfo(&line);
+
+    for (i = 0; i < nrow; i++)
+    {
+        Datum tags = (Datum) 0;
+        Datum fields = (Datum) 0;
+        bool has_time = false;
+        bool has_time_text = false;
+        int64 ts = 0;
+
+        for (j = 0; j < natts; j++)
+        {
+            int attidx = attnums[j] - 1;
+            Datum value = slots[i]->tts_values[attidx];
+
+            if (slots[i]->tts_isnull[attidx])
+                continue;
+
+            switch (roles[j])
+            {
+                case 'T':
+                case 't':
+                    /* time 和 time_text 都有值时以 time_text 为准 */
+                    if (roles[j] == 't' && has_time_text)
+                        break;
+                    ts = tdengine_time_from_pg(tdengine_insert_time_value(TupleDescAttr(tupdesc, attidx)->atttypid, value),
+                                               options->precision);
+                    has_time = true;
+                    has_time_text = (roles[j] == 'T');
+                    break;
+                case 'g':
+                    tags = value;
+                    break;
+                default:
+                    fields = value;
+                    break;
+            }
+        }
+
+        resetStringInfo(&line);
+        tdengine_append_line_protocol(&line, tablename, tags, fields, has_time, ts);
+
+        if (buf.len > 0 && (Size)buf.len + 1 + line.len > (Size)options->max_payload_bytes)
+        {
+            ret = TDengineSchemalessInsert(fmstate->user, options, buf.data, buf.len);
+            if (ret != NULL)
+                elog(ERROR, "tdengine_fdw : %s", ret);
+            resetStringInfo(&buf);
+        }
+
+        if (buf.len > 0)
+            appendStringInfoChar(&buf, '\n');
+        appendBinaryStringInfo(&buf, line.data, line.len);
+    }
+
+    if (buf.len > 0)
+    {
+        ret = TDengineSchemalessInsert(fmstate->user, options, buf.data, buf.len);
+        if (ret != NULL)
+            elog(ERROR, "tdengine_fdw : %s", ret);
+    }
 
     MemoryContextSwitchTo(oldcontext);
     MemoryContextReset(fmstate->temp_cxt);
+}
+
+/*
+ * tdengine_finish_insert - 等待正在提交的一批完成，失败时报错
+ */
+static void tdengine_finish_insert(TDengineFdwExecState *fmstate)
+{
+    int nrow = fmstate->inflight_rows;
+    double elapsed_ms = 0;
+    char *ret;
+
+    if (nrow == 0)
+        return;
+
+    fmstate->inflight_rows = 0;
+    ret = TDengineInsertWait(fmstate->insert_stmt, &elapsed_ms);
+    if (ret != NULL)
+        elog(ERROR, "tdengine_fdw : %s", ret);
+
+    if (fmstate->batch_auto)
+        tdengine_adjust_batch_rows(fmstate, nrow, fmstate->inflight_bytes, elapsed_ms);
+}
+
+/*
+ * execute_foreign_insert_modify - 将一批元组插入远程表
+ *
+ * 每次提交都通过参数绑定语句一次发送。单次提交的字节数不超过 max_payload_bytes，
+ * 超过时将该次提交的行数减半；batch_size 为 'auto' 时每次提交的行数由
+ * tdengine_adjust_batch_rows() 调整。
+ *
+ * pipelined_insert 开启时最后一批提交后不等待即返回，执行器准备下一批的同时
+ * 远程写入在后台进行；下一次提交前或 EndForeignModify 时再等待并检查结果
+ */
+static TupleTableSlot **execute_foreign_insert_modify(EState *estate, ResultRelInfo *resultRelInfo, TupleTableSlot **slots, TupleTableSlot **planSlots, int numSlots)
+{
+    // 获取执行状态
+    TDengineFdwExecState *fmstate = (TDengineFdwExecState *)resultRelInfo->ri_FdwState;
+    // 获取表信息和描述符
+    Relation rel = resultRelInfo->ri_RelationDesc;
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    char *tablename = tdengine_get_table_name(rel);
+    Size max_payload = fmstate->tdengineFdwOptions->max_payload_bytes;
+    int offset = 0;
+    char *ret;
+    int i;
+
+    if (slots == NULL || fmstate->retrieved_attrs == NIL)
+        return slots;
+
+    for (i = 0; i < numSlots; i++)
+        slot_getallattrs(slots[i]);
+
+    /* 第一次提交前使读取了远程表的缓存结果失效，写入期间开始的查询不再缓存 */
+    if (!fmstate->cache_write_started)
+    {
+        tdengine_result_cache_begin_write(tdengine_result_cache_table_key(fmstate->user->serverid, fmstate->tdengineFdwOptions));
+        fmstate->cache_write_started = true;
+    }
+
+    if (fmstate->slinfo.schemaless)
+    {
+        tdengine_insert_schemaless_rows(fmstate, tupdesc, tablename, slots, numSlots);
+        return slots;
+    }
+
+    /* 值按远程列的类型和时间精度绑定，第一次提交前从服务器取得 */
+    if (fmstate->bind_types == NULL)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(GetMemoryChunkContext(fmstate));
+
+        ret = TDengineInsertDescribe(fmstate->insert_stmt, &fmstate->bind_types, &fmstate->bind_ncol, &fmstate->bind_precision);
+        MemoryContextSwitchTo(oldcontext);
+        if (ret != NULL)
+            elog(ERROR, "tdengine_fdw : %s", ret);
+    }
+
+    while (offset < numSlots)
+    {
+        int nrow = numSlots - offset;
+        TDengineBindColumn *columns;
+        int ncolumns;
+        Size bytes;
+        MemoryContext oldcontext;
+
+        if (fmstate->batch_auto)
+            nrow = Min(nrow, fmstate->batch_rows);
+
+        // 切换到临时内存上下文处理参数
+        oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
+
+        columns = (TDengineBindColumn *)palloc0(sizeof(TDengineBindColumn) * list_length(fmstate->retrieved_attrs));
+
+        /* 超过最大字节数时减少行数重新绑定 */
+        for (;;)
+        {
+            ncolumns = tdengine_bind_insert_rows(fmstate, tupdesc, tablename, slots + offset, nrow, columns, &bytes);
+            if (bytes <= max_payload)
+                break;
+            if (nrow == 1)
+                elog(ERROR, "tdengine_fdw : row of %zu bytes exceeds max_payload_bytes (%zu)", bytes, max_payload);
+
+            MemoryContextReset(fmstate->temp_cxt);
+            columns = (TDengineBindColumn *)palloc0(sizeof(TDengineBindColumn) * list_length(fmstate->retrieved_attrs));
+            nrow = nrow / 2;
+        }
+
+        /* 同一语句同时只能有一批在提交，这一批已经绑定好，等待上一批完成后提交 */
+        tdengine_finish_insert(fmstate);
+
+        ret = TDengineInsertSubmit(fmstate->insert_stmt, columns, ncolumns, nrow);
+        if (ret != NULL)
+            elog(ERROR, "tdengine_fdw : %s", ret);
+        fmstate->inflight_rows = nrow;
+        fmstate->inflight_bytes = bytes;
+
+        if (!fmstate->tdengineFdwOptions->pipelined_insert)
+            tdengine_finish_insert(fmstate);
+
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(fmstate->temp_cxt);
+
+        offset += nrow;
+    }
 
     return slots;
 }
 
-static int tdengine_get_batch_size_option(Relation rel)
+/*
+ * tdengine_get_batch_size_option - 获取 batch_size 选项
+ *
+ * 'auto' 时返回 TDENGINE_AUTO_BATCH_MAX_ROWS 作为执行器缓冲的行数，实际每次提交的行数
+ * 由 execute_foreign_insert_modify() 自动调整，is_auto 不为 NULL 时通过它返回是否为 'auto'
+ */
+static int tdengine_get_batch_size_option(Relation rel, bool *is_auto)
 {
     Oid foreigntableid = RelationGetRelid(rel);
     List *options = NIL;
@@ -1876,6 +4477,9 @@ static int tdengine_get_batch_size_option(Relation rel)
     /* 默认批量大小为1(不启用批量操作) */
     int batch_size = 1;
 
+    if (is_auto)
+        *is_auto = false;
+
     /*
      * 加载表和服务器选项:
      * 表选项优先于服务器选项
@@ -1892,7 +4496,14 @@ static int tdengine_get_batch_size_option(Relation rel)
 
         if (strcmp(def->defname, "batch_size") == 0)
         {
-            (void)parse_int(defGetString(def), &batch_size, 0, NULL);
+            if (pg_strcasecmp(defGetString(def), "auto") == 0)
+            {
+                batch_size = TDENGINE_AUTO_BATCH_MAX_ROWS;
+                if (is_auto)
+                    *is_auto = true;
+            }
+            else
+                (void)parse_int(defGetString(def), &batch_size, 0, NULL);
             break;
         }
     }
@@ -49,6 +49,8 @@
 #include "postmaster/syslogger.h"
 #include "storage/fd.h"
 
+#include <taosws.h>
+
 
 
 extern char *tdengine_replace_function(char *in);
@@ -388,3 +390,573 @@ tdengine_bind_sql_var(Oid type, int idx, Datum value, TDengineColumnInfo *param_
     }
 }
 
+
+/*
+ * tdengine_time_to_pg - 将TDengine时间戳(Unix纪元)转换为PostgreSQL时间戳
+ *
+ * 参数:
+ *   @value: TDengine返回的时间戳数值
+ *   @precision: 时间戳精度(毫秒/微秒/纳秒)
+ */
+Timestamp
+tdengine_time_to_pg(int64 value, int precision)
+{
+	/* PostgreSQL与Unix纪元之间的差值(微秒) */
+	const int64 epoch_diff = (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+	int64		usecs;
+
+	switch (precision)
+	{
+		case TDENGINE_PRECISION_US:
+			usecs = value;
+			break;
+		case TDENGINE_PRECISION_NS:
+			usecs = value / 1000;
+			break;
+		default:
+			usecs = value * 1000;
+			break;
+	}
+
+	return (Timestamp) (usecs - epoch_diff);
+}
+
+/*
+ * tdengine_format_time_literal - 将PostgreSQL时间戳格式化为TDengine时间字面量
+ *
+ * 以RFC3339格式(UTC)输出并带单引号，避免依赖客户端时区和数据库精度
+ */
+char *
+tdengine_format_time_literal(Timestamp ts)
+{
+	struct pg_tm tm;
+	fsec_t		fsec;
+
+	if (timestamp2tm(ts, NULL, &tm, &fsec, NULL, NULL) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+
+	return psprintf("'%04d-%02d-%02dT%02d:%02d:%02d.%06dZ'",
+					tm.tm_year, tm.tm_mon, tm.tm_mday,
+					tm.tm_hour, tm.tm_min, tm.tm_sec, (int) fsec);
+}
+
+/*
+ * tdengine_time_from_pg - 将PostgreSQL时间戳转换为指定精度的TDengine时间戳(Unix纪元)
+ *
+ * 参数:
+ *   @ts: PostgreSQL时间戳
+ *   @precision: 目标数据库的时间精度(毫秒/微秒/纳秒)
+ */
+int64
+tdengine_time_from_pg(Timestamp ts, int precision)
+{
+	/* PostgreSQL与Unix纪元之间的差值(微秒) */
+	const int64 epoch_diff = (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+	int64		usecs = ts + epoch_diff;
+
+	switch (precision)
+	{
+		case TDENGINE_PRECISION_US:
+			return usecs;
+		case TDENGINE_PRECISION_NS:
+			return usecs * 1000;
+		default:
+			return usecs / 1000;
+	}
+}
+
+/*
+ * 以文本形式取得值，文本类型直接使用其内容，其他类型调用输出函数
+ */
+static char *
+tdengine_bind_value_text(Oid type, Datum value, int *len)
+{
+	char	   *str;
+	Oid			typefnoid;
+	bool		isvarlena;
+
+	if (type == TEXTOID || type == BPCHAROID || type == VARCHAROID)
+	{
+		struct varlena *v = pg_detoast_datum_packed((struct varlena *) DatumGetPointer(value));
+
+		*len = VARSIZE_ANY_EXHDR(v);
+		return VARDATA_ANY(v);
+	}
+
+	getTypeOutputInfo(type, &typefnoid, &isvarlena);
+	str = OidOutputFunctionCall(typefnoid, value);
+	*len = strlen(str);
+	return str;
+}
+
+/*
+ * 将值转换为整数，远程列为整数类型时使用，超出 [min, max] 时报错
+ */
+static int64
+tdengine_bind_value_int64(Oid type, Datum value, int64 min, int64 max)
+{
+	int64		result;
+	int			len;
+
+	switch (type)
+	{
+		case BOOLOID:
+			result = DatumGetBool(value) ? 1 : 0;
+			break;
+		case INT2OID:
+			result = DatumGetInt16(value);
+			break;
+		case INT4OID:
+			result = DatumGetInt32(value);
+			break;
+		case INT8OID:
+			result = DatumGetInt64(value);
+			break;
+		case FLOAT4OID:
+			result = DatumGetInt64(DirectFunctionCall1(ftoi8, value));
+			break;
+		case FLOAT8OID:
+			result = DatumGetInt64(DirectFunctionCall1(dtoi8, value));
+			break;
+		case NUMERICOID:
+			result = DatumGetInt64(DirectFunctionCall1(numeric_int8, value));
+			break;
+		default:
+			result = DatumGetInt64(DirectFunctionCall1(int8in, CStringGetDatum(pnstrdup(tdengine_bind_value_text(type, value, &len), len))));
+			break;
+	}
+
+	if (result < min || result > max)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("value " INT64_FORMAT " out of range for the remote column", result)));
+
+	return result;
+}
+
+/*
+ * 将值转换为浮点数，远程列为 FLOAT/DOUBLE 时使用
+ */
+static float8
+tdengine_bind_value_float8(Oid type, Datum value)
+{
+	int			len;
+
+	switch (type)
+	{
+		case INT2OID:
+			return (float8) DatumGetInt16(value);
+		case INT4OID:
+			return (float8) DatumGetInt32(value);
+		case INT8OID:
+			return (float8) DatumGetInt64(value);
+		case FLOAT4OID:
+			return (float8) DatumGetFloat4(value);
+		case FLOAT8OID:
+			return DatumGetFloat8(value);
+		case NUMERICOID:
+			return DatumGetFloat8(DirectFunctionCall1(numeric_float8, value));
+		default:
+			return DatumGetFloat8(DirectFunctionCall1(float8in, CStringGetDatum(pnstrdup(tdengine_bind_value_text(type, value, &len), len))));
+	}
+}
+
+/*
+ * 将值转换为时间戳，远程列为 TIMESTAMP 时使用，其他类型按文本解析
+ */
+static Timestamp
+tdengine_bind_value_timestamp(Oid type, Datum value)
+{
+	int			len;
+
+	if (type == TIMESTAMPOID || type == TIMESTAMPTZOID)
+		return DatumGetTimestamp(value);
+
+	return DatumGetTimestampTz(DirectFunctionCall3(timestamptz_in,
+												   CStringGetDatum(pnstrdup(tdengine_bind_value_text(type, value, &len), len)),
+												   ObjectIdGetDatum(InvalidOid),
+												   Int32GetDatum(-1)));
+}
+
+/*
+ * tdengine_bind_column - 将一列的 nrow 个值转换为远程列类型的定长数组，用于列式参数绑定
+ *
+ * 绑定的缓冲区类型必须与远程列的类型一致，因此按远程列类型（由准备好的语句
+ * 返回）而不是本地类型选择。本地类型可以直接转换时不经过文本格式化，否则
+ * 以文本形式交给目标类型的输入函数，与以文本值插入时的行为一致；字符串类
+ * 的远程列（VARCHAR、NCHAR 等）绑定值的文本形式，每个值占用的字节数为该列
+ * 中最长值的长度。结果分配在当前内存上下文中
+ *
+ * 参数:
+ *   @type: 列的PostgreSQL数据类型OID
+ *   @remote_type: 远程列的类型 TSDB_DATA_TYPE_*
+ *   @values/@isnull: 该列在各行中的值
+ *   @nrow: 行数
+ *   @precision: 远程数据库的时间精度
+ *   @col: 输出参数，绑定用的列数组
+ */
+void
+tdengine_bind_column(Oid type, int remote_type, Datum *values, bool *isnull, int nrow, int precision, TDengineBindColumn *col)
+{
+	char	  **strs = NULL;
+	int			i;
+
+	col->type = remote_type;
+	col->is_null = (char *) palloc(nrow);
+	col->lengths = (int32_t *) palloc(sizeof(int32_t) * nrow);
+
+	switch (remote_type)
+	{
+		case TSDB_DATA_TYPE_BOOL:
+		case TSDB_DATA_TYPE_TINYINT:
+		case TSDB_DATA_TYPE_UTINYINT:
+			col->elem_size = sizeof(int8);
+			break;
+		case TSDB_DATA_TYPE_SMALLINT:
+		case TSDB_DATA_TYPE_USMALLINT:
+			col->elem_size = sizeof(int16);
+			break;
+		case TSDB_DATA_TYPE_INT:
+		case TSDB_DATA_TYPE_UINT:
+			col->elem_size = sizeof(int32);
+			break;
+		case TSDB_DATA_TYPE_BIGINT:
+		case TSDB_DATA_TYPE_UBIGINT:
+		case TSDB_DATA_TYPE_TIMESTAMP:
+			col->elem_size = sizeof(int64);
+			break;
+		case TSDB_DATA_TYPE_FLOAT:
+			col->elem_size = sizeof(float4);
+			break;
+		case TSDB_DATA_TYPE_DOUBLE:
+			col->elem_size = sizeof(float8);
+			break;
+		default:
+			/* 字符串类的列，先取得各值的文本形式以确定最大长度 */
+			strs = (char **) palloc(sizeof(char *) * nrow);
+			col->elem_size = 0;
+			for (i = 0; i < nrow; i++)
+			{
+				int			len = 0;
+
+				strs[i] = isnull[i] ? NULL : tdengine_bind_value_text(type, values[i], &len);
+				col->lengths[i] = len;
+				col->elem_size = Max(col->elem_size, len);
+			}
+			break;
+	}
+
+	col->values = (char *) palloc0((Size) Max(col->elem_size, 1) * nrow);
+
+	for (i = 0; i < nrow; i++)
+	{
+		char	   *dst = col->values + (Size) i * col->elem_size;
+
+		col->is_null[i] = isnull[i] ? 1 : 0;
+		if (strs == NULL)
+			col->lengths[i] = col->elem_size;
+		if (isnull[i])
+			continue;
+
+		switch (remote_type)
+		{
+			case TSDB_DATA_TYPE_BOOL:
+				*(int8 *) dst = tdengine_bind_value_int64(type, values[i], PG_INT64_MIN, PG_INT64_MAX) != 0 ? 1 : 0;
+				break;
+			case TSDB_DATA_TYPE_TINYINT:
+				*(int8 *) dst = (int8) tdengine_bind_value_int64(type, values[i], PG_INT8_MIN, PG_INT8_MAX);
+				break;
+			case TSDB_DATA_TYPE_UTINYINT:
+				*(uint8 *) dst = (uint8) tdengine_bind_value_int64(type, values[i], 0, PG_UINT8_MAX);
+				break;
+			case TSDB_DATA_TYPE_SMALLINT:
+				*(int16 *) dst = (int16) tdengine_bind_value_int64(type, values[i], PG_INT16_MIN, PG_INT16_MAX);
+				break;
+			case TSDB_DATA_TYPE_USMALLINT:
+				*(uint16 *) dst = (uint16) tdengine_bind_value_int64(type, values[i], 0, PG_UINT16_MAX);
+				break;
+			case TSDB_DATA_TYPE_INT:
+				*(int32 *) dst = (int32) tdengine_bind_value_int64(type, values[i], PG_INT32_MIN, PG_INT32_MAX);
+				break;
+			case TSDB_DATA_TYPE_UINT:
+				*(uint32 *) dst = (uint32) tdengine_bind_value_int64(type, values[i], 0, PG_UINT32_MAX);
+				break;
+			case TSDB_DATA_TYPE_BIGINT:
+				*(int64 *) dst = tdengine_bind_value_int64(type, values[i], PG_INT64_MIN, PG_INT64_MAX);
+				break;
+			case TSDB_DATA_TYPE_UBIGINT:
+				*(uint64 *) dst = (uint64) tdengine_bind_value_int64(type, values[i], 0, PG_INT64_MAX);
+				break;
+			case TSDB_DATA_TYPE_FLOAT:
+				*(float4 *) dst = (float4) tdengine_bind_value_float8(type, values[i]);
+				break;
+			case TSDB_DATA_TYPE_DOUBLE:
+				*(float8 *) dst = tdengine_bind_value_float8(type, values[i]);
+				break;
+			case TSDB_DATA_TYPE_TIMESTAMP:
+				*(int64 *) dst = tdengine_time_from_pg(tdengine_bind_value_timestamp(type, values[i]), precision);
+				break;
+			default:
+				memcpy(dst, strs[i], col->lengths[i]);
+				break;
+		}
+	}
+}
+
+/* 判断单元格是否为整数类型 */
+#define TDENGINE_CELL_IS_SIGNED(cell) ((cell)->type == TSDB_DATA_TYPE_TINYINT || \
+									   (cell)->type == TSDB_DATA_TYPE_SMALLINT || \
+									   (cell)->type == TSDB_DATA_TYPE_INT || \
+									   (cell)->type == TSDB_DATA_TYPE_BIGINT)
+#define TDENGINE_CELL_IS_UNSIGNED(cell) ((cell)->type == TSDB_DATA_TYPE_UTINYINT || \
+										 (cell)->type == TSDB_DATA_TYPE_USMALLINT || \
+										 (cell)->type == TSDB_DATA_TYPE_UINT || \
+										 (cell)->type == TSDB_DATA_TYPE_UBIGINT)
+#define TDENGINE_CELL_IS_FLOAT(cell) ((cell)->type == TSDB_DATA_TYPE_FLOAT || \
+									  (cell)->type == TSDB_DATA_TYPE_DOUBLE)
+
+/*
+ * tdengine_cell_get_int64 - 读取整数单元格的值，无符号值超出 int64 范围时报错
+ */
+static bool
+tdengine_cell_get_int64(TDengineCell *cell, int64 *result)
+{
+	if (TDENGINE_CELL_IS_SIGNED(cell))
+	{
+		*result = (int64) cell->v.i;
+		return true;
+	}
+
+	if (TDENGINE_CELL_IS_UNSIGNED(cell))
+	{
+		if (cell->v.u > (unsigned long long) PG_INT64_MAX)
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("bigint out of range")));
+		*result = (int64) cell->v.u;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * tdengine_convert_cell_to_datum - 将二进制单元格直接转换为PostgreSQL数据
+ *
+ * 常用的目标类型直接由原生值构造Datum，避免数值→文本→数值的往返转换；
+ * 其他组合退回到文本形式并调用类型输入函数
+ *
+ * 参数:
+ *   @pgtyp: 目标PostgreSQL类型OID
+ *   @pgtypmod: 目标类型修饰符
+ *   @typinput/@typioparam: 预先解析的类型输入函数信息
+ *   @cell: 非空单元格
+ *   @precision: 结果中时间戳的精度
+ */
+Datum
+tdengine_convert_cell_to_datum(Oid pgtyp, int pgtypmod, FmgrInfo *typinput, Oid typioparam, TDengineCell *cell, int precision)
+{
+	int64		ival;
+
+	switch (pgtyp)
+	{
+		case BOOLOID:
+			if (cell->type == TSDB_DATA_TYPE_BOOL)
+				return BoolGetDatum(cell->v.b);
+			break;
+
+		case INT2OID:
+			if (tdengine_cell_get_int64(cell, &ival))
+			{
+				if (ival < PG_INT16_MIN || ival > PG_INT16_MAX)
+					ereport(ERROR,
+							(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+							 errmsg("smallint out of range")));
+				return Int16GetDatum((int16) ival);
+			}
+			break;
+
+		case INT4OID:
+			if (tdengine_cell_get_int64(cell, &ival))
+			{
+				if (ival < PG_INT32_MIN || ival > PG_INT32_MAX)
+					ereport(ERROR,
+							(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+							 errmsg("integer out of range")));
+				return Int32GetDatum((int32) ival);
+			}
+			break;
+
+		case INT8OID:
+			if (tdengine_cell_get_int64(cell, &ival))
+				return Int64GetDatum(ival);
+			break;
+
+		case FLOAT4OID:
+			if (TDENGINE_CELL_IS_FLOAT(cell))
+				return Float4GetDatum((float4) cell->v.d);
+			if (tdengine_cell_get_int64(cell, &ival))
+				return Float4GetDatum((float4) ival);
+			break;
+
+		case FLOAT8OID:
+			if (TDENGINE_CELL_IS_FLOAT(cell))
+				return Float8GetDatum(cell->v.d);
+			if (tdengine_cell_get_int64(cell, &ival))
+				return Float8GetDatum((float8) ival);
+			break;
+
+		case NUMERICOID:
+			/* 带精度修饰的numeric需要经过输入函数进行舍入 */
+			if (pgtypmod >= 0)
+				break;
+			if (TDENGINE_CELL_IS_FLOAT(cell))
+				return DirectFunctionCall1(float8_numeric, Float8GetDatum(cell->v.d));
+			if (tdengine_cell_get_int64(cell, &ival))
+				return DirectFunctionCall1(int8_numeric, Int64GetDatum(ival));
+			break;
+
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			if (cell->type == TSDB_DATA_TYPE_TIMESTAMP)
+				return TimestampGetDatum(tdengine_time_to_pg(cell->v.i, precision));
+			break;
+
+		case TEXTOID:
+			if (cell->type == TSDB_DATA_TYPE_VARCHAR ||
+				cell->type == TSDB_DATA_TYPE_NCHAR)
+				return PointerGetDatum(cstring_to_text_with_len(cell->v.s, cell->len));
+			break;
+
+		default:
+			break;
+	}
+
+	return tdengine_convert_text_to_datum(pgtyp, pgtypmod, typinput, typioparam, tdengine_cell_to_cstring(cell, precision));
+}
+
+/*
+ * tdengine_parse_timestamp - 不经过fmgr直接解析时间戳文本
+ *
+ * 只处理普通的日期时间，infinity等特殊值返回false交给输入函数处理
+ */
+static bool
+tdengine_parse_timestamp(char *str, bool with_tz, Timestamp *result)
+{
+	fsec_t		fsec;
+	struct pg_tm tt,
+			   *tm = &tt;
+	int			tz;
+	int			dtype;
+	int			nf;
+	char	   *field[MAXDATEFIELDS];
+	int			ftype[MAXDATEFIELDS];
+	char		workbuf[MAXDATELEN + MAXDATEFIELDS];
+#if PG_VERSION_NUM >= 160000
+	DateTimeErrorExtra extra;
+#endif
+
+	if (ParseDateTime(str, workbuf, sizeof(workbuf), field, ftype, MAXDATEFIELDS, &nf) != 0)
+		return false;
+	/* PostgreSQL 16 起 DecodeDateTime 多了一个返回错误详情的参数 */
+#if PG_VERSION_NUM >= 160000
+	if (DecodeDateTime(field, ftype, nf, &dtype, tm, &fsec, &tz, &extra) != 0)
+		return false;
+#else
+	if (DecodeDateTime(field, ftype, nf, &dtype, tm, &fsec, &tz) != 0)
+		return false;
+#endif
+	if (dtype != DTK_DATE)
+		return false;
+	if (tm2timestamp(tm, fsec, with_tz ? &tz : NULL, result) != 0)
+		return false;
+
+	return true;
+}
+
+/*
+ * tdengine_convert_text_to_datum - 使用预先解析的类型输入信息将文本转换为PostgreSQL数据
+ *
+ * 与tdengine_convert_to_pg不同，这里不再查询系统缓存。int2/4/8、float4/8、
+ * bool和不带精度修饰的timestamp(tz)直接解析；解析失败时退回到类型输入函数，
+ * 由其给出标准的错误信息
+ *
+ * 参数:
+ *   @pgtyp: 目标PostgreSQL类型OID
+ *   @pgtypmod: 目标类型修饰符
+ *   @typinput: 类型输入函数
+ *   @typioparam: 类型输入函数的参数类型
+ *   @value: 文本形式的值
+ */
+Datum
+tdengine_convert_text_to_datum(Oid pgtyp, int pgtypmod, FmgrInfo *typinput, Oid typioparam, char *value)
+{
+	switch (pgtyp)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+			{
+				char	   *end;
+				long long int ival;
+
+				errno = 0;
+				ival = strtoll(value, &end, 10);
+				if (errno != 0 || end == value || *end != '\0')
+					break;
+
+				if (pgtyp == INT8OID)
+					return Int64GetDatum((int64) ival);
+				if (pgtyp == INT4OID && ival >= PG_INT32_MIN && ival <= PG_INT32_MAX)
+					return Int32GetDatum((int32) ival);
+				if (pgtyp == INT2OID && ival >= PG_INT16_MIN && ival <= PG_INT16_MAX)
+					return Int16GetDatum((int16) ival);
+				break;
+			}
+
+		case FLOAT4OID:
+		case FLOAT8OID:
+			{
+				char	   *end;
+				double		dval;
+
+				errno = 0;
+				dval = strtod(value, &end);
+				if (errno != 0 || end == value || *end != '\0')
+					break;
+
+				if (pgtyp == FLOAT8OID)
+					return Float8GetDatum(dval);
+				/* 超出float4范围时交给float4in报错 */
+				if (isinf((float4) dval) && !isinf(dval))
+					break;
+				return Float4GetDatum((float4) dval);
+			}
+
+		case BOOLOID:
+			{
+				bool		bval;
+
+				if (parse_bool(value, &bval))
+					return BoolGetDatum(bval);
+				break;
+			}
+
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			{
+				Timestamp	ts;
+
+				if (pgtypmod < 0 && tdengine_parse_timestamp(value, pgtyp == TIMESTAMPTZOID, &ts))
+					return TimestampGetDatum(ts);
+				break;
+			}
+
+		default:
+			break;
+	}
+
+	return InputFunctionCall(typinput, value, typioparam, pgtypmod);
+}
@@ -0,0 +1,224 @@
+extern "C" {
+#include "postgres.h"
+}
+
+#include "tmq.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+ * 订阅（TMQ）外部表
+ *
+ * 设置了 topic 选项的外部表不发送查询，而是以 group_id 消费组中的消费者
+ * 订阅该主题，每次扫描读取最多 max_messages 条新消息。消费者关闭了自动
+ * 提交，扫描读过的消息在事务提交前确认；事务中止时关闭消费者，未确认的
+ * 消息由下一次扫描重新读取。
+ *
+ * 消费者按 (服务器, 用户, 主题, 消费组, 客户端标识) 缓存在当前后端中，
+ * 多次扫描之间保持订阅，避免每次重新加入消费组。
+ */
+
+struct TDengineTmqConsumer
+{
+    Oid serverid;
+    Oid userid;
+    std::string topic;
+    std::string group_id;
+    std::string client_id;
+    WS_TMQ *tmq;
+    bool dirty;                 /* 当前事务中是否读取过消息，提交时需要确认 */
+    bool incomplete;            /* 是否有消息没有读完，不能确认 */
+};
+
+static std::vector<TDengineTmqConsumer *> tmq_consumers;
+
+static WS_TMQ *tdengine_tmq_subscribe(tdengine_opt *options);
+static void tdengine_tmq_close(TDengineTmqConsumer *consumer);
+
+/*
+ * tdengine_tmq_get_consumer - 返回外部表所用的消费者，不存在时创建并订阅主题
+ */
+TDengineTmqConsumer *
+tdengine_tmq_get_consumer(UserMapping *user, tdengine_opt *options)
+{
+    TDengineTmqConsumer *consumer;
+    WS_TMQ *tmq;
+    const char *client_id = options->client_id ? options->client_id : "";
+
+    for (auto *c : tmq_consumers)
+    {
+        if (c->serverid == user->serverid && c->userid == user->userid &&
+            c->topic == options->topic && c->group_id == options->group_id &&
+            c->client_id == client_id)
+            return c;
+    }
+
+    /* 订阅成功后才加入缓存，订阅失败时下一次扫描重新创建 */
+    tmq = tdengine_tmq_subscribe(options);
+
+    consumer = new TDengineTmqConsumer();
+    consumer->serverid = user->serverid;
+    consumer->userid = user->userid;
+    consumer->topic = options->topic;
+    consumer->group_id = options->group_id;
+    consumer->client_id = client_id;
+    consumer->tmq = tmq;
+    consumer->dirty = false;
+    consumer->incomplete = false;
+    tmq_consumers.push_back(consumer);
+
+    return consumer;
+}
+
+/*
+ * 创建关闭了自动提交的消费者并订阅主题
+ */
+static WS_TMQ *
+tdengine_tmq_subscribe(tdengine_opt *options)
+{
+    WS_TMQ_CONF *conf;
+    WS_TMQ_LIST *topics;
+    WS_TMQ *tmq;
+    char dsn[TDENGINE_DSN_LEN];
+    char errstr[256];
+    int code;
+
+    if (options->group_id == NULL || options->group_id[0] == '\0')
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                 errmsg("tdengine_fdw : option \"group_id\" must be specified together with \"topic\"")));
+
+    conf = ws_tmq_conf_new();
+    if (ws_tmq_conf_set(conf, "group.id", options->group_id) != WS_TMQ_CONF_OK ||
+        (options->client_id && ws_tmq_conf_set(conf, "client.id", options->client_id) != WS_TMQ_CONF_OK) ||
+        ws_tmq_conf_set(conf, "enable.auto.commit", "false") != WS_TMQ_CONF_OK)
+    {
+        ws_tmq_conf_destroy(conf);
+        elog(ERROR, "tdengine_fdw : could not configure consumer for topic \"%s\"", options->topic);
+    }
+
+    tdengine_build_dsn(options, dsn, sizeof(dsn));
+    errstr[0] = '\0';
+    tmq = ws_tmq_consumer_new(conf, dsn, errstr, sizeof(errstr));
+    ws_tmq_conf_destroy(conf);
+    if (tmq == NULL)
+        elog(ERROR, "tdengine_fdw : could not create consumer for topic \"%s\": %s", options->topic, errstr);
+
+    topics = ws_tmq_list_new();
+    ws_tmq_list_append(topics, options->topic);
+    code = ws_tmq_subscribe(tmq, topics);
+    ws_tmq_list_destroy(topics);
+
+    if (code != 0)
+    {
+        char *err = pstrdup(ws_tmq_errstr(tmq));
+
+        ws_tmq_consumer_close(tmq);
+        elog(ERROR, "tdengine_fdw : could not subscribe to topic \"%s\": %s (error code: %d)",
+             options->topic, err, code);
+    }
+
+    elog(DEBUG1, "tdengine_fdw : subscribed to topic \"%s\" in group \"%s\"", options->topic, options->group_id);
+
+    return tmq;
+}
+
+/*
+ * tdengine_tmq_poll - 最多等待 timeout 毫秒拉取一条消息，没有新消息时返回 NULL
+ *
+ * 返回的消息由调用者通过 ws_free_result() 释放
+ */
+WS_RES *
+tdengine_tmq_poll(TDengineTmqConsumer *consumer, int timeout)
+{
+    WS_RES *res = ws_tmq_consumer_poll(consumer->tmq, timeout);
+
+    if (res != NULL)
+        consumer->dirty = true;
+
+    return res;
+}
+
+/*
+ * tdengine_tmq_mark_incomplete - 扫描在读完一条消息前结束，本事务不能确认读过的消息
+ */
+void
+tdengine_tmq_mark_incomplete(TDengineTmqConsumer *consumer)
+{
+    consumer->incomplete = true;
+}
+
+/*
+ * 关闭消费者并从缓存中删除，未确认的消息会重新投递给消费组
+ */
+static void
+tdengine_tmq_close(TDengineTmqConsumer *consumer)
+{
+    for (auto it = tmq_consumers.begin(); it != tmq_consumers.end(); ++it)
+    {
+        if (*it == consumer)
+        {
+            tmq_consumers.erase(it);
+            break;
+        }
+    }
+
+    if (consumer->tmq != NULL)
+        ws_tmq_consumer_close(consumer->tmq);
+    delete consumer;
+}
+
+/*
+ * tdengine_tmq_xact_end - 事务提交前确认本事务读过的消息，中止时放弃
+ *
+ * 消费者只能确认到当前读取的位置，因此放弃确认时关闭消费者，下一次扫描
+ * 重新加入消费组后从上次确认的位置开始读取。有消息没有读完（例如被
+ * LIMIT 提前结束）时同样放弃确认，读过的消息会被再次读到
+ */
+void
+tdengine_tmq_xact_end(bool commit)
+{
+    size_t i;
+
+    /* 关闭的消费者会从缓存中删除，因此从后向前遍历 */
+    for (i = tmq_consumers.size(); i-- > 0;)
+    {
+        TDengineTmqConsumer *consumer = tmq_consumers[i];
+
+        if (!consumer->dirty)
+            continue;
+
+        if (commit && !consumer->incomplete)
+        {
+            int code = ws_tmq_commit_sync(consumer->tmq, NULL);
+
+            if (code != 0)
+            {
+                char *err = pstrdup(ws_tmq_errstr(consumer->tmq));
+                char *topic = pstrdup(consumer->topic.c_str());
+
+                tdengine_tmq_close(consumer);
+                elog(ERROR, "tdengine_fdw : could not commit consumed messages of topic \"%s\": %s (error code: %d)",
+                     topic, err, code);
+            }
+
+            consumer->dirty = false;
+        }
+        else
+        {
+            elog(DEBUG1, "tdengine_fdw : rewinding consumer of topic \"%s\"", consumer->topic.c_str());
+            tdengine_tmq_close(consumer);
+        }
+    }
+}
+
+/*
+ * tdengine_tmq_cleanup - 关闭所有消费者，进程退出时调用
+ */
+void
+tdengine_tmq_cleanup(void)
+{
+    while (!tmq_consumers.empty())
+        tdengine_tmq_close(tmq_consumers.back());
+}
@@ -0,0 +1,15 @@
+#ifndef TMQ_HPP
+#define TMQ_HPP
+
+#include "connection.hpp"
+
+/* 订阅表使用的消息队列消费者，定义在 tmq.cpp 中 */
+struct TDengineTmqConsumer;
+
+extern TDengineTmqConsumer* tdengine_tmq_get_consumer(UserMapping *user, tdengine_opt *options);
+
+extern WS_RES* tdengine_tmq_poll(TDengineTmqConsumer *consumer, int timeout);
+
+extern void tdengine_tmq_mark_incomplete(TDengineTmqConsumer *consumer);
+
+#endif /* TMQ_HPP */